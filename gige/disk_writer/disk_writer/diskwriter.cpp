@@ -2,9 +2,22 @@
 #include "diskwriter.h"
 
 
-DiskWriter::DiskWriter()
+DiskWriter::DiskWriter() : queue(DISKWRITER_QUEUE_SIZE), WriterErrors(DISKWRITER_ERROR_QUEUE_SIZE)
 {
 	WriterThread = NULL;
+	NumberOfWrittenImages = 0;
+	NumberOfDispatched = 0;
+	NumberOfCollected = 0;
+	Format = DISKWRITER_FORMAT_CONTAINER;
+	Codec = FRAMECODEC_NONE;
+	NumberOfCompressors = 0;
+	NumberOfCompressDealt = 0;
+	NumberOfCompressCollected = 0;
+	CompressRawBytes = 0;
+	CompressStoredBytes = 0;
+	CompressNanoseconds = 0;
+	pLatencyPop = Latency.Add("pop");
+	pLatencyWrite = Latency.Add("write");
 }
 
 
@@ -12,30 +25,111 @@ DiskWriter::~DiskWriter()
 {
 }
 
-bool DiskWriter::Initialize(LPCTSTR file_path, IImageQueue *source_ptr, bool pass_through_enable)
+bool DiskWriter::Initialize(LPCTSTR file_path, IImageQueue *source_ptr, bool pass_through_enable, std::shared_ptr<ImageSubscriber> subscription, DiskWriterFormat format, uint64_t preallocate)
+{
+	// Single target
+	#ifdef UNICODE
+		std::wstring wide_path(file_path);
+		std::string path(wide_path.begin(), wide_path.end());
+	#else
+		std::string path(file_path);
+	#endif
+	return Initialize(std::vector<std::string>(1, path), source_ptr, pass_through_enable, subscription, format, preallocate);
+}
+
+bool DiskWriter::Initialize(const std::vector<std::string>& file_paths, IImageQueue *source_ptr, bool pass_through_enable, std::shared_ptr<ImageSubscriber> subscription, DiskWriterFormat format, uint64_t preallocate)
 {
 	// Save inputs
+	// (when reading from a broadcast subscription, source_ptr is that
+	//  subscription and we hold on to it until shutdown)
 	pass_through = pass_through_enable;
 	pSource = source_ptr;
+	Subscription = subscription;
+	Format = format;
 
-	// Open file
-	WriterFile = CreateFile(file_path, 
-		                    GENERIC_WRITE,
-					        FILE_SHARE_READ,
-					        NULL,
-							CREATE_ALWAYS,
-							FILE_ATTRIBUTE_NORMAL,
-							NULL);
-
-	// Check errors
-	if (WriterFile == INVALID_HANDLE_VALUE)
+	// Check inputs
+	if (file_paths.empty())
 	{
-		PushError(std::string("OpenFile failed with code ") + std::to_string(GetLastError()));
+		PushError("Initialize: no target file.");
 		Shutdown();
 		return false;
 	}
+	if (Codec != FRAMECODEC_NONE && Format != DISKWRITER_FORMAT_CONTAINER)
+	{
+		PushError("Initialize: compressed frames can only be written to a container.");
+		Shutdown();
+		return false;
+	}
+
+	// Open files
+	// (unbuffered, with the space reserved ahead of the writes)
+	for (size_t i = 0; i < file_paths.size(); i++)
+	{
+		Stripes.push_back(std::unique_ptr<DiskWriterStripe>(new DiskWriterStripe()));
+		DiskWriterStripe& stripe = *Stripes.back();
+		stripe.Path = file_paths[i];
+		stripe.Owner = this;
+		if (!stripe.File.Open(stripe.Path, preallocate))
+		{
+			PushError("OpenFile failed for " + stripe.Path + ": " + stripe.File.GetError());
+			Shutdown();
+			return false;
+		}
+		stripe.File.SetLatency(pLatencyWrite);
+
+		// File header
+		if (!WriteFileHeader(stripe))
+		{
+			Shutdown();
+			return false;
+		}
+	}
+
+	// Manifest, to put the frames of several targets back in order
+	if (Stripes.size() > 1)
+	{
+		ManifestPath = file_paths[0] + DISKWRITER_MANIFEST_SUFFIX;
+		if (!WriteManifest(false))
+		{
+			Shutdown();
+			return false;
+		}
+	}
 
-	// Start thread
+	// Start threads
+	// (one per target when striping; with a single target, the frames are
+	//  written by the main writer thread itself)
+	StripeStopFlag = false;
+	if (Stripes.size() > 1)
+	{
+		for (size_t i = 0; i < Stripes.size(); i++)
+		{
+			Stripes[i]->Thread = CreateThread(NULL, 0, StripeStaticStart, (void*)Stripes[i].get(), 0, NULL);
+			if (Stripes[i]->Thread == NULL)
+			{
+				PushError(std::string("CreateThread failed with code ") + std::to_string(GetLastError()));
+				Shutdown();
+				return false;
+			}
+		}
+	}
+	CompressStopFlag = false;
+	if (Codec != FRAMECODEC_NONE)
+	{
+		Packets = std::make_shared<DiskWriterPacketPool>();
+		for (size_t i = 0; i < NumberOfCompressors; i++)
+		{
+			Compressors.push_back(std::unique_ptr<DiskWriterCompressor>(new DiskWriterCompressor()));
+			Compressors[i]->Owner = this;
+			Compressors[i]->Thread = CreateThread(NULL, 0, CompressStaticStart, (void*)Compressors[i].get(), 0, NULL);
+			if (Compressors[i]->Thread == NULL)
+			{
+				PushError(std::string("CreateThread failed with code ") + std::to_string(GetLastError()));
+				Shutdown();
+				return false;
+			}
+		}
+	}
 	WriterThread = CreateThread(NULL, 0, WriterStaticStart, (void*)this, 0, NULL);
 	if (WriterThread == NULL)
 	{
@@ -60,13 +154,62 @@ void DiskWriter::Shutdown()
 		if (WaitResult != WAIT_OBJECT_0)
 			MessageBox(NULL, _T("Writer thread does not respond."), _T("Error"), MB_OK | MB_ICONERROR);
 		CloseHandle(WriterThread);
+		WriterThread = NULL;
+	}
+
+	// Stop the compression threads
+	// (the dispatcher has written out what they had)
+	CompressStopFlag = true;
+	for (size_t i = 0; i < Compressors.size(); i++)
+	{
+		if (Compressors[i]->Thread != NULL)
+		{
+			DWORD WaitResult = WaitForSingleObject(Compressors[i]->Thread, 10000);
+			if (WaitResult != WAIT_OBJECT_0)
+				MessageBox(NULL, _T("Compression thread does not respond."), _T("Error"), MB_OK | MB_ICONERROR);
+			CloseHandle(Compressors[i]->Thread);
+			Compressors[i]->Thread = NULL;
+		}
 	}
+	Compressors.clear();
 
-	// Close file
-	CloseHandle(WriterFile);
+	// Stop the target threads
+	// (after the dispatcher, so that they write out everything it queued)
+	StripeStopFlag = true;
+	for (size_t i = 0; i < Stripes.size(); i++)
+	{
+		if (Stripes[i]->Thread != NULL)
+		{
+			DWORD WaitResult = WaitForSingleObject(Stripes[i]->Thread, 10000);
+			if (WaitResult != WAIT_OBJECT_0)
+				MessageBox(NULL, _T("Writer thread does not respond."), _T("Error"), MB_OK | MB_ICONERROR);
+			CloseHandle(Stripes[i]->Thread);
+			Stripes[i]->Thread = NULL;
+		}
+	}
+
+	// Close files
+	// (with the index at the end, once nothing else will be written)
+	for (size_t i = 0; i < Stripes.size(); i++)
+	{
+		WriteIndex(*Stripes[i]);
+		if (!Stripes[i]->File.Close())
+			PushError("Closing " + Stripes[i]->Path + " failed: " + Stripes[i]->File.GetError());
+	}
+	if (!ManifestPath.empty())
+		WriteManifest(true);
+	Stripes.clear();
+	ManifestPath.clear();
+
+	// Leave the broadcast
+	if (Subscription)
+	{
+		Subscription->Unsubscribe();
+		Subscription.reset();
+	}
 
 	// Empty SPSC_queue
-	std::unique_ptr<PvBuffer> upBuffer;
+	ImagePtr upBuffer;
 	while (upBuffer = queue.TryPop())
 		upBuffer.reset();
 
@@ -78,44 +221,421 @@ DWORD WINAPI DiskWriter::WriterStaticStart(LPVOID lpParams)
 	return diskwriter->WriteBuffersContinuously();
 }
 
-bool DiskWriter::WriteBuffer(std::unique_ptr<PvBuffer>& upBuffer)
+DWORD WINAPI DiskWriter::StripeStaticStart(LPVOID lpParams)
 {
-	// Access image data
-	PvImage *lImage = upBuffer->GetImage();
-	uint8_t *pData = lImage->GetDataPointer();
-	uint32_t ImageSize = lImage->GetImageSize();
-	DWORD    BytesWritten = 0;
+	DiskWriterStripe* stripe = (DiskWriterStripe*)lpParams;
+	return stripe->Owner->WriteStripeContinuously(*stripe);
+}
 
-	// Write out
-	BOOL success = WriteFile(WriterFile, pData, ImageSize, &BytesWritten, NULL);
+DWORD WINAPI DiskWriter::CompressStaticStart(LPVOID lpParams)
+{
+	DiskWriterCompressor* compressor = (DiskWriterCompressor*)lpParams;
+	return compressor->Owner->CompressContinuously(*compressor);
+}
 
-	// Check success
-	if (success)
+bool DiskWriter::WriteData(DiskWriterStripe& stripe, const void* pData, size_t Size, uint64_t Arrival)
+{
+	// Gathered into sector-aligned blocks, written in the background
+	if (!stripe.File.Write(pData, Size, Arrival))
 	{
-		// Increase count
-		NumberOfWrittenImages++;
+		PushError("Write failed for " + stripe.Path + ": " + stripe.File.GetError());
+		return false;
 	}
-	else {
-		// Report error
-		PushError(std::string("WriteFile failed with code ") + std::to_string(GetLastError()));
+	stripe.Unflushed = true;
+	return true;
+}
+
+bool DiskWriter::WriteBuffer(DiskWriterStripe& stripe, ImagePtr& upBuffer)
+{
+	std::lock_guard<std::mutex> lock(stripe.FileMutex);
+
+	// A packet that is only a codec header is followed by the original, and
+	// so is a frame that could not get a packet at all, behind a header of
+	// its own
+	const void* pData = upBuffer->data;
+	size_t DataSize = upBuffer->size;
+	const Frame* pStored = NULL;
+	FrameCodecHeader codec;
+	if (!Compressors.empty())
+	{
+		DiskWriterPacket* packet = GetPacket(upBuffer);
+		if (packet == NULL)
+		{
+			codec.codec = FRAMECODEC_NONE;
+			codec.reserved = 0;
+			codec.rawSize = upBuffer->size;
+			pData = &codec;
+			DataSize = sizeof(codec);
+			pStored = upBuffer.get();
+		}
+		else if (packet->stored)
+		{
+			pStored = packet->original.get();
+		}
 	}
 
-	// Check write size
-	if (BytesWritten != ImageSize)
+	// Frame header, then the pixel data
+	uint64_t Offset = stripe.File.GetSize();
+	if (Format == DISKWRITER_FORMAT_CONTAINER)
+	{
+		RecordingFrameHeader header;
+		RecordingInitFrameHeader(header, *upBuffer);
+		header.size = DataSize;
+		if (pStored != NULL)
+			header.size += pStored->size;
+		if (!WriteData(stripe, &header, sizeof(header)))
+			return false;
+	}
+	if (pStored == NULL)
 	{
-		PushError(std::string("WriteFile failed due to incomplete write."));
-		success = 0;
+		if (!WriteData(stripe, pData, DataSize, upBuffer->arrival))
+			return false;
+	}
+	else
+	{
+		if (!WriteData(stripe, pData, DataSize))
+			return false;
+		if (!WriteData(stripe, pStored->data, pStored->size, upBuffer->arrival))
+			return false;
 	}
 
-	// Return
-	return success!=0;
+	// Increase count
+	NumberOfWrittenImages++;
+	if (Format == DISKWRITER_FORMAT_CONTAINER)
+		stripe.FrameOffsets.push_back(Offset);
+	return true;
+}
+
+bool DiskWriter::FlushFile(DiskWriterStripe& stripe)
+{
+	// Write out the partial block, when the stream pauses
+	std::lock_guard<std::mutex> lock(stripe.FileMutex);
+	if (!stripe.Unflushed)
+		return true;
+	stripe.Unflushed = false;
+	if (!stripe.File.Flush())
+	{
+		PushError("Flush failed for " + stripe.Path + ": " + stripe.File.GetError());
+		return false;
+	}
+	return true;
+}
+
+bool DiskWriter::WriteFileHeader(DiskWriterStripe& stripe)
+{
+	// Called at the start of the file
+	stripe.FrameOffsets.clear();
+	if (Format != DISKWRITER_FORMAT_CONTAINER)
+		return true;
+
+	// Index offset and number of frames are not known yet
+	RecordingFileHeader header;
+	RecordingInitFileHeader(header);
+	header.codec = Codec;
+	return WriteData(stripe, &header, sizeof(header));
+}
+
+bool DiskWriter::WriteIndex(DiskWriterStripe& stripe)
+{
+	std::lock_guard<std::mutex> lock(stripe.FileMutex);
+	if (Format != DISKWRITER_FORMAT_CONTAINER || stripe.File.GetSize() == 0)
+		return true;
+
+	// Index at the end
+	RecordingIndexHeader index;
+	index.magic = RECORDING_INDEX_MAGIC;
+	index.reserved = 0;
+	index.numberOfFrames = stripe.FrameOffsets.size();
+	uint64_t IndexOffset = stripe.File.GetSize();
+	if (!WriteData(stripe, &index, sizeof(index)))
+		return false;
+	if (!stripe.FrameOffsets.empty() && !WriteData(stripe, stripe.FrameOffsets.data(), stripe.FrameOffsets.size()*sizeof(uint64_t)))
+		return false;
+
+	// Then point the file header at it
+	RecordingFileHeader header;
+	RecordingInitFileHeader(header);
+	header.codec = Codec;
+	header.indexOffset = IndexOffset;
+	header.numberOfFrames = stripe.FrameOffsets.size();
+	if (!stripe.File.WriteHead(&header, sizeof(header)))
+	{
+		PushError("WriteIndex failed for " + stripe.Path + ": " + stripe.File.GetError());
+		return false;
+	}
+	return true;
+}
+
+bool DiskWriter::WriteManifest(bool closed)
+{
+	// Text file next to the first target (see recordingformat.h)
+	FILE* file = fopen(ManifestPath.c_str(), "w");
+	if (file == NULL)
+	{
+		PushError("The manifest " + ManifestPath + " could not be created.");
+		return false;
+	}
+	fprintf(file, "%s %d\n", RECORDING_MANIFEST_MAGIC, RECORDING_MANIFEST_VERSION);
+	fprintf(file, "format %s\n", (Format == DISKWRITER_FORMAT_CONTAINER) ? "container" : "raw");
+	fprintf(file, "stripes %u\n", (unsigned int)Stripes.size());
+	if (closed)
+		fprintf(file, "frames %llu\n", (unsigned long long)NumberOfWrittenImages);
+	for (size_t i = 0; i < Stripes.size(); i++)
+		fprintf(file, "stripe %s\n", Stripes[i]->Path.c_str());
+	bool res = (ferror(file) == 0);
+	res &= (fclose(file) == 0);
+	if (!res)
+		PushError("The manifest " + ManifestPath + " could not be written.");
+	return res;
+}
+
+bool DiskWriter::Dispatch(ImagePtr& upBuffer)
+{
+	// Next target in turn
+	DiskWriterStripe& stripe = *Stripes[NumberOfDispatched % Stripes.size()];
+	NumberOfDispatched++;
+
+	// Single target: write here
+	if (Stripes.size() == 1)
+	{
+		if (!WriteBuffer(stripe, upBuffer))
+			PushError("Write operation failed.");
+		ReleaseWritten(upBuffer);
+		stripe.Written.TryPush(upBuffer);
+		if (upBuffer)
+		{
+			PushError("Pass-through queuing operation failed.");
+			upBuffer.reset();
+		}
+		return true;
+	}
+
+	// Several targets: queue it for the target's thread
+	// (waiting for room if that disk falls behind, and meanwhile handing on
+	//  what the others have written, so that they do not stall as well)
+	while (true)
+	{
+		stripe.ToWrite.TryPush(upBuffer);
+		if (!upBuffer)
+			return true;
+		if (StripeStopFlag)
+		{
+			PushError("Frame dropped at shutdown, the disk did not keep up.");
+			upBuffer.reset();
+			return false;
+		}
+		Collect();
+		Sleep(1);
+	}
+}
+
+size_t DiskWriter::Collect()
+{
+	ImagePtr					upBuffers[IMAGE_QUEUE_BATCH_SIZE];
+	size_t						nCollected = 0;
+	size_t						nBatch;
+	size_t						nPushed;
+
+	// Written frames, in the order they were dealt
+	do
+	{
+		for (nBatch = 0; nBatch < IMAGE_QUEUE_BATCH_SIZE && NumberOfCollected < NumberOfDispatched; nBatch++)
+		{
+			DiskWriterStripe& stripe = *Stripes[NumberOfCollected % Stripes.size()];
+			stripe.Written.TryPop(upBuffers[nBatch]);
+			if (!upBuffers[nBatch])
+				break;
+			NumberOfCollected++;
+		}
+
+		// Push to output queue
+		nPushed = queue.TryPushBatch(upBuffers, nBatch);
+
+		// Report error if the push operation failed
+		if (nPushed != nBatch)
+		{
+			PushError("Pass-through queuing operation failed.");
+			for (size_t i = nPushed; i < nBatch; i++)
+				upBuffers[i].reset();
+		}
+		nCollected += nBatch;
+	} while (nBatch == IMAGE_QUEUE_BATCH_SIZE);
+
+	return nCollected;
+}
+
+bool DiskWriter::Compress(ImagePtr& upBuffer)
+{
+	// Next worker in turn
+	DiskWriterCompressor& compressor = *Compressors[NumberOfCompressDealt % Compressors.size()];
+	NumberOfCompressDealt++;
+
+	// Queue it, waiting for room if the pool falls behind
+	while (true)
+	{
+		compressor.ToCompress.TryPush(upBuffer);
+		if (!upBuffer)
+			return true;
+		if (WriterStopFlag)
+		{
+			PushError("Frame dropped at shutdown, the compression did not keep up.");
+			upBuffer.reset();
+			return false;
+		}
+		CollectCompressed(true);
+		Collect();
+		Sleep(1);
+	}
+}
+
+size_t DiskWriter::CollectCompressed(bool write)
+{
+	ImagePtr					upBuffer;
+	size_t						nCollected = 0;
+
+	// Compressed frames, in the order they were dealt, on to the targets
+	// (or dropped, when flushing)
+	while (NumberOfCompressCollected < NumberOfCompressDealt)
+	{
+		DiskWriterCompressor& compressor = *Compressors[NumberOfCompressCollected % Compressors.size()];
+		compressor.Compressed.TryPop(upBuffer);
+		if (!upBuffer)
+			break;
+		NumberOfCompressCollected++;
+		nCollected++;
+		if (write)
+			Dispatch(upBuffer);
+		else
+			upBuffer.reset();
+	}
+	return nCollected;
+}
+
+void DiskWriter::ReleaseWritten(ImagePtr& upBuffer)
+{
+	// Compressed frame: the original goes on instead
+	DiskWriterPacket* packet = Compressors.empty() ? NULL : GetPacket(upBuffer);
+	if (packet != NULL)
+	{
+		ImagePtr original = std::move(packet->original);
+		upBuffer = std::move(original);
+	}
+
+	// Without pass-through, the frame goes back to its pool right away, and
+	// an empty frame takes its place so that the output queue still counts
+	// the written images
+	if (!pass_through || !upBuffer)
+		upBuffer = ImagePtr(new Frame());
+}
+
+DiskWriterPacket* DiskWriter::GetPacket(const ImagePtr& upBuffer)
+{
+	// Packets are told apart by their pool, since the originals may use the
+	// context of the frame as well (a frame that could not get a packet is
+	// written as it is)
+	if (upBuffer.get_deleter().Recycler.get() != Packets.get())
+		return NULL;
+	return (DiskWriterPacket*)upBuffer->context;
+}
+
+DWORD DiskWriter::CompressContinuously(DiskWriterCompressor& compressor)
+{
+	ImagePtr					upBuffers[IMAGE_QUEUE_BATCH_SIZE];
+	size_t						nReady;
+	size_t						nPopped;
+	size_t						nPushed;
+
+	// Continuous loop, until the dispatcher has stopped and the queue is empty
+	while (true)
+	{
+		// Wait for frames
+		nReady = compressor.ToCompress.WaitAny(1, IMAGE_QUEUE_BATCH_SIZE, CompressStopFlag ? 0 : 1000);
+		if (nReady == 0)
+		{
+			if (CompressStopFlag)
+				break;
+			continue;
+		}
+		nPopped = compressor.ToCompress.TryPopBatch(upBuffers, nReady);
+
+		for (size_t i = 0; i < nPopped; i++)
+		{
+			std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+			// Compress into a packet
+			// (without the memory for it, the original is stored as it is
+			//  behind a packet that only holds its codec header; a frame that
+			//  could not even get that goes on as it is, and is written
+			//  behind a header of its own)
+			Frame& original = *upBuffers[i];
+			Frame* pPacket = Packets->Get(FrameCodecBound(original));
+			bool stored = (pPacket == NULL);
+			if (stored)
+			{
+				PushError("Compression failed: out of memory. The frame is stored uncompressed.");
+				pPacket = Packets->Get(sizeof(FrameCodecHeader));
+				if (pPacket == NULL)
+				{
+					CompressRawBytes += original.size;
+					CompressStoredBytes += sizeof(FrameCodecHeader) + original.size;
+					continue;
+				}
+			}
+			DiskWriterPacket* packet = (DiskWriterPacket*)pPacket->context;
+			packet->stored = stored;
+			pPacket->width = original.width;
+			pPacket->height = original.height;
+			pPacket->bpp = original.bpp;
+			pPacket->timestamp = original.timestamp;
+			pPacket->blockId = original.blockId;
+			pPacket->arrival = original.arrival;
+			if (stored)
+			{
+				FrameCodecHeader header;
+				header.codec = FRAMECODEC_NONE;
+				header.reserved = 0;
+				header.rawSize = original.size;
+				memcpy(pPacket->data, &header, sizeof(header));
+				pPacket->size = sizeof(header);
+			}
+			else
+				pPacket->size = FrameEncode(original, pPacket->data, packet->capacity);
+
+			// Statistics
+			CompressRawBytes += original.size;
+			CompressStoredBytes += pPacket->size + (stored ? original.size : 0);
+			CompressNanoseconds += (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+
+			// Keep the original until written for the pass-through (or as
+			// the data of a stored frame), or release it now
+			if (pass_through || stored)
+				packet->original = std::move(upBuffers[i]);
+			upBuffers[i] = ImagePtr(pPacket, ImageRelease(Packets));
+		}
+
+		// Back to the dispatcher
+		// (once it has stopped, nobody hands them on any more)
+		nPushed = 0;
+		while (nPushed < nPopped && !CompressStopFlag)
+		{
+			nPushed += compressor.Compressed.TryPushBatch(&upBuffers[nPushed], nPopped - nPushed);
+			if (nPushed < nPopped)
+				Sleep(1);
+		}
+		for (size_t i = nPushed; i < nPopped; i++)
+			upBuffers[i].reset();
+	}
+
+	// Leave
+	return EXIT_SUCCESS;
 }
 
 DWORD DiskWriter::WriteBuffersContinuously()
 {
-	std::unique_ptr<PvBuffer>	upBuffer;
-	DWORD						resWait;
-	bool						resWrite;
+	ImagePtr					upBuffers[IMAGE_QUEUE_BATCH_SIZE];
+	size_t						nReady;
+	size_t						nPopped;
+	DWORD						timeout;
 
 	// Thread priority
 	// SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_BELOW_NORMAL);
@@ -124,60 +644,122 @@ DWORD DiskWriter::WriteBuffersContinuously()
 	WriterStopFlag = false;
 	while (!WriterStopFlag)
 	{
-		// Retrieve buffer
-		resWait = pSource->WaitImages(1, 1000);
+		// Wait for at least one buffer, and take whatever burst is there
+		// (not for long while written frames are still to be handed on)
+		timeout = (NumberOfCollected < NumberOfDispatched || NumberOfCompressCollected < NumberOfCompressDealt) ? 1 : 1000;
+		nReady = pSource->WaitImagesAny(1, IMAGE_QUEUE_BATCH_SIZE, timeout);
 
-		// Check if retrieve is successful
-		if (resWait == WAIT_OBJECT_0)
+		std::lock_guard<std::mutex> lock(DispatchMutex);
+		if (nReady == 0)
 		{
-			if (upBuffer = pSource->GetImage())
-			{
-				// Write to disk
-				resWrite = WriteBuffer(upBuffer);
-				if (!resWrite)
-					PushError("Write operation failed.");
-
-				// Output queue
-				if (!pass_through)
-					upBuffer->Free();
-
-				// Push to output queue
-				queue.TryPush(upBuffer);
-
-				// Report error if the push operation failed
-				if (upBuffer)
-					PushError("Pass-through queuing operation failed.");
-			} 
-			else 
-			{
-				// Unexpected error
-				PushError("Wait operation succeeded but the queue pop operation failed.");
-				Sleep(1);
-			}
+			if (Stripes.size() == 1 && NumberOfCompressCollected == NumberOfCompressDealt)
+				FlushFile(*Stripes[0]);
+			CollectCompressed(true);
+			Collect();
+			continue;
 		}
-		else if (resWait == WAIT_FAILED)
+
+		// Retrieve buffers
+		nPopped = pSource->GetImages(upBuffers, nReady);
+		if (nPopped == 0)
 		{
-			// Wait fail
-			PushError("Queue wait operation failed.");
+			// Unexpected error
+			PushError("Wait operation succeeded but the queue pop operation failed.");
 			Sleep(1);
-		} 
-		else if (resWait != WAIT_TIMEOUT)
+			continue;
+		}
+		uint64_t now = LatencyNow();
+		for (size_t i = 0; i < nPopped; i++)
+			pLatencyPop->RecordSince(upBuffers[i]->arrival, now);
+
+		// Deal them to the compression pool or to the targets
+		for (size_t i = 0; i < nPopped; i++)
 		{
-			// Unexpected error
-			PushError("Unexpected wait error.");
+			if (Compressors.empty())
+				Dispatch(upBuffers[i]);
+			else
+				Compress(upBuffers[i]);
+		}
+
+		// Push to output queue
+		CollectCompressed(true);
+		Collect();
+	}
+
+	// Write out what is still being compressed
+	DWORD start = GetTickCount();
+	while (NumberOfCompressCollected < NumberOfCompressDealt && GetTickCount() - start < 10000)
+	{
+		std::lock_guard<std::mutex> lock(DispatchMutex);
+		if (CollectCompressed(true) == 0)
 			Sleep(1);
+		Collect();
+	}
+
+	// Leave
+	return EXIT_SUCCESS;
+}
+
+DWORD DiskWriter::WriteStripeContinuously(DiskWriterStripe& stripe)
+{
+	ImagePtr					upBuffers[IMAGE_QUEUE_BATCH_SIZE];
+	size_t						nReady;
+	size_t						nPopped;
+	size_t						nPushed;
+	bool						resWrite;
+
+	// Continuous loop, until the dispatcher has stopped and the queue is empty
+	while (true)
+	{
+		// Wait for frames
+		nReady = stripe.ToWrite.WaitAny(1, IMAGE_QUEUE_BATCH_SIZE, StripeStopFlag ? 0 : 1000);
+		if (nReady == 0)
+		{
+			if (StripeStopFlag)
+				break;
+			FlushFile(stripe);
+			continue;
+		}
+		nPopped = stripe.ToWrite.TryPopBatch(upBuffers, nReady);
+
+		for (size_t i = 0; i < nPopped; i++)
+		{
+			// Write to disk
+			resWrite = WriteBuffer(stripe, upBuffers[i]);
+			if (!resWrite)
+				PushError("Write operation failed.");
+
+			// Release the frame right away without pass-through
+			ReleaseWritten(upBuffers[i]);
 		}
+
+		// Back to the dispatcher
+		// (once it has stopped, nobody hands them on any more)
+		nPushed = 0;
+		while (nPushed < nPopped && !StripeStopFlag)
+		{
+			nPushed += stripe.Written.TryPushBatch(&upBuffers[nPushed], nPopped - nPushed);
+			if (nPushed < nPopped)
+				Sleep(1);
+		}
+		for (size_t i = nPushed; i < nPopped; i++)
+			upBuffers[i].reset();
 	}
 
 	// Leave
 	return EXIT_SUCCESS;
 }
 
-std::unique_ptr<PvBuffer> DiskWriter::GetImage()
+ImagePtr DiskWriter::GetImage()
 {
 	return queue.TryPop();
 }
 
+size_t DiskWriter::GetImages(ImagePtr* buffers, size_t n)
+{
+	return queue.TryPopBatch(buffers, n);
+}
+
 size_t DiskWriter::GetNumberOfAvailableImages()
 {
 	return queue.GetCount();
@@ -193,24 +775,33 @@ DWORD DiskWriter::WaitImages(size_t n, DWORD timeoutMilliseconds)
 	return queue.Wait(n, timeoutMilliseconds);
 }
 
+size_t DiskWriter::WaitImagesAny(size_t nMin, size_t nMax, DWORD timeoutMilliseconds)
+{
+	return queue.WaitAny(nMin, nMax, timeoutMilliseconds);
+}
+
 
 void DiskWriter::PushError(std::string str)
 {
-	return WriterErrors.TryPush(std::unique_ptr<std::string>(new std::string(str)));
+	// Called from the writer and the compression threads
+	std::lock_guard<std::mutex> lock(WriterErrorsMutex);
+	WriterErrors.TryPush(str);
 }
 
 std::unique_ptr<std::string> DiskWriter::GetError()
 {
-	return WriterErrors.TryPop();
+	std::unique_ptr<std::string> err(new std::string());
+	if (!WriterErrors.TryPop(*err))
+		err.reset();
+	return err;
 }
 
 std::string DiskWriter::GetQueuedError()
 {
-	std::unique_ptr<std::string> err;
-	WriterErrors.TryPop(err);
-	if (err)
+	std::string err;
+	if (WriterErrors.TryPop(err))
 	{
-		return std::string(*err.get());
+		return err;
 	}
 	else
 	{
@@ -221,34 +812,179 @@ std::string DiskWriter::GetQueuedError()
 
 bool DiskWriter::FlushImages()
 {
-	// Truncate the file
-	DWORD resPtr = SetFilePointer(WriterFile, 0, 0, FILE_BEGIN);
-	BOOL  resEnd = SetEndOfFile(WriterFile);
+	// Stop dealing frames
+	std::lock_guard<std::mutex> lock(DispatchMutex);
 
-	// Pop all elements and free the associated buffers
-	// (object deletion is handled implicitly by the unique_ptr;
-	//  here we additionally added pBuffer->Free() but this is
-	//  redundant)
-	std::unique_ptr<PvBuffer> pBuffer;
-	while (pBuffer = queue.TryPop())
+	// Drop the frames that are being compressed
+	DWORD start = GetTickCount();
+	while (NumberOfCompressCollected < NumberOfCompressDealt)
 	{
-		pBuffer->Free();
-		pBuffer.reset();
+		if (CollectCompressed(false) > 0)
+			continue;
+		if (GetTickCount() - start > 10000)
+		{
+			PushError("FlushImages: the compression threads do not respond.");
+			return false;
+		}
+		Sleep(1);
 	}
+	NumberOfCompressDealt = 0;
+	NumberOfCompressCollected = 0;
+
+	// Wait for the targets to write what they were given
+	// (and drop those frames, which belong to the old file)
+	ImagePtr pBuffer;
+	start = GetTickCount();
+	while (NumberOfCollected < NumberOfDispatched)
+	{
+		DiskWriterStripe& stripe = *Stripes[NumberOfCollected % Stripes.size()];
+		stripe.Written.TryPop(pBuffer);
+		if (pBuffer)
+		{
+			pBuffer.reset();
+			NumberOfCollected++;
+		}
+		else if (GetTickCount() - start > 10000)
+		{
+			PushError("FlushImages: the writer threads do not respond.");
+			return false;
+		}
+		else
+		{
+			Sleep(1);
+		}
+	}
+	NumberOfDispatched = 0;
+	NumberOfCollected = 0;
+	NumberOfWrittenImages = 0;
 
-	// Check failures
-	if (resPtr == INVALID_SET_FILE_POINTER)
+	// Truncate the files, and start them over
+	bool res = true;
+	for (size_t i = 0; i < Stripes.size(); i++)
 	{
-		PushError("FlushImages: SetFilePointer INVALID_SET_FILE_POINTER error.");
-		return false;
+		DiskWriterStripe& stripe = *Stripes[i];
+		std::lock_guard<std::mutex> file_lock(stripe.FileMutex);
+		if (!stripe.File.Truncate())
+		{
+			PushError("FlushImages: " + stripe.File.GetError());
+			res = false;
+		}
+		else if (!WriteFileHeader(stripe))
+		{
+			PushError("FlushImages: the file header could not be written.");
+			res = false;
+		}
 	}
-	if (resEnd == 0)
+
+	// Pop all elements and release the associated buffers
+	// (object deletion is handled implicitly by the unique_ptr; frames
+	//  shared with other subscribers must not be freed explicitly here)
+	while (pBuffer = queue.TryPop())
+		pBuffer.reset();
+
+	// Return
+	return res;
+}
+
+size_t DiskWriter::GetNumberOfTargets()
+{
+	return Stripes.size();
+}
+
+double DiskWriter::GetWriteRate()
+{
+	// Summed over the targets
+	double rate = 0;
+	for (size_t i = 0; i < Stripes.size(); i++)
+		rate += Stripes[i]->File.GetWriteRate();
+	return rate;
+}
+
+bool DiskWriter::SetCompression(FrameCodec codec, size_t threads)
+{
+	// Before Initialize only
+	if (WriterThread != NULL)
 	{
-		PushError(std::string("FlushImages: SetEndOfFile error code ") + std::to_string(GetLastError()));
+		PushError("SetCompression: the compression cannot be changed while recording.");
 		return false;
 	}
-
-	// Return success
+	Codec = (threads > 0) ? codec : FRAMECODEC_NONE;
+	NumberOfCompressors = (codec != FRAMECODEC_NONE) ? threads : 0;
 	return true;
+}
+
+double DiskWriter::GetCompressionRatio()
+{
+	// Bytes from the camera per byte written
+	uint64_t stored = CompressStoredBytes;
+	return (stored > 0) ? (double)CompressRawBytes / stored : 1.0;
+}
+
+double DiskWriter::GetCompressionRate()
+{
+	// MB/s of camera data the pool can compress, all workers together
+	uint64_t busy = CompressNanoseconds;
+	return (busy > 0) ? (double)CompressRawBytes / 1e6 / (busy / 1e9) * NumberOfCompressors : 0.0;
+}
+
+LatencyProbes& DiskWriter::GetLatency()
+{
+	return Latency;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Class implementation: DiskWriterPacketPool
+////////////////////////////////////////////////////////////////////////////////
+DiskWriterPacketPool::~DiskWriterPacketPool()
+{
+	// All the packets are back (each one holds a reference to the pool)
+	for (size_t i = 0; i < FreePackets.size(); i++)
+	{
+		spsc_aligned_free(FreePackets[i]->frame.data);
+		delete FreePackets[i];
+	}
+}
 
-}
\ No newline at end of file
+Frame* DiskWriterPacketPool::Get(size_t capacity)
+{
+	// Reuse a packet, or make a new one
+	DiskWriterPacket* packet = NULL;
+	{
+		std::lock_guard<std::mutex> lock(FreeMutex);
+		if (!FreePackets.empty())
+		{
+			packet = FreePackets.back();
+			FreePackets.pop_back();
+		}
+	}
+	if (packet == NULL)
+	{
+		packet = new DiskWriterPacket();
+		packet->frame.data = NULL;
+		packet->frame.context = packet;
+		packet->capacity = 0;
+		packet->stored = false;
+	}
+
+	// With room for the frame
+	if (packet->capacity < capacity)
+	{
+		spsc_aligned_free(packet->frame.data);
+		packet->frame.data = (uint8_t*)spsc_aligned_malloc(capacity, UNBUFFERED_ALIGNMENT);
+		packet->capacity = (packet->frame.data != NULL) ? capacity : 0;
+		if (packet->frame.data == NULL)
+		{
+			delete packet;
+			return NULL;
+		}
+	}
+	return &packet->frame;
+}
+
+void DiskWriterPacketPool::Recycle(Frame* pFrame)
+{
+	DiskWriterPacket* packet = (DiskWriterPacket*)pFrame->context;
+	packet->original.reset();
+	std::lock_guard<std::mutex> lock(FreeMutex);
+	FreePackets.push_back(packet);
+}
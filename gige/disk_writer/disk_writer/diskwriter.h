@@ -9,9 +9,98 @@
 //////////////
 #include <windows.h>
 #include <string>
-#include <PvBuffer.h>
+#include <vector>
+#include <mutex>
+#include <atomic>
+#include <chrono>
 #include "spsc_queue.h"
 #include "iimagequeue.h"
+#include "imagebroadcast.h"
+#include "recordingformat.h"
+#include "unbufferedfile.h"
+#include "framecodec.h"
+#include "latencyhistogram.h"
+
+/////////////
+// GLOBALS //
+/////////////
+#define DISKWRITER_QUEUE_SIZE        SPSC_QUEUE_SIZE
+#define DISKWRITER_ERROR_QUEUE_SIZE  1024
+#define DISKWRITER_STRIPE_QUEUE_SIZE 256			// Frames queued per target when striping
+#define DISKWRITER_MANIFEST_SUFFIX   ".manifest"	// Appended to the first target path
+
+// File formats
+enum DiskWriterFormat
+{
+	DISKWRITER_FORMAT_CONTAINER,	// Frame headers and index (see recordingformat.h)
+	DISKWRITER_FORMAT_RAW			// Pixel data only, frames back to back
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// Struct name: DiskWriterStripe
+// One target file. With several targets, frames are dealt round-robin and
+// each target has its own writer thread, so that the recording bandwidth
+// adds up over the disks.
+////////////////////////////////////////////////////////////////////////////////
+struct DiskWriterStripe
+{
+	DiskWriterStripe() : ToWrite(DISKWRITER_STRIPE_QUEUE_SIZE), Written(DISKWRITER_STRIPE_QUEUE_SIZE), Thread(NULL), Unflushed(false) {}
+
+	std::string				Path;
+	UnbufferedFile			File;
+	std::mutex				FileMutex;		// Shared by the writer thread and FlushImages
+	std::vector<uint64_t>	FrameOffsets;
+	bool					Unflushed;
+
+	SPSC_ImageQueue			ToWrite;		// From the dispatcher
+	SPSC_ImageQueue			Written;		// Back to the dispatcher, to restore the frame order
+	HANDLE					Thread;
+	class DiskWriter*		Owner;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// Struct name: DiskWriterCompressor
+// One worker of the compression pool. Frames are dealt to the workers
+// round-robin and collected back in the same order, as for the targets.
+////////////////////////////////////////////////////////////////////////////////
+struct DiskWriterCompressor
+{
+	DiskWriterCompressor() : ToCompress(DISKWRITER_STRIPE_QUEUE_SIZE), Compressed(DISKWRITER_STRIPE_QUEUE_SIZE), Thread(NULL) {}
+
+	SPSC_ImageQueue			ToCompress;
+	SPSC_ImageQueue			Compressed;
+	HANDLE					Thread;
+	class DiskWriter*		Owner;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// Class name: DiskWriterPacketPool
+// Compressed frames. Each one holds on to the frame it was made from until
+// it is written, for the pass-through, and its memory is kept for the next
+// frames once it is released. When there is no memory to compress a frame
+// into, the packet is only a codec header for the original pixel data, which
+// is written after it.
+////////////////////////////////////////////////////////////////////////////////
+struct DiskWriterPacket
+{
+	Frame					frame;			// Compressed data; context points back to the packet
+	ImagePtr				original;
+	size_t					capacity;
+	bool					stored;			// Header only; the data is the original's
+};
+
+class DiskWriterPacketPool : public IImageRecycler
+{
+public:
+	~DiskWriterPacketPool();
+
+	Frame*					Get(size_t);
+	void					Recycle(Frame*);
+
+private:
+	std::mutex				FreeMutex;
+	std::vector<DiskWriterPacket*> FreePackets;
+};
 
 ////////////////////////////////////////////////////////////////////////////////
 // Class name: DiskWriter
@@ -22,34 +111,92 @@ public:
 	DiskWriter();
 	~DiskWriter();
 
-	bool	Initialize(LPCTSTR, IImageQueue*, bool);
+	bool	Initialize(LPCTSTR, IImageQueue*, bool, std::shared_ptr<ImageSubscriber> = nullptr, DiskWriterFormat = DISKWRITER_FORMAT_CONTAINER, uint64_t = 0);
+	bool	Initialize(const std::vector<std::string>&, IImageQueue*, bool, std::shared_ptr<ImageSubscriber> = nullptr, DiskWriterFormat = DISKWRITER_FORMAT_CONTAINER, uint64_t = 0);
 	void	Shutdown();
 
 	bool							FlushImages();
-	std::unique_ptr<PvBuffer>		GetImage();
+	ImagePtr						GetImage();
+	size_t							GetImages(ImagePtr*, size_t);
 	std::unique_ptr<std::string>	GetError();
 	size_t							GetNumberOfAvailableImages();
 	size_t							GetNumberOfWrittenImages();
 	size_t							GetNumberOfErrors();
+	size_t							GetNumberOfTargets();
+	double							GetWriteRate();
+	bool							SetCompression(FrameCodec, size_t);
+	double							GetCompressionRatio();
+	double							GetCompressionRate();
+	LatencyProbes&					GetLatency();
 	DWORD							WaitImages(size_t, DWORD);
+	size_t							WaitImagesAny(size_t, size_t, DWORD);
 
 
 private:
 	IImageQueue				*pSource;
-	SPSC_Queue<PvBuffer>	queue;
+	std::shared_ptr<ImageSubscriber> Subscription;
+	SPSC_ImageQueue			queue;
 	bool					pass_through;
 
 	HANDLE					WriterThread;
-	HANDLE					WriterFile;
 	bool volatile			WriterStopFlag = false;
-	size_t					NumberOfWrittenImages;
-	bool					WriteBuffer(std::unique_ptr<PvBuffer>&);
+	std::atomic<size_t>		NumberOfWrittenImages;
 	DWORD					WriteBuffersContinuously();
 	static DWORD WINAPI		DiskWriter::WriterStaticStart(LPVOID);
 
+	// Targets
+	// (the dispatcher deals frame n to target n % size, and hands them on
+	//  in the same order once written; DispatchMutex is held while it does,
+	//  so that FlushImages can reset the whole set)
+	std::vector<std::unique_ptr<DiskWriterStripe>> Stripes;
+	std::mutex				DispatchMutex;
+	uint64_t				NumberOfDispatched;
+	uint64_t				NumberOfCollected;
+	std::string				ManifestPath;
+	bool volatile			StripeStopFlag = false;
+	bool					Dispatch(ImagePtr&);
+	size_t					Collect();
+	bool					WriteManifest(bool);
+	DWORD					WriteStripeContinuously(DiskWriterStripe&);
+	static DWORD WINAPI		StripeStaticStart(LPVOID);
+
+	// Compression
+	// (in front of the targets, in the same way)
+	FrameCodec				Codec;
+	size_t					NumberOfCompressors;
+	std::vector<std::unique_ptr<DiskWriterCompressor>> Compressors;
+	std::shared_ptr<DiskWriterPacketPool> Packets;
+	uint64_t				NumberOfCompressDealt;
+	uint64_t				NumberOfCompressCollected;
+	bool volatile			CompressStopFlag = false;
+	std::atomic<uint64_t>	CompressRawBytes;
+	std::atomic<uint64_t>	CompressStoredBytes;
+	std::atomic<uint64_t>	CompressNanoseconds;
+	bool					Compress(ImagePtr&);
+	size_t					CollectCompressed(bool);
+	void					ReleaseWritten(ImagePtr&);
+	DiskWriterPacket*		GetPacket(const ImagePtr&);
+	DWORD					CompressContinuously(DiskWriterCompressor&);
+	static DWORD WINAPI		CompressStaticStart(LPVOID);
+
+	// Container format
+	DiskWriterFormat		Format;
+	bool					WriteBuffer(DiskWriterStripe&, ImagePtr&);
+	bool					WriteData(DiskWriterStripe&, const void*, size_t, uint64_t = 0);
+	bool					WriteFileHeader(DiskWriterStripe&);
+	bool					WriteIndex(DiskWriterStripe&);
+	bool					FlushFile(DiskWriterStripe&);
 	
 
-	SPSC_Queue<std::string>	WriterErrors;
+	// Latency since arrival, when popped and once on disk
+	// (the write stage is recorded by the files, when the block that holds
+	//  the end of the frame has been written)
+	LatencyProbes			Latency;
+	LatencyHistogram*		pLatencyPop;
+	LatencyHistogram*		pLatencyWrite;
+
+	SPSC_Ring<std::string>	WriterErrors;
+	std::mutex				WriterErrorsMutex;
 	void					PushError(std::string);
 	std::string				GetQueuedError();
 };
@@ -7,6 +7,30 @@
 %       from the gigesource. If concurrent access to the gigesource does
 %       occur, no synchronisation mechanism exists, and therefore race 
 %       conditions are possible.
+%       To share the gigesource with other consumers (e.g. an fftprocessor
+%       and a live preview), pass subscribe=true: the diskwriter then gets
+%       its own copy of the frame stream. See gigesource.getsubscriberstats
+%       for the number of frames each subscriber dropped.
+%       By default the file is a container: a header, then each frame with
+%       its own header (size, bits per pixel, timestamp and block ID), and
+%       an index of the frames at the end, written when the diskwriter is
+%       deleted. Pass format='raw' for the pixel data only, frames back to
+%       back. See recordingformat.h for the layout.
+%       To record faster than one disk allows, pass a cell array of paths
+%       (one per disk) as file_path: the frames are dealt round-robin to
+%       the files, each written by its own thread, and a manifest
+%       <first path>.manifest lists them in order. A replaysource or a
+%       RecordingReader opens the manifest like a single recording.
+%       The file is written without going through the system cache, and
+%       extended ahead of the writes by preallocate_mb megabytes at a time
+%       (256 MB by default); set it to the expected size of the recording
+%       to reserve the space once. getwriterate returns the sustained
+%       write rate in MB/s.
+%       With compression_threads > 0, the frames are compressed losslessly
+%       (see framecodec.h) by that many threads before they are written.
+%       getcompressionratio returns the bytes from the camera per byte
+%       written, and getcompressionrate the MB/s of camera data that the
+%       threads can compress together, to compare with the camera rate.
 %       
 %  - Damien Loterie (03/2015)
 
@@ -31,11 +55,23 @@ classdef diskwriter < hgsetget
     
     methods        
         % Constructor
-        function obj = diskwriter(file_path, vid, pass_through) 
+        function obj = diskwriter(file_path, vid, pass_through, subscribe, format, preallocate_mb, compression_threads) 
             % Input processing
             if nargin<3
                pass_through = false; 
             end
+            if nargin<4
+               subscribe = false; 
+            end
+            if nargin<5
+               format = 'container'; 
+            end
+            if nargin<6
+               preallocate_mb = 0; 
+            end
+            if nargin<7
+               compression_threads = 0; 
+            end
             if isa(vid,'gigeinput')
                obj.vid = vid; 
             else
@@ -53,7 +89,11 @@ classdef diskwriter < hgsetget
             diskwriter_mex('Initialize', obj.objectHandle, ...
                                          file_path, ...
                                          obj.vid.source, ...
-                                         pass_through==true);
+                                         pass_through==true, ...
+                                         subscribe==true, ...
+                                         format, ...
+                                         double(preallocate_mb)*1024*1024, ...
+                                         double(compression_threads));
         end
         
         % Destructor
@@ -91,13 +131,18 @@ classdef diskwriter < hgsetget
         end
         
         % Get a number of images
-        function [data, time] = getimages(this, n)
+        % (transposed=false returns them as width x height, which saves the
+        %  transpose)
+        function [data, time] = getimages(this, n, transposed)
+            if nargin<3
+                transposed = true;
+            end
             if nargout<=1
                 % Only get the images
-                data = diskwriter_mex('GetImages', this.objectHandle, n);
+                data = diskwriter_mex('GetImages', this.objectHandle, n, transposed);
             elseif nargout==2
                 % Also get the timestamps
-                [data, time] = diskwriter_mex('GetImages', this.objectHandle, n);
+                [data, time] = diskwriter_mex('GetImages', this.objectHandle, n, transposed);
                 
                 % Attempt converting to seconds
                 try
@@ -145,6 +190,40 @@ classdef diskwriter < hgsetget
            res = diskwriter_mex('GetNumberOfErrors', this.objectHandle);
         end
         
+        % Get the disk write rate (MB/s)
+        function res = getwriterate(this)
+           res = diskwriter_mex('GetWriteRate', this.objectHandle);
+        end
+        
+        % Get the compression ratio
+        function res = getcompressionratio(this)
+           res = diskwriter_mex('GetCompressionRatio', this.objectHandle);
+        end
+        
+        % Get the compression rate (MB/s)
+        function res = getcompressionrate(this)
+           res = diskwriter_mex('GetCompressionRate', this.objectHandle);
+        end
+        
+        % Latency of the frames since they arrived on the host, per stage
+        % ('pop', 'write'): one row per stage, [count mean min p50 p90 p99
+        % p999 max] in nanoseconds, and the names of the stages. A frame
+        % counts as written once the disk write of its last block is done.
+        function [res, stages] = getlatency(this)
+           [res, stages] = diskwriter_mex('GetLatency', this.objectHandle);
+        end
+        
+        % Reset the latency histograms
+        function resetlatency(this)
+           diskwriter_mex('ResetLatency', this.objectHandle);
+        end
+        
+        % Write the latency histograms to a CSV file
+        % (stage, lower_ns, upper_ns, count; one row per non-empty bucket)
+        function writelatencycsv(this, path)
+           diskwriter_mex('WriteLatencyCsv', this.objectHandle, path);
+        end
+        
         % Get list of errors
         function res = geterrors(this)
            res = diskwriter_mex('GetErrors', this.objectHandle);
@@ -6,6 +6,8 @@
 #include "mex.h"
 #include "class_handle.hpp"
 #include "diskwriter.cpp"
+#include "unbufferedfile.cpp"
+#include "framecodec.cpp"
 #include "gigesource_mex_lib.cpp"
 #include "gigesource.h"
 
@@ -53,24 +55,65 @@ void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
     // Initialize    
     if (!strcmp("Initialize", cmd)) {
         // Check parameters
-        if (nlhs>1 || nrhs != 5)
+        if (nlhs>1 || nrhs < 5 || nrhs > 9)
             mexErrMsgTxt("Initialize: Unexpected arguments.");
-		if (!mxIsChar(prhs[2]) || !mxIsLogicalScalar(prhs[4]))
+		if (!(mxIsChar(prhs[2]) || mxIsCell(prhs[2])) || !mxIsLogicalScalar(prhs[4]) || (nrhs >= 6 && !mxIsLogicalScalar(prhs[5])) || (nrhs >= 7 && !mxIsChar(prhs[6]))
+			|| (nrhs >= 8 && (!mxIsDouble(prhs[7]) || mxGetNumberOfElements(prhs[7]) != 1))
+			|| (nrhs == 9 && (!mxIsDouble(prhs[8]) || mxGetNumberOfElements(prhs[8]) != 1)))
 			mexErrMsgTxt("Initialize: Unexpected arguments.");
 
+		// Target files: one path, or a cell array of paths to stripe the frames over
+		std::vector<std::string> file_paths;
+		size_t NumberOfPaths = mxIsCell(prhs[2]) ? mxGetNumberOfElements(prhs[2]) : 1;
+		for (size_t i = 0; i < NumberOfPaths; i++) {
+			const mxArray* mxPath = mxIsCell(prhs[2]) ? mxGetCell(prhs[2], (mwIndex)i) : prhs[2];
+			if (mxPath == NULL || !mxIsChar(mxPath))
+				mexErrMsgTxt("Initialize: The file paths should be strings.");
+			char* path = mxArrayToString(mxPath);
+			file_paths.push_back(path);
+			mxFree(path);
+		}
+
 		// Inputs
-		LPCTSTR      file_path    = mxArrayToString(prhs[2]);
 		bool         pass_through = mxIsLogicalScalarTrue(prhs[4]);
+		bool         subscribe    = (nrhs >= 6) && mxIsLogicalScalarTrue(prhs[5]);
+
+		// File format: 'container' (default) or 'raw'
+		DiskWriterFormat format = DISKWRITER_FORMAT_CONTAINER;
+		if (nrhs >= 7) {
+			char format_name[16];
+			mxGetString(prhs[6], format_name, sizeof(format_name));
+			if (!strcmp("raw", format_name))
+				format = DISKWRITER_FORMAT_RAW;
+			else if (strcmp("container", format_name))
+				mexErrMsgTxt("Initialize: The format should be 'container' or 'raw'.");
+		}
+
+		// Disk space to reserve ahead of the writes, in bytes (0 for the default)
+		uint64_t preallocate = (nrhs >= 8) ? (uint64_t)mxGetScalar(prhs[7]) : 0;
+
+		// Number of compression threads (0 to write the frames as they are)
+		size_t compression_threads = (nrhs == 9) ? (size_t)mxGetScalar(prhs[8]) : 0;
+		dw_instance->SetCompression(FRAMECODEC_PREDICT, compression_threads);
 		
 		IImageQueue* source;
+		std::shared_ptr<ImageSubscriber> subscription;
 		if (mxIsClass(prhs[3], "gigesource")) {
-			source = (IImageQueue*)convertMat2Ptr<GigE_Source>(mxGetProperty(prhs[3], 0, "objectHandle"));
+			GigE_Source* gige = convertMat2Ptr<GigE_Source>(mxGetProperty(prhs[3], 0, "objectHandle"));
+			if (gige->IsSharedRingEnabled())
+				mexErrMsgTxt("Initialize: The gigesource publishes its frames to a shared ring.");
+			if (subscribe) {
+				subscription = gige->Subscribe(DISKWRITER_QUEUE_SIZE);
+				source = subscription.get();
+			} else {
+				source = (IImageQueue*)gige;
+			}
 		} else {
 			mexErrMsgTxt("Initialize: Unsupported source class.");
 		}
 		
         // Call the method
-		bool res = dw_instance->Initialize(file_path, source, pass_through);
+		bool res = dw_instance->Initialize(file_paths, source, pass_through, subscription, format, preallocate);
 		
 		// Check result
 		if (!res)
@@ -97,34 +140,33 @@ void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
 	// Get image data  
 	if (!strcmp("GetImages", cmd)) {
 		// Check parameters
-		if (nlhs > 2 || nrhs != 3 || mxGetNumberOfElements(prhs[2])!=1)
+		if (nlhs > 2 || nrhs < 3 || nrhs > 4 || mxGetNumberOfElements(prhs[2])!=1)
 			mexErrMsgTxt("GetImages: Unexpected arguments.");
 
-		// Read input (number of frames)
+		// Read input (number of frames, and whether to transpose them to
+		// height x width, the default)
 		size_t NumberOfFrames = (size_t)mxGetScalar(prhs[2]);
+		bool Transposed = (nrhs < 4) || (mxGetScalar(prhs[3]) != 0);
 
 		// Check if there are that many frames available
 		if (NumberOfFrames > dw_instance->GetNumberOfAvailableImages())
 			mexErrMsgTxt("GetImages: The number of images requested exceeds the number of available images.");
 
 		// Pop the first image
-		std::unique_ptr<PvBuffer> pBuffer = dw_instance->GetImage();
+		ImagePtr pBuffer = dw_instance->GetImage();
 
 		// Check if pop was successful
 		if (!pBuffer)
 			mexErrMsgTxt("GetImages: The first image could not be retrieved.");
 
-		// Get image specific buffer interface
-		PvImage *lImage = pBuffer->GetImage();
-
 		// Read image dimensions
-		uint32_t ImageWidth = lImage->GetWidth();
-        uint32_t ImageHeight = lImage->GetHeight();
-		uint32_t ImageBpp = lImage->GetBitsPerPixel();
+		uint32_t ImageWidth = pBuffer->width;
+        uint32_t ImageHeight = pBuffer->height;
+		uint32_t ImageBpp = pBuffer->bpp;
 
 		// Prepare dimensions of the MATLAB frames array
 		mwSize ndims = 4;
-		mwSize dims[4]{ImageHeight, ImageWidth, 1, (mwSize)NumberOfFrames};
+		mwSize dims[4]{Transposed ? ImageHeight : ImageWidth, Transposed ? ImageWidth : ImageHeight, 1, (mwSize)NumberOfFrames};
 
 		// Prepare MATLAB time array
 		mxArray*  mxTime = mxCreateNumericMatrix((int)NumberOfFrames, 1, mxUINT64_CLASS, mxREAL);
@@ -138,14 +180,8 @@ void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
 				// Create a MATLAB array
 				plhs[0] = mxCreateNumericArray(ndims, dims, mxUINT8_CLASS, mxREAL);
 
-				// Transfer first frame
-				char* pMat = (char*)mxGetData(plhs[0]);
-				transpose(pMat, lImage->GetDataPointer(), ImageWidth, ImageHeight);
-				pTime[0] = pBuffer->GetTimestamp();
-				pBuffer.reset();
-
-				// Transfer the other frames
-				transfer_many(&pMat[ImageWidth*ImageHeight], &pTime[1], dw_instance, ImageWidth, ImageHeight, NumberOfFrames-1);
+				// Transfer the frames, starting with the first one
+				transfer_many((uint8_t*)mxGetData(plhs[0]), pTime, dw_instance, pBuffer, NumberOfFrames, Transposed);
 			}
 			break;
 		case 16:
@@ -153,14 +189,8 @@ void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
 				// Create array
 				plhs[0] = mxCreateNumericArray(ndims, dims, mxUINT16_CLASS, mxREAL);
 
-				// Transfer first frame
-				short* pMat = (short*)mxGetData(plhs[0]);
-				transpose(pMat, lImage->GetDataPointer(), ImageWidth, ImageHeight);
-				pTime[0] = pBuffer->GetTimestamp();
-				pBuffer.reset();
-
-				// Transfer the other frames
-				transfer_many(&pMat[ImageWidth*ImageHeight], &pTime[1], dw_instance, ImageWidth, ImageHeight, NumberOfFrames - 1);
+				// Transfer the frames, starting with the first one
+				transfer_many((uint16_t*)mxGetData(plhs[0]), pTime, dw_instance, pBuffer, NumberOfFrames, Transposed);
 			}
 			break;
 		default:
@@ -237,6 +267,48 @@ void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
 		return;
 	}
 
+	// Get the compression statistics
+	if (!strcmp("GetCompressionRatio", cmd)) {
+		// Check parameters
+		if (nlhs != 1 || nrhs != 2)
+			mexErrMsgTxt("GetCompressionRatio: Unexpected arguments.");
+
+		// Get ratio
+		plhs[0] = mxCreateDoubleScalar(dw_instance->GetCompressionRatio());
+
+		// Return
+		return;
+	}
+	if (!strcmp("GetCompressionRate", cmd)) {
+		// Check parameters
+		if (nlhs != 1 || nrhs != 2)
+			mexErrMsgTxt("GetCompressionRate: Unexpected arguments.");
+
+		// Get rate
+		plhs[0] = mxCreateDoubleScalar(dw_instance->GetCompressionRate());
+
+		// Return
+		return;
+	}
+
+	// Get the disk write rate (MB/s)
+	if (!strcmp("GetWriteRate", cmd)) {
+		// Check parameters
+		if (nlhs != 1 || nrhs != 2)
+			mexErrMsgTxt("GetWriteRate: Unexpected arguments.");
+
+		// Get rate
+		plhs[0] = mxCreateDoubleScalar(dw_instance->GetWriteRate());
+
+		// Return
+		return;
+	}
+
+
+	// Latency histograms
+	if (LatencyCommand(cmd, dw_instance->GetLatency(), nlhs, plhs, nrhs, prhs))
+		return;
+
 
 	// Get image data  
 	if (!strcmp("GetErrors", cmd)) {
@@ -0,0 +1,460 @@
+// Sequential unbuffered file writer with several asynchronous writes in flight.
+
+#include "unbufferedfile.h"
+#include <string.h>
+#ifndef _WIN32
+	#include <fcntl.h>
+	#include <unistd.h>
+	#include <errno.h>
+#endif
+
+
+UnbufferedFile::UnbufferedFile()
+{
+	#ifdef _WIN32
+		File = INVALID_HANDLE_VALUE;
+	#else
+		File = -1;
+	#endif
+	IsOpen = false;
+	Current = 0;
+	Offset = 0;
+	Allocated = 0;
+	GrowSize = UNBUFFERED_GROW_SIZE;
+	Head = NULL;
+	HeadWritten = false;
+	BytesWritten = 0;
+	FirstWrite = 0;
+	pLatency = NULL;
+}
+
+
+UnbufferedFile::~UnbufferedFile()
+{
+	Close();
+}
+
+bool UnbufferedFile::Open(const std::string& path, uint64_t preallocate)
+{
+	// Start over
+	Close();
+	Error.clear();
+
+	// Open file
+	#ifdef _WIN32
+		File = CreateFileA(path.c_str(),
+						   GENERIC_WRITE,
+						   FILE_SHARE_READ,
+						   NULL,
+						   CREATE_ALWAYS,
+						   FILE_ATTRIBUTE_NORMAL | FILE_FLAG_NO_BUFFERING | FILE_FLAG_OVERLAPPED,
+						   NULL);
+		if (File == INVALID_HANDLE_VALUE)
+		{
+			Fail("CreateFile failed with code " + std::to_string(GetLastError()));
+			return false;
+		}
+	#else
+		// (file systems without direct I/O, e.g. tmpfs, get buffered writes)
+		File = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_DIRECT, 0644);
+		if (File < 0 && errno == EINVAL)
+			File = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+		if (File < 0)
+		{
+			Fail("open failed with code " + std::to_string(errno));
+			return false;
+		}
+	#endif
+	IsOpen = true;
+
+	// Aligned blocks
+	// (value-initialized, so the OVERLAPPED/aiocb structures start zeroed)
+	Blocks.resize(UNBUFFERED_BLOCKS);
+	for (size_t i = 0; i < Blocks.size(); i++)
+	{
+		Blocks[i].data = (uint8_t*)spsc_aligned_malloc(UNBUFFERED_BLOCK_SIZE, UNBUFFERED_ALIGNMENT);
+		Blocks[i].used = 0;
+		Blocks[i].pending = false;
+		Blocks[i].arrivals.reserve(UNBUFFERED_BLOCK_SIZE / UNBUFFERED_ALIGNMENT);
+		if (Blocks[i].data == NULL)
+		{
+			Fail("Could not allocate the write blocks.");
+			Close();
+			return false;
+		}
+		#ifdef _WIN32
+			Blocks[i].overlapped.hEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+			if (Blocks[i].overlapped.hEvent == NULL)
+			{
+				Fail("CreateEvent failed with code " + std::to_string(GetLastError()));
+				Close();
+				return false;
+			}
+		#endif
+	}
+	Head = (uint8_t*)spsc_aligned_malloc(UNBUFFERED_ALIGNMENT, UNBUFFERED_ALIGNMENT);
+	if (Head == NULL)
+	{
+		Fail("Could not allocate the write blocks.");
+		Close();
+		return false;
+	}
+	memset(Head, 0, UNBUFFERED_ALIGNMENT);
+
+	// Preallocate
+	Current = 0;
+	Offset = 0;
+	Allocated = 0;
+	HeadWritten = false;
+	BytesWritten = 0;
+	FirstWrite = 0;
+	GrowSize = (preallocate > 0) ? preallocate : UNBUFFERED_GROW_SIZE;
+	if (!Extend(GrowSize))
+	{
+		Close();
+		return false;
+	}
+
+	return true;
+}
+
+bool UnbufferedFile::Close()
+{
+	// Write what is left, and cut the file at the end of the data
+	bool res = true;
+	if (IsOpen)
+	{
+		res = Flush();
+		res &= SetLength(GetSize());
+	}
+
+	// Close file
+	#ifdef _WIN32
+		if (File != INVALID_HANDLE_VALUE)
+			CloseHandle(File);
+		File = INVALID_HANDLE_VALUE;
+	#else
+		if (File >= 0)
+			close(File);
+		File = -1;
+	#endif
+	IsOpen = false;
+
+	// Release blocks
+	for (size_t i = 0; i < Blocks.size(); i++)
+	{
+		if (Blocks[i].data != NULL)
+			spsc_aligned_free(Blocks[i].data);
+		#ifdef _WIN32
+			if (Blocks[i].overlapped.hEvent != NULL)
+				CloseHandle(Blocks[i].overlapped.hEvent);
+		#endif
+	}
+	Blocks.clear();
+	if (Head != NULL)
+		spsc_aligned_free(Head);
+	Head = NULL;
+
+	return res;
+}
+
+bool UnbufferedFile::Write(const void* data, size_t size, uint64_t arrival)
+{
+	if (!IsOpen)
+		return false;
+
+	const uint8_t* source = (const uint8_t*)data;
+	while (size > 0)
+	{
+		// Gather into the current block
+		Block& block = Blocks[Current];
+		size_t n = UNBUFFERED_BLOCK_SIZE - block.used;
+		if (n > size)
+			n = size;
+		memcpy(block.data + block.used, source, n);
+		block.used += n;
+		source += n;
+		size -= n;
+
+		// The end of a frame: its latency counts once this block is written
+		if (size == 0 && arrival != 0 && pLatency != NULL)
+			block.arrivals.push_back(arrival);
+
+		// Write it out once it is full, and move on to the oldest block,
+		// once its write has completed
+		if (block.used == UNBUFFERED_BLOCK_SIZE)
+		{
+			if (!Submit(block))
+				return false;
+			Current = (Current + 1) % Blocks.size();
+			Offset += UNBUFFERED_BLOCK_SIZE;
+			if (!Complete(Blocks[Current]))
+				return false;
+			Blocks[Current].used = 0;
+		}
+	}
+	return true;
+}
+
+bool UnbufferedFile::WriteHead(const void* data, size_t size)
+{
+	// Overwrite the start of the file (e.g. a header that is only complete
+	// once everything else was written)
+	if (!IsOpen || size > UNBUFFERED_ALIGNMENT)
+		return false;
+	memcpy(Head, data, size);
+
+	// Still in the block being filled
+	if (Offset == 0)
+		memcpy(Blocks[Current].data, data, size);
+
+	// Already on the disk
+	if (HeadWritten)
+	{
+		if (!CompleteAll())
+			return false;
+		return WriteAligned(Head, UNBUFFERED_ALIGNMENT, 0);
+	}
+	return true;
+}
+
+bool UnbufferedFile::Flush()
+{
+	// Write the partial block, and keep it to be completed and written
+	// again by the next writes
+	if (!IsOpen)
+		return false;
+	Block& block = Blocks[Current];
+	if (block.used > 0 && !Submit(block))
+		return false;
+	return CompleteAll();
+}
+
+bool UnbufferedFile::Truncate()
+{
+	// Back to an empty file
+	if (!IsOpen)
+		return false;
+	bool res = CompleteAll();
+	for (size_t i = 0; i < Blocks.size(); i++)
+		Blocks[i].used = 0;
+	Current = 0;
+	Offset = 0;
+	HeadWritten = false;
+	BytesWritten = 0;
+	FirstWrite = 0;
+	res &= SetLength(0);
+	Allocated = 0;
+	res &= Extend(GrowSize);
+	return res;
+}
+
+bool UnbufferedFile::Submit(Block& block)
+{
+	// Sector-aligned size, padded with zeros
+	size_t size = (block.used + UNBUFFERED_ALIGNMENT - 1) / UNBUFFERED_ALIGNMENT * UNBUFFERED_ALIGNMENT;
+	memset(block.data + block.used, 0, size - block.used);
+
+	// Extend the file ahead of the writes
+	// (writes beyond the end of the file are not asynchronous)
+	if (Offset + size > Allocated)
+	{
+		uint64_t target = Allocated + GrowSize;
+		if (target < Offset + size)
+			target = Offset + size;
+		if (!Extend(target))
+			return false;
+	}
+
+	// Keep the first sector, for WriteHead
+	if (Offset == 0)
+	{
+		memcpy(Head, block.data, UNBUFFERED_ALIGNMENT);
+		HeadWritten = true;
+	}
+
+	// Start the clock
+	if (FirstWrite == 0)
+		FirstWrite = (int64_t)std::chrono::steady_clock::now().time_since_epoch().count();
+
+	// Write
+	#ifdef _WIN32
+		ResetEvent(block.overlapped.hEvent);
+		block.overlapped.Offset = (DWORD)(Offset & 0xFFFFFFFF);
+		block.overlapped.OffsetHigh = (DWORD)(Offset >> 32);
+		if (!WriteFile(File, block.data, (DWORD)size, NULL, &block.overlapped) && GetLastError() != ERROR_IO_PENDING)
+		{
+			Fail("WriteFile failed with code " + std::to_string(GetLastError()));
+			return false;
+		}
+	#else
+		block.control.aio_fildes = File;
+		block.control.aio_buf = block.data;
+		block.control.aio_nbytes = size;
+		block.control.aio_offset = (off_t)Offset;
+		if (aio_write(&block.control) != 0)
+		{
+			Fail("aio_write failed with code " + std::to_string(errno));
+			return false;
+		}
+	#endif
+	block.pending = true;
+	return true;
+}
+
+bool UnbufferedFile::Complete(Block& block)
+{
+	// Wait for the write of this block
+	if (!block.pending)
+		return true;
+	block.pending = false;
+
+	#ifdef _WIN32
+		DWORD written = 0;
+		if (!GetOverlappedResult(File, &block.overlapped, &written, TRUE))
+		{
+			Fail("WriteFile failed with code " + std::to_string(GetLastError()));
+			return false;
+		}
+	#else
+		const struct aiocb* list[1] = { &block.control };
+		while (aio_error(&block.control) == EINPROGRESS)
+			aio_suspend(list, 1, NULL);
+		ssize_t written = aio_return(&block.control);
+		if (written < 0)
+		{
+			Fail("aio_write failed with code " + std::to_string(aio_error(&block.control)));
+			return false;
+		}
+	#endif
+
+	BytesWritten += (uint64_t)written;
+
+	// The frames that end in this block are on disk
+	// (as far as we know now: blocks are only waited for when they are
+	//  reused or flushed, so this is an upper bound)
+	if (!block.arrivals.empty())
+	{
+		uint64_t now = LatencyNow();
+		for (size_t i = 0; i < block.arrivals.size(); i++)
+			pLatency->RecordSince(block.arrivals[i], now);
+		block.arrivals.clear();
+	}
+	return true;
+}
+
+bool UnbufferedFile::CompleteAll()
+{
+	bool res = true;
+	for (size_t i = 0; i < Blocks.size(); i++)
+		res &= Complete(Blocks[i]);
+	return res;
+}
+
+bool UnbufferedFile::WriteAligned(const uint8_t* data, size_t size, uint64_t offset)
+{
+	// One write, waited for
+	#ifdef _WIN32
+		OVERLAPPED overlapped;
+		memset(&overlapped, 0, sizeof(overlapped));
+		overlapped.Offset = (DWORD)(offset & 0xFFFFFFFF);
+		overlapped.OffsetHigh = (DWORD)(offset >> 32);
+		DWORD written = 0;
+		if (!WriteFile(File, data, (DWORD)size, NULL, &overlapped) && GetLastError() != ERROR_IO_PENDING)
+		{
+			Fail("WriteFile failed with code " + std::to_string(GetLastError()));
+			return false;
+		}
+		if (!GetOverlappedResult(File, &overlapped, &written, TRUE) || written != size)
+		{
+			Fail("WriteFile failed with code " + std::to_string(GetLastError()));
+			return false;
+		}
+	#else
+		if (pwrite(File, data, size, (off_t)offset) != (ssize_t)size)
+		{
+			Fail("pwrite failed with code " + std::to_string(errno));
+			return false;
+		}
+	#endif
+	return true;
+}
+
+bool UnbufferedFile::Extend(uint64_t size)
+{
+	#ifdef _WIN32
+		if (!SetLength(size))
+			return false;
+
+		// Also skip zeroing the new space if the process may
+		// (needs SE_MANAGE_VOLUME_NAME; otherwise NTFS zeroes it as we go)
+		SetFileValidData(File, (LONGLONG)size);
+	#else
+		// Reserve the blocks, or at least set the size
+		if (posix_fallocate(File, (off_t)Allocated, (off_t)(size - Allocated)) != 0 && !SetLength(size))
+			return false;
+	#endif
+	Allocated = size;
+	return true;
+}
+
+bool UnbufferedFile::SetLength(uint64_t size)
+{
+	#ifdef _WIN32
+		LARGE_INTEGER position;
+		position.QuadPart = (LONGLONG)size;
+		if (!SetFilePointerEx(File, position, NULL, FILE_BEGIN) || !SetEndOfFile(File))
+		{
+			Fail("SetEndOfFile failed with code " + std::to_string(GetLastError()));
+			return false;
+		}
+	#else
+		if (ftruncate(File, (off_t)size) != 0)
+		{
+			Fail("ftruncate failed with code " + std::to_string(errno));
+			return false;
+		}
+	#endif
+	return true;
+}
+
+uint64_t UnbufferedFile::GetSize()
+{
+	// Bytes handed to Write so far
+	if (Blocks.empty())
+		return Offset;
+	return Offset + Blocks[Current].used;
+}
+
+uint64_t UnbufferedFile::GetBytesWritten()
+{
+	return BytesWritten;
+}
+
+double UnbufferedFile::GetWriteRate()
+{
+	// Sustained rate since the first write, in MB/s
+	int64_t start = FirstWrite;
+	if (start == 0)
+		return 0;
+	std::chrono::steady_clock::duration elapsed = std::chrono::steady_clock::now().time_since_epoch() - std::chrono::steady_clock::duration(start);
+	double seconds = std::chrono::duration<double>(elapsed).count();
+	if (seconds <= 0)
+		return 0;
+	return (double)BytesWritten / 1e6 / seconds;
+}
+
+void UnbufferedFile::SetLatency(LatencyHistogram* pHistogram)
+{
+	pLatency = pHistogram;
+}
+
+std::string UnbufferedFile::GetError()
+{
+	return Error;
+}
+
+void UnbufferedFile::Fail(const std::string& message)
+{
+	Error = message;
+}
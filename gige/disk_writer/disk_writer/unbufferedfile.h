@@ -0,0 +1,107 @@
+////////////////////////////////////////////////////////////////////////////////
+// Filename: unbufferedfile.h
+// Sequential file writer that bypasses the page cache. The data is gathered
+// into large sector-aligned blocks, and each full block is written
+// asynchronously, with several blocks in flight, so that the disk always has
+// work queued and the cache never builds up a backlog that stalls the writer
+// for seconds when it is flushed. The file is extended ahead of the writes.
+// Writes can carry the arrival time of their frame; once the block that holds
+// the end of the frame is known to be written, the latency since the arrival
+// goes into a histogram.
+//   - Windows: FILE_FLAG_NO_BUFFERING | FILE_FLAG_OVERLAPPED
+//   - Elsewhere: O_DIRECT (where the file system supports it) with POSIX AIO
+////////////////////////////////////////////////////////////////////////////////
+#ifndef _UNBUFFEREDFILE_H_
+#define _UNBUFFEREDFILE_H_
+
+//////////////
+// INCLUDES //
+//////////////
+#ifdef _WIN32
+	#include <windows.h>
+#else
+	#include <aio.h>
+#endif
+#include <string>
+#include <vector>
+#include <chrono>
+#include <atomic>
+#include <stdint.h>
+#include "spsc_queue.h"
+#include "latencyhistogram.h"
+
+/////////////
+// GLOBALS //
+/////////////
+#define UNBUFFERED_ALIGNMENT       4096							// Multiple of the sector size of any disk
+#define UNBUFFERED_BLOCK_SIZE      (4 * 1024 * 1024)			// Bytes per write
+#define UNBUFFERED_BLOCKS          4							// Writes in flight, plus the one being filled
+#define UNBUFFERED_GROW_SIZE       (256ULL * 1024 * 1024)		// Default preallocation step
+
+////////////////////////////////////////////////////////////////////////////////
+// Class name: UnbufferedFile
+////////////////////////////////////////////////////////////////////////////////
+class UnbufferedFile
+{
+public:
+	UnbufferedFile();
+	~UnbufferedFile();
+
+	bool			Open(const std::string&, uint64_t = 0);
+	bool			Close();
+
+	bool			Write(const void*, size_t, uint64_t = 0);
+	bool			WriteHead(const void*, size_t);
+	bool			Flush();
+	bool			Truncate();
+
+	uint64_t		GetSize();
+	uint64_t		GetBytesWritten();
+	double			GetWriteRate();
+	std::string		GetError();
+	void			SetLatency(LatencyHistogram*);
+
+private:
+	struct Block
+	{
+		uint8_t*		data;
+		size_t			used;
+		bool			pending;
+		std::vector<uint64_t> arrivals;		// Of the frames that end in this block
+		#ifdef _WIN32
+			OVERLAPPED	overlapped;
+		#else
+			struct aiocb control;
+		#endif
+	};
+
+	#ifdef _WIN32
+		HANDLE			File;
+	#else
+		int				File;
+	#endif
+	bool				IsOpen;
+
+	std::vector<Block>	Blocks;
+	size_t				Current;			// Block being filled
+	uint64_t			Offset;				// File offset of the current block
+	uint64_t			Allocated;			// Size the file has been extended to
+	uint64_t			GrowSize;
+	uint8_t*			Head;				// Copy of the first sector
+	bool				HeadWritten;
+
+	std::atomic<uint64_t>	BytesWritten;		// Read by other threads for the write rate
+	std::atomic<int64_t>	FirstWrite;			// steady_clock ticks, 0 before the first write
+	std::string			Error;
+	LatencyHistogram*	pLatency;
+
+	bool			Submit(Block&);
+	bool			Complete(Block&);
+	bool			CompleteAll();
+	bool			WriteAligned(const uint8_t*, size_t, uint64_t);
+	bool			Extend(uint64_t);
+	bool			SetLength(uint64_t);
+	void			Fail(const std::string&);
+};
+
+#endif
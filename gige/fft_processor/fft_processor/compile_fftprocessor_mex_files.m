@@ -24,6 +24,6 @@ compile_args = [optim_args, include_args];
 disp('Compiling...');
 mex(compile_args{:}, 'fftw_wrapper_r2c_mex.cpp');
 mex(compile_args{:}, 'fftw_wrapper_c2c_mex.cpp');
-mex(compile_args{:}, 'fftprocessor_mex.cpp');
+mex(compile_args{:}, '-largeArrayDims', 'fftprocessor_mex.cpp', '-lmwblas');  % BLAS for tmaccumulator
 
 warning('Consider using the -largeArrayDims flag when compiling, and adapting the code for this.');
\ No newline at end of file
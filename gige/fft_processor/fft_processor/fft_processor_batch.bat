@@ -1,3 +1,2 @@
 @echo off
-fft_processor_float.exe > fft_processor_float_log.txt
-fft_processor_double.exe > fft_processor_double_log.txt
+fft_processor.exe > fft_processor_log.txt
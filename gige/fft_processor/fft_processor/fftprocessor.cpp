@@ -4,34 +4,254 @@
 
 #include "fftprocessor.h"
 
-FFTProcessor::FFTProcessor()
+// Conjugated copy of a run of coefficients
+// (complex<R> is laid out as {real, imag}, so flipping the sign bit of every
+//  other value conjugates; with SSE2, 2 float or 1 double coefficients at once)
+template<class R>
+struct FFTConjugateRun
 {
-	ProcessorThread = NULL;
+	static inline void Run(complex<R>* out, const complex<R>* in, size_t n)
+	{
+		for (size_t i = 0; i < n; i++)
+			out[i] = conj(in[i]);
+	}
+};
+
+#ifdef FFTPROCESSOR_BUILD_SSE2
+template<>
+struct FFTConjugateRun<float>
+{
+	static inline void Run(complex<float>* out, const complex<float>* in, size_t n)
+	{
+		const __m128 sign = _mm_set_ps(-0.0f, 0.0f, -0.0f, 0.0f);
+		size_t i = 0;
+		for (; i + 2 <= n; i += 2)
+			_mm_storeu_ps((float*)&out[i], _mm_xor_ps(_mm_loadu_ps((const float*)&in[i]), sign));
+		for (; i < n; i++)
+			out[i] = conj(in[i]);
+	}
+};
+
+template<>
+struct FFTConjugateRun<double>
+{
+	static inline void Run(complex<double>* out, const complex<double>* in, size_t n)
+	{
+		const __m128d sign = _mm_set_pd(-0.0, 0.0);
+		for (size_t i = 0; i < n; i++)
+			_mm_storeu_pd((double*)&out[i], _mm_xor_pd(_mm_loadu_pd((const double*)&in[i]), sign));
+	}
+};
+#endif
+
+// Same, split into real and imaginary parts
+// (with SSE2, 4 float or 2 double coefficients are de-interleaved at once)
+template<class R>
+struct FFTSplitRun
+{
+	static inline void Run(R* re, R* im, const complex<R>* in, size_t n, bool conjugate)
+	{
+		R sign = conjugate ? (R)-1 : (R)1;
+		for (size_t i = 0; i < n; i++)
+		{
+			re[i] = in[i].real();
+			im[i] = sign * in[i].imag();
+		}
+	}
+};
+
+#ifdef FFTPROCESSOR_BUILD_SSE2
+template<>
+struct FFTSplitRun<float>
+{
+	static inline void Run(float* re, float* im, const complex<float>* in, size_t n, bool conjugate)
+	{
+		const __m128 sign = conjugate ? _mm_set1_ps(-0.0f) : _mm_setzero_ps();
+		size_t i = 0;
+		for (; i + 4 <= n; i += 4)
+		{
+			__m128 a = _mm_loadu_ps((const float*)&in[i]);
+			__m128 b = _mm_loadu_ps((const float*)&in[i + 2]);
+			_mm_storeu_ps(re + i, _mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0)));
+			_mm_storeu_ps(im + i, _mm_xor_ps(_mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1)), sign));
+		}
+		for (; i < n; i++)
+		{
+			re[i] = in[i].real();
+			im[i] = conjugate ? -in[i].imag() : in[i].imag();
+		}
+	}
+};
+
+template<>
+struct FFTSplitRun<double>
+{
+	static inline void Run(double* re, double* im, const complex<double>* in, size_t n, bool conjugate)
+	{
+		const __m128d sign = conjugate ? _mm_set1_pd(-0.0) : _mm_setzero_pd();
+		size_t i = 0;
+		for (; i + 2 <= n; i += 2)
+		{
+			__m128d a = _mm_loadu_pd((const double*)&in[i]);
+			__m128d b = _mm_loadu_pd((const double*)&in[i + 1]);
+			_mm_storeu_pd(re + i, _mm_unpacklo_pd(a, b));
+			_mm_storeu_pd(im + i, _mm_xor_pd(_mm_unpackhi_pd(a, b), sign));
+		}
+		for (; i < n; i++)
+		{
+			re[i] = in[i].real();
+			im[i] = conjugate ? -in[i].imag() : in[i].imag();
+		}
+	}
+};
+#endif
+
+template<class R>
+FFTWorker<R>::FFTWorker() : FreeSlots(FFTW_STAGING_SLOTS), StagedSlots(FFTW_STAGING_SLOTS + 1), Results(FFTPROCESSOR_RESULT_QUEUE_SIZE), FreeBatch(1)
+{
+	pProcessor = NULL;
+	Thread = NULL;
+}
+
+template<class R>
+FFTProcessor<R>::FFTProcessor() : queue(FFTPROCESSOR_QUEUE_SIZE), Pool(FFTPROCESSOR_POOL_SIZE), Errors(FFTPROCESSOR_ERROR_QUEUE_SIZE)
+{
+	StagingThread = NULL;
+	ReorderThread = NULL;
+	pLatencyPop = Latency.Add("pop");
+	pLatencyFFT = Latency.Add("fft");
 }
 
 
-FFTProcessor::~FFTProcessor()
+template<class R>
+FFTProcessor<R>::~FFTProcessor()
 {
 }
 
-bool FFTProcessor::Initialize(IImageQueue *source_ptr, size_t width, size_t height, vector<int> filter)
+template<class R>
+bool FFTProcessor<R>::Initialize(IImageQueue *source_ptr, size_t width, size_t height, vector<int> filter, shared_ptr<ImageSubscriber> subscription, size_t workers, size_t batch)
 {
 	// Save inputs
+	// (when reading from a broadcast subscription, source_ptr is that
+	//  subscription and we hold on to it until shutdown)
 	pSource = source_ptr;
+	Subscription = subscription;
 
-	// Create FFTW object
-	if (!fft_r2c.Initialize(width, height))
+	// Save filter indices, and check them once and for all
+	indices = filter;
+	if (!MakeRuns((width / 2 + 1) * height))
 	{
-		PushError(std::string("FFTW initialization failed."));
+		PushError(std::string("Initialize failed: filter indices out of range."));
 		return false;
 	}
 
-	// Save filter indices
-	indices = filter;
+	// Extracts ready for the first images
+	Pool.Clear();
+	for (size_t i = 0; i < FFTPROCESSOR_POOL_SIZE; i++)
+	{
+		Extract extract;
+		if (Planar)
+		{
+			extract.real.resize(indices.size());
+			extract.imag.resize(indices.size());
+		}
+		else
+			extract.coefficients.resize(indices.size());
+		ReleaseImage(extract);
+	}
 
-	// Start thread
-	ProcessorThread = CreateThread(NULL, 0, ProcessorStaticStart, (void*)this, 0, NULL);
-	if (ProcessorThread == NULL)
+	// Number of workers
+	// (by default one per core, minus one for the staging thread; the cores
+	//  are shared between the FFTW plans of the workers)
+	int cores = numberOfCores();
+	if (workers == 0)
+		workers = (cores > 1) ? (size_t)(cores - 1) : 1;
+	int threads = max(1, cores / (int)workers);
+
+	// Coefficients to compute
+	vector<size_t> output_indices;
+	output_indices.reserve(indices.size());
+	for (size_t i = 0; i < indices.size(); i++)
+		output_indices.push_back((size_t)abs(indices[i]));
+
+	// Create the workers
+	// (plans are made one after the other, FFTW planning is not thread-safe;
+	//  the background planner waits until all the workers have their plans)
+	FFTW_PlannerHold<R> hold;
+	Workers.clear();
+	for (size_t w = 0; w < workers; w++)
+	{
+		unique_ptr<Worker> pWorker(new Worker());
+		pWorker->pProcessor = this;
+		if (Planar)
+		{
+			pWorker->result.extract.real.resize(indices.size());
+			pWorker->result.extract.imag.resize(indices.size());
+		}
+		else
+			pWorker->result.extract.coefficients.resize(indices.size());
+
+		// Create FFTW object
+		if (!pWorker->fft_r2c.Initialize(width, height, threads))
+		{
+			PushError(std::string("FFTW initialization failed."));
+			pWorker->fft_r2c.Shutdown();
+			Shutdown();
+			return false;
+		}
+
+		// Pick the transform engine for this set of coefficients
+		// (only computing the requested ones, if the filter is small enough)
+		pWorker->fft_r2c.SetOutputIndices(output_indices, FFTPROCESSOR_ENGINE);
+
+		// Batched plan for bursts
+		// (the sparse engine already skips most of the work, and does not
+		//  batch; without a batch, images are simply transformed one by one)
+		if (batch > 1 && pWorker->fft_r2c.GetEngine() == FFTW_ENGINE_FULL)
+		{
+			if (pWorker->fft_r2c.SetBatchSize(batch))
+			{
+				pWorker->batch_timestamps.resize(batch);
+				pWorker->batch_blockids.resize(batch);
+				pWorker->batch_arrivals.resize(batch);
+			}
+			else
+				PushError(std::string("FFTW batch initialization failed, images will be transformed one by one."));
+		}
+
+		// All staging arrays are free
+		for (size_t i = 0; i < FFTW_STAGING_SLOTS; i++)
+			pWorker->FreeSlots.TryPush(i);
+		size_t batch_token = 0;
+		if (pWorker->fft_r2c.GetBatchSize() > 0)
+			pWorker->FreeBatch.TryPush(batch_token);
+
+		Workers.push_back(std::move(pWorker));
+	}
+
+	// Start threads
+	StagingStopFlag = false;
+	ProcessorStopFlag = false;
+	ReorderStopFlag = false;
+	ReorderThread = CreateThread(NULL, 0, ReorderStaticStart, (void*)this, 0, NULL);
+	if (ReorderThread == NULL)
+	{
+		PushError(std::string("CreateThread failed with code ") + std::to_string(GetLastError()));
+		Shutdown();
+		return false;
+	}
+	for (size_t w = 0; w < Workers.size(); w++)
+	{
+		Workers[w]->Thread = CreateThread(NULL, 0, ProcessorStaticStart, (void*)Workers[w].get(), 0, NULL);
+		if (Workers[w]->Thread == NULL)
+		{
+			PushError(std::string("CreateThread failed with code ") + std::to_string(GetLastError()));
+			Shutdown();
+			return false;
+		}
+	}
+	StagingThread = CreateThread(NULL, 0, StagingStaticStart, (void*)this, 0, NULL);
+	if (StagingThread == NULL)
 	{
 		PushError(std::string("CreateThread failed with code ") + std::to_string(GetLastError()));
 		Shutdown();
@@ -44,205 +264,552 @@ bool FFTProcessor::Initialize(IImageQueue *source_ptr, size_t width, size_t heig
 }
 
 
-void FFTProcessor::Shutdown()
+template<class R>
+void FFTProcessor<R>::Shutdown()
 {
-	// Stop buffer Writer
-	if (ProcessorThread != NULL)
+	// Stop the staging thread first, so that the workers do not wait for
+	// images that will never come
+	if (StagingThread != NULL)
 	{
-		ProcessorStopFlag = true;
-		DWORD WaitResult = WaitForSingleObject(ProcessorThread, 10000);
+		StagingStopFlag = true;
+		DWORD WaitResult = WaitForSingleObject(StagingThread, 10000);
 		if (WaitResult != WAIT_OBJECT_0)
-			MessageBox(NULL, "Writer thread does not respond.", "Error", MB_OK | MB_ICONERROR);
-		CloseHandle(ProcessorThread);
+			MessageBox(NULL, "Staging thread does not respond.", "Error", MB_OK | MB_ICONERROR);
+		CloseHandle(StagingThread);
+		StagingThread = NULL;
 	}
 
-	// Cleanup FFTW
-	fft_r2c.Shutdown();
-	FFTW_PREFIX(cleanup_threads());
-	FFTW_PREFIX(cleanup());
+	// Stop the workers
+	ProcessorStopFlag = true;
+	for (size_t w = 0; w < Workers.size(); w++)
+	{
+		if (Workers[w]->Thread != NULL)
+		{
+			DWORD WaitResult = WaitForSingleObject(Workers[w]->Thread, 10000);
+			if (WaitResult != WAIT_OBJECT_0)
+				MessageBox(NULL, "Worker thread does not respond.", "Error", MB_OK | MB_ICONERROR);
+			CloseHandle(Workers[w]->Thread);
+			Workers[w]->Thread = NULL;
+		}
+	}
+
+	// Stop the reorder thread
+	if (ReorderThread != NULL)
+	{
+		ReorderStopFlag = true;
+		DWORD WaitResult = WaitForSingleObject(ReorderThread, 10000);
+		if (WaitResult != WAIT_OBJECT_0)
+			MessageBox(NULL, "Reorder thread does not respond.", "Error", MB_OK | MB_ICONERROR);
+		CloseHandle(ReorderThread);
+		ReorderThread = NULL;
+	}
+
+	// Leave the broadcast
+	if (Subscription)
+	{
+		Subscription->Unsubscribe();
+		Subscription.reset();
+	}
+
+	// Release the workers
+	// (FFTW itself is not cleaned up, so that the planner keeps its plans)
+	for (size_t w = 0; w < Workers.size(); w++)
+		Workers[w]->fft_r2c.Shutdown();
+	Workers.clear();
 
 	// Empty SPSC_queue
 	queue.Clear();
 }
 
-DWORD WINAPI FFTProcessor::ProcessorStaticStart(LPVOID lpParams)
+template<class R>
+DWORD WINAPI FFTProcessor<R>::StagingStaticStart(LPVOID lpParams)
 {
 	FFTProcessor* processor = (FFTProcessor*)lpParams;
-	return processor->ProcessBuffersContinuously();
+	return processor->StageBuffersContinuously();
+}
+
+template<class R>
+DWORD WINAPI FFTProcessor<R>::ProcessorStaticStart(LPVOID lpParams)
+{
+	Worker* worker = (Worker*)lpParams;
+	return worker->pProcessor->ProcessBuffersContinuously(*worker);
 }
 
-bool FFTProcessor::ProcessBuffer(std::unique_ptr<PvBuffer>& upBuffer)
+template<class R>
+DWORD WINAPI FFTProcessor<R>::ReorderStaticStart(LPVOID lpParams)
+{
+	FFTProcessor* processor = (FFTProcessor*)lpParams;
+	return processor->ReorderContinuously();
+}
+
+template<class R>
+bool FFTProcessor<R>::StageBuffer(ImagePtr& upBuffer, Worker& worker, size_t slot)
 {
 	// Access image data
-	PvImage *lImage = upBuffer->GetImage();
-	uint8_t *pData = lImage->GetDataPointer();
-	uint32_t ImageSizeBytes = lImage->GetImageSize();
-	uint32_t ImageBpp = lImage->GetBitsPerPixel();
-	size_t   ImageNumel = (ImageSizeBytes * 8) / ImageBpp;
-		
-	// Load data
-	bool resCopy;
-	switch (ImageBpp)
-	{
-	case 8:
-		resCopy = fft_r2c.SetDataIn(pData, ImageNumel);
-		break;
-	case 16:
-		resCopy = fft_r2c.SetDataIn((uint16_t *)pData, ImageNumel);
-		break;
-	default:
-		PushError(std::string("ProcessBuffer failed: cannot copy the data to the FFTW buffer (unsupported bit depth)"));
+	uint8_t *pData = upBuffer->data;
+	size_t   ImageSizeBytes = upBuffer->size;
+	uint32_t ImageBpp = upBuffer->bpp;
+
+	// Pixel format (Mono8, Mono12Packed or Mono16)
+	PixelFormat format = GetPixelFormat(ImageBpp);
+	if (format == PIXEL_FORMAT_UNKNOWN)
+	{
+		PushError(std::string("StageBuffer failed: cannot copy the data to the FFTW buffer (unsupported bit depth)"));
 		return false;
-		break;
 	}
-	if (!resCopy)
+	size_t   ImageNumel = (ImageSizeBytes * 8) / ImageBpp;
+
+	// Dark frame and gain, if any
+	shared_ptr<FFTCorrection> pCorrection = std::atomic_load(&correction);
+	const float* pDark = pCorrection ? pCorrection->dark.data() : NULL;
+	const float* pGain = pCorrection ? pCorrection->gain.data() : NULL;
+
+	// Convert the pixels straight into the staging array
+	if (!worker.fft_r2c.SetStagingIn(format, pData, ImageNumel, slot, pDark, pGain))
 	{
-		PushError(std::string("ProcessBuffer failed: cannot copy the data to the FFTW buffer (ImageSize=")
+		PushError(std::string("StageBuffer failed: cannot copy the data to the FFTW buffer (ImageSize=")
 			+ std::to_string(ImageNumel)
 			+ std::string("; Buffer=")
-			+ std::to_string(fft_r2c.GetSizeIn())
+			+ std::to_string(worker.fft_r2c.GetSizeIn())
 			+ std::string(")"));
 		return false;
 	}
 
-	// Fourier transform
-	fft_r2c.TransformForward();
+	// Hand the array over to the worker
+	FFTStagedImage staged;
+	staged.slot = slot;
+	staged.timestamp = upBuffer->timestamp;
+	staged.blockId = upBuffer->blockId;
+	staged.arrival = upBuffer->arrival;
+	if (!worker.StagedSlots.TryPush(staged))
+	{
+		PushError(std::string("StageBuffer failed: could not push the staged image."));
+		return false;
+	}
 
-	// Fetch output
-	Complex* full_output = fft_r2c.GetDataOutPtr();
-	size_t   full_output_max = fft_r2c.GetSizeOut();
+	// Return
+	return true;
+}
 
-	// Extract part of the output
-	unique_ptr<FFTExtract> extract(new FFTExtract());
-	extract->coefficients.reserve(indices.size());
-	extract->timestamp = upBuffer->GetTimestamp();
+template<class R>
+bool FFTProcessor<R>::StageBatch(ImagePtr* upBuffers, Worker& worker)
+{
+	// Dark frame and gain, if any
+	shared_ptr<FFTCorrection> pCorrection = std::atomic_load(&correction);
+	const float* pDark = pCorrection ? pCorrection->dark.data() : NULL;
+	const float* pGain = pCorrection ? pCorrection->gain.data() : NULL;
+
+	// Convert each image into its place in the batch
+	size_t batch = worker.fft_r2c.GetBatchSize();
+	for (size_t k = 0; k < batch; k++)
+	{
+		PixelFormat format = GetPixelFormat(upBuffers[k]->bpp);
+		if (format == PIXEL_FORMAT_UNKNOWN)
+		{
+			PushError(std::string("StageBatch failed: cannot copy the data to the FFTW buffer (unsupported bit depth)"));
+			return false;
+		}
+		size_t ImageNumel = (upBuffers[k]->size * 8) / upBuffers[k]->bpp;
 
-	for (size_t i = 0; i < indices.size(); i++) {
-		if (indices[i] >= 0)
+		if (!worker.fft_r2c.SetBatchIn(format, upBuffers[k]->data, ImageNumel, k, pDark, pGain))
+		{
+			PushError(std::string("StageBatch failed: cannot copy the data to the FFTW buffer (ImageSize=")
+				+ std::to_string(ImageNumel)
+				+ std::string("; Buffer=")
+				+ std::to_string(worker.fft_r2c.GetSizeIn())
+				+ std::string(")"));
+			return false;
+		}
+		worker.batch_timestamps[k] = upBuffers[k]->timestamp;
+		worker.batch_blockids[k] = upBuffers[k]->blockId;
+		worker.batch_arrivals[k] = upBuffers[k]->arrival;
+	}
+
+	// Hand the batch over to the worker
+	FFTStagedImage staged;
+	staged.slot = FFTPROCESSOR_BATCH_SLOT;
+	staged.timestamp = worker.batch_timestamps[0];
+	staged.blockId = worker.batch_blockids[0];
+	staged.arrival = worker.batch_arrivals[0];
+	if (!worker.StagedSlots.TryPush(staged))
+	{
+		PushError(std::string("StageBatch failed: could not push the staged images."));
+		return false;
+	}
+
+	// Return
+	return true;
+}
+
+template<class R>
+DWORD FFTProcessor<R>::StageBuffersContinuously()
+{
+	ImagePtr				  upBuffers[IMAGE_QUEUE_BATCH_SIZE];
+	size_t					  nReady;
+	size_t					  nPopped;
+	size_t					  slot;
+	size_t					  batch;
+	size_t					  next = 0;
+	bool					  resStage;
+
+	// Continuous loop for buffer retrieve/convert
+	while (!StagingStopFlag)
+	{
+		// Wait for at least one buffer, and take whatever burst is there
+		nReady = pSource->WaitImagesAny(1, IMAGE_QUEUE_BATCH_SIZE, 1000);
+		if (nReady == 0)
+			continue;
+
+		// Retrieve buffers
+		nPopped = pSource->GetImages(upBuffers, nReady);
+		if (nPopped == 0)
+		{
+			// Unexpected error
+			PushError("Wait operation succeeded but the queue pop operation failed.");
+			Sleep(1);
+			continue;
+		}
+		uint64_t now = LatencyNow();
+		for (size_t i = 0; i < nPopped; i++)
+			pLatencyPop->RecordSince(upBuffers[i]->arrival, now);
+
+		// Hand the buffers to the workers in turn, as soon as the next worker
+		// is done with one of its staging arrays
+		// (the reorder thread collects the results in the same turn, so only
+		//  move on to the next worker when an image was really staged)
+		for (size_t i = 0; i < nPopped; i++)
 		{
-			if (indices[i] < full_output_max) {
-				extract->coefficients.push_back(full_output[indices[i]]);
+			Worker& worker = *Workers[next];
+
+			// When enough images are waiting, and the batch of this worker
+			// is free, give it a whole batch at once
+			batch = worker.fft_r2c.GetBatchSize();
+			if (batch > 1 && (nPopped - i) >= batch && worker.FreeBatch.TryPop(slot))
+			{
+				resStage = StageBatch(&upBuffers[i], worker);
+				if (resStage)
+				{
+					next = (next + 1) % Workers.size();
+				}
+				else
+				{
+					PushError("Staging operation failed.");
+					worker.FreeBatch.TryPush(slot);
+				}
+
+				// The images are not needed anymore
+				for (size_t k = 0; k < batch; k++)
+					upBuffers[i + k].reset();
+				i += batch - 1;
+				continue;
+			}
+
+			// Otherwise, one image as soon as the worker is done with one of
+			// its staging arrays
+			while (!worker.FreeSlots.TryPop(slot) && !StagingStopFlag)
+				worker.FreeSlots.Wait(1, 1000);
+			if (StagingStopFlag)
+				break;
+
+			resStage = StageBuffer(upBuffers[i], worker, slot);
+			if (resStage)
+			{
+				next = (next + 1) % Workers.size();
 			}
 			else
 			{
-				PushError(std::string("ProcessBuffer failed: filter indices out of range."));
-				return false;
+				PushError("Staging operation failed.");
+				worker.FreeSlots.TryPush(slot);
 			}
+
+			// The image is not needed anymore
+			upBuffers[i].reset();
 		}
-		else
+	}
+
+	// Release images left over when stopping
+	for (size_t i = 0; i < IMAGE_QUEUE_BATCH_SIZE; i++)
+		upBuffers[i].reset();
+
+	// Leave
+	return EXIT_SUCCESS;
+}
+
+template<class R>
+bool FFTProcessor<R>::MakeRuns(size_t full_output_max)
+{
+	// Split the filter into runs of consecutive output coefficients, taken
+	// as they are (positive indices) or conjugated (negative indices)
+	DirectRuns.clear();
+	ConjugateRuns.clear();
+	vector<FFTExtractRun>* pLast = NULL;
+	for (size_t i = 0; i < indices.size(); i++)
+	{
+		bool   conjugate = (indices[i] < 0);
+		size_t source = (size_t)abs(indices[i]);
+		if (source >= full_output_max)
+			return false;
+
+		// Extends the previous run?
+		vector<FFTExtractRun>& runs = conjugate ? ConjugateRuns : DirectRuns;
+		if (pLast == &runs)
 		{
-			if (-indices[i] < full_output_max) {
-				extract->coefficients.push_back(conj(full_output[-indices[i]]));
-			}
-			else
+			FFTExtractRun& run = runs.back();
+			if (run.source + run.length == source && run.target + run.length == i)
 			{
-				PushError(std::string("ProcessBuffer failed: filter indices out of range."));
-				return false;
+				run.length++;
+				continue;
 			}
 		}
+
+		// New run
+		FFTExtractRun run;
+		run.source = source;
+		run.target = i;
+		run.length = 1;
+		runs.push_back(run);
+		pLast = &runs;
 	}
+	return true;
+}
 
-	// Push output to the queue
-	queue.TryPush(extract);
-	if (extract)
+template<class R>
+void FFTProcessor<R>::ExtractCoefficients(Worker& worker, const Complex* full_output, uint64_t timestamp, uint64_t blockId)
+{
+	// Extract part of the output
+	// (the extract comes from the pool, or back from the rings, with room
+	//  for all the coefficients; the runs were checked at initialization)
+	Extract& extract = worker.result.extract;
+	extract.timestamp = timestamp;
+	extract.blockId = blockId;
+	extract.planar = Planar;
+
+	// Planar: real and imaginary parts apart
+	if (extract.planar)
 	{
-		PushError(std::string("ProcessBuffer failed: could not push the transformed data to the output stack."));
-		return false;
+		extract.real.resize(indices.size());
+		extract.imag.resize(indices.size());
+		R* pReal = extract.real.data();
+		R* pImag = extract.imag.data();
+		for (size_t r = 0; r < DirectRuns.size(); r++)
+		{
+			const FFTExtractRun& run = DirectRuns[r];
+			FFTSplitRun<R>::Run(pReal + run.target, pImag + run.target, full_output + run.source, run.length, false);
+		}
+		for (size_t r = 0; r < ConjugateRuns.size(); r++)
+		{
+			const FFTExtractRun& run = ConjugateRuns[r];
+			FFTSplitRun<R>::Run(pReal + run.target, pImag + run.target, full_output + run.source, run.length, true);
+		}
+		return;
 	}
 
+	// Interleaved
+	extract.coefficients.resize(indices.size());
+	Complex* pOut = extract.coefficients.data();
+	for (size_t r = 0; r < DirectRuns.size(); r++)
+	{
+		const FFTExtractRun& run = DirectRuns[r];
+		memcpy(pOut + run.target, full_output + run.source, run.length * sizeof(Complex));
+	}
+	for (size_t r = 0; r < ConjugateRuns.size(); r++)
+	{
+		const FFTExtractRun& run = ConjugateRuns[r];
+		FFTConjugateRun<R>::Run(pOut + run.target, full_output + run.source, run.length);
+	}
+}
+
+template<class R>
+void FFTProcessor<R>::PushResult(Worker& worker, bool valid, bool last)
+{
+	// Hand the result to the reorder thread, even if it failed, so that it
+	// does not wait for this image forever
+	worker.result.valid = valid;
+	worker.result.last = last;
+	while (!worker.Results.TryPush(worker.result) && !ProcessorStopFlag)
+		Sleep(1);
+}
+
+template<class R>
+bool FFTProcessor<R>::ProcessStagedImage(Worker& worker, FFTStagedImage& staged)
+{
+	// Fourier transform
+	worker.fft_r2c.TransformForward(staged.slot);
+
+	// The staging array can take the next image while we extract
+	worker.FreeSlots.TryPush(staged.slot);
+
+	// Extract and hand over
+	ExtractCoefficients(worker, worker.fft_r2c.GetDataOutPtr(), staged.timestamp, staged.blockId);
+	worker.result.arrival = staged.arrival;
+	PushResult(worker, true, true);
+
 	// Return
 	return true;
 }
 
-DWORD FFTProcessor::ProcessBuffersContinuously()
+template<class R>
+bool FFTProcessor<R>::ProcessStagedBatch(Worker& worker)
 {
-	std::unique_ptr<PvBuffer> upBuffer;
-	DWORD					  resWait;
+	// Fourier transform of all images at once
+	worker.fft_r2c.TransformForwardBatch();
+
+	// Extract and hand over each image, in order
+	size_t batch = worker.fft_r2c.GetBatchSize();
+	for (size_t k = 0; k < batch; k++)
+	{
+		ExtractCoefficients(worker, worker.fft_r2c.GetBatchOutPtr(k), worker.batch_timestamps[k], worker.batch_blockids[k]);
+		worker.result.arrival = worker.batch_arrivals[k];
+		PushResult(worker, true, k == batch - 1);
+	}
+
+	// The batch can take the next images
+	// (only now, since the staging thread also rewrites the timestamps)
+	size_t batch_token = 0;
+	worker.FreeBatch.TryPush(batch_token);
+
+	// Return
+	return true;
+}
+
+template<class R>
+DWORD FFTProcessor<R>::ProcessBuffersContinuously(Worker& worker)
+{
+	FFTStagedImage			  staged;
 	bool					  resProcess;
 
 	// Thread priority
 	//SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_BELOW_NORMAL);
 
-	// Continuous loop for buffer retrieve/create
-	ProcessorStopFlag = false;
+	// Continuous loop for transforms
 	while (!ProcessorStopFlag)
 	{
-		// Retrieve buffer
-		resWait = pSource->WaitImages(1, 1000);
-
-		// Check if retrieve is successful
-		if (resWait == WAIT_OBJECT_0)
+		// Wait for a staged image
+		if (!worker.StagedSlots.TryPop(staged))
 		{
-			if (upBuffer = pSource->GetImage())
-			{
-				// Process buffer
-				resProcess = ProcessBuffer(upBuffer);
-				if (!resProcess)
-					PushError("Process operation failed.");
-			} 
-			else 
-			{
-				// Unexpected error
-				PushError("Wait operation succeeded but the queue pop operation failed.");
-				Sleep(1);
-			}
+			worker.StagedSlots.Wait(1, 1000);
+			continue;
 		}
-		else if (resWait == WAIT_FAILED)
-		{
-			// Wait fail
-			PushError("Queue wait operation failed.");
-			Sleep(1);
-		} 
-		else if (resWait != WAIT_TIMEOUT)
+
+		// Process it
+		if (staged.slot == FFTPROCESSOR_BATCH_SLOT)
+			resProcess = ProcessStagedBatch(worker);
+		else
+			resProcess = ProcessStagedImage(worker, staged);
+		if (!resProcess)
+			PushError("Process operation failed.");
+	}
+
+	// Leave
+	return EXIT_SUCCESS;
+}
+
+template<class R>
+DWORD FFTProcessor<R>::ReorderContinuously()
+{
+	FFTWorkerResult<R>		  result;
+	size_t					  next = 0;
+
+	// Collect the results in the order in which the staging thread handed
+	// out the images
+	while (!ReorderStopFlag)
+	{
+		// Wait for the result of the next worker in turn
+		Worker& worker = *Workers[next];
+		if (!worker.Results.TryPop(result))
 		{
-			// Unexpected error
-			PushError("Unexpected wait error.");
-			Sleep(1);
+			worker.Results.Wait(1, 1000);
+			continue;
 		}
+		if (result.last)
+			next = (next + 1) % Workers.size();
+
+		// Push output to the queue
+		uint64_t arrival = result.arrival;
+		if (result.valid && !queue.TryPush(result.extract))
+			PushError(std::string("ReorderContinuously failed: could not push the transformed data to the output stack."));
+		else if (result.valid)
+			pLatencyFFT->RecordSince(arrival, LatencyNow());
+
+		// What goes back to the worker is what the consumer left in the
+		// queue; if it has no room for the coefficients, take one from the
+		// pool instead, so that the workers do not allocate
+		if (!HasRoom(result.extract, Planar))
+			Pool.TryPop(result.extract);
 	}
 
 	// Leave
 	return EXIT_SUCCESS;
 }
 
-std::unique_ptr<FFTExtract> FFTProcessor::GetImage()
+template<class R>
+bool FFTProcessor<R>::GetImage(Extract& target)
 {
-	return queue.TryPop();
+	return queue.TryPop(target);
 }
 
-size_t FFTProcessor::GetNumberOfAvailableImages()
+template<class R>
+void FFTProcessor<R>::ReleaseImage(Extract& extract)
+{
+	// Extract that the consumer is done with, for the pool
+	// (the consumer gets an empty one back; dropped if the pool is full)
+	if (HasRoom(extract, Planar))
+		Pool.TryPush(extract);
+}
+
+template<class R>
+bool FFTProcessor<R>::HasRoom(const Extract& extract, bool planar)
+{
+	// Whether filling the extract in that layout would not allocate
+	if (planar)
+		return extract.real.capacity() >= indices.size() && extract.imag.capacity() >= indices.size();
+	else
+		return extract.coefficients.capacity() >= indices.size();
+}
+
+template<class R>
+size_t FFTProcessor<R>::GetNumberOfAvailableImages()
 {
 	return queue.GetCount();
 }
 
-size_t FFTProcessor::GetNumberOfErrors()
+template<class R>
+size_t FFTProcessor<R>::GetNumberOfErrors()
 {
 	return Errors.GetCount();
 }
 
-DWORD FFTProcessor::WaitImages(size_t n, DWORD timeoutMilliseconds)
+template<class R>
+DWORD FFTProcessor<R>::WaitImages(size_t n, DWORD timeoutMilliseconds)
 {
 	return queue.Wait(n, timeoutMilliseconds);
 }
 
 
-void FFTProcessor::PushError(std::string str)
+template<class R>
+void FFTProcessor<R>::PushError(std::string str)
 {
-	return Errors.TryPush(std::unique_ptr<std::string>(new std::string(str)));
+	// Called from the staging, worker and reorder threads
+	std::lock_guard<std::mutex> lock(ErrorsMutex);
+	Errors.TryPush(str);
 }
 
-std::unique_ptr<std::string> FFTProcessor::GetError()
+template<class R>
+std::unique_ptr<std::string> FFTProcessor<R>::GetError()
 {
-	return Errors.TryPop();
+	std::unique_ptr<std::string> err(new std::string());
+	if (!Errors.TryPop(*err))
+		err.reset();
+	return err;
 }
 
-std::string FFTProcessor::GetQueuedError()
+template<class R>
+std::string FFTProcessor<R>::GetQueuedError()
 {
-	std::unique_ptr<std::string> err;
-	Errors.TryPop(err);
-	if (err)
+	std::string err;
+	if (Errors.TryPop(err))
 	{
-		return std::string(*err.get());
+		return err;
 	}
 	else
 	{
@@ -251,12 +818,112 @@ std::string FFTProcessor::GetQueuedError()
 
 }
 
-bool FFTProcessor::FlushImages()
+template<class R>
+FFTW_Engine FFTProcessor<R>::GetEngine()
+{
+	// All workers use the same engine
+	if (Workers.empty())
+		return FFTW_ENGINE_FULL;
+	return Workers[0]->fft_r2c.GetEngine();
+}
+
+template<class R>
+bool FFTProcessor<R>::IsPlanned()
+{
+	// All workers share the same plans
+	if (Workers.empty())
+		return false;
+	return Workers[0]->fft_r2c.IsPlanned();
+}
+
+template<class R>
+size_t FFTProcessor<R>::GetNumberOfWorkers()
+{
+	return Workers.size();
+}
+
+template<class R>
+size_t FFTProcessor<R>::GetBatchSize()
+{
+	// All workers use the same batch size (0 = no batches)
+	if (Workers.empty())
+		return 0;
+	return Workers[0]->fft_r2c.GetBatchSize();
+}
+
+template<class R>
+size_t FFTProcessor<R>::GetNumberOfCoefficients()
+{
+	return indices.size();
+}
+
+template<class R>
+bool FFTProcessor<R>::SetCorrection(const vector<float>& dark, const vector<float>& gain)
+{
+	// No correction
+	if (dark.empty() && gain.empty())
+	{
+		std::atomic_store(&correction, shared_ptr<FFTCorrection>());
+		return true;
+	}
+
+	// Check sizes (one value per pixel)
+	if (Workers.empty())
+	{
+		PushError(std::string("SetCorrection failed: the processor is not initialized."));
+		return false;
+	}
+	size_t numel = Workers[0]->fft_r2c.GetSizeIn();
+	if ((!dark.empty() && dark.size() != numel) || (!gain.empty() && gain.size() != numel))
+	{
+		PushError(std::string("SetCorrection failed: the dark frame and gain must have one value per pixel."));
+		return false;
+	}
+
+	// A missing part does nothing
+	shared_ptr<FFTCorrection> pCorrection(new FFTCorrection());
+	pCorrection->dark = dark.empty() ? vector<float>(numel, 0.0f) : dark;
+	pCorrection->gain = gain.empty() ? vector<float>(numel, 1.0f) : gain;
+
+	// The staging thread picks it up with the next image
+	std::atomic_store(&correction, pCorrection);
+	return true;
+}
+
+template<class R>
+void FFTProcessor<R>::SetPlanar(bool planar)
+{
+	// The workers pick it up with the next image; images already in the
+	// queue keep their layout
+	Planar = planar;
+}
+
+template<class R>
+bool FFTProcessor<R>::GetPlanar()
+{
+	return Planar;
+}
+
+template<class R>
+bool FFTProcessor<R>::FlushImages()
 {
 	// Clear queue
-	queue.Clear();
+	// (the extracts go to the pool)
+	Extract extract;
+	while (queue.TryPop(extract))
+		ReleaseImage(extract);
 
 	// Return success
 	return true;
 
-}
\ No newline at end of file
+}
+
+template<class R>
+LatencyProbes& FFTProcessor<R>::GetLatency()
+{
+	return Latency;
+}
+
+// Both precisions
+template class FFTProcessor<float>;
+template class FFTProcessor<double>;
@@ -1,7 +1,13 @@
 ////////////////////////////////////////////////////////////////////////////////
 // Filename: fftprocessor.h
 // The FFTProcessor class takes live Fourier transforms of images in an input
-// queue.
+// queue. A staging thread converts each image into one of the FFTW input
+// arrays of a worker and hands the camera buffer back right away. Several
+// workers, each with its own FFTW plan and buffers, transform images side by
+// side, and a reorder thread puts their results back in the order of arrival.
+// When a burst of images is waiting, a worker takes several at once and
+// transforms them with a single batched plan. The processor works in float
+// or double precision, as FFTProcessor<float> or FFTProcessor<double>.
 //   - Damien Loterie (04/2015)
 ////////////////////////////////////////////////////////////////////////////////
 #ifndef _FFTPROCESSOR_H_
@@ -12,53 +18,181 @@
 //////////////
 #include <windows.h>
 #include <string>
-#include <PvBuffer.h>
+#include <mutex>
 #include "spsc_queue.h"
 #include "iimagequeue.h"
+#include "imagebroadcast.h"
+#include "latencyhistogram.h"
 #include "fftw_wrapper_r2c.h"
 using namespace std;
 
+///////////////////////
+// INSTRUCTION SETS  //
+///////////////////////
+#if defined(_M_X64) || defined(__SSE2__) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+	#define FFTPROCESSOR_BUILD_SSE2
+	#include <emmintrin.h>
+#endif
+
+/////////////
+// GLOBALS //
+/////////////
+#define FFTPROCESSOR_QUEUE_SIZE        4096			// Extracts waiting for the consumer (and frames, when subscribed)
+#define FFTPROCESSOR_ERROR_QUEUE_SIZE  1024
+#define FFTPROCESSOR_ENGINE            FFTW_ENGINE_AUTO
+#define FFTPROCESSOR_RESULT_QUEUE_SIZE 16
+#define FFTPROCESSOR_BATCH_SIZE        4
+#define FFTPROCESSOR_BATCH_SLOT        ((size_t)-1)
+#define FFTPROCESSOR_POOL_SIZE         256
+
 ////////////////////////////////////////////////////////////////////////////////
 // Class name: FFTProcessor
 ////////////////////////////////////////////////////////////////////////////////
+// The coefficients are either interleaved, as FFTW writes them, or planar:
+// all real parts, then all imaginary parts, as MATLAB stores complex arrays
+template<class R>
 struct FFTExtract
 {
-	vector<Complex>     coefficients;
+	FFTExtract() : planar(false), timestamp(0), blockId(0) {}
+
+	vector<complex<R>>  coefficients;		// Interleaved
+	vector<R>			real;				// Planar
+	vector<R>			imag;
+	bool				planar;
+	uint64_t			timestamp;
+	uint64_t			blockId;
+};
+
+// Coefficients [target, target+length) of the extract are the output
+// coefficients [source, source+length), conjugated or not
+struct FFTExtractRun
+{
+	size_t				source;
+	size_t				target;
+	size_t				length;
+};
+
+struct FFTCorrection
+{
+	vector<float>		dark;
+	vector<float>		gain;
+};
+
+struct FFTStagedImage
+{
+	size_t				slot;			// Staging array, or FFTPROCESSOR_BATCH_SLOT
 	uint64_t			timestamp;
+	uint64_t			blockId;
+	uint64_t			arrival;
 };
 
+template<class R>
+struct FFTWorkerResult
+{
+	FFTExtract<R>		extract;
+	bool				valid;
+	bool				last;			// Last result of what was staged at once
+	uint64_t			arrival;		// Of the image, for the latency
+};
+
+template<class R> class FFTProcessor;
+template<class R>
+struct FFTWorker
+{
+	FFTWorker();
+
+	FFTProcessor<R>				*pProcessor;
+	FFTW_Wrapper_R2C<R>			fft_r2c;
+	SPSC_Ring<size_t>			FreeSlots;
+	SPSC_Ring<FFTStagedImage>	StagedSlots;
+	SPSC_Ring<FFTWorkerResult<R>> Results;
+	FFTWorkerResult<R>			result;
+	HANDLE						Thread;
+
+	SPSC_Ring<size_t>			FreeBatch;
+	vector<uint64_t>			batch_timestamps;
+	vector<uint64_t>			batch_blockids;
+	vector<uint64_t>			batch_arrivals;
+};
+
+template<class R>
 class FFTProcessor
 {
 public:
+	typedef complex<R>			Complex;
+	typedef FFTExtract<R>		Extract;
+	typedef FFTWorker<R>		Worker;
+
 	FFTProcessor();
 	~FFTProcessor();
 
-	bool	Initialize(IImageQueue*, size_t, size_t, vector<int>);
+	bool	Initialize(IImageQueue*, size_t, size_t, vector<int>, shared_ptr<ImageSubscriber> = nullptr, size_t = 0, size_t = FFTPROCESSOR_BATCH_SIZE);
 	void	Shutdown();
 
+	FFTW_Engine					GetEngine();
+	bool						IsPlanned();
+	bool						SetCorrection(const vector<float>&, const vector<float>&);
+	void						SetPlanar(bool);
+	bool						GetPlanar();
+	size_t						GetNumberOfWorkers();
+	size_t						GetBatchSize();
+	size_t						GetNumberOfCoefficients();
 	bool						FlushImages();
-	unique_ptr<FFTExtract>	    GetImage();
+	bool					    GetImage(Extract&);
+	void						ReleaseImage(Extract&);
 	unique_ptr<string>			GetError();
 	size_t						GetNumberOfAvailableImages();
 	size_t						GetNumberOfWrittenImages();
 	size_t						GetNumberOfErrors();
 	DWORD						WaitImages(size_t, DWORD);
+	LatencyProbes&				GetLatency();
 
 
 private:
 	IImageQueue					*pSource;
-	SPSC_Queue<FFTExtract>		queue;
+	shared_ptr<ImageSubscriber>	Subscription;
+	SPSC_Ring<Extract>			queue;
 
 	vector<int>					indices;
-	FFTW_Wrapper_R2C			fft_r2c;
+	vector<FFTExtractRun>		DirectRuns;
+	vector<FFTExtractRun>		ConjugateRuns;
+	bool						MakeRuns(size_t);
+	bool volatile				Planar = false;
+	bool						HasRoom(const Extract&, bool);
+
+	// Extracts with room for all the coefficients, given back by the
+	// consumer and handed out again by the reorder thread
+	SPSC_Ring<Extract>			Pool;
+	shared_ptr<FFTCorrection>	correction;
+	vector<unique_ptr<Worker>>	Workers;
+
+	HANDLE						StagingThread;
+	bool volatile				StagingStopFlag = false;
+	bool						StageBuffer(ImagePtr&, Worker&, size_t);
+	bool						StageBatch(ImagePtr*, Worker&);
+	DWORD						StageBuffersContinuously();
+	static DWORD WINAPI			StagingStaticStart(LPVOID);
 
-	HANDLE						ProcessorThread;
 	bool volatile				ProcessorStopFlag = false;
-	bool						ProcessBuffer(unique_ptr<PvBuffer>&);
-	DWORD						ProcessBuffersContinuously();
-	static DWORD WINAPI			FFTProcessor::ProcessorStaticStart(LPVOID);
+	bool						ProcessStagedImage(Worker&, FFTStagedImage&);
+	bool						ProcessStagedBatch(Worker&);
+	void						ExtractCoefficients(Worker&, const Complex*, uint64_t, uint64_t);
+	void						PushResult(Worker&, bool, bool);
+	DWORD						ProcessBuffersContinuously(Worker&);
+	static DWORD WINAPI			ProcessorStaticStart(LPVOID);
+
+	HANDLE						ReorderThread;
+	bool volatile				ReorderStopFlag = false;
+	DWORD						ReorderContinuously();
+	static DWORD WINAPI			ReorderStaticStart(LPVOID);
+
+	// Latency since arrival, when popped and once transformed
+	LatencyProbes				Latency;
+	LatencyHistogram*			pLatencyPop;
+	LatencyHistogram*			pLatencyFFT;
 
-	SPSC_Queue<string>			Errors;
+	SPSC_Ring<string>			Errors;
+	std::mutex					ErrorsMutex;
 	void						PushError(string);
 	string						GetQueuedError();
 };
@@ -7,6 +7,32 @@
 %       from the gigesource. If concurrent access to the gigesource does
 %       occur, no synchronisation mechanism exists, and therefore race 
 %       conditions are possible.
+%       To share the gigesource with other consumers (e.g. a diskwriter
+%       and a live preview), pass subscribe=true: the fftprocessor then gets
+%       its own copy of the frame stream, and disk latency no longer sits in
+%       the FFT path. See gigesource.getsubscriberstats for the number of
+%       frames each subscriber dropped.
+%
+%       The transforms are spread over several workers, each with its own
+%       FFTW plan; by default there is one worker per core, minus one.
+%       Pass workers to choose the number. The images always come out in
+%       the order in which they were acquired.
+%       When a burst of at least batch images is waiting (default 4, at
+%       most 64), a worker transforms them all with one batched FFTW plan.
+%       Pass batch=0 to always transform the images one by one.
+%       The transforms are done in double precision, unless precision is
+%       'single'; getdata then returns single complex data, which takes
+%       half the memory bandwidth.
+%       The FFTW plans are cached and shared between the processors (and
+%       workers) of the same size. The wisdom files are in the current
+%       directory, unless fftprocessor.setwisdomdirectory says otherwise.
+%       With fftprocessor.setbackgroundplanning(true), sizes that are not
+%       in the wisdom yet start with a quick estimated plan, and the patient
+%       plan replaces it once a background thread has made it (see
+%       isplanned and fftprocessor.waitplanning). fftw_train_wisdom.exe
+%       makes the wisdom for a list of sizes ahead of time.
+%       A tmaccumulator can take the images instead, and build a
+%       transmission matrix from them while the sequence is measured.
 %       
 %  - Damien Loterie (03/2015)
 
@@ -32,8 +58,23 @@ classdef fftprocessor < hgsetget
     
     methods        
         % Constructor
-        function obj = fftprocessor(width, height, input_obj, indices) 
+        function obj = fftprocessor(width, height, input_obj, indices, subscribe, workers, batch, precision) 
             % Input processing
+            if nargin<5
+               subscribe = false; 
+            end
+            if nargin<6
+               workers = 0; 
+            end
+            if nargin<7
+               batch = 4; 
+            end
+            if nargin<8
+               precision = 'double'; 
+            end
+            if subscribe && ~isa(input_obj,'gigeinput')
+               error('fftprocessor can only subscribe to a gigeinput'); 
+            end
             if isa(input_obj,'gigeinput')
                init_obj = input_obj.source;
             elseif isa(input_obj, 'diskwriter')
@@ -49,14 +90,17 @@ classdef fftprocessor < hgsetget
             obj.Timeout = 10;
             
             % Create class
-            obj.objectHandle = fftprocessor_mex('new');
+            obj.objectHandle = fftprocessor_mex('new', precision);
             
             % Attempt to initialize the acquisition system
             fftprocessor_mex('Initialize', obj.objectHandle, ...
                                          width, ...
                                          height, ...
                                          init_obj,...
-                                         indices);
+                                         indices, ...
+                                         subscribe==true, ...
+                                         double(workers), ...
+                                         double(batch));
         end
         
         % Destructor
@@ -143,11 +187,67 @@ classdef fftprocessor < hgsetget
             end
         end
         
+        % Transform engine: 'full' (2D FFT of the whole image) or 'sparse'
+        % (row FFTs, then only the columns that hold the requested indices),
+        % chosen with a cost model when the processor is created
+        function res = getengine(this)
+           res = fftprocessor_mex('GetEngine', this.objectHandle);
+        end
+        
+        % Number of images per batched transform (0 = no batches, e.g.
+        % with the sparse engine)
+        function res = getbatchsize(this)
+           res = fftprocessor_mex('GetBatchSize', this.objectHandle);
+        end
+        
+        % Whether the final plans are in use, rather than estimates that
+        % are still being planned in the background
+        function res = isplanned(this)
+           res = fftprocessor_mex('IsPlanned', this.objectHandle);
+        end
+        
+        % Dark frame subtraction and gain, applied to every image before the
+        % transform: (image - dark).*gain. Both are single arrays of
+        % width x height; pass [] for either one to leave it out.
+        function setcorrection(this, dark, gain)
+           fftprocessor_mex('SetCorrection', this.objectHandle, single(dark), single(gain));
+        end
+        
+        % Layout in which the workers extract the coefficients: planar
+        % (real parts, then imaginary parts) or interleaved, as FFTW writes
+        % them. Planar images are copied to MATLAB as they are, which is
+        % faster for large filters. Images already waiting keep their layout.
+        function setplanar(this, planar)
+           fftprocessor_mex('SetPlanar', this.objectHandle, planar==true);
+        end
+        
+        function res = getplanar(this)
+           res = fftprocessor_mex('GetPlanar', this.objectHandle);
+        end
+        
         % Get number of errors
         function res = getnumberoferrors(this)
            res = fftprocessor_mex('GetNumberOfErrors', this.objectHandle);
         end
         
+        % Latency of the frames since they arrived on the host, per stage
+        % ('pop', 'fft'): one row per stage, [count mean min p50 p90 p99
+        % p999 max] in nanoseconds, and the names of the stages
+        function [res, stages] = getlatency(this)
+           [res, stages] = fftprocessor_mex('GetLatency', this.objectHandle);
+        end
+        
+        % Reset the latency histograms
+        function resetlatency(this)
+           fftprocessor_mex('ResetLatency', this.objectHandle);
+        end
+        
+        % Write the latency histograms to a CSV file
+        % (stage, lower_ns, upper_ns, count; one row per non-empty bucket)
+        function writelatencycsv(this, path)
+           fftprocessor_mex('WriteLatencyCsv', this.objectHandle, path);
+        end
+        
         % Get list of errors
         function res = geterrors(this)
            res = fftprocessor_mex('GetErrors', this.objectHandle);
@@ -160,4 +260,30 @@ classdef fftprocessor < hgsetget
         end
 		
     end
+    
+    methods (Static)
+        % Directory of the FFTW wisdom files (for all precisions)
+        function setwisdomdirectory(directory)
+           fftprocessor_mex('SetWisdomDirectory', directory);
+        end
+        
+        function res = getwisdomdirectory()
+           res = fftprocessor_mex('GetWisdomDirectory');
+        end
+        
+        % Plan the sizes that are not in the wisdom in the background
+        function setbackgroundplanning(enable)
+           fftprocessor_mex('SetBackgroundPlanning', enable==true);
+        end
+        
+        % Wait for the background plans; false on timeout
+        function res = waitplanning(timeout_seconds)
+           res = fftprocessor_mex('WaitPlanning', 1000*timeout_seconds);
+        end
+        
+        % Forget the cached plans (existing processors keep theirs)
+        function clearplancache()
+           fftprocessor_mex('ClearPlanCache');
+        end
+    end
 end
\ No newline at end of file
@@ -5,39 +5,27 @@
 
 #include "mex.h"
 #include "class_handle.hpp"
+#include "fftw_wrapper_mex.h"
 #include "number_of_cores.cpp"
+#include "pixelconvert.cpp"
+#include "fftw_planner.cpp"
 #include "fftw_wrapper_r2c.cpp"
 #include "fftprocessor.cpp"
+#include "tmaccumulator.cpp"
 #include "gigesource_mex_lib.cpp"
 #include "diskwriter.cpp"
+#include "unbufferedfile.cpp"
+#include "framecodec.cpp"
 #include "gigesource.h"
 
 
 
-void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
-{	
-    // Get the command string
-    char cmd[64];
-	if (nrhs < 1 || mxGetString(prhs[0], cmd, sizeof(cmd)))
-		mexErrMsgTxt("First input should be a command string less than 64 characters long.");
-        
-    // New
-    if (!strcmp("new", cmd)) {
-        // Check parameters
-        if (nlhs != 1)
-            mexErrMsgTxt("New: One output expected.");
-			
-        // Return a handle to a new C++ instance
-        plhs[0] = convertPtr2Mat<FFTProcessor>(new FFTProcessor);
-        return;
-    }
-    
-    // Check there is a second input, which should be the class instance handle
-    if (nrhs < 2)
-		mexErrMsgTxt("Second input should be a class instance handle.");
-    
+// Commands on an instance of either precision
+template<class R>
+void ProcessorCommand(const char* cmd, int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
+{
 	// Get the class instance pointer from the second input
-    FFTProcessor *proc_instance = convertMat2Ptr<FFTProcessor>(prhs[1]);
+    FFTProcessor<R> *proc_instance = convertMat2Ptr<FFTProcessor<R> >(prhs[1]);
 	
     // Delete
     if (!strcmp("delete", cmd)) {
@@ -45,7 +33,7 @@ void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
 		proc_instance->Shutdown();
 	
         // Destroy the C++ object
-        destroyObject<FFTProcessor>(prhs[1]);
+        destroyObject<FFTProcessor<R> >(prhs[1]);
 		
         // Warn if other commands were ignored
         if (nlhs != 0 || nrhs != 2)
@@ -56,16 +44,36 @@ void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
     // Initialize    
     if (!strcmp("Initialize", cmd)) {
         // Check parameters
-        if (nlhs>1 || nrhs != 6)
+        if (nlhs>1 || nrhs < 6 || nrhs > 9)
             mexErrMsgTxt("Initialize: Unexpected arguments.");
+		if (nrhs >= 7 && !mxIsLogicalScalar(prhs[6]))
+			mexErrMsgTxt("Initialize: Unexpected arguments.");
+		if (nrhs >= 8 && (!mxIsNumeric(prhs[7]) || mxGetNumberOfElements(prhs[7]) != 1 || mxGetScalar(prhs[7]) < 0))
+			mexErrMsgTxt("Initialize: Unexpected arguments.");
+		if (nrhs == 9 && (!mxIsNumeric(prhs[8]) || mxGetNumberOfElements(prhs[8]) != 1 || mxGetScalar(prhs[8]) < 0))
+			mexErrMsgTxt("Initialize: Unexpected arguments.");
+		if (nrhs == 9 && mxGetScalar(prhs[8]) > IMAGE_QUEUE_BATCH_SIZE)
+			mexErrMsgTxt("Initialize: the batch size cannot be larger than the burst size of the source.");
 
 		// Inputs
 		size_t width = mxGetScalar(prhs[2]);
 		size_t height = mxGetScalar(prhs[3]);
+		bool   subscribe = (nrhs >= 7) && mxIsLogicalScalarTrue(prhs[6]);
+		size_t workers = (nrhs >= 8) ? (size_t)mxGetScalar(prhs[7]) : 0;
+		size_t batch = (nrhs == 9) ? (size_t)mxGetScalar(prhs[8]) : FFTPROCESSOR_BATCH_SIZE;
 		
 		IImageQueue* source;
+		shared_ptr<ImageSubscriber> subscription;
 		if (mxIsClass(prhs[4], "gigesource")) {
-			source = (IImageQueue*)convertMat2Ptr<GigE_Source>(mxGetProperty(prhs[4],0,"objectHandle"));
+			GigE_Source* gige = convertMat2Ptr<GigE_Source>(mxGetProperty(prhs[4],0,"objectHandle"));
+			if (gige->IsSharedRingEnabled())
+				mexErrMsgTxt("Initialize: The gigesource publishes its frames to a shared ring.");
+			if (subscribe) {
+				subscription = gige->Subscribe(FFTPROCESSOR_QUEUE_SIZE);
+				source = subscription.get();
+			} else {
+				source = (IImageQueue*)gige;
+			}
 		} else if (mxIsClass(prhs[4], "diskwriter")) {
 			source = (IImageQueue*)convertMat2Ptr<DiskWriter>(mxGetProperty(prhs[4],0,"objectHandle"));
 		} else {
@@ -84,14 +92,133 @@ void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
 		}
 
         // Call the initialization routine
-		if (!proc_instance->Initialize(source, width, height, indices))
+		if (!proc_instance->Initialize(source, width, height, indices, subscription, workers, batch))
 			mexErrMsgTxt("Initialize: C++ initialization failure.");
 
 		// Return
         return;
     }
 
+
+	// Get the transform engine
+	if (!strcmp("GetEngine", cmd)) {
+		// Check parameters
+		if (nlhs != 1 || nrhs != 2)
+			mexErrMsgTxt("GetEngine: Unexpected arguments.");
+
+		// Return its name
+		plhs[0] = mxCreateString(proc_instance->GetEngine() == FFTW_ENGINE_SPARSE ? "sparse" : "full");
+		return;
+	}
+
+	// Whether the final plans are in use (rather than background estimates)
+	if (!strcmp("IsPlanned", cmd)) {
+		// Check parameters
+		if (nlhs != 1 || nrhs != 2)
+			mexErrMsgTxt("IsPlanned: Unexpected arguments.");
+
+		// Return it
+		plhs[0] = mxCreateLogicalScalar(proc_instance->IsPlanned());
+		return;
+	}
+
+	// Get the number of images per batched transform
+	if (!strcmp("GetBatchSize", cmd)) {
+		// Check parameters
+		if (nlhs != 1 || nrhs != 2)
+			mexErrMsgTxt("GetBatchSize: Unexpected arguments.");
+
+		// Return it
+		plhs[0] = mxCreateDoubleScalar((double)proc_instance->GetBatchSize());
+		return;
+	}
+
+	// Set the dark frame and gain
+	if (!strcmp("SetCorrection", cmd)) {
+		// Check parameters
+		if (nlhs != 0 || nrhs != 4)
+			mexErrMsgTxt("SetCorrection: Unexpected arguments.");
+		if ((!mxIsEmpty(prhs[2]) && !mxIsSingle(prhs[2])) || (!mxIsEmpty(prhs[3]) && !mxIsSingle(prhs[3])))
+			mexErrMsgTxt("SetCorrection: the dark frame and gain must be of type 'single'.");
+
+		// Inputs (empty means no dark frame or unit gain)
+		vector<float> dark;
+		vector<float> gain;
+		if (!mxIsEmpty(prhs[2]))
+			dark.assign((float*)mxGetData(prhs[2]), (float*)mxGetData(prhs[2]) + mxGetNumberOfElements(prhs[2]));
+		if (!mxIsEmpty(prhs[3]))
+			gain.assign((float*)mxGetData(prhs[3]), (float*)mxGetData(prhs[3]) + mxGetNumberOfElements(prhs[3]));
+
+		// Set
+		if (!proc_instance->SetCorrection(dark, gain))
+			mexErrMsgTxt("SetCorrection: the dark frame and gain must have one value per pixel.");
+
+		// Return
+		return;
+	}
 	
+	// Transmission matrix built from the images of this processor
+	if (!strcmp("NewTM", cmd)) {
+		// Check parameters
+		char basis_name[16];
+		if (nlhs != 1 || nrhs != 5 || !mxIsDouble(prhs[2]) || mxGetNumberOfElements(prhs[3]) != 1 || mxGetString(prhs[4], basis_name, sizeof(basis_name)))
+			mexErrMsgTxt("NewTM: Unexpected arguments.");
+
+		// Basis
+		TMBasis basis;
+		if (!strcmp("unit", basis_name))
+			basis = TM_BASIS_UNIT;
+		else if (!strcmp("hadamard", basis_name))
+			basis = TM_BASIS_HADAMARD;
+		else if (!strcmp("fourier", basis_name))
+			basis = TM_BASIS_FOURIER;
+		else
+			mexErrMsgTxt("NewTM: The basis should be 'unit', 'hadamard' or 'fourier'.");
+
+		// Column of each frame (from 1 in MATLAB, 0 for calibration frames)
+		double* pColumns = mxGetPr(prhs[2]);
+		size_t  NumberOfFrames = mxGetNumberOfElements(prhs[2]);
+		vector<int64_t> columns(NumberOfFrames);
+		for (size_t i = 0; i < NumberOfFrames; i++)
+			columns[i] = (pColumns[i] == 0) ? TMACC_CALIBRATION : (int64_t)pColumns[i] - 1;
+
+		// Create and start
+		TMAccumulator<R>* tm_instance = new TMAccumulator<R>();
+		if (!tm_instance->Initialize(proc_instance, columns, (size_t)mxGetScalar(prhs[3]), basis))
+		{
+			std::unique_ptr<std::string> pErr = tm_instance->GetError();
+			std::string msg = std::string("NewTM: ") + (pErr ? *pErr : std::string("C++ initialization failure."));
+			delete tm_instance;
+			mexErrMsgTxt(msg.c_str());
+		}
+
+		// Return a handle to it
+		plhs[0] = convertPtr2Mat<TMAccumulator<R> >(tm_instance);
+		return;
+	}
+
+	// Layout of the coefficients: planar (real and imaginary parts apart)
+	// or interleaved
+	if (!strcmp("SetPlanar", cmd)) {
+		// Check parameters
+		if (nlhs != 0 || nrhs != 3 || !mxIsLogicalScalar(prhs[2]))
+			mexErrMsgTxt("SetPlanar: Unexpected arguments.");
+
+		// Set
+		proc_instance->SetPlanar(mxIsLogicalScalarTrue(prhs[2]));
+		return;
+	}
+
+	if (!strcmp("GetPlanar", cmd)) {
+		// Check parameters
+		if (nlhs != 1 || nrhs != 2)
+			mexErrMsgTxt("GetPlanar: Unexpected arguments.");
+
+		// Return it
+		plhs[0] = mxCreateLogicalScalar(proc_instance->GetPlanar());
+		return;
+	}
+
 	// Get number of available images 
 	if (!strcmp("GetNumberOfImages", cmd)) {
 		// Check parameters
@@ -119,59 +246,54 @@ void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
 			mexErrMsgTxt("GetImages: The number of images requested exceeds the number of available images.");
 
 		// Pop the first image
-		unique_ptr<FFTExtract> vec = proc_instance->GetImage();
-
-		// Check if pop was successful
-		if (!vec)
+		FFTExtract<R> vec;
+		if (!proc_instance->GetImage(vec))
 			mexErrMsgTxt("GetImages: The first image could not be retrieved.");
 
 		// Create MATLAB data array
-		mwSize NumberOfElements = vec->coefficients.size();
-		#ifdef FFTW_PRECISION_FLOAT
-			plhs[0] = mxCreateNumericMatrix(NumberOfElements, NumberOfFrames, mxSINGLE_CLASS, mxCOMPLEX);
-		#else
-			plhs[0] = mxCreateNumericMatrix(NumberOfElements, NumberOfFrames, mxDOUBLE_CLASS, mxCOMPLEX);
-		#endif
-		Real* data_real = (Real*)mxGetData(plhs[0]);
-		Real* data_imag = (Real*)mxGetImagData(plhs[0]);
+		mwSize NumberOfElements = vec.planar ? vec.real.size() : vec.coefficients.size();
+		plhs[0] = mxCreateNumericMatrix(NumberOfElements, NumberOfFrames, FFTW_MatlabClass<R>(), mxCOMPLEX);
+		R* data_real = (R*)mxGetData(plhs[0]);
+		R* data_imag = (R*)mxGetImagData(plhs[0]);
 
 		// Create MATLAB time array
 		mxArray*  mxTime = mxCreateNumericMatrix((int)NumberOfFrames, 1, mxUINT64_CLASS, mxREAL);
 		uint64_t*  pTime = (uint64_t*)mxGetData(mxTime);
 
-		// Transfer first frame
-		for (size_t i = 0; i < NumberOfElements; i++)
-		{
-			data_real[i] = vec->coefficients.at(i).real();
-			data_imag[i] = vec->coefficients.at(i).imag();
-		}
-		pTime[0] = vec->timestamp;
-		vec.reset();
-
-		// Transfer the other frames
-		for (size_t n = 1; n < NumberOfFrames; n++)
+		// Transfer the frames
+		for (size_t n = 0; n < NumberOfFrames; n++)
 		{
 			// Pop the next image
-			vec = proc_instance->GetImage();
-
-			// Check if pop was successful
-			if (!vec)
+			// (the previous extract goes back to the processor for reuse)
+			if (n > 0 && !proc_instance->GetImage(vec))
 				mexErrMsgTxt("GetImages: An image could not be retrieved. Some of the data was lost.");
-			if (vec->coefficients.size()!=NumberOfElements)
+			if ((vec.planar ? vec.real.size() : vec.coefficients.size()) != NumberOfElements)
 				mexErrMsgTxt("GetImages: Not all the images have the right size. Some of the data was lost.");
 
 			// Copy to MATLAB
-			for (size_t i = 0; i < NumberOfElements; i++)
+			// (planar extracts are already in the layout of MATLAB)
+			R* pReal = data_real + n*NumberOfElements;
+			R* pImag = data_imag + n*NumberOfElements;
+			if (vec.planar)
 			{
-				data_real[n*NumberOfElements + i] = vec->coefficients.at(i).real();
-				data_imag[n*NumberOfElements + i] = vec->coefficients.at(i).imag();
+				memcpy(pReal, vec.real.data(), NumberOfElements*sizeof(R));
+				memcpy(pImag, vec.imag.data(), NumberOfElements*sizeof(R));
 			}
-			pTime[n] = vec->timestamp;
-
-			// Clear
-			vec.reset();
+			else
+			{
+				const complex<R>* pCoefficients = vec.coefficients.data();
+				for (size_t i = 0; i < NumberOfElements; i++)
+				{
+					pReal[i] = pCoefficients[i].real();
+					pImag[i] = pCoefficients[i].imag();
+				}
+			}
+			pTime[n] = vec.timestamp;
 		}
 
+		// The last extract goes back to the processor's pool
+		proc_instance->ReleaseImage(vec);
+
 		// Return timestamps if needed
 		if (nlhs >= 2)
 		{
@@ -240,6 +362,11 @@ void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
 	}
 
 
+	// Latency histograms
+	if (LatencyCommand(cmd, proc_instance->GetLatency(), nlhs, plhs, nrhs, prhs))
+		return;
+
+
 	// Get image data  
 	if (!strcmp("GetErrors", cmd)) {
 		// Check parameters
@@ -280,3 +407,157 @@ void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
     // Got here, so command not recognized
     mexErrMsgTxt("Command not recognized.");
 }
+
+
+// Commands on a transmission matrix accumulator
+template<class R>
+void AccumulatorCommand(const char* cmd, int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
+{
+	// Get the class instance pointer from the second input
+	TMAccumulator<R> *tm_instance = convertMat2Ptr<TMAccumulator<R> >(prhs[1]);
+
+	// Delete
+	if (!strcmp("delete", cmd)) {
+		// Call the shutdown method
+		tm_instance->Shutdown();
+
+		// Destroy the C++ object
+		destroyObject<TMAccumulator<R> >(prhs[1]);
+
+		// Warn if other commands were ignored
+		if (nlhs != 0 || nrhs != 2)
+			mexWarnMsgTxt("Delete: Unexpected arguments ignored.");
+		return;
+	}
+
+	// Wait for the end of the sequence
+	if (!strcmp("WaitTM", cmd)) {
+		// Check parameters
+		if (nlhs > 1 || nrhs != 3 || mxGetNumberOfElements(prhs[2]) != 1)
+			mexErrMsgTxt("WaitTM: Unexpected arguments.");
+
+		// Wait
+		bool done = tm_instance->WaitDone((DWORD)(1000 * mxGetScalar(prhs[2])));
+		plhs[0] = mxCreateLogicalScalar(done);
+		return;
+	}
+
+	// Progress: [received frames, frames in the sequence]
+	if (!strcmp("GetTMProgress", cmd)) {
+		// Check parameters
+		if (nlhs > 1 || nrhs != 2)
+			mexErrMsgTxt("GetTMProgress: Unexpected arguments.");
+
+		// Return them
+		plhs[0] = mxCreateDoubleMatrix(1, 2, mxREAL);
+		double* pProgress = mxGetPr(plhs[0]);
+		pProgress[0] = (double)tm_instance->GetNumberOfReceivedFrames();
+		pProgress[1] = (double)tm_instance->GetNumberOfFrames();
+		return;
+	}
+
+	// Get the matrix, the calibration frames and the timestamps
+	// (stops the accumulation if the sequence is not complete)
+	if (!strcmp("GetTM", cmd)) {
+		// Check parameters
+		if (nlhs > 3 || nrhs != 2)
+			mexErrMsgTxt("GetTM: Unexpected arguments.");
+
+		// Finish
+		tm_instance->Shutdown();
+
+		// Copy the complex matrices to MATLAB
+		const vector<complex<R>>* sources[2] = { &tm_instance->GetMatrix(), &tm_instance->GetCalibration() };
+		size_t columns[2] = { tm_instance->GetNumberOfColumns(), tm_instance->GetNumberOfCalibrationFrames() };
+		size_t rows = tm_instance->GetNumberOfRows();
+		for (int m = 0; m < 2 && m < max(nlhs, 1); m++)
+		{
+			plhs[m] = mxCreateNumericMatrix(rows, columns[m], FFTW_MatlabClass<R>(), mxCOMPLEX);
+			R* data_real = (R*)mxGetData(plhs[m]);
+			R* data_imag = (R*)mxGetImagData(plhs[m]);
+			const complex<R>* pSource = sources[m]->data();
+			for (size_t i = 0; i < rows*columns[m]; i++)
+			{
+				data_real[i] = pSource[i].real();
+				data_imag[i] = pSource[i].imag();
+			}
+		}
+
+		// Timestamps of all the frames (0 when missing)
+		if (nlhs >= 3)
+		{
+			const vector<uint64_t>& timestamps = tm_instance->GetTimestamps();
+			plhs[2] = mxCreateNumericMatrix(timestamps.size(), 1, mxUINT64_CLASS, mxREAL);
+			if (!timestamps.empty())
+				memcpy(mxGetData(plhs[2]), timestamps.data(), timestamps.size()*sizeof(uint64_t));
+		}
+		return;
+	}
+
+	// Get errors
+	if (!strcmp("GetErrors", cmd)) {
+		// Check parameters
+		if (nlhs > 1 || nrhs != 2)
+			mexErrMsgTxt("GetErrors: Unexpected arguments.");
+
+		// Gather all the errors
+		size_t NumberOfErrors = tm_instance->GetNumberOfErrors();
+		mxArray *mxStrArr = mxCreateCellMatrix((mwSize)NumberOfErrors, 1);
+		for (size_t i = 0; i < NumberOfErrors; i++)
+		{
+			std::unique_ptr<std::string> pRes = tm_instance->GetError();
+			if (!pRes)
+				mexErrMsgTxt("GetErrors: One of the errors could not be retrieved. Due to this problem, some of the errors were lost.");
+			mxSetCell(mxStrArr, (mwIndex)i, mxCreateString(pRes->c_str()));
+		}
+
+		// Return
+		plhs[0] = mxStrArr;
+		return;
+	}
+
+	// Got here, so command not recognized
+	mexErrMsgTxt("Command not recognized.");
+}
+
+void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
+{	
+	// Keep the MEX file loaded while plans are made in the background
+	FFTW_PlannerScope planner_scope;
+
+    // Get the command string
+    char cmd[64];
+	if (nrhs < 1 || mxGetString(prhs[0], cmd, sizeof(cmd)))
+		mexErrMsgTxt("First input should be a command string less than 64 characters long.");
+        
+    // New
+    if (!strcmp("new", cmd)) {
+        // Check parameters
+        if (nlhs != 1)
+            mexErrMsgTxt("New: One output expected.");
+			
+        // Return a handle to a new C++ instance
+        plhs[0] = FFTW_NewInstance<FFTProcessor>(nrhs, prhs, 1);
+        return;
+    }
+    
+    // Planner
+    if (FFTW_PlannerCommand(cmd, nlhs, plhs, nrhs, prhs))
+        return;
+
+    // Check there is a second input, which should be the class instance handle
+    if (nrhs < 2)
+		mexErrMsgTxt("Second input should be a class instance handle.");
+
+	// Transmission matrix accumulators
+	if (isHandleOf<TMAccumulator<float> >(prhs[1]))
+		return AccumulatorCommand<float>(cmd, nlhs, plhs, nrhs, prhs);
+	if (isHandleOf<TMAccumulator<double> >(prhs[1]))
+		return AccumulatorCommand<double>(cmd, nlhs, plhs, nrhs, prhs);
+
+	// Commands for the precision of this instance
+	if (isHandleOf<FFTProcessor<float> >(prhs[1]))
+		ProcessorCommand<float>(cmd, nlhs, plhs, nrhs, prhs);
+	else
+		ProcessorCommand<double>(cmd, nlhs, plhs, nrhs, prhs);
+}
@@ -0,0 +1,443 @@
+// Plans, plan cache and wisdom of the FFTW wrappers.
+//   - Damien Loterie (04/2015)
+
+#include "fftw_planner.h"
+
+template<class R>
+FFTW_Planner<R> FFTW_Planner<R>::instance;
+
+template<class R>
+bool volatile FFTW_Planner<R>::alive = false;
+
+////////////////////////////////////////////////////////////////////////////////
+// Entries
+////////////////////////////////////////////////////////////////////////////////
+template<class R>
+FFTW_PlanEntry<R>::FFTW_PlanEntry(Plan plan, bool is_final)
+	: current(plan), final(is_final), retired(NULL)
+{
+}
+
+template<class R>
+FFTW_PlanEntry<R>::~FFTW_PlanEntry()
+{
+	FFTW_Planner<R>::Instance().DestroyPlan(current.load());
+	FFTW_Planner<R>::Instance().DestroyPlan(retired);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Planner
+////////////////////////////////////////////////////////////////////////////////
+template<class R>
+FFTW_Planner<R>::FFTW_Planner()
+{
+	directory = FFTW_WISDOM_DIRECTORY;
+	wisdom_loaded = false;
+	threads_initialized = false;
+	background = false;
+	background_running = false;
+	background_pending = 0;
+	background_holds = 0;
+	alive = true;
+}
+
+template<class R>
+FFTW_Planner<R>::~FFTW_Planner()
+{
+	// The background thread is not joined here: in a DLL this runs under the
+	// loader lock, where waiting for a thread deadlocks. It should have been
+	// stopped already (see StopBackgroundPlanning).
+	{
+		std::unique_lock<std::mutex> lock(JobsMutex);
+		background_pending -= jobs.size();
+		jobs.clear();
+		JobsDone.notify_all();
+	}
+	if (BackgroundThread.joinable())
+		BackgroundThread.detach();
+
+	// Destroy the plans nobody uses
+	// (plans still held by wrappers are destroyed with them)
+	std::lock_guard<std::recursive_mutex> lock(PlannerMutex);
+	{
+		std::lock_guard<std::mutex> cache_lock(CacheMutex);
+		cache.clear();
+	}
+	FlushGraveyard();
+	alive = false;
+}
+
+template<class R>
+void FFTW_Planner<R>::DestroyPlan(Plan plan)
+{
+	if (plan == NULL)
+		return;
+
+	// At exit
+	if (!alive)
+	{
+		FFTW<R>::destroy_plan(plan);
+		return;
+	}
+
+	// FFTW may be in the middle of making a plan, which can take minutes, so
+	// the plan is left for whoever plans next rather than waited for
+	if (PlannerMutex.try_lock())
+	{
+		FFTW<R>::destroy_plan(plan);
+		FlushGraveyard();
+		PlannerMutex.unlock();
+	}
+	else
+	{
+		std::lock_guard<std::mutex> lock(GraveyardMutex);
+		graveyard.push_back(plan);
+	}
+}
+
+template<class R>
+void FFTW_Planner<R>::FlushGraveyard()
+{
+	// Called with the planner lock
+	std::vector<Plan> plans;
+	{
+		std::lock_guard<std::mutex> lock(GraveyardMutex);
+		plans.swap(graveyard);
+	}
+	for (size_t i = 0; i < plans.size(); i++)
+		FFTW<R>::destroy_plan(plans[i]);
+}
+
+template<class R>
+void FFTW_Planner<R>::LoadWisdom()
+{
+	// Called with the planner lock
+	if (!threads_initialized)
+	{
+		#ifdef FFTW_MULTITHREAD
+			threads_initialized = (FFTW<R>::init_threads() != 0);
+		#else
+			threads_initialized = true;
+		#endif
+	}
+
+	if (!wisdom_loaded)
+	{
+		FFTW<R>::import_wisdom_from_filename(GetWisdomFile().c_str());
+		wisdom_loaded = true;
+	}
+}
+
+template<class R>
+typename FFTW_Planner<R>::Plan FFTW_Planner<R>::MakePlan(const FFTW_PlanKey& key)
+{
+	// Called with the planner lock
+	#ifdef FFTW_MULTITHREAD
+		if (!threads_initialized)
+			return NULL;
+		FFTW<R>::plan_with_nthreads(key.threads);
+	#endif
+
+	// Scratch arrays of the right size, since planning overwrites its arrays
+	// (the wrappers only execute plans on their own arrays)
+	size_t frames = (key.howmany > 0) ? (size_t)key.howmany : 1;
+	size_t numel_real = frames * (size_t)key.height * (size_t)key.width;
+	size_t numel_complex = frames * (size_t)key.height * (size_t)(key.width / 2 + 1);
+	if (key.kind == FFTW_PLAN_C2C_2D || key.kind == FFTW_PLAN_C2C_1D)
+		numel_complex = numel_real;
+
+	Real*    in  = NULL;
+	Complex* out = (Complex*)FFTW<R>::alloc(numel_complex * sizeof(Complex));
+	if (key.kind != FFTW_PLAN_C2C_2D && key.kind != FFTW_PLAN_C2C_1D)
+		in = (Real*)FFTW<R>::alloc(numel_real * sizeof(Real));
+	Complex* in_complex = NULL;
+	if (key.kind == FFTW_PLAN_C2C_2D)
+		in_complex = (Complex*)FFTW<R>::alloc(numel_complex * sizeof(Complex));
+
+	// Plan
+	Plan plan = NULL;
+	bool allocated = (out != NULL) && (in != NULL || in_complex != NULL || key.kind == FFTW_PLAN_C2C_1D);
+	if (allocated)
+	{
+		int n2[2] = { key.height, key.width };
+		int n1[1] = { key.width };
+		switch (key.kind)
+		{
+		case FFTW_PLAN_R2C_2D:
+			plan = FFTW<R>::plan_dft_r2c_2d(key.height, key.width, in, out, key.flags);
+			break;
+		case FFTW_PLAN_C2R_2D:
+			plan = FFTW<R>::plan_dft_c2r_2d(key.height, key.width, out, in, key.flags);
+			break;
+		case FFTW_PLAN_C2C_2D:
+			plan = FFTW<R>::plan_dft_2d(key.height, key.width, in_complex, out, key.sign, key.flags);
+			break;
+		case FFTW_PLAN_R2C_ROWS:
+			plan = FFTW<R>::plan_many_dft_r2c(1, n1, key.height,
+											  in, NULL, 1, key.width,
+											  out, NULL, 1, key.width / 2 + 1,
+											  key.flags);
+			break;
+		case FFTW_PLAN_C2C_1D:
+			plan = FFTW<R>::plan_dft_1d(key.height, out, out, key.sign, key.flags);
+			break;
+		case FFTW_PLAN_R2C_BATCH:
+			plan = FFTW<R>::plan_many_dft_r2c(2, n2, key.howmany,
+											  in, NULL, 1, key.height*key.width,
+											  out, NULL, 1, key.height*(key.width / 2 + 1),
+											  key.flags);
+			break;
+		}
+	}
+
+	// Release the scratch arrays
+	if (in != NULL)			FFTW<R>::dealloc(in);
+	if (in_complex != NULL)	FFTW<R>::dealloc(in_complex);
+	if (out != NULL)		FFTW<R>::dealloc(out);
+	return plan;
+}
+
+template<class R>
+std::shared_ptr<FFTW_PlanEntry<R> > FFTW_Planner<R>::GetPlan(const FFTW_PlanKey& key)
+{
+	// Cached plan
+	{
+		std::lock_guard<std::mutex> cache_lock(CacheMutex);
+		typename std::map<FFTW_PlanKey, std::shared_ptr<Entry> >::iterator it = cache.find(key);
+		if (it != cache.end())
+			return it->second;
+	}
+
+	// Otherwise, plan it (unless someone else did in the meantime)
+	std::lock_guard<std::recursive_mutex> lock(PlannerMutex);
+	FlushGraveyard();
+	LoadWisdom();
+	{
+		std::lock_guard<std::mutex> cache_lock(CacheMutex);
+		typename std::map<FFTW_PlanKey, std::shared_ptr<Entry> >::iterator it = cache.find(key);
+		if (it != cache.end())
+			return it->second;
+	}
+
+	// New plan
+	std::shared_ptr<Entry> entry;
+	bool estimate = (key.flags & FFTW_ESTIMATE) != 0;
+	if (background && !estimate)
+	{
+		// Take it from the wisdom if it is there...
+		FFTW_PlanKey wise = key;
+		wise.flags |= FFTW_WISDOM_ONLY;
+		Plan plan = MakePlan(wise);
+		if (plan != NULL)
+		{
+			entry = std::make_shared<Entry>(plan, true);
+		}
+		else
+		{
+			// ...otherwise estimate it for now and plan it properly later
+			FFTW_PlanKey quick = key;
+			quick.flags = (key.flags & ~(FFTW_MEASURE | FFTW_PATIENT | FFTW_EXHAUSTIVE)) | FFTW_ESTIMATE;
+			plan = MakePlan(quick);
+			if (plan == NULL)
+				return nullptr;
+			entry = std::make_shared<Entry>(plan, false);
+
+			Job job;
+			job.key = key;
+			job.entry = entry;
+			std::unique_lock<std::mutex> jobs_lock(JobsMutex);
+			jobs.push_back(job);
+			background_pending++;
+			if (!background_running)
+			{
+				if (BackgroundThread.joinable())
+					BackgroundThread.join();
+				background_running = true;
+				BackgroundThread = std::thread(&FFTW_Planner<R>::PlanContinuously, this);
+			}
+		}
+	}
+	else
+	{
+		Plan plan = MakePlan(key);
+		if (plan == NULL)
+			return nullptr;
+		entry = std::make_shared<Entry>(plan, true);
+		if (!estimate)
+			ExportWisdom();
+	}
+
+	std::lock_guard<std::mutex> cache_lock(CacheMutex);
+	cache[key] = entry;
+	return entry;
+}
+
+template<class R>
+void FFTW_Planner<R>::PlanContinuously()
+{
+	while (true)
+	{
+		// Next job, once nobody holds the planner back
+		Job job;
+		{
+			std::unique_lock<std::mutex> lock(JobsMutex);
+			JobsDone.wait(lock, [this]{ return background_holds == 0 || jobs.empty(); });
+			if (jobs.empty())
+			{
+				background_running = false;
+				JobsDone.notify_all();
+				return;
+			}
+			job = jobs.front();
+			jobs.pop_front();
+		}
+
+		// Plan it, unless nobody needs it anymore
+		std::shared_ptr<Entry> entry = job.entry.lock();
+		if (entry)
+		{
+			Plan plan;
+			{
+				std::lock_guard<std::recursive_mutex> lock(PlannerMutex);
+
+				// Put it back if a hold was taken meanwhile
+				{
+					std::unique_lock<std::mutex> jobs_lock(JobsMutex);
+					if (background_holds > 0)
+					{
+						jobs.push_front(job);
+						continue;
+					}
+				}
+
+				plan = MakePlan(job.key);
+				if (plan != NULL)
+					ExportWisdom();
+			}
+
+			// Swap it in (the estimate stays valid for whoever is executing it)
+			if (plan != NULL)
+			{
+				entry->retired = entry->current.exchange(plan);
+				entry->final.store(true, std::memory_order_release);
+			}
+		}
+		entry.reset();
+
+		// Done
+		std::unique_lock<std::mutex> lock(JobsMutex);
+		background_pending--;
+		JobsDone.notify_all();
+	}
+}
+
+template<class R>
+void FFTW_Planner<R>::ClearCache()
+{
+	// Wrappers keep the plans they hold
+	// (the others are destroyed once out of the cache lock, or left for the
+	//  next planner call if a plan is being made)
+	std::map<FFTW_PlanKey, std::shared_ptr<Entry> > old;
+	{
+		std::lock_guard<std::mutex> cache_lock(CacheMutex);
+		old.swap(cache);
+	}
+}
+
+template<class R>
+void FFTW_Planner<R>::SetWisdomDirectory(const std::string& path)
+{
+	// The wisdom there adds to what was already loaded
+	std::lock_guard<std::recursive_mutex> lock(PlannerMutex);
+	directory = path.empty() ? FFTW_WISDOM_DIRECTORY : path;
+	wisdom_loaded = false;
+	LoadWisdom();
+}
+
+template<class R>
+std::string FFTW_Planner<R>::GetWisdomDirectory()
+{
+	std::lock_guard<std::recursive_mutex> lock(PlannerMutex);
+	return directory;
+}
+
+template<class R>
+std::string FFTW_Planner<R>::GetWisdomFile()
+{
+	std::lock_guard<std::recursive_mutex> lock(PlannerMutex);
+	char last = directory[directory.size() - 1];
+	if (last == '/' || last == '\\')
+		return directory + FFTW<R>::wisdom_file();
+	return directory + "/" + FFTW<R>::wisdom_file();
+}
+
+template<class R>
+bool FFTW_Planner<R>::ExportWisdom()
+{
+	std::lock_guard<std::recursive_mutex> lock(PlannerMutex);
+	return FFTW<R>::export_wisdom_to_filename(GetWisdomFile().c_str()) != 0;
+}
+
+template<class R>
+void FFTW_Planner<R>::SetBackgroundPlanning(bool enable)
+{
+	std::lock_guard<std::recursive_mutex> lock(PlannerMutex);
+	background = enable;
+}
+
+template<class R>
+bool FFTW_Planner<R>::GetBackgroundPlanning()
+{
+	std::lock_guard<std::recursive_mutex> lock(PlannerMutex);
+	return background;
+}
+
+template<class R>
+size_t FFTW_Planner<R>::GetNumberOfPendingPlans()
+{
+	std::unique_lock<std::mutex> lock(JobsMutex);
+	return background_pending;
+}
+
+template<class R>
+bool FFTW_Planner<R>::WaitBackgroundPlanning(DWORD timeout)
+{
+	std::unique_lock<std::mutex> lock(JobsMutex);
+	return JobsDone.wait_for(lock, std::chrono::milliseconds(timeout), [this]{ return background_pending == 0; });
+}
+
+template<class R>
+void FFTW_Planner<R>::StopBackgroundPlanning()
+{
+	// Drop the plans that were not made yet, and wait for the one being made
+	// (FFTW cannot interrupt it)
+	{
+		std::unique_lock<std::mutex> lock(JobsMutex);
+		background_pending -= jobs.size();
+		jobs.clear();
+		JobsDone.notify_all();
+	}
+	if (BackgroundThread.joinable())
+		BackgroundThread.join();
+}
+
+template<class R>
+void FFTW_Planner<R>::HoldBackground()
+{
+	std::unique_lock<std::mutex> lock(JobsMutex);
+	background_holds++;
+}
+
+template<class R>
+void FFTW_Planner<R>::ReleaseBackground()
+{
+	std::unique_lock<std::mutex> lock(JobsMutex);
+	background_holds--;
+	JobsDone.notify_all();
+}
+
+// Both precisions
+template class FFTW_PlanEntry<float>;
+template class FFTW_PlanEntry<double>;
+template class FFTW_Planner<float>;
+template class FFTW_Planner<double>;
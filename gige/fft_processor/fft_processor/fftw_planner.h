@@ -0,0 +1,199 @@
+////////////////////////////////////////////////////////////////////////////////
+// Filename: fftw_planner.h
+// All FFTW plans of the wrappers are made here, one precision per planner.
+//   - Plans are cached by kind, size, number of threads and planner flags, so
+//     that wrappers of the same size (e.g. the workers of a processor) share
+//     them. They are always executed with the new-array functions, on the
+//     arrays of each wrapper.
+//   - Wisdom is read from and written to a configurable directory.
+//   - FFTW planning is not thread-safe, so the planner serializes it. The
+//     cache has a lock of its own, so cached plans are found without waiting
+//     for a plan that is being made.
+//   - In background mode, a plan that the wisdom does not cover starts out as
+//     an FFTW_ESTIMATE plan, and the patient plan made by a background thread
+//     takes its place once it is ready. Whoever is about to ask for several
+//     plans (e.g. a wrapper, or a processor for all its workers) holds the
+//     background thread back meanwhile (see FFTW_PlannerHold), so that their
+//     estimates are not stuck behind a patient plan.
+//   - Damien Loterie (04/2015)
+////////////////////////////////////////////////////////////////////////////////
+#ifndef _FFTW_PLANNER_H_
+#define _FFTW_PLANNER_H_
+
+//////////////
+// INCLUDES //
+//////////////
+#include <windows.h>
+#include <complex>
+#include <fftw3.h>
+#include <string>
+#include <vector>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <condition_variable>
+#include <chrono>
+#include "fftw_wrapper_def.h"
+
+/////////////
+// GLOBALS //
+/////////////
+#define FFTW_WISDOM_DIRECTORY "."
+
+enum FFTW_PlanKind
+{
+	FFTW_PLAN_R2C_2D,			// Forward real transform of an image
+	FFTW_PLAN_C2R_2D,			// Backward real transform of an image
+	FFTW_PLAN_C2C_2D,			// Complex transform of an image (sign gives the direction)
+	FFTW_PLAN_R2C_ROWS,			// Forward real transforms of each row of an image
+	FFTW_PLAN_C2C_1D,			// In-place complex transform of a column
+	FFTW_PLAN_R2C_BATCH			// Forward real transforms of several images
+};
+
+struct FFTW_PlanKey
+{
+	FFTW_PlanKind	kind;
+	int				height;
+	int				width;
+	int				howmany;
+	int				sign;
+	int				threads;
+	unsigned		flags;
+
+	bool operator<(const FFTW_PlanKey& other) const
+	{
+		if (kind != other.kind)			return kind < other.kind;
+		if (height != other.height)		return height < other.height;
+		if (width != other.width)		return width < other.width;
+		if (howmany != other.howmany)	return howmany < other.howmany;
+		if (sign != other.sign)			return sign < other.sign;
+		if (threads != other.threads)	return threads < other.threads;
+		return flags < other.flags;
+	}
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// Class name: FFTW_PlanEntry
+// A cached plan. Get() is what the wrappers execute; it changes once when a
+// background plan replaces the estimate, which stays valid until the entry
+// goes away, for the threads that were still using it.
+////////////////////////////////////////////////////////////////////////////////
+template<class R> class FFTW_Planner;
+
+template<class R>
+class FFTW_PlanEntry
+{
+public:
+	typedef typename FFTW<R>::plan	Plan;
+
+	FFTW_PlanEntry(Plan, bool);
+	~FFTW_PlanEntry();
+
+	Plan			Get()		{ return current.load(std::memory_order_acquire); }
+	bool			IsFinal()	{ return final.load(std::memory_order_acquire); }
+
+private:
+	friend class FFTW_Planner<R>;
+
+	std::atomic<Plan>	current;
+	std::atomic<bool>	final;
+	Plan				retired;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// Class name: FFTW_Planner
+////////////////////////////////////////////////////////////////////////////////
+template<class R>
+class FFTW_Planner
+{
+public:
+	typedef R							Real;
+	typedef std::complex<R>				Complex;
+	typedef typename FFTW<R>::plan		Plan;
+	typedef FFTW_PlanEntry<R>			Entry;
+
+	// One planner per precision
+	static FFTW_Planner&	Instance()	{ return instance; }
+
+	std::shared_ptr<Entry>	GetPlan(const FFTW_PlanKey&);
+	void					ClearCache();
+
+	void					SetWisdomDirectory(const std::string&);
+	std::string				GetWisdomDirectory();
+	std::string				GetWisdomFile();
+	bool					ExportWisdom();
+
+	void					SetBackgroundPlanning(bool);
+	bool					GetBackgroundPlanning();
+	size_t					GetNumberOfPendingPlans();
+	bool					WaitBackgroundPlanning(DWORD);
+	void					StopBackgroundPlanning();
+	void					HoldBackground();
+	void					ReleaseBackground();
+
+	// Called by entries that go away (possibly while a plan is being made)
+	void					DestroyPlan(Plan);
+
+private:
+	FFTW_Planner();
+	~FFTW_Planner();
+	static FFTW_Planner		instance;
+	static bool volatile	alive;
+
+	// Planner state (FFTW planning and wisdom)
+	// (recursive, since entries destroyed under it destroy their plans)
+	std::recursive_mutex	PlannerMutex;
+
+	// Cache (only held to look up or insert an entry)
+	std::mutex				CacheMutex;
+	std::map<FFTW_PlanKey, std::shared_ptr<Entry> > cache;
+	std::string				directory;
+	bool					wisdom_loaded;
+	bool					threads_initialized;
+
+	Plan					MakePlan(const FFTW_PlanKey&);
+	void					LoadWisdom();
+	void					FlushGraveyard();
+
+	// Plans to destroy once nobody is planning
+	std::mutex				GraveyardMutex;
+	std::vector<Plan>		graveyard;
+
+	// Background planning
+	struct Job
+	{
+		FFTW_PlanKey		key;
+		std::weak_ptr<Entry> entry;
+	};
+	std::mutex				JobsMutex;
+	std::condition_variable	JobsDone;
+	std::deque<Job>			jobs;
+	std::thread				BackgroundThread;
+	bool					background;
+	bool					background_running;
+	size_t					background_pending;
+	size_t					background_holds;
+
+	void					PlanContinuously();
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// Class name: FFTW_PlannerHold
+// Keeps the background planner from starting a patient plan while it exists.
+////////////////////////////////////////////////////////////////////////////////
+template<class R>
+class FFTW_PlannerHold
+{
+public:
+	FFTW_PlannerHold()	{ FFTW_Planner<R>::Instance().HoldBackground(); }
+	~FFTW_PlannerHold()	{ FFTW_Planner<R>::Instance().ReleaseBackground(); }
+
+private:
+	FFTW_PlannerHold(const FFTW_PlannerHold&);
+	FFTW_PlannerHold& operator=(const FFTW_PlannerHold&);
+};
+
+#endif
@@ -0,0 +1,192 @@
+// Makes the FFTW wisdom for a list of image sizes ahead of time, so that the
+// FFT processors and wrappers find their patient plans in the wisdom files
+// rather than planning them when they start (which can take minutes for large
+// images and many threads). The plans are made through the wrappers, so they
+// are exactly the ones that the processor asks the planner for. Build it from
+// a Visual Studio x64 command prompt with:
+//   cl /O2 /EHsc /Ifftw-3.3.4-dll64 fftw_train_wisdom.cpp fftw_planner.cpp fftw_wrapper_r2c.cpp fftw_wrapper_c2c.cpp pixelconvert.cpp number_of_cores.cpp /link /LIBPATH:fftw-3.3.4-dll64
+//
+// Usage: fftw_train_wisdom [-d directory] [-p single|double|both] [-t threads]...
+//                          [-b batch] [-s] [-c] WIDTHxHEIGHT...
+//   -d  Directory of the wisdom files (default: current directory)
+//   -p  Precision of the plans (default: both)
+//   -t  Threads per plan, may be repeated (default: the processor default with
+//       one worker per core minus one, and all cores)
+//   -b  Frames per batched plan, 0 for none (default: 4, as the processor)
+//   -s  Also the plans of the sparse engine
+//   -c  Also the complex to complex plans of FFTW_Wrapper_C2C
+//   - Damien Loterie (04/2015)
+
+#include <iostream>
+#include <vector>
+#include <string>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <cstdio>
+#include "fftw_planner.h"
+#include "fftw_wrapper_r2c.h"
+#include "fftw_wrapper_c2c.h"
+
+#define TRAIN_BATCH_SIZE 4
+
+struct TrainSize
+{
+	size_t width;
+	size_t height;
+};
+
+struct TrainOptions
+{
+	std::vector<TrainSize>	sizes;
+	std::vector<int>		threads;
+	size_t					batch;
+	bool					sparse;
+	bool					c2c;
+};
+
+typedef std::chrono::steady_clock train_clock;
+
+double Seconds(train_clock::time_point start)
+{
+	return std::chrono::duration<double>(train_clock::now() - start).count();
+}
+
+template<class R>
+int Train(const char* precision, const TrainOptions& options)
+{
+	int errors = 0;
+	for (size_t s = 0; s < options.sizes.size(); s++)
+	{
+		size_t width  = options.sizes[s].width;
+		size_t height = options.sizes[s].height;
+
+		for (size_t t = 0; t < options.threads.size(); t++)
+		{
+			int threads = options.threads[t];
+			std::cout << precision << " " << width << "x" << height << ", " << threads << " thread(s): ";
+			std::cout.flush();
+			train_clock::time_point start = train_clock::now();
+
+			// Forward and backward plans
+			FFTW_Wrapper_R2C<R> fft_r2c;
+			bool res = fft_r2c.Initialize(width, height, threads);
+
+			// Batched plan
+			if (res && options.batch > 1)
+				res &= fft_r2c.SetBatchSize(options.batch);
+
+			// Row and column plans of the sparse engine
+			if (res && options.sparse)
+			{
+				std::vector<size_t> index(1, 0);
+				res &= (fft_r2c.SetOutputIndices(index, FFTW_ENGINE_SPARSE) == FFTW_ENGINE_SPARSE);
+			}
+
+			std::cout << (res ? "done" : "FAILED") << " in " << Seconds(start) << " s" << std::endl;
+			if (!res)
+				errors++;
+		}
+
+		// Complex plans (always on all cores)
+		if (options.c2c)
+		{
+			std::cout << precision << " " << width << "x" << height << ", complex: ";
+			std::cout.flush();
+			train_clock::time_point start = train_clock::now();
+
+			FFTW_Wrapper_C2C<R> fft_c2c;
+			bool res = fft_c2c.Initialize(width, height);
+
+			std::cout << (res ? "done" : "FAILED") << " in " << Seconds(start) << " s" << std::endl;
+			if (!res)
+				errors++;
+		}
+	}
+
+	// The planner writes the wisdom after each plan; once more to be sure
+	if (!FFTW_Planner<R>::Instance().ExportWisdom())
+	{
+		std::cout << "Could not write " << FFTW_Planner<R>::Instance().GetWisdomFile() << std::endl;
+		errors++;
+	}
+	else
+	{
+		std::cout << "Wisdom written to " << FFTW_Planner<R>::Instance().GetWisdomFile() << std::endl;
+	}
+	return errors;
+}
+
+int Usage()
+{
+	std::cout << "Usage: fftw_train_wisdom [-d directory] [-p single|double|both] [-t threads]..." << std::endl;
+	std::cout << "                         [-b batch] [-s] [-c] WIDTHxHEIGHT..." << std::endl;
+	return 2;
+}
+
+int main(int argc, char* argv[])
+{
+	TrainOptions options;
+	options.batch = TRAIN_BATCH_SIZE;
+	options.sparse = false;
+	options.c2c = false;
+	std::string directory = FFTW_WISDOM_DIRECTORY;
+	std::string precision = "both";
+
+	// Arguments
+	for (int i = 1; i < argc; i++)
+	{
+		std::string arg = argv[i];
+		if (arg == "-d" && i + 1 < argc)
+			directory = argv[++i];
+		else if (arg == "-p" && i + 1 < argc)
+			precision = argv[++i];
+		else if (arg == "-t" && i + 1 < argc)
+			options.threads.push_back(atoi(argv[++i]));
+		else if (arg == "-b" && i + 1 < argc)
+			options.batch = (size_t)atoi(argv[++i]);
+		else if (arg == "-s")
+			options.sparse = true;
+		else if (arg == "-c")
+			options.c2c = true;
+		else
+		{
+			TrainSize size;
+			unsigned w = 0, h = 0;
+			if (sscanf(arg.c_str(), "%ux%u", &w, &h) != 2 || w == 0 || h == 0)
+				return Usage();
+			size.width = w;
+			size.height = h;
+			options.sizes.push_back(size);
+		}
+	}
+	if (options.sizes.empty())
+		return Usage();
+	if (precision != "single" && precision != "double" && precision != "both")
+		return Usage();
+
+	// Default threads: as the workers of a processor, and as a single wrapper
+	if (options.threads.empty())
+	{
+		int cores = numberOfCores();
+		int workers = (cores > 1) ? cores - 1 : 1;
+		options.threads.push_back((cores / workers > 1) ? cores / workers : 1);
+		if (cores != options.threads[0])
+			options.threads.push_back(cores);
+	}
+
+	// Patient plans, made right away
+	FFTW_Planner<float>::Instance().SetBackgroundPlanning(false);
+	FFTW_Planner<double>::Instance().SetBackgroundPlanning(false);
+	FFTW_Planner<float>::Instance().SetWisdomDirectory(directory);
+	FFTW_Planner<double>::Instance().SetWisdomDirectory(directory);
+
+	// Train
+	int errors = 0;
+	if (precision != "double")
+		errors += Train<float>("single", options);
+	if (precision != "single")
+		errors += Train<double>("double", options);
+
+	return (errors == 0) ? 0 : 1;
+}
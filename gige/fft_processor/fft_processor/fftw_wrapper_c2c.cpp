@@ -3,140 +3,134 @@
 //   - Damien Loterie (04/2015)
 #include "fftw_wrapper_c2c.h"
 
-FFTW_Wrapper_C2C::FFTW_Wrapper_C2C()
+template<class R>
+FFTW_Wrapper_C2C<R>::FFTW_Wrapper_C2C()
 {
-	plan_forward = NULL;
-	plan_backward = NULL;
 	data_in = NULL;
 	data_out = NULL;
 }
 
 
-FFTW_Wrapper_C2C::~FFTW_Wrapper_C2C()
+template<class R>
+FFTW_Wrapper_C2C<R>::~FFTW_Wrapper_C2C()
 {
 	Shutdown();
 }
 
-void FFTW_Wrapper_C2C::Shutdown()
+template<class R>
+void FFTW_Wrapper_C2C<R>::Shutdown()
 {
-	if (plan_forward != NULL)
-	{
-		FFTW_PREFIX(destroy_plan(plan_forward));
-		plan_forward = NULL;
-	}
-
-	if (plan_backward != NULL)
-	{
-		FFTW_PREFIX(destroy_plan(plan_backward));
-		plan_backward = NULL;
-	}
+	// The planner keeps the plans for the next wrapper of this size
+	plan_forward.reset();
+	plan_backward.reset();
 
 	if (data_in != NULL)
 	{
-		FFTW_PREFIX(free(data_in));
+		FFTW<R>::dealloc(data_in);
 		data_in = NULL;
 	}
 
 	if (data_out != NULL)
 	{
-		FFTW_PREFIX(free(data_out));
+		FFTW<R>::dealloc(data_out);
 		data_out = NULL;
 	}
 
 }
 
-bool FFTW_Wrapper_C2C::Initialize(size_t Width, size_t Height)
+template<class R>
+bool FFTW_Wrapper_C2C<R>::Initialize(size_t Width, size_t Height)
 {
 	// Allocate arrays
 	width     = Width;
 	height    = Height;
 	numel_in  = height * width;
 	numel_out = height * width;
-	data_in   = (Complex*)FFTW_PREFIX(malloc(numel_in  * sizeof(*data_in)));
-	data_out  = (Complex*)FFTW_PREFIX(malloc(numel_out * sizeof(*data_out)));
-
-	// Enable threading
-	#ifdef FFTW_MULTITHREAD
-		int resThread = FFTW_PREFIX(init_threads());
-	#endif
-
-	// Try to import wisdom
-	FFTW_PREFIX(import_wisdom_from_filename(FFTW_WISDOM_FILE));
-
-	// Number of threads
-	#ifdef FFTW_MULTITHREAD
-		FFTW_PREFIX(plan_with_nthreads(numberOfCores()));
-	#endif
-
-	// Create plan
-	plan_forward  = FFTW_PREFIX(plan_dft_2d((int)height,
-											(int)width,
-											data_in,
-											data_out,
-											FFTW_FORWARD,
-											FFTW_PATIENT | FFTW_DESTROY_INPUT));
-
-	plan_backward = FFTW_PREFIX(plan_dft_2d((int)height,
-											(int)width,
-											data_out,
-											data_in,
-											FFTW_BACKWARD,
-											FFTW_PATIENT | FFTW_DESTROY_INPUT));
-
-	// Export wisdom back
-	FFTW_PREFIX(export_wisdom_to_filename(FFTW_WISDOM_FILE));
+	data_in   = (Complex*)FFTW<R>::alloc(numel_in  * sizeof(*data_in));
+	data_out  = (Complex*)FFTW<R>::alloc(numel_out * sizeof(*data_out));
+
+	// Get plans
+	// (the background planner waits until both are there)
+	FFTW_PlannerHold<R> hold;
+	FFTW_PlanKey key;
+	key.kind	= FFTW_PLAN_C2C_2D;
+	key.height	= (int)height;
+	key.width	= (int)width;
+	key.howmany	= 1;
+	key.threads	= numberOfCores();
+	key.flags	= FFTW_PATIENT | FFTW_DESTROY_INPUT;
+
+	key.sign = FFTW_FORWARD;
+	plan_forward  = FFTW_Planner<R>::Instance().GetPlan(key);
+	key.sign = FFTW_BACKWARD;
+	plan_backward = FFTW_Planner<R>::Instance().GetPlan(key);
 
 	// Return
-	bool resFinal = (plan_forward != NULL) && (plan_backward != NULL);
-	#ifdef FFTW_MULTITHREAD
-		resFinal &= (resThread != 0);
-	#endif
+	bool resFinal = (data_in != NULL) && (data_out != NULL);
+	resFinal &= (plan_forward != nullptr) && (plan_backward != nullptr);
 	return resFinal;
 }
 
+template<class R>
+bool FFTW_Wrapper_C2C<R>::IsPlanned()
+{
+	// False while background plans are still being made
+	return (plan_forward != nullptr) && plan_forward->IsFinal()
+		&& (plan_backward != nullptr) && plan_backward->IsFinal();
+}
+
 
-void FFTW_Wrapper_C2C::TransformForward()
+template<class R>
+void FFTW_Wrapper_C2C<R>::TransformForward()
 {
-	FFTW_PREFIX(execute(plan_forward));
+	FFTW<R>::execute_dft(plan_forward->Get(), data_in, data_out);
 }
 
-void FFTW_Wrapper_C2C::TransformBackward()
+template<class R>
+void FFTW_Wrapper_C2C<R>::TransformBackward()
 {
-	FFTW_PREFIX(execute(plan_backward));
+	FFTW<R>::execute_dft(plan_backward->Get(), data_out, data_in);
 }
 
-Complex* FFTW_Wrapper_C2C::GetDataInPtr()
+template<class R>
+std::complex<R>* FFTW_Wrapper_C2C<R>::GetDataInPtr()
 {
 	return data_in;
 }
 
-Complex* FFTW_Wrapper_C2C::GetDataOutPtr()
+template<class R>
+std::complex<R>* FFTW_Wrapper_C2C<R>::GetDataOutPtr()
 {
 	return data_out;
 }
 
-size_t FFTW_Wrapper_C2C::GetWidth()
+template<class R>
+size_t FFTW_Wrapper_C2C<R>::GetWidth()
 {
 	return width;
 }
 
-size_t FFTW_Wrapper_C2C::GetHeight()
+template<class R>
+size_t FFTW_Wrapper_C2C<R>::GetHeight()
 {
 	return height;
 }
 
-size_t FFTW_Wrapper_C2C::GetSizeIn()
+template<class R>
+size_t FFTW_Wrapper_C2C<R>::GetSizeIn()
 {
 	return numel_in;
 }
 
-size_t FFTW_Wrapper_C2C::GetSizeOut()
+template<class R>
+size_t FFTW_Wrapper_C2C<R>::GetSizeOut()
 {
 	return numel_out;
 }
 
 
-bool FFTW_Wrapper_C2C::SetDataIn(const Complex* source, size_t numel)
+template<class R>
+bool FFTW_Wrapper_C2C<R>::SetDataIn(const Complex* source, size_t numel)
 {
 	// Check sizes
 	if (numel != numel_in)
@@ -148,7 +142,8 @@ bool FFTW_Wrapper_C2C::SetDataIn(const Complex* source, size_t numel)
 
 }
 
-bool FFTW_Wrapper_C2C::GetDataIn(Complex* target, size_t numel)
+template<class R>
+bool FFTW_Wrapper_C2C<R>::GetDataIn(Complex* target, size_t numel)
 {
 	// Check sizes
 	if (numel != numel_in)
@@ -159,7 +154,8 @@ bool FFTW_Wrapper_C2C::GetDataIn(Complex* target, size_t numel)
 	return true;
 }
 
-bool FFTW_Wrapper_C2C::SetDataOut(const Complex* source, size_t numel)
+template<class R>
+bool FFTW_Wrapper_C2C<R>::SetDataOut(const Complex* source, size_t numel)
 {
 	// Check sizes
 	if (numel != numel_out)
@@ -171,7 +167,8 @@ bool FFTW_Wrapper_C2C::SetDataOut(const Complex* source, size_t numel)
 
 }
 
-bool FFTW_Wrapper_C2C::GetDataOut(Complex* target, size_t numel)
+template<class R>
+bool FFTW_Wrapper_C2C<R>::GetDataOut(Complex* target, size_t numel)
 {
 	// Check sizes
 	if (numel != numel_out)
@@ -180,4 +177,8 @@ bool FFTW_Wrapper_C2C::GetDataOut(Complex* target, size_t numel)
 	// Copy
 	CopyMemory(target, data_out, numel*sizeof(*target));
 	return true;
-}
\ No newline at end of file
+}
+
+// Both precisions
+template class FFTW_Wrapper_C2C<float>;
+template class FFTW_Wrapper_C2C<double>;
@@ -1,7 +1,7 @@
 ////////////////////////////////////////////////////////////////////////////////
 // Filename: fftw_wrapper_c2c.h
 // Wrapper class which simplifies calls to FFTW for the complex to complex
-// transforms.
+// transforms, in float or double precision.
 //   - Damien Loterie (04/2015)
 ////////////////////////////////////////////////////////////////////////////////
 #ifndef _FFTW_WRAPPER_C2C_H_
@@ -15,14 +15,25 @@
 #include <fftw3.h>
 #include <vector>
 #include "fftw_wrapper_def.h"
+#include "fftw_planner.h"
+#include "pixelconvert.h"
 
+/////////////
+// GLOBALS //
+/////////////
+#define FFTW_CONVERT_BLOCK 1024
 
 ////////////////////////////////////////////////////////////////////////////////
 // Class name: FFTW_Wrapper_C2C
 ////////////////////////////////////////////////////////////////////////////////
+template<class R>
 class FFTW_Wrapper_C2C
 {
 public:
+	typedef R						Real;
+	typedef std::complex<R>			Complex;
+	typedef std::shared_ptr<FFTW_PlanEntry<R> >	Plan;
+
 	FFTW_Wrapper_C2C();
 	~FFTW_Wrapper_C2C();
 
@@ -31,6 +42,7 @@ public:
 
 	void			TransformForward();
 	void			TransformBackward();
+	bool			IsPlanned();
 
 	Complex*		GetDataInPtr();
 	Complex*	    GetDataOutPtr();
@@ -47,8 +59,8 @@ public:
 	bool			GetDataOut(Complex*, size_t);
 
 private:
-	FFTW_PREFIX(plan)	plan_forward;
-	FFTW_PREFIX(plan)	plan_backward;
+	Plan				plan_forward;
+	Plan				plan_backward;
 
 	size_t         width;
 	size_t         height;
@@ -62,17 +74,23 @@ private:
 ////////////////////////////////////////////////////////////////////////////////
 // METHODS
 ////////////////////////////////////////////////////////////////////////////////
+template<class R>
 template<class T>
-bool FFTW_Wrapper_C2C::SetDataIn(const T* source, size_t numel)
+bool FFTW_Wrapper_C2C<R>::SetDataIn(const T* source, size_t numel)
 {
 	// Check sizes
 	if (numel != numel_in)
 		return false;
 
-	// Copy
-	for (size_t i = 0; i < numel; i++)
+	// Convert a block at a time into a buffer that stays in L1, and spread
+	// it over the real parts
+	Real block[FFTW_CONVERT_BLOCK];
+	for (size_t i = 0; i < numel; i += FFTW_CONVERT_BLOCK)
 	{
-		data_in[i] = Complex((Real)source[i], 0);
+		size_t n = std::min<size_t>(FFTW_CONVERT_BLOCK, numel - i);
+		ConvertPixels(&source[i], block, n);
+		for (size_t k = 0; k < n; k++)
+			data_in[i + k] = Complex(block[k], 0);
 	}
 	return true;
 }
@@ -11,9 +11,14 @@ classdef fftw_wrapper_c2c < hgsetget
     
     methods        
         % Constructor
-        function obj = fftw_wrapper_c2c(width, height)             
+        % (precision is 'double', the default, or 'single')
+        function obj = fftw_wrapper_c2c(width, height, precision)             
+            if nargin<3
+               precision = 'double'; 
+            end
+            
             % Create class
-            obj.objectHandle = fftw_wrapper_c2c_mex('new');
+            obj.objectHandle = fftw_wrapper_c2c_mex('new', precision);
             
             % Attempt to initialize the acquisition system
             fftw_wrapper_c2c_mex('Initialize', obj.objectHandle, width, height);
@@ -29,6 +34,11 @@ classdef fftw_wrapper_c2c < hgsetget
            res = fftw_wrapper_c2c_mex('Transform', this.objectHandle, arr);
         end
         
+        % Whether the final plans are in use, rather than background estimates
+        function res = isplanned(this)
+           res = fftw_wrapper_c2c_mex('IsPlanned', this.objectHandle);
+        end
+        
         % Gerchberg-Saxton
         function res = gerchberg_saxton(this, data, ind, iter)
            res = fftw_wrapper_c2c_mex('GerchbergSaxton', this.objectHandle, data, ind, iter);
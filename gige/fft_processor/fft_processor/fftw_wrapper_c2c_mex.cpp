@@ -4,36 +4,21 @@
 
 #include "mex.h"
 #include "class_handle.hpp"
+#include "fftw_wrapper_mex.h"
+#include "pixelconvert.cpp"
+#include "fftw_planner.cpp"
 #include "fftw_wrapper_c2c.cpp"
 #include "number_of_cores.cpp"
 #include <string>
 //#include "gigesource_mex_lib.cpp"
 
 
-void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
+// Commands on an instance of either precision
+template<class R>
+void WrapperCommand(const char* cmd, int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
 {
-	// Get the command string
-	char cmd[64];
-	if (nrhs < 1 || mxGetString(prhs[0], cmd, sizeof(cmd)))
-		mexErrMsgTxt("First input should be a command string less than 64 characters long.");
-
-	// New
-	if (!strcmp("new", cmd)) {
-		// Check parameters
-		if (nlhs != 1)
-			mexErrMsgTxt("New: One output expected.");
-
-		// Return a handle to a new C++ instance
-		plhs[0] = convertPtr2Mat<FFTW_Wrapper_C2C>(new FFTW_Wrapper_C2C);
-		return;
-	}
-
-	// Check there is a second input, which should be the class instance handle
-	if (nrhs < 2)
-		mexErrMsgTxt("Second input should be a class instance handle.");
-
 	// Get the class instance pointer from the second input
-	FFTW_Wrapper_C2C *fftw_instance = convertMat2Ptr<FFTW_Wrapper_C2C>(prhs[1]);
+	FFTW_Wrapper_C2C<R> *fftw_instance = convertMat2Ptr<FFTW_Wrapper_C2C<R> >(prhs[1]);
 
 	// Delete
 	if (!strcmp("delete", cmd)) {
@@ -41,7 +26,7 @@ void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
 		fftw_instance->Shutdown();
 
 		// Destroy the C++ object
-		destroyObject<FFTW_Wrapper_C2C>(prhs[1]);
+		destroyObject<FFTW_Wrapper_C2C<R> >(prhs[1]);
 
 		// Warn if other commands were ignored
 		if (nlhs != 0 || nrhs != 2)
@@ -70,6 +55,17 @@ void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
 		return;
 	}
 
+	// Whether the final plans are in use (rather than background estimates)
+	if (!strcmp("IsPlanned", cmd)) {
+		// Check parameters
+		if (nlhs != 1 || nrhs != 2)
+			mexErrMsgTxt("IsPlanned: Unexpected arguments.");
+
+		// Return it
+		plhs[0] = mxCreateLogicalScalar(fftw_instance->IsPlanned());
+		return;
+	}
+
 
 	// Get image data  
 	if (!strcmp("Transform", cmd)) {
@@ -78,7 +74,7 @@ void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
 			mexErrMsgTxt("Transform: Unexpected arguments.");
 
 		// Check input array
-		if (!mxIsNumeric(prhs[2]) || !mxIsComplex(prhs[2]) || !(mxGetClassID(prhs[2]) == FFTW_MATLAB_CLASS))
+		if (!mxIsNumeric(prhs[2]) || !mxIsComplex(prhs[2]) || !(mxGetClassID(prhs[2]) == FFTW_MatlabClass<R>()))
 			mexErrMsgTxt("Transform: Not a complex numeric array of the right type.");
 		if (mxGetNumberOfDimensions(prhs[2]) != 2)
 			mexErrMsgTxt("Transform: Wrong array number of dimensions.");
@@ -87,12 +83,12 @@ void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
 			mexErrMsgTxt("Transform: Wrong array dimensions.");
 
 		// Transfer frame
-		Complex* data_in = fftw_instance->GetDataInPtr();
-		const Real* pInputR = (const Real*)mxGetData(prhs[2]);
-		const Real* pInputI = (const Real*)mxGetImagData(prhs[2]);
+		std::complex<R>* data_in = fftw_instance->GetDataInPtr();
+		const R* pInputR = (const R*)mxGetData(prhs[2]);
+		const R* pInputI = (const R*)mxGetImagData(prhs[2]);
 		for (size_t i = 0; i < mxGetNumberOfElements(prhs[2]); i++)
 		{
-			data_in[i] = Complex(pInputR[i], pInputI[i]);
+			data_in[i] = std::complex<R>(pInputR[i], pInputI[i]);
 		}
 
 		// Transform
@@ -101,13 +97,13 @@ void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
 		// Create output array
 		plhs[0] = mxCreateNumericMatrix((int)mxGetN(prhs[2]),
 										(int)mxGetM(prhs[2]),
-										FFTW_MATLAB_CLASS,
+										FFTW_MatlabClass<R>(),
 										mxCOMPLEX);
-		Real* pOutputR = (Real*)mxGetData(plhs[0]);
-		Real* pOutputI = (Real*)mxGetImagData(plhs[0]);
+		R* pOutputR = (R*)mxGetData(plhs[0]);
+		R* pOutputI = (R*)mxGetImagData(plhs[0]);
 
 		// Extract data
-		Complex* data_out = fftw_instance->GetDataOutPtr();
+		std::complex<R>* data_out = fftw_instance->GetDataOutPtr();
 		for (size_t i = 0; i < mxGetNumberOfElements(plhs[0]); i++)
 		{
 			pOutputR[i] = data_out[i].real();
@@ -129,7 +125,7 @@ void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
 			mexErrMsgTxt("GerchbergSaxton: Unexpected arguments.");
 
 		// Check input array
-		if (!mxIsNumeric(prhs[2]) || !mxIsComplex(prhs[2]) || !(mxGetClassID(prhs[2]) == FFTW_MATLAB_CLASS))
+		if (!mxIsNumeric(prhs[2]) || !mxIsComplex(prhs[2]) || !(mxGetClassID(prhs[2]) == FFTW_MatlabClass<R>()))
 			mexErrMsgTxt("GerchbergSaxton: Not a complex numeric array of the right type.");
 		if (mxGetNumberOfDimensions(prhs[2]) != 2)
 			mexErrMsgTxt("GerchbergSaxton: Wrong array number of dimensions.");
@@ -139,11 +135,11 @@ void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
 			mexErrMsgTxt("GerchbergSaxton: Index and data array mismatch.");
 
 		// Get pointers
-		Complex* data_out = fftw_instance->GetDataOutPtr();
-		Complex* data_in  = fftw_instance->GetDataInPtr();
+		std::complex<R>* data_out = fftw_instance->GetDataOutPtr();
+		std::complex<R>* data_in  = fftw_instance->GetDataInPtr();
 		const int* pInd = (const int*)mxGetData(prhs[3]);
-		const Real* pInputR = (const Real*)mxGetData(prhs[2]);
-		const Real* pInputI = (const Real*)mxGetImagData(prhs[2]);
+		const R* pInputR = (const R*)mxGetData(prhs[2]);
+		const R* pInputI = (const R*)mxGetImagData(prhs[2]);
 		size_t N_ind  = (size_t)mxGetNumberOfElements(prhs[3]);
 		size_t N_full = fftw_instance->GetSizeIn();
 		size_t N_iter = (size_t)mxGetScalar(prhs[4]);
@@ -157,7 +153,7 @@ void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
 		{
 			if (pInd[i] < N_full)
 			{
-				data_out[pInd[i]] = Complex(pInputR[i], pInputI[i]);
+				data_out[pInd[i]] = std::complex<R>(pInputR[i], pInputI[i]);
 			}
 			else
 			{
@@ -170,21 +166,21 @@ void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
 		fftw_instance->TransformBackward();
 
 		// Get maximum norm
-		Real max_norm = 0;
+		R max_norm = 0;
 		for (size_t i = 0; i < N_full; i++)
 		{
-			Real current_norm = norm(data_in[i]);
+			R current_norm = norm(data_in[i]);
 			if (current_norm > max_norm)
 				max_norm = current_norm;
 		}
 		
 		// Set normalization factor
-		Real norm_factor = max_norm / ((double)N_full);
+		R norm_factor = max_norm / ((double)N_full);
 
 		// Normalize
 		for (size_t i = 0; i < N_full; i++)
 		{
-			Real temp_norm = norm(data_in[i]);
+			R temp_norm = norm(data_in[i]);
 			if (temp_norm != 0)
 			{
 				data_in[i] = data_in[i] * (norm_factor / temp_norm);
@@ -205,7 +201,7 @@ void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
 
 			// Copy FFT data
 			for (size_t i = 0; i < N_ind; i++)
-				data_out[pInd[i]] = Complex(pInputR[i], pInputI[i]);
+				data_out[pInd[i]] = std::complex<R>(pInputR[i], pInputI[i]);
 
 			// Transform
 			fftw_instance->TransformBackward();
@@ -221,10 +217,10 @@ void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
 		// Create output array
 		plhs[0] = mxCreateNumericMatrix((int)fftw_instance->GetHeight(),
 										(int)fftw_instance->GetWidth(),
-										FFTW_MATLAB_CLASS,
+										FFTW_MatlabClass<R>(),
 										mxCOMPLEX);
-		Real* pOutputR = (Real*)mxGetData(plhs[0]);
-		Real* pOutputI = (Real*)mxGetImagData(plhs[0]);
+		R* pOutputR = (R*)mxGetData(plhs[0]);
+		R* pOutputI = (R*)mxGetImagData(plhs[0]);
 
 		// Extract data
 		for (size_t i = 0; i < N_full; i++)
@@ -241,3 +237,40 @@ void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
 	// Got here, so command not recognized
 	mexErrMsgTxt("Command not recognized.");
 }
+
+
+void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
+{
+	// Keep the MEX file loaded while plans are made in the background
+	FFTW_PlannerScope planner_scope;
+
+	// Get the command string
+	char cmd[64];
+	if (nrhs < 1 || mxGetString(prhs[0], cmd, sizeof(cmd)))
+		mexErrMsgTxt("First input should be a command string less than 64 characters long.");
+
+	// New
+	if (!strcmp("new", cmd)) {
+		// Check parameters
+		if (nlhs != 1)
+			mexErrMsgTxt("New: One output expected.");
+
+		// Return a handle to a new C++ instance
+		plhs[0] = FFTW_NewInstance<FFTW_Wrapper_C2C>(nrhs, prhs, 1);
+		return;
+	}
+
+	// Planner
+	if (FFTW_PlannerCommand(cmd, nlhs, plhs, nrhs, prhs))
+		return;
+
+	// Check there is a second input, which should be the class instance handle
+	if (nrhs < 2)
+		mexErrMsgTxt("Second input should be a class instance handle.");
+
+	// Commands for the precision of this instance
+	if (isHandleOf<FFTW_Wrapper_C2C<float> >(prhs[1]))
+		WrapperCommand<float>(cmd, nlhs, plhs, nrhs, prhs);
+	else
+		WrapperCommand<double>(cmd, nlhs, plhs, nrhs, prhs);
+}
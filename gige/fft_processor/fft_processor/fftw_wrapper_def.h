@@ -1,7 +1,8 @@
 ////////////////////////////////////////////////////////////////////////////////
 // Filename: fftw_wrapper_def.h
-// Definitions for the FFT classes. Allows to switch multithreading on or off,
-// and allows switching between float or double precision.
+// Definitions for the FFT classes. Allows to switch multithreading on or off.
+// Both float and double precision are built; the FFT classes are templates on
+// the scalar type, and FFTW<T> maps them to the fftwf_ or fftw_ library.
 //   - Damien Loterie (04/2015)
 ////////////////////////////////////////////////////////////////////////////////
 #ifndef _FFTW_WRAPPER_DEF_H_
@@ -15,36 +16,72 @@
 /////////////////
 // DEFINITIONS //
 /////////////////
-// Comment or uncomment to choose float or double precision respectively
-#define FFTW_PRECISION_DOUBLE
 #define FFTW_MULTITHREAD
 
 ///////////////
 // AUTOMATIC //
 ///////////////
-#ifdef FFTW_PRECISION_DOUBLE
-	typedef double Real;
-	#pragma comment(lib, "libfftw3-3.lib")
-	#define FFTW_PREFIX(arg)fftw_ ## arg
-	#define FFTW_MATLAB_CLASS mxDOUBLE_CLASS
-	#ifdef FFTW_MULTITHREAD
-		#define FFTW_WISDOM_FILE "./fftw_wisdom_mt.dat"
-	#else
-		#define FFTW_WISDOM_FILE "./fftw_wisdom_st.dat"
-	#endif
+#pragma comment(lib, "libfftw3-3.lib")
+#pragma comment(lib, "libfftw3f-3.lib")
+
+// Each precision has its own wisdom in FFTW, so each has its own file
+// (in the wisdom directory of the planner)
+#ifdef FFTW_MULTITHREAD
+	#define FFTW_WISDOM_FILE_DOUBLE "fftw_wisdom_mt.dat"
+	#define FFTW_WISDOM_FILE_FLOAT  "fftwf_wisdom_mt.dat"
 #else
-typedef float Real;
-	#define FFTW_PRECISION_FLOAT
-	#pragma comment(lib, "libfftw3f-3.lib")
-	#define FFTW_PREFIX(arg)fftwf_ ## arg
-	#define FFTW_MATLAB_CLASS mxSINGLE_CLASS
-	#ifdef FFTW_MULTITHREAD
-	#define FFTW_WISDOM_FILE "./fftwf_wisdom_mt.dat"
-	#else
-	#define FFTW_WISDOM_FILE "./fftwf_wisdom_st.dat"
-	#endif
+	#define FFTW_WISDOM_FILE_DOUBLE "fftw_wisdom_st.dat"
+	#define FFTW_WISDOM_FILE_FLOAT  "fftwf_wisdom_st.dat"
 #endif
 
-typedef FFTW_PREFIX(complex) Complex;
+////////////////////////////////////////////////////////////////////////////////
+// Struct name: FFTW
+// The FFTW functions of one precision, as FFTW<float> or FFTW<double>
+// (fftw_malloc and fftw_free are alloc and dealloc, so that the debug heap
+//  macros for malloc and free cannot get in the way)
+////////////////////////////////////////////////////////////////////////////////
+template<class T>
+struct FFTW;
+
+#define FFTW_DEFINE_PRECISION(R, X, WISDOM)																	\
+template<>																									\
+struct FFTW<R>																								\
+{																											\
+	typedef X##plan		plan;																				\
+	typedef X##complex	complex;																			\
+																											\
+	static const char*	wisdom_file()						{ return WISDOM; }								\
+	static void*		alloc(size_t n)						{ return X##malloc(n); }						\
+	static void			dealloc(void* p)					{ X##free(p); }									\
+	static int			init_threads()						{ return X##init_threads(); }					\
+	static void			plan_with_nthreads(int n)			{ X##plan_with_nthreads(n); }					\
+	static void			cleanup_threads()					{ X##cleanup_threads(); }						\
+	static void			cleanup()							{ X##cleanup(); }								\
+	static int			import_wisdom_from_filename(const char* f)	{ return X##import_wisdom_from_filename(f); }	\
+	static int			export_wisdom_to_filename(const char* f)	{ return X##export_wisdom_to_filename(f); }		\
+	static void			destroy_plan(plan p)				{ X##destroy_plan(p); }							\
+	static void			execute(const plan p)				{ X##execute(p); }								\
+	static void			execute_dft_r2c(const plan p, R* in, complex* out)	{ X##execute_dft_r2c(p, in, out); }	\
+	static void			execute_dft_c2r(const plan p, complex* in, R* out)	{ X##execute_dft_c2r(p, in, out); }	\
+	static void			execute_dft(const plan p, complex* in, complex* out)	{ X##execute_dft(p, in, out); }		\
+																											\
+	static plan plan_dft_r2c_2d(int n0, int n1, R* in, complex* out, unsigned flags)						\
+		{ return X##plan_dft_r2c_2d(n0, n1, in, out, flags); }												\
+	static plan plan_dft_c2r_2d(int n0, int n1, complex* in, R* out, unsigned flags)						\
+		{ return X##plan_dft_c2r_2d(n0, n1, in, out, flags); }												\
+	static plan plan_dft_2d(int n0, int n1, complex* in, complex* out, int sign, unsigned flags)			\
+		{ return X##plan_dft_2d(n0, n1, in, out, sign, flags); }											\
+	static plan plan_dft_1d(int n, complex* in, complex* out, int sign, unsigned flags)						\
+		{ return X##plan_dft_1d(n, in, out, sign, flags); }													\
+	static plan plan_many_dft_r2c(int rank, const int* n, int howmany,										\
+								  R* in, const int* inembed, int istride, int idist,						\
+								  complex* out, const int* onembed, int ostride, int odist, unsigned flags)	\
+		{ return X##plan_many_dft_r2c(rank, n, howmany, in, inembed, istride, idist, out, onembed, ostride, odist, flags); }	\
+};
 
-#endif
\ No newline at end of file
+FFTW_DEFINE_PRECISION(double, fftw_,  FFTW_WISDOM_FILE_DOUBLE)
+FFTW_DEFINE_PRECISION(float,  fftwf_, FFTW_WISDOM_FILE_FLOAT)
+
+#undef FFTW_DEFINE_PRECISION
+
+#endif
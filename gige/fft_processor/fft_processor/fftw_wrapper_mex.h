@@ -0,0 +1,167 @@
+////////////////////////////////////////////////////////////////////////////////
+// Filename: fftw_wrapper_mex.h
+// Helpers for the MEX interfaces of the FFT classes. Each MATLAB object holds
+// either a float or a double instance; the precision is chosen with the 'new'
+// command, and the other commands find it back from the handle. The planner
+// commands need no instance and apply to both precisions.
+//   - Damien Loterie (04/2015)
+////////////////////////////////////////////////////////////////////////////////
+#ifndef _FFTW_WRAPPER_MEX_H_
+#define _FFTW_WRAPPER_MEX_H_
+
+//////////////
+// INCLUDES //
+//////////////
+#include "mex.h"
+#include "class_handle.hpp"
+#include "fftw_planner.h"
+#include <cstring>
+
+////////////////////////////////////////////////////////////////////////////////
+// Precision
+////////////////////////////////////////////////////////////////////////////////
+// MATLAB class of each precision
+template<class R> inline mxClassID FFTW_MatlabClass();
+template<> inline mxClassID FFTW_MatlabClass<float>()  { return mxSINGLE_CLASS; }
+template<> inline mxClassID FFTW_MatlabClass<double>() { return mxDOUBLE_CLASS; }
+
+// Optional precision argument: 'single' or 'double' (the default)
+inline bool FFTW_IsSinglePrecision(int nrhs, const mxArray *prhs[], int index)
+{
+	char precision[16];
+	if (nrhs <= index)
+		return false;
+	if (mxGetString(prhs[index], precision, sizeof(precision)))
+		mexErrMsgTxt("New: The precision should be 'single' or 'double'.");
+	if (!strcmp("single", precision))
+		return true;
+	if (!strcmp("double", precision))
+		return false;
+	mexErrMsgTxt("New: The precision should be 'single' or 'double'.");
+	return false;
+}
+
+// Create a new instance in the requested precision
+template<template<class> class C>
+inline mxArray* FFTW_NewInstance(int nrhs, const mxArray *prhs[], int index)
+{
+	if (FFTW_IsSinglePrecision(nrhs, prhs, index))
+		return convertPtr2Mat<C<float> >(new C<float>);
+	else
+		return convertPtr2Mat<C<double> >(new C<double>);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Planner
+////////////////////////////////////////////////////////////////////////////////
+// Commands that do not take an instance handle (returns false for the others)
+inline bool FFTW_PlannerCommand(const char* cmd, int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
+{
+	// Directory of the wisdom files
+	if (!strcmp("SetWisdomDirectory", cmd)) {
+		// Check parameters
+		char directory[1024];
+		if (nlhs != 0 || nrhs != 2 || mxGetString(prhs[1], directory, sizeof(directory)))
+			mexErrMsgTxt("SetWisdomDirectory: Unexpected arguments.");
+
+		// Set it
+		FFTW_Planner<float>::Instance().SetWisdomDirectory(directory);
+		FFTW_Planner<double>::Instance().SetWisdomDirectory(directory);
+		return true;
+	}
+
+	if (!strcmp("GetWisdomDirectory", cmd)) {
+		// Check parameters
+		if (nlhs != 1 || nrhs != 1)
+			mexErrMsgTxt("GetWisdomDirectory: Unexpected arguments.");
+
+		// Return it
+		plhs[0] = mxCreateString(FFTW_Planner<double>::Instance().GetWisdomDirectory().c_str());
+		return true;
+	}
+
+	// Estimate plans that are not in the wisdom, and plan them properly in the background
+	if (!strcmp("SetBackgroundPlanning", cmd)) {
+		// Check parameters
+		if (nlhs != 0 || nrhs != 2 || !mxIsLogicalScalar(prhs[1]))
+			mexErrMsgTxt("SetBackgroundPlanning: Unexpected arguments.");
+
+		// Set it
+		bool enable = mxIsLogicalScalarTrue(prhs[1]);
+		FFTW_Planner<float>::Instance().SetBackgroundPlanning(enable);
+		FFTW_Planner<double>::Instance().SetBackgroundPlanning(enable);
+		return true;
+	}
+
+	// Wait for the background plans
+	if (!strcmp("WaitPlanning", cmd)) {
+		// Check parameters
+		if (nlhs != 1 || nrhs != 2 || !mxIsDouble(prhs[1]))
+			mexErrMsgTxt("WaitPlanning: Unexpected arguments.");
+
+		// Wait
+		DWORD timeout = (DWORD)mxGetScalar(prhs[1]);
+		bool done = FFTW_Planner<float>::Instance().WaitBackgroundPlanning(timeout);
+		done &= FFTW_Planner<double>::Instance().WaitBackgroundPlanning(timeout);
+		plhs[0] = mxCreateLogicalScalar(done);
+		return true;
+	}
+
+	// Forget the cached plans (instances keep theirs)
+	if (!strcmp("ClearPlanCache", cmd)) {
+		// Check parameters
+		if (nlhs != 0 || nrhs != 1)
+			mexErrMsgTxt("ClearPlanCache: Unexpected arguments.");
+
+		// Clear
+		FFTW_Planner<float>::Instance().ClearCache();
+		FFTW_Planner<double>::Instance().ClearCache();
+		return true;
+	}
+
+	return false;
+}
+
+// Stops the background planning before the MEX file is unloaded
+inline void FFTW_PlannerExit()
+{
+	FFTW_Planner<float>::Instance().StopBackgroundPlanning();
+	FFTW_Planner<double>::Instance().StopBackgroundPlanning();
+}
+
+// Keeps the MEX file locked while plans are pending, so that 'clear mex'
+// cannot unload it under the background thread
+inline void FFTW_PlannerKeepLoaded()
+{
+	static bool registered = false;
+	static bool locked = false;
+	if (!registered)
+	{
+		mexAtExit(FFTW_PlannerExit);
+		registered = true;
+	}
+
+	bool pending = (FFTW_Planner<float>::Instance().GetNumberOfPendingPlans() > 0)
+				|| (FFTW_Planner<double>::Instance().GetNumberOfPendingPlans() > 0);
+	if (pending && !locked)
+	{
+		mexLock();
+		locked = true;
+	}
+	else if (!pending && locked)
+	{
+		mexUnlock();
+		locked = false;
+	}
+}
+
+// Checks the pending plans when a MEX call starts and when it ends
+// (also when it ends with an error)
+class FFTW_PlannerScope
+{
+public:
+	FFTW_PlannerScope()		{ FFTW_PlannerKeepLoaded(); }
+	~FFTW_PlannerScope()	{ FFTW_PlannerKeepLoaded(); }
+};
+
+#endif
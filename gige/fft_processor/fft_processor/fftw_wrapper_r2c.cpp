@@ -3,139 +3,421 @@
 //   - Damien Loterie (04/2015)
 
 #include "fftw_wrapper_r2c.h"
+#include <map>
+#include <algorithm>
+#include <math.h>
 
-FFTW_Wrapper_R2C::FFTW_Wrapper_R2C()
+template<class R>
+FFTW_Wrapper_R2C<R>::FFTW_Wrapper_R2C()
 {
-	plan_forward = NULL;
-	plan_backward = NULL;
 	data_in = NULL;
 	data_out = NULL;
+	for (size_t i = 0; i < FFTW_STAGING_SLOTS; i++)
+		data_staging[i] = NULL;
+	engine = FFTW_ENGINE_FULL;
+	column = NULL;
+	threads = 0;
+	batch_size = 0;
+	data_batch_in = NULL;
+	data_batch_out = NULL;
 }
 
 
-FFTW_Wrapper_R2C::~FFTW_Wrapper_R2C()
+template<class R>
+FFTW_Wrapper_R2C<R>::~FFTW_Wrapper_R2C()
 {
 	Shutdown();
 }
 
-void FFTW_Wrapper_R2C::Shutdown()
+template<class R>
+void FFTW_Wrapper_R2C<R>::Shutdown()
 {
-	if (plan_forward != NULL)
-	{
-		FFTW_PREFIX(destroy_plan(plan_forward));
-		plan_forward = NULL;
-	}
+	ShutdownSparse();
+	ShutdownBatch();
 
-	if (plan_backward != NULL)
-	{
-		FFTW_PREFIX(destroy_plan(plan_backward));
-		plan_backward = NULL;
-	}
+	// The planner keeps the plans for the next wrapper of this size
+	plan_forward.reset();
+	plan_backward.reset();
 
 	if (data_in != NULL)
 	{
-		FFTW_PREFIX(free(data_in));
+		FFTW<R>::dealloc(data_in);
 		data_in = NULL;
 	}
 
 	if (data_out != NULL)
 	{
-		FFTW_PREFIX(free(data_out));
+		FFTW<R>::dealloc(data_out);
 		data_out = NULL;
 	}
 
+	for (size_t i = 0; i < FFTW_STAGING_SLOTS; i++)
+	{
+		if (data_staging[i] != NULL)
+		{
+			FFTW<R>::dealloc(data_staging[i]);
+			data_staging[i] = NULL;
+		}
+	}
+
 }
 
-bool FFTW_Wrapper_R2C::Initialize(size_t Width, size_t Height)
+template<class R>
+bool FFTW_Wrapper_R2C<R>::Initialize(size_t Width, size_t Height, int nThreads)
 {
 	// Allocate arrays
 	width = Width;
 	height = Height;
 	numel_in = height * width;
 	numel_out = height * (width / 2 + 1);
-	data_in  = (Real*)   FFTW_PREFIX(malloc(numel_in  * sizeof(*data_in)));
-	data_out = (Complex*)FFTW_PREFIX(malloc(numel_out * sizeof(*data_out)));
+	data_in  = (Real*)   FFTW<R>::alloc(numel_in  * sizeof(*data_in));
+	data_out = (Complex*)FFTW<R>::alloc(numel_out * sizeof(*data_out));
 
-	// Enable threading
-	#ifdef FFTW_MULTITHREAD
-		int resThread = FFTW_PREFIX(init_threads());
-	#endif
-
-	// Try to import wisdom
-	FFTW_PREFIX(import_wisdom_from_filename(FFTW_WISDOM_FILE));
+	// Staging arrays
+	// (allocated the same way as data_in, so they have the same alignment
+	//  and the forward plan can be applied to them directly)
+	for (size_t i = 0; i < FFTW_STAGING_SLOTS; i++)
+		data_staging[i] = (Real*)FFTW<R>::alloc(numel_in * sizeof(*data_in));
 
 	// Number of threads
-	#ifdef FFTW_MULTITHREAD
-		FFTW_PREFIX(plan_with_nthreads(numberOfCores()));
-	#endif
-
-	// Create plan
-	plan_forward = FFTW_PREFIX(plan_dft_r2c_2d(	(int)height,
-												(int)width,
-												data_in,
-												data_out,
-												FFTW_PATIENT | FFTW_DESTROY_INPUT));
-
-	plan_backward = FFTW_PREFIX(plan_dft_c2r_2d((int)height,
-												(int)width,
-												data_out,
-												data_in,
-												FFTW_PATIENT | FFTW_DESTROY_INPUT));
-
-	// Export wisdom back
-	FFTW_PREFIX(export_wisdom_to_filename(FFTW_WISDOM_FILE));
+	// (0 = all cores; less when several wrappers transform side by side)
+	threads = (nThreads > 0) ? nThreads : numberOfCores();
+
+	// Get plans
+	// (the background planner waits until both are there)
+	FFTW_PlannerHold<R> hold;
+	plan_forward  = GetPlan(FFTW_PLAN_R2C_2D, (int)height, (int)width, 1, FFTW_FORWARD, FFTW_PLAN_FLAGS);
+	plan_backward = GetPlan(FFTW_PLAN_C2R_2D, (int)height, (int)width, 1, FFTW_BACKWARD, FFTW_PLAN_FLAGS);
 
 	// Return
-	bool resFinal = (plan_forward != NULL) && (plan_backward != NULL);
-	#ifdef FFTW_MULTITHREAD
-		resFinal &= (resThread != 0);
-	#endif
+	bool resFinal = (data_in != NULL) && (data_out != NULL);
+	resFinal &= (plan_forward != nullptr) && (plan_backward != nullptr);
+	for (size_t i = 0; i < FFTW_STAGING_SLOTS; i++)
+		resFinal &= (data_staging[i] != NULL);
 	return resFinal;
 }
 
+template<class R>
+typename FFTW_Wrapper_R2C<R>::Plan FFTW_Wrapper_R2C<R>::GetPlan(FFTW_PlanKind kind, int n0, int n1, int howmany, int sign, unsigned flags)
+{
+	FFTW_PlanKey key;
+	key.kind	= kind;
+	key.height	= n0;
+	key.width	= n1;
+	key.howmany	= howmany;
+	key.sign	= sign;
+	key.threads	= threads;
+	key.flags	= flags;
+	return FFTW_Planner<R>::Instance().GetPlan(key);
+}
+
+template<class R>
+bool FFTW_Wrapper_R2C<R>::IsPlanned()
+{
+	// False while background plans are still being made
+	bool res = (plan_forward != nullptr) && plan_forward->IsFinal();
+	res &= (plan_backward != nullptr) && plan_backward->IsFinal();
+	if (plan_rows != nullptr)
+		res &= plan_rows->IsFinal() && plan_column->IsFinal();
+	if (plan_batch != nullptr)
+		res &= plan_batch->IsFinal();
+	return res;
+}
+
+
+template<class R>
+void FFTW_Wrapper_R2C<R>::TransformForward()
+{
+	FFTW<R>::execute_dft_r2c(plan_forward->Get(), data_in, data_out);
+}
+
+template<class R>
+void FFTW_Wrapper_R2C<R>::TransformForward(size_t slot)
+{
+	// Only the requested coefficients
+	if (engine == FFTW_ENGINE_SPARSE)
+	{
+		TransformForwardSparse(data_staging[slot]);
+		return;
+	}
+
+	// Same plan, applied to a staging array
+	FFTW<R>::execute_dft_r2c(plan_forward->Get(), data_staging[slot], data_out);
+}
+
+template<class R>
+void FFTW_Wrapper_R2C<R>::ShutdownSparse()
+{
+	engine = FFTW_ENGINE_FULL;
+	sparse_columns.clear();
+	twiddles.clear();
+
+	plan_rows.reset();
+	plan_column.reset();
+
+	if (column != NULL)
+	{
+		FFTW<R>::dealloc(column);
+		column = NULL;
+	}
+}
+
+template<class R>
+FFTW_Engine FFTW_Wrapper_R2C<R>::SetOutputIndices(const std::vector<size_t>& output_indices, FFTW_Engine mode)
+{
+	// Start over from the full transform
+	ShutdownSparse();
+	if (mode == FFTW_ENGINE_FULL || output_indices.empty() || plan_forward == nullptr)
+		return engine;
+
+	// Group the requested coefficients by output column
+	size_t width_out = width / 2 + 1;
+	std::map<size_t, std::vector<size_t> > requested;
+	for (size_t i = 0; i < output_indices.size(); i++)
+	{
+		if (output_indices[i] < numel_out)
+			requested[output_indices[i] % width_out].push_back(output_indices[i] / width_out);
+	}
+
+	// Cost model, in floating point operations: 5 N log2(N) for a complex
+	// FFT and half of that for a real one, 8 per term of a direct DFT
+	double full_cost = 2.5 * (double)numel_in * log2((double)numel_in);
+	double sparse_cost = 2.5 * (double)numel_in * log2((double)width);
+	double column_fft_cost = 5.0 * (double)height * log2((double)height) + 4.0 * (double)height;
+	for (std::map<size_t, std::vector<size_t> >::iterator it = requested.begin(); it != requested.end(); ++it)
+	{
+		// Each row only once
+		std::vector<size_t>& rows = it->second;
+		std::sort(rows.begin(), rows.end());
+		rows.erase(std::unique(rows.begin(), rows.end()), rows.end());
+
+		// Cheapest way to get these rows
+		SparseColumn col;
+		col.index = it->first;
+		col.rows = rows;
+		double direct_cost = 8.0 * (double)height * (double)rows.size();
+		col.direct = (direct_cost < column_fft_cost);
+		sparse_cost += col.direct ? direct_cost : column_fft_cost;
+		sparse_columns.push_back(col);
+	}
+
+	// Keep the full transform if it is cheaper
+	if (mode == FFTW_ENGINE_AUTO && sparse_cost >= FFTW_SPARSE_MARGIN * full_cost)
+	{
+		sparse_columns.clear();
+		return engine;
+	}
 
-void FFTW_Wrapper_R2C::TransformForward()
+	// Row transforms, written in the layout of the full output
+	plan_rows = GetPlan(FFTW_PLAN_R2C_ROWS, (int)height, (int)width, 1, FFTW_FORWARD, FFTW_PLAN_FLAGS);
+
+	// Column transform, on a contiguous copy of the column
+	column = (Complex*)FFTW<R>::alloc(height * sizeof(*column));
+	if (column != NULL)
+		plan_column = GetPlan(FFTW_PLAN_C2C_1D, (int)height, 1, 1, FFTW_FORWARD, FFTW_PATIENT);
+
+	if (plan_rows == nullptr || plan_column == nullptr)
+	{
+		ShutdownSparse();
+		return engine;
+	}
+
+	// Twiddle factors for the direct DFTs
+	const double pi = 3.14159265358979323846;
+	twiddles.resize(height);
+	for (size_t m = 0; m < height; m++)
+		twiddles[m] = Complex((Real)cos(2.0 * pi * (double)m / (double)height), (Real)-sin(2.0 * pi * (double)m / (double)height));
+
+	// Ready
+	engine = FFTW_ENGINE_SPARSE;
+	return engine;
+}
+
+template<class R>
+void FFTW_Wrapper_R2C<R>::TransformForwardSparse(Real* source)
 {
-	FFTW_PREFIX(execute(plan_forward));
+	size_t width_out = width / 2 + 1;
+
+	// Row transforms
+	FFTW<R>::execute_dft_r2c(plan_rows->Get(), source, data_out);
+
+	// Columns that hold requested coefficients
+	for (size_t c = 0; c < sparse_columns.size(); c++)
+	{
+		const SparseColumn& col = sparse_columns[c];
+		Complex* base = data_out + col.index;
+
+		if (col.direct)
+		{
+			// Direct DFT of the requested rows (kept aside until the end,
+			// since they overwrite the input of the others)
+			for (size_t j = 0; j < col.rows.size(); j++)
+			{
+				size_t  r = col.rows[j];
+				size_t  m = 0;
+				Complex acc = 0;
+				for (size_t y = 0; y < height; y++)
+				{
+					acc += base[y*width_out] * twiddles[m];
+					m += r;
+					if (m >= height)
+						m -= height;
+				}
+				column[j] = acc;
+			}
+			for (size_t j = 0; j < col.rows.size(); j++)
+				base[col.rows[j] * width_out] = column[j];
+		}
+		else
+		{
+			// Full FFT of the column
+			for (size_t y = 0; y < height; y++)
+				column[y] = base[y*width_out];
+			FFTW<R>::execute_dft(plan_column->Get(), column, column);
+			for (size_t j = 0; j < col.rows.size(); j++)
+				base[col.rows[j] * width_out] = column[col.rows[j]];
+		}
+	}
 }
 
-void FFTW_Wrapper_R2C::TransformBackward()
+template<class R>
+FFTW_Engine FFTW_Wrapper_R2C<R>::GetEngine()
 {
-	FFTW_PREFIX(execute(plan_backward));
+	return engine;
 }
 
-Real* FFTW_Wrapper_R2C::GetDataInPtr()
+template<class R>
+void FFTW_Wrapper_R2C<R>::ShutdownBatch()
+{
+	batch_size = 0;
+
+	plan_batch.reset();
+
+	if (data_batch_in != NULL)
+	{
+		FFTW<R>::dealloc(data_batch_in);
+		data_batch_in = NULL;
+	}
+
+	if (data_batch_out != NULL)
+	{
+		FFTW<R>::dealloc(data_batch_out);
+		data_batch_out = NULL;
+	}
+}
+
+template<class R>
+bool FFTW_Wrapper_R2C<R>::SetBatchSize(size_t frames)
+{
+	// Start over
+	ShutdownBatch();
+	if (frames == 0)
+		return true;
+	if (plan_forward == nullptr)
+		return false;
+
+	// Frames one after the other, in the same layout as data_in and data_out
+	data_batch_in  = (Real*)   FFTW<R>::alloc(frames * numel_in  * sizeof(*data_batch_in));
+	data_batch_out = (Complex*)FFTW<R>::alloc(frames * numel_out * sizeof(*data_batch_out));
+	if (data_batch_in == NULL || data_batch_out == NULL)
+	{
+		ShutdownBatch();
+		return false;
+	}
+
+	// Plan over all frames at once
+	plan_batch = GetPlan(FFTW_PLAN_R2C_BATCH, (int)height, (int)width, (int)frames, FFTW_FORWARD, FFTW_BATCH_FLAGS);
+	if (plan_batch == nullptr)
+	{
+		ShutdownBatch();
+		return false;
+	}
+
+	// Return
+	batch_size = frames;
+	return true;
+}
+
+template<class R>
+size_t FFTW_Wrapper_R2C<R>::GetBatchSize()
+{
+	return batch_size;
+}
+
+template<class R>
+bool FFTW_Wrapper_R2C<R>::SetBatchIn(PixelFormat format, const uint8_t* source, size_t numel, size_t frame, const float* dark, const float* gain)
+{
+	// Check sizes
+	if (numel != numel_in || frame >= batch_size)
+		return false;
+
+	// Convert (and correct)
+	return ConvertPixels(format, source, numel, data_batch_in + frame*numel_in, dark, gain);
+}
+
+template<class R>
+void FFTW_Wrapper_R2C<R>::TransformForwardBatch()
+{
+	FFTW<R>::execute_dft_r2c(plan_batch->Get(), data_batch_in, data_batch_out);
+}
+
+template<class R>
+std::complex<R>* FFTW_Wrapper_R2C<R>::GetBatchOutPtr(size_t frame)
+{
+	return data_batch_out + frame*numel_out;
+}
+
+template<class R>
+void FFTW_Wrapper_R2C<R>::TransformBackward()
+{
+	FFTW<R>::execute_dft_c2r(plan_backward->Get(), data_out, data_in);
+}
+
+template<class R>
+R* FFTW_Wrapper_R2C<R>::GetDataInPtr()
 {
 	return data_in;
 }
 
-Complex* FFTW_Wrapper_R2C::GetDataOutPtr()
+template<class R>
+R* FFTW_Wrapper_R2C<R>::GetStagingPtr(size_t slot)
+{
+	return data_staging[slot];
+}
+
+template<class R>
+std::complex<R>* FFTW_Wrapper_R2C<R>::GetDataOutPtr()
 {
 	return data_out;
 }
 
-size_t FFTW_Wrapper_R2C::GetWidth()
+template<class R>
+size_t FFTW_Wrapper_R2C<R>::GetWidth()
 {
 	return width;
 }
 
-size_t FFTW_Wrapper_R2C::GetHeight()
+template<class R>
+size_t FFTW_Wrapper_R2C<R>::GetHeight()
 {
 	return height;
 }
 
-size_t FFTW_Wrapper_R2C::GetSizeIn()
+template<class R>
+size_t FFTW_Wrapper_R2C<R>::GetSizeIn()
 {
 	return numel_in;
 }
 
-size_t FFTW_Wrapper_R2C::GetSizeOut()
+template<class R>
+size_t FFTW_Wrapper_R2C<R>::GetSizeOut()
 {
 	return numel_out;
 }
 
 
-bool FFTW_Wrapper_R2C::GetDataIn(Real* target, size_t numel)
+template<class R>
+bool FFTW_Wrapper_R2C<R>::GetDataIn(Real* target, size_t numel)
 {
 	// Check sizes
 	if (numel != numel_in)
@@ -146,7 +428,19 @@ bool FFTW_Wrapper_R2C::GetDataIn(Real* target, size_t numel)
 	return true;
 }
 
-bool FFTW_Wrapper_R2C::SetDataOut(const Complex* source, size_t numel)
+template<class R>
+bool FFTW_Wrapper_R2C<R>::SetStagingIn(PixelFormat format, const uint8_t* source, size_t numel, size_t slot, const float* dark, const float* gain)
+{
+	// Check sizes
+	if (numel != numel_in || slot >= FFTW_STAGING_SLOTS)
+		return false;
+
+	// Convert (and correct)
+	return ConvertPixels(format, source, numel, data_staging[slot], dark, gain);
+}
+
+template<class R>
+bool FFTW_Wrapper_R2C<R>::SetDataOut(const Complex* source, size_t numel)
 {
 	// Check sizes
 	if (numel != numel_out)
@@ -158,7 +452,8 @@ bool FFTW_Wrapper_R2C::SetDataOut(const Complex* source, size_t numel)
 
 }
 
-bool FFTW_Wrapper_R2C::GetDataOut(Complex* target, size_t numel)
+template<class R>
+bool FFTW_Wrapper_R2C<R>::GetDataOut(Complex* target, size_t numel)
 {
 	// Check sizes
 	if (numel != numel_out)
@@ -167,4 +462,8 @@ bool FFTW_Wrapper_R2C::GetDataOut(Complex* target, size_t numel)
 	// Copy
 	CopyMemory(target, data_out, numel*sizeof(*target));
 	return true;
-}
\ No newline at end of file
+}
+
+// Both precisions
+template class FFTW_Wrapper_R2C<float>;
+template class FFTW_Wrapper_R2C<double>;
@@ -1,7 +1,8 @@
 ////////////////////////////////////////////////////////////////////////////////
 // Filename: fftw_wrapper_r2c.h
 // Wrapper class which simplifies calls to FFTW for the real to complex
-// transforms.
+// transforms, in float or double precision. The plans come from the planner,
+// and are shared with the other wrappers of the same size.
 //   - Damien Loterie (04/2015)
 ////////////////////////////////////////////////////////////////////////////////
 #ifndef _FFTW_WRAPPER_R2C_H_
@@ -15,24 +16,70 @@
 #include <fftw3.h>
 #include <vector>
 #include "fftw_wrapper_def.h"
+#include "fftw_planner.h"
+#include "pixelconvert.h"
+
+/////////////
+// GLOBALS //
+/////////////
+// Number of input arrays that images can be staged in while the plan
+// transforms another one
+#define FFTW_STAGING_SLOTS 2
+
+// Planner flags of the plans
+#define FFTW_PLAN_FLAGS (FFTW_PATIENT | FFTW_DESTROY_INPUT)
+
+// Planner flags of the batched plan (a plan over many frames takes much
+// longer to make, so it is measured rather than searched patiently)
+#define FFTW_BATCH_FLAGS (FFTW_MEASURE | FFTW_DESTROY_INPUT)
+
+// The sparse engine has to beat the estimated cost of the full transform by
+// this factor, since the full 2D plan is better optimized than our column
+// loop
+#define FFTW_SPARSE_MARGIN 0.75
+
+// Engines for the forward transform of the staging arrays
+enum FFTW_Engine
+{
+	FFTW_ENGINE_AUTO,		// Pick one with the cost model
+	FFTW_ENGINE_FULL,		// Full 2D transform
+	FFTW_ENGINE_SPARSE		// Row transforms, then only the columns that hold requested coefficients
+};
 
 
 ////////////////////////////////////////////////////////////////////////////////
 // Class name: FFTW_Wrapper_R2C
 ////////////////////////////////////////////////////////////////////////////////
+template<class R>
 class FFTW_Wrapper_R2C
 {
 public:
+	typedef R						Real;
+	typedef std::complex<R>			Complex;
+	typedef std::shared_ptr<FFTW_PlanEntry<R> >	Plan;
+
 	FFTW_Wrapper_R2C();
 	~FFTW_Wrapper_R2C();
 
-	bool			Initialize(size_t, size_t); //,vector<size_t>
+	bool			Initialize(size_t, size_t, int = 0); //,vector<size_t>
 	void			Shutdown();
 	
 	void			TransformForward();
+	void			TransformForward(size_t);
 	void			TransformBackward();
 
+	FFTW_Engine		SetOutputIndices(const std::vector<size_t>&, FFTW_Engine = FFTW_ENGINE_AUTO);
+	FFTW_Engine		GetEngine();
+	bool			IsPlanned();
+
+	bool			SetBatchSize(size_t);
+	size_t			GetBatchSize();
+	bool			SetBatchIn(PixelFormat, const uint8_t*, size_t, size_t, const float* = NULL, const float* = NULL);
+	void			TransformForwardBatch();
+	Complex*		GetBatchOutPtr(size_t);
+
 	Real*			GetDataInPtr();
+	Real*			GetStagingPtr(size_t);
 	Complex*	    GetDataOutPtr();
 	size_t			GetWidth();
 	size_t			GetHeight();
@@ -41,35 +88,81 @@ public:
 
 	template<class T>
 	bool			SetDataIn(const T*, size_t);
+	template<class T>
+	bool			SetStagingIn(const T*, size_t, size_t);
+	bool			SetStagingIn(PixelFormat, const uint8_t*, size_t, size_t, const float* = NULL, const float* = NULL);
 	bool			GetDataIn(Real*, size_t);
 	bool			SetDataOut(const Complex*, size_t);
 	bool			GetDataOut(Complex*, size_t);
 
 private:
-	FFTW_PREFIX(plan)	plan_forward;
-	FFTW_PREFIX(plan)	plan_backward;
+	Plan				plan_forward;
+	Plan				plan_backward;
+	Plan			GetPlan(FFTW_PlanKind, int, int, int, int, unsigned);
 
 	size_t         width;
 	size_t         height;
 	size_t		   numel_in;
 	size_t         numel_out;
+	int			   threads;
 
 	Real*          data_in;
+	Real*          data_staging[FFTW_STAGING_SLOTS];
 	Complex*	   data_out;
+
+	// Sparse engine
+	struct SparseColumn
+	{
+		size_t					index;		// Column in the output
+		bool					direct;		// Direct DFT of the rows below, rather than a column FFT
+		std::vector<size_t>		rows;		// Requested rows in that column
+	};
+
+	FFTW_Engine					engine;
+	Plan						plan_rows;
+	Plan						plan_column;
+	Complex*					column;
+	std::vector<Complex>		twiddles;
+	std::vector<SparseColumn>	sparse_columns;
+
+	void			TransformForwardSparse(Real*);
+	void			ShutdownSparse();
+
+	// Batched engine: one plan over several consecutive frames
+	Plan						plan_batch;
+	size_t						batch_size;
+	Real*						data_batch_in;
+	Complex*					data_batch_out;
+
+	void			ShutdownBatch();
 };
 
 ////////////////////////////////////////////////////////////////////////////////
 // METHODS
 ////////////////////////////////////////////////////////////////////////////////
+template<class R>
 template<class T>
-bool FFTW_Wrapper_R2C::SetDataIn(const T* source, size_t numel)
+bool FFTW_Wrapper_R2C<R>::SetDataIn(const T* source, size_t numel)
 {
 	// Check sizes
 	if (numel != numel_in)
 		return false;
 
-	// Copy
-	std::copy(&source[0], &source[numel], data_in);
+	// Convert
+	ConvertPixels(source, data_in, numel);
+	return true;
+}
+
+template<class R>
+template<class T>
+bool FFTW_Wrapper_R2C<R>::SetStagingIn(const T* source, size_t numel, size_t slot)
+{
+	// Check sizes
+	if (numel != numel_in || slot >= FFTW_STAGING_SLOTS)
+		return false;
+
+	// Convert
+	ConvertPixels(source, data_staging[slot], numel);
 	return true;
 }
 
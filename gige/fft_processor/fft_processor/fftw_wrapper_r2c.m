@@ -11,9 +11,14 @@ classdef fftw_wrapper_r2c < hgsetget
     
     methods        
         % Constructor
-        function obj = fftw_wrapper_r2c(width, height)             
+        % (precision is 'double', the default, or 'single')
+        function obj = fftw_wrapper_r2c(width, height, precision)             
+            if nargin<3
+               precision = 'double'; 
+            end
+            
             % Create class
-            obj.objectHandle = fftw_wrapper_r2c_mex('new');
+            obj.objectHandle = fftw_wrapper_r2c_mex('new', precision);
             
             % Attempt to initialize the acquisition system
             fftw_wrapper_r2c_mex('Initialize', obj.objectHandle, width, height);
@@ -28,6 +33,11 @@ classdef fftw_wrapper_r2c < hgsetget
         function res = transform(this,arr)
            res = fftw_wrapper_r2c_mex('Transform', this.objectHandle, arr);
         end
+        
+        % Whether the final plans are in use, rather than background estimates
+        function res = isplanned(this)
+           res = fftw_wrapper_r2c_mex('IsPlanned', this.objectHandle);
+        end
 
 		
     end
@@ -4,36 +4,21 @@
 
 #include "mex.h"
 #include "class_handle.hpp"
+#include "fftw_wrapper_mex.h"
+#include "pixelconvert.cpp"
+#include "fftw_planner.cpp"
 #include "fftw_wrapper_r2c.cpp"
 #include "number_of_cores.cpp"
 #include <string>
 //#include "gigesource_mex_lib.cpp"
 
 
-void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
+// Commands on an instance of either precision
+template<class R>
+void WrapperCommand(const char* cmd, int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
 {
-    // Get the command string
-    char cmd[64];
-	if (nrhs < 1 || mxGetString(prhs[0], cmd, sizeof(cmd)))
-		mexErrMsgTxt("First input should be a command string less than 64 characters long.");
-        
-    // New
-    if (!strcmp("new", cmd)) {
-        // Check parameters
-        if (nlhs != 1)
-            mexErrMsgTxt("New: One output expected.");
-			
-        // Return a handle to a new C++ instance
-        plhs[0] = convertPtr2Mat<FFTW_Wrapper_R2C>(new FFTW_Wrapper_R2C);
-        return;
-    }
-    
-    // Check there is a second input, which should be the class instance handle
-    if (nrhs < 2)
-		mexErrMsgTxt("Second input should be a class instance handle.");
-
 	// Get the class instance pointer from the second input
-	FFTW_Wrapper_R2C *fftw_instance = convertMat2Ptr<FFTW_Wrapper_R2C>(prhs[1]);
+	FFTW_Wrapper_R2C<R> *fftw_instance = convertMat2Ptr<FFTW_Wrapper_R2C<R> >(prhs[1]);
 
 	// Delete
 	if (!strcmp("delete", cmd)) {
@@ -41,7 +26,7 @@ void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
 		fftw_instance->Shutdown();
 
 		// Destroy the C++ object
-		destroyObject<FFTW_Wrapper_R2C>(prhs[1]);
+		destroyObject<FFTW_Wrapper_R2C<R> >(prhs[1]);
 
 		// Warn if other commands were ignored
 		if (nlhs != 0 || nrhs != 2)
@@ -70,6 +55,17 @@ void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
 		return;
 	}
 
+	// Whether the final plans are in use (rather than background estimates)
+	if (!strcmp("IsPlanned", cmd)) {
+		// Check parameters
+		if (nlhs != 1 || nrhs != 2)
+			mexErrMsgTxt("IsPlanned: Unexpected arguments.");
+
+		// Return it
+		plhs[0] = mxCreateLogicalScalar(fftw_instance->IsPlanned());
+		return;
+	}
+
 
 	// Get image data  
 	if (!strcmp("Transform", cmd)) {
@@ -125,13 +121,13 @@ void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
 		// Create output array
 		plhs[0] = mxCreateNumericMatrix((int)mxGetN(prhs[2]) / 2 + 1,
 										(int)mxGetM(prhs[2]),
-										FFTW_MATLAB_CLASS,
+										FFTW_MatlabClass<R>(),
 										mxCOMPLEX);
-		Real* pOutputR = (Real*)mxGetData(plhs[0]);
-		Real* pOutputI = (Real*)mxGetImagData(plhs[0]);
+		R* pOutputR = (R*)mxGetData(plhs[0]);
+		R* pOutputI = (R*)mxGetImagData(plhs[0]);
 
 		// Extract data
-		Complex* data_out = fftw_instance->GetDataOutPtr();
+		std::complex<R>* data_out = fftw_instance->GetDataOutPtr();
 		for (size_t i = 0; i < mxGetNumberOfElements(plhs[0]); i++)
 		{
 			pOutputR[i] = data_out[i].real();
@@ -147,3 +143,40 @@ void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
     // Got here, so command not recognized
     mexErrMsgTxt("Command not recognized.");
 }
+
+
+void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
+{
+	// Keep the MEX file loaded while plans are made in the background
+	FFTW_PlannerScope planner_scope;
+
+    // Get the command string
+    char cmd[64];
+	if (nrhs < 1 || mxGetString(prhs[0], cmd, sizeof(cmd)))
+		mexErrMsgTxt("First input should be a command string less than 64 characters long.");
+        
+    // New
+    if (!strcmp("new", cmd)) {
+        // Check parameters
+        if (nlhs != 1)
+            mexErrMsgTxt("New: One output expected.");
+			
+        // Return a handle to a new C++ instance
+        plhs[0] = FFTW_NewInstance<FFTW_Wrapper_R2C>(nrhs, prhs, 1);
+        return;
+    }
+    
+    // Planner
+    if (FFTW_PlannerCommand(cmd, nlhs, plhs, nrhs, prhs))
+        return;
+
+    // Check there is a second input, which should be the class instance handle
+    if (nrhs < 2)
+		mexErrMsgTxt("Second input should be a class instance handle.");
+
+	// Commands for the precision of this instance
+	if (isHandleOf<FFTW_Wrapper_R2C<float> >(prhs[1]))
+		WrapperCommand<float>(cmd, nlhs, plhs, nrhs, prhs);
+	else
+		WrapperCommand<double>(cmd, nlhs, plhs, nrhs, prhs);
+}
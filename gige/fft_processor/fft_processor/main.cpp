@@ -104,7 +104,8 @@
 //	return 0;
 //}
 
-int main_sub_test(FFTW_Wrapper_R2C &fftw)
+template<class R>
+int main_sub_test(FFTW_Wrapper_R2C<R> &fftw)
 {
 	// Performance
 	double interval;
@@ -112,18 +113,18 @@ int main_sub_test(FFTW_Wrapper_R2C &fftw)
 	QueryPerformanceFrequency(&frequency);
 
 	// Create arrays
-	Real *testDataIn;
-	Complex *testDataOut;
+	R *testDataIn;
+	std::complex<R> *testDataOut;
 	size_t N = 20;
 	size_t rep = 10;
 	size_t numel_in = fftw.GetSizeIn();
 	size_t numel_out = fftw.GetSizeOut();
-	testDataIn = new Real[N*numel_in];
-	testDataOut = new Complex[N*numel_out];
+	testDataIn = new R[N*numel_in];
+	testDataOut = new std::complex<R>[N*numel_out];
 
 	// Fill source with random data
 	for (size_t i = 0; i < numel_in; i++)
-		testDataIn[i] = (Real)(rand() / float(RAND_MAX));
+		testDataIn[i] = (R)(rand() / float(RAND_MAX));
 
 	// Transforms
 	QueryPerformanceCounter(&start);
@@ -169,7 +170,8 @@ int main_sub_test(FFTW_Wrapper_R2C &fftw)
 	return 0;
 }
 
-int main_sub_test(FFTW_Wrapper_C2C &fftw)
+template<class R>
+int main_sub_test(FFTW_Wrapper_C2C<R> &fftw)
 {
 	// Performance
 	double interval;
@@ -177,18 +179,18 @@ int main_sub_test(FFTW_Wrapper_C2C &fftw)
 	QueryPerformanceFrequency(&frequency);
 
 	// Create arrays
-	Complex *testDataIn;
-	Complex *testDataOut;
+	std::complex<R> *testDataIn;
+	std::complex<R> *testDataOut;
 	size_t N = 20;
 	size_t rep = 10;
 	size_t numel_in = fftw.GetSizeIn();
 	size_t numel_out = fftw.GetSizeOut();
-	testDataIn = new Complex[N*numel_in];
-	testDataOut = new Complex[N*numel_out];
+	testDataIn = new std::complex<R>[N*numel_in];
+	testDataOut = new std::complex<R>[N*numel_out];
 
 	// Fill source with random data
 	for (size_t i = 0; i < numel_in; i++)
-		testDataIn[i] = Complex(rand()/float(RAND_MAX), rand()/float(RAND_MAX));
+		testDataIn[i] = std::complex<R>((R)(rand()/float(RAND_MAX)), (R)(rand()/float(RAND_MAX)));
 
 	// Transforms
 	QueryPerformanceCounter(&start);
@@ -234,14 +236,9 @@ int main_sub_test(FFTW_Wrapper_C2C &fftw)
 	return 0;
 }
 
-int main_sub_prepare()
+template<class R>
+int main_sub_sizes()
 {
-	std::cout << "Setting priority.\n";
-	SetPriorityClass(GetCurrentProcess(), HIGH_PRIORITY_CLASS);
-
-	std::cout << "Waiting 10s.\n";
-	Sleep(10*1000);
-
 	int arr[] = {2, 3, 4, 5, 6, 7, 8, 9, 10, 12, 14, 15, 16, 18, 20, 21, 24, 25, 27, 28, 30, 32, 35, 36, 40, 42, 45, 48, 49, 50, 54, 56, 60, 63, 64, 70, 72, 75, 80, 81, 84, 90, 96, 98, 100, 105, 108, 112, 120, 125, 126, 128, 135, 140, 144, 147, 150, 160, 162, 168, 175, 180, 189, 192, 196, 200, 210, 216, 224, 225, 240, 243, 245, 250, 252, 256, 270, 280, 288, 294, 300, 315, 320, 324, 336, 343, 350, 360, 375, 378, 384, 392, 400, 405, 420, 432, 441, 448, 450, 480, 486, 490, 500, 504, 512, 525, 540, 560, 567, 576, 588, 600, 625, 630, 640, 648, 672, 675, 686, 700, 720, 729, 735, 750, 756, 768, 784, 800, 810, 832, 840, 864, 875, 882, 896, 900, 928, 945, 960, 972, 980, 992, 1000, 1008, 1024, 1056};
 	int N = sizeof(arr) / sizeof(arr[0]);
 	for (int i = 0; i < N; i++)
@@ -252,13 +249,13 @@ int main_sub_prepare()
 		std::cout << "...\t";
 
 		std::cout << "R";
-		FFTW_Wrapper_R2C fftw;
+		FFTW_Wrapper_R2C<R> fftw;
 		fftw.Initialize(arr[i], arr[i]);
 		main_sub_test(fftw);
 		fftw.Shutdown();
 
 		std::cout << "C";
-		FFTW_Wrapper_C2C fftwc;
+		FFTW_Wrapper_C2C<R> fftwc;
 		fftwc.Initialize(arr[i], arr[i]);
 		main_sub_test(fftwc);
 		fftwc.Shutdown();
@@ -285,13 +282,13 @@ int main_sub_prepare()
 		std::cout << "...\t";
 
 		std::cout << "R";
-		FFTW_Wrapper_R2C fftw;
+		FFTW_Wrapper_R2C<R> fftw;
 		fftw.Initialize(arr2[i][0], arr2[i][1]);
 		main_sub_test(fftw);
 		fftw.Shutdown();
 
 		std::cout << "C";
-		FFTW_Wrapper_C2C fftwc;
+		FFTW_Wrapper_C2C<R> fftwc;
 		fftwc.Initialize(arr2[i][0], arr2[i][1]);
 		main_sub_test(fftwc);
 		fftwc.Shutdown();
@@ -302,11 +299,77 @@ int main_sub_prepare()
 	return 0;
 }
 
+template<class R>
+int main_sub_background()
+{
+	// A size the wisdom is unlikely to cover, so a patient plan has to be made
+	size_t width = 1318;
+	size_t height = 1046;
+	FFTW_Planner<R> &planner = FFTW_Planner<R>::Instance();
+	planner.SetBackgroundPlanning(true);
+
+	// First wrapper: estimates, the patient plans are queued
+	DWORD start = GetTickCount();
+	FFTW_Wrapper_R2C<R> first;
+	first.Initialize(width, height);
+	std::cout << "First initialization: " << (GetTickCount() - start) << " ms, ";
+	std::cout << planner.GetNumberOfPendingPlans() << " plans pending.\n";
+
+	// Second wrapper, while the patient plan is being made
+	// (should find the estimates in the cache without waiting)
+	int result = 0;
+	Sleep(100);
+	if (planner.GetNumberOfPendingPlans() > 0)
+	{
+		start = GetTickCount();
+		FFTW_Wrapper_R2C<R> second;
+		second.Initialize(width, height);
+		DWORD elapsed = GetTickCount() - start;
+		bool fast = (elapsed < 1000);
+		std::cout << "Second initialization: " << elapsed << " ms, ";
+		std::cout << (fast ? "OK" : "FAILED") << ".\n";
+		result = fast ? 0 : 1;
+		second.Shutdown();
+	}
+	else
+	{
+		std::cout << "Second initialization: skipped (the wisdom had the plans).\n";
+	}
+
+	// Clean up
+	planner.WaitBackgroundPlanning(INFINITE);
+	planner.SetBackgroundPlanning(false);
+	first.Shutdown();
+	return result;
+}
+
+int main_sub_prepare()
+{
+	std::cout << "Setting priority.\n";
+	SetPriorityClass(GetCurrentProcess(), HIGH_PRIORITY_CLASS);
+
+	std::cout << "Waiting 10s.\n";
+	Sleep(10*1000);
+
+	// Cache lookups during background planning
+	std::cout << "Background planning.\n";
+	main_sub_background<float>();
+
+	// Both precisions, one after the other
+	std::cout << "Single precision.\n";
+	main_sub_sizes<float>();
+
+	std::cout << "Double precision.\n";
+	main_sub_sizes<double>();
+
+	return 0;
+}
+
 //#include "gigesource.cpp"
 //void main_test_interface()
 //{
 //	GigE_Source cam;
-//	FFTProcessor fftp;
+//	FFTProcessor<double> fftp;
 //	std::unique_ptr<std::string> pErrorStr;
 //	std::unique_ptr<PvResult>    pErrorPv;
 //	PvResult resCam;
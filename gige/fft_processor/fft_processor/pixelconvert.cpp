@@ -0,0 +1,516 @@
+// Conversion of camera pixels to the floating point input of the FFT, with
+// optional dark frame subtraction and gain, and run-time selection of the
+// instruction set.
+
+#include "pixelconvert.h"
+
+///////////////////////
+// INSTRUCTION SETS  //
+///////////////////////
+#if defined(_M_X64) || defined(__x86_64__) || defined(_M_IX86) || defined(__i386__)
+	#define PIXELCONVERT_X86
+#endif
+
+#ifdef PIXELCONVERT_X86
+	#if defined(_M_X64) || defined(__SSE2__) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+		#define PIXELCONVERT_BUILD_SSE2
+	#endif
+	#if defined(__GNUC__) || defined(_MSC_VER)
+		#define PIXELCONVERT_BUILD_AVX2
+	#endif
+	#if defined(__GNUC__) || (defined(_MSC_VER) && _MSC_VER >= 1911)
+		#define PIXELCONVERT_BUILD_AVX512
+	#endif
+
+	#ifdef _MSC_VER
+		#include <intrin.h>
+	#endif
+	#include <immintrin.h>
+#endif
+
+// GCC only compiles AVX code in functions that ask for it; MSVC always does
+#if defined(__GNUC__)
+	#define PIXELCONVERT_TARGET_AVX2   __attribute__((target("avx2")))
+	#define PIXELCONVERT_TARGET_AVX512 __attribute__((target("avx512f,avx2")))
+#else
+	#define PIXELCONVERT_TARGET_AVX2
+	#define PIXELCONVERT_TARGET_AVX512
+#endif
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Scalar kernels (reference, and tails of the vector kernels)
+////////////////////////////////////////////////////////////////////////////////
+template<class D, bool C>
+inline D CorrectPixel(uint32_t value, const float* dark, const float* gain, size_t i)
+{
+	if (C)
+		return ((D)value - (D)dark[i]) * (D)gain[i];
+	else
+		return (D)value;
+}
+
+template<class D, bool C>
+void ConvertMono8_Scalar(const uint8_t* source, D* target, size_t numel, const float* dark, const float* gain)
+{
+	for (size_t i = 0; i < numel; i++)
+		target[i] = CorrectPixel<D, C>(source[i], dark, gain, i);
+}
+
+template<class D, bool C>
+void ConvertMono16_Scalar(const uint8_t* source, D* target, size_t numel, const float* dark, const float* gain)
+{
+	const uint16_t* source16 = (const uint16_t*)source;
+	for (size_t i = 0; i < numel; i++)
+		target[i] = CorrectPixel<D, C>(source16[i], dark, gain, i);
+}
+
+inline void UnpackMono12Pair(const uint8_t* source, uint32_t& p0, uint32_t& p1)
+{
+	// Byte 0: p0 bits 11..4; byte 1: p0 bits 3..0 (low nibble) and p1 bits
+	// 3..0 (high nibble); byte 2: p1 bits 11..4
+	p0 = ((uint32_t)source[0] << 4) | (source[1] & 0x0F);
+	p1 = ((uint32_t)source[2] << 4) | (source[1] >> 4);
+}
+
+template<class D, bool C>
+void ConvertMono12Packed_Scalar(const uint8_t* source, D* target, size_t numel, const float* dark, const float* gain)
+{
+	uint32_t p0, p1;
+	size_t i = 0;
+	for (; i + 2 <= numel; i += 2, source += 3)
+	{
+		UnpackMono12Pair(source, p0, p1);
+		target[i]     = CorrectPixel<D, C>(p0, dark, gain, i);
+		target[i + 1] = CorrectPixel<D, C>(p1, dark, gain, i + 1);
+	}
+	if (i < numel)
+		target[i] = CorrectPixel<D, C>(((uint32_t)source[0] << 4) | (source[1] & 0x0F), dark, gain, i);
+}
+
+// Offset of the dark/gain arrays for the tails (they are NULL without correction)
+inline const float* OffsetCorrection(const float* p, size_t i)
+{
+	return (p != NULL) ? p + i : NULL;
+}
+
+
+#ifdef PIXELCONVERT_BUILD_SSE2
+////////////////////////////////////////////////////////////////////////////////
+// SSE2 kernels, 4 pixels per vector
+////////////////////////////////////////////////////////////////////////////////
+template<bool C>
+inline void Store4_Sse2(__m128i v, float* target, const float* dark, const float* gain, size_t i)
+{
+	__m128 f = _mm_cvtepi32_ps(v);
+	if (C)
+		f = _mm_mul_ps(_mm_sub_ps(f, _mm_loadu_ps(dark + i)), _mm_loadu_ps(gain + i));
+	_mm_storeu_ps(target + i, f);
+}
+
+template<bool C>
+inline void Store4_Sse2(__m128i v, double* target, const float* dark, const float* gain, size_t i)
+{
+	__m128d lo = _mm_cvtepi32_pd(v);
+	__m128d hi = _mm_cvtepi32_pd(_mm_srli_si128(v, 8));
+	if (C)
+	{
+		__m128 d = _mm_loadu_ps(dark + i);
+		__m128 g = _mm_loadu_ps(gain + i);
+		lo = _mm_mul_pd(_mm_sub_pd(lo, _mm_cvtps_pd(d)), _mm_cvtps_pd(g));
+		hi = _mm_mul_pd(_mm_sub_pd(hi, _mm_cvtps_pd(_mm_movehl_ps(d, d))), _mm_cvtps_pd(_mm_movehl_ps(g, g)));
+	}
+	_mm_storeu_pd(target + i, lo);
+	_mm_storeu_pd(target + i + 2, hi);
+}
+
+template<class D, bool C>
+inline void Store8_Sse2(__m128i v16, D* target, const float* dark, const float* gain, size_t i)
+{
+	const __m128i zero = _mm_setzero_si128();
+	Store4_Sse2<C>(_mm_unpacklo_epi16(v16, zero), target, dark, gain, i);
+	Store4_Sse2<C>(_mm_unpackhi_epi16(v16, zero), target, dark, gain, i + 4);
+}
+
+template<class D, bool C>
+void ConvertMono8_Sse2(const uint8_t* source, D* target, size_t numel, const float* dark, const float* gain)
+{
+	const __m128i zero = _mm_setzero_si128();
+	size_t i = 0;
+	for (; i + 16 <= numel; i += 16)
+	{
+		__m128i v8 = _mm_loadu_si128((const __m128i*)(source + i));
+		Store8_Sse2<D, C>(_mm_unpacklo_epi8(v8, zero), target, dark, gain, i);
+		Store8_Sse2<D, C>(_mm_unpackhi_epi8(v8, zero), target, dark, gain, i + 8);
+	}
+	ConvertMono8_Scalar<D, C>(source + i, target + i, numel - i, OffsetCorrection(dark, i), OffsetCorrection(gain, i));
+}
+
+template<class D, bool C>
+void ConvertMono16_Sse2(const uint8_t* source, D* target, size_t numel, const float* dark, const float* gain)
+{
+	const uint16_t* source16 = (const uint16_t*)source;
+	size_t i = 0;
+	for (; i + 8 <= numel; i += 8)
+		Store8_Sse2<D, C>(_mm_loadu_si128((const __m128i*)(source16 + i)), target, dark, gain, i);
+	ConvertMono16_Scalar<D, C>((const uint8_t*)(source16 + i), target + i, numel - i, OffsetCorrection(dark, i), OffsetCorrection(gain, i));
+}
+
+template<class D, bool C>
+void ConvertMono12Packed_Sse2(const uint8_t* source, D* target, size_t numel, const float* dark, const float* gain)
+{
+	// SSE2 has no byte shuffle; unpacking to 16 bits first and converting
+	// that with the Mono16 kernel measured slower than the scalar loop
+	ConvertMono12Packed_Scalar<D, C>(source, target, numel, dark, gain);
+}
+#endif
+
+
+#ifdef PIXELCONVERT_BUILD_AVX2
+////////////////////////////////////////////////////////////////////////////////
+// AVX2 kernels, 8 pixels per vector
+////////////////////////////////////////////////////////////////////////////////
+template<bool C>
+PIXELCONVERT_TARGET_AVX2 inline void Store8_Avx2(__m256i v, float* target, const float* dark, const float* gain, size_t i)
+{
+	__m256 f = _mm256_cvtepi32_ps(v);
+	if (C)
+		f = _mm256_mul_ps(_mm256_sub_ps(f, _mm256_loadu_ps(dark + i)), _mm256_loadu_ps(gain + i));
+	_mm256_storeu_ps(target + i, f);
+}
+
+template<bool C>
+PIXELCONVERT_TARGET_AVX2 inline void Store8_Avx2(__m256i v, double* target, const float* dark, const float* gain, size_t i)
+{
+	__m256d lo = _mm256_cvtepi32_pd(_mm256_castsi256_si128(v));
+	__m256d hi = _mm256_cvtepi32_pd(_mm256_extracti128_si256(v, 1));
+	if (C)
+	{
+		lo = _mm256_mul_pd(_mm256_sub_pd(lo, _mm256_cvtps_pd(_mm_loadu_ps(dark + i))),     _mm256_cvtps_pd(_mm_loadu_ps(gain + i)));
+		hi = _mm256_mul_pd(_mm256_sub_pd(hi, _mm256_cvtps_pd(_mm_loadu_ps(dark + i + 4))), _mm256_cvtps_pd(_mm_loadu_ps(gain + i + 4)));
+	}
+	_mm256_storeu_pd(target + i, lo);
+	_mm256_storeu_pd(target + i + 4, hi);
+}
+
+// 8 Mono12Packed pixels (12 bytes, 16 are read) to 8 words
+PIXELCONVERT_TARGET_AVX2 inline __m128i UnpackMono12x8_Avx2(const uint8_t* source)
+{
+	// Pair j is in bytes 3j..3j+2; even pixels get the word (b0, b1), odd
+	// pixels the word (b1, b2)
+	const __m128i shuffle = _mm_setr_epi8(0, 1, 1, 2, 3, 4, 4, 5, 6, 7, 7, 8, 9, 10, 10, 11);
+	__m128i w = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)source), shuffle);
+
+	// Even: (b0 << 4) | (b1 & 0xF); odd: (b2 << 4) | (b1 >> 4)
+	__m128i even = _mm_or_si128(_mm_and_si128(_mm_slli_epi16(w, 4), _mm_set1_epi32(0x00000FF0)),
+	                            _mm_and_si128(_mm_srli_epi16(w, 8), _mm_set1_epi32(0x0000000F)));
+	__m128i odd  = _mm_and_si128(_mm_srli_epi16(w, 4), _mm_set1_epi32((int)0xFFFF0000));
+	return _mm_or_si128(even, odd);
+}
+
+template<class D, bool C>
+PIXELCONVERT_TARGET_AVX2 void ConvertMono8_Avx2(const uint8_t* source, D* target, size_t numel, const float* dark, const float* gain)
+{
+	size_t i = 0;
+	for (; i + 16 <= numel; i += 16)
+	{
+		__m128i v8 = _mm_loadu_si128((const __m128i*)(source + i));
+		Store8_Avx2<C>(_mm256_cvtepu8_epi32(v8), target, dark, gain, i);
+		Store8_Avx2<C>(_mm256_cvtepu8_epi32(_mm_srli_si128(v8, 8)), target, dark, gain, i + 8);
+	}
+	ConvertMono8_Scalar<D, C>(source + i, target + i, numel - i, OffsetCorrection(dark, i), OffsetCorrection(gain, i));
+}
+
+template<class D, bool C>
+PIXELCONVERT_TARGET_AVX2 void ConvertMono16_Avx2(const uint8_t* source, D* target, size_t numel, const float* dark, const float* gain)
+{
+	const uint16_t* source16 = (const uint16_t*)source;
+	size_t i = 0;
+	for (; i + 16 <= numel; i += 16)
+	{
+		__m256i v16 = _mm256_loadu_si256((const __m256i*)(source16 + i));
+		Store8_Avx2<C>(_mm256_cvtepu16_epi32(_mm256_castsi256_si128(v16)), target, dark, gain, i);
+		Store8_Avx2<C>(_mm256_cvtepu16_epi32(_mm256_extracti128_si256(v16, 1)), target, dark, gain, i + 8);
+	}
+	ConvertMono16_Scalar<D, C>((const uint8_t*)(source16 + i), target + i, numel - i, OffsetCorrection(dark, i), OffsetCorrection(gain, i));
+}
+
+template<class D, bool C>
+PIXELCONVERT_TARGET_AVX2 void ConvertMono12Packed_Avx2(const uint8_t* source, D* target, size_t numel, const float* dark, const float* gain)
+{
+	// 16 pixels (24 bytes) per iteration; the second load reads up to byte
+	// 28, so keep enough pixels for the scalar tail
+	size_t i = 0;
+	for (; i + 20 <= numel; i += 16)
+	{
+		const uint8_t* s = source + (i / 2) * 3;
+		Store8_Avx2<C>(_mm256_cvtepu16_epi32(UnpackMono12x8_Avx2(s)), target, dark, gain, i);
+		Store8_Avx2<C>(_mm256_cvtepu16_epi32(UnpackMono12x8_Avx2(s + 12)), target, dark, gain, i + 8);
+	}
+	ConvertMono12Packed_Scalar<D, C>(source + (i / 2) * 3, target + i, numel - i, OffsetCorrection(dark, i), OffsetCorrection(gain, i));
+}
+#endif
+
+
+#ifdef PIXELCONVERT_BUILD_AVX512
+////////////////////////////////////////////////////////////////////////////////
+// AVX-512 kernels, 16 pixels per vector
+////////////////////////////////////////////////////////////////////////////////
+template<bool C>
+PIXELCONVERT_TARGET_AVX512 inline void Store16_Avx512(__m512i v, float* target, const float* dark, const float* gain, size_t i)
+{
+	__m512 f = _mm512_cvtepi32_ps(v);
+	if (C)
+		f = _mm512_mul_ps(_mm512_sub_ps(f, _mm512_loadu_ps(dark + i)), _mm512_loadu_ps(gain + i));
+	_mm512_storeu_ps(target + i, f);
+}
+
+template<bool C>
+PIXELCONVERT_TARGET_AVX512 inline void Store16_Avx512(__m512i v, double* target, const float* dark, const float* gain, size_t i)
+{
+	__m512d lo = _mm512_cvtepi32_pd(_mm512_castsi512_si256(v));
+	__m512d hi = _mm512_cvtepi32_pd(_mm512_extracti64x4_epi64(v, 1));
+	if (C)
+	{
+		lo = _mm512_mul_pd(_mm512_sub_pd(lo, _mm512_cvtps_pd(_mm256_loadu_ps(dark + i))),     _mm512_cvtps_pd(_mm256_loadu_ps(gain + i)));
+		hi = _mm512_mul_pd(_mm512_sub_pd(hi, _mm512_cvtps_pd(_mm256_loadu_ps(dark + i + 8))), _mm512_cvtps_pd(_mm256_loadu_ps(gain + i + 8)));
+	}
+	_mm512_storeu_pd(target + i, lo);
+	_mm512_storeu_pd(target + i + 8, hi);
+}
+
+PIXELCONVERT_TARGET_AVX512 inline __m128i UnpackMono12x8_Avx512(const uint8_t* source)
+{
+	// Same as UnpackMono12x8_Avx2, compiled for this target
+	const __m128i shuffle = _mm_setr_epi8(0, 1, 1, 2, 3, 4, 4, 5, 6, 7, 7, 8, 9, 10, 10, 11);
+	__m128i w = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)source), shuffle);
+	__m128i even = _mm_or_si128(_mm_and_si128(_mm_slli_epi16(w, 4), _mm_set1_epi32(0x00000FF0)),
+	                            _mm_and_si128(_mm_srli_epi16(w, 8), _mm_set1_epi32(0x0000000F)));
+	__m128i odd  = _mm_and_si128(_mm_srli_epi16(w, 4), _mm_set1_epi32((int)0xFFFF0000));
+	return _mm_or_si128(even, odd);
+}
+
+template<class D, bool C>
+PIXELCONVERT_TARGET_AVX512 void ConvertMono8_Avx512(const uint8_t* source, D* target, size_t numel, const float* dark, const float* gain)
+{
+	size_t i = 0;
+	for (; i + 16 <= numel; i += 16)
+		Store16_Avx512<C>(_mm512_cvtepu8_epi32(_mm_loadu_si128((const __m128i*)(source + i))), target, dark, gain, i);
+	ConvertMono8_Scalar<D, C>(source + i, target + i, numel - i, OffsetCorrection(dark, i), OffsetCorrection(gain, i));
+}
+
+template<class D, bool C>
+PIXELCONVERT_TARGET_AVX512 void ConvertMono16_Avx512(const uint8_t* source, D* target, size_t numel, const float* dark, const float* gain)
+{
+	const uint16_t* source16 = (const uint16_t*)source;
+	size_t i = 0;
+	for (; i + 16 <= numel; i += 16)
+		Store16_Avx512<C>(_mm512_cvtepu16_epi32(_mm256_loadu_si256((const __m256i*)(source16 + i))), target, dark, gain, i);
+	ConvertMono16_Scalar<D, C>((const uint8_t*)(source16 + i), target + i, numel - i, OffsetCorrection(dark, i), OffsetCorrection(gain, i));
+}
+
+template<class D, bool C>
+PIXELCONVERT_TARGET_AVX512 void ConvertMono12Packed_Avx512(const uint8_t* source, D* target, size_t numel, const float* dark, const float* gain)
+{
+	// 16 pixels (24 bytes) per iteration, see ConvertMono12Packed_Avx2
+	size_t i = 0;
+	for (; i + 20 <= numel; i += 16)
+	{
+		const uint8_t* s = source + (i / 2) * 3;
+		__m256i v16 = _mm256_inserti128_si256(_mm256_castsi128_si256(UnpackMono12x8_Avx512(s)), UnpackMono12x8_Avx512(s + 12), 1);
+		Store16_Avx512<C>(_mm512_cvtepu16_epi32(v16), target, dark, gain, i);
+	}
+	ConvertMono12Packed_Scalar<D, C>(source + (i / 2) * 3, target + i, numel - i, OffsetCorrection(dark, i), OffsetCorrection(gain, i));
+}
+#endif
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Kernel tables
+////////////////////////////////////////////////////////////////////////////////
+template<class D>
+struct PixelKernels
+{
+	typedef void(*Kernel)(const uint8_t*, D*, size_t, const float*, const float*);
+
+	// [format][with correction]
+	Kernel kernels[PIXEL_FORMAT_COUNT][2];
+};
+
+#define PIXELCONVERT_TABLE(D, ISA) \
+	{ { { ConvertMono8_##ISA<D, false>,        ConvertMono8_##ISA<D, true> }, \
+	    { ConvertMono16_##ISA<D, false>,       ConvertMono16_##ISA<D, true> }, \
+	    { ConvertMono12Packed_##ISA<D, false>, ConvertMono12Packed_##ISA<D, true> }, \
+	    { ConvertMono16_##ISA<D, false>,       ConvertMono16_##ISA<D, true> } } }
+
+template<class D>
+const PixelKernels<D>& GetPixelKernels(PixelConvertISA isa)
+{
+	static const PixelKernels<D> scalar = PIXELCONVERT_TABLE(D, Scalar);
+	#ifdef PIXELCONVERT_BUILD_SSE2
+		static const PixelKernels<D> sse2 = PIXELCONVERT_TABLE(D, Sse2);
+	#endif
+	#ifdef PIXELCONVERT_BUILD_AVX2
+		static const PixelKernels<D> avx2 = PIXELCONVERT_TABLE(D, Avx2);
+	#endif
+	#ifdef PIXELCONVERT_BUILD_AVX512
+		static const PixelKernels<D> avx512 = PIXELCONVERT_TABLE(D, Avx512);
+	#endif
+
+	switch (isa)
+	{
+	#ifdef PIXELCONVERT_BUILD_AVX512
+		case PIXELCONVERT_AVX512: return avx512;
+	#endif
+	#ifdef PIXELCONVERT_BUILD_AVX2
+		case PIXELCONVERT_AVX2:   return avx2;
+	#endif
+	#ifdef PIXELCONVERT_BUILD_SSE2
+		case PIXELCONVERT_SSE2:   return sse2;
+	#endif
+	default:                      return scalar;
+	}
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// CPU detection
+////////////////////////////////////////////////////////////////////////////////
+PixelConvertISA DetectPixelConvertISA()
+{
+	PixelConvertISA isa = PIXELCONVERT_SCALAR;
+
+	#ifdef PIXELCONVERT_BUILD_SSE2
+		isa = PIXELCONVERT_SSE2;
+	#endif
+
+	#if defined(PIXELCONVERT_X86) && defined(__GNUC__)
+		// The compiler runtime also checks that the OS saves the registers
+		__builtin_cpu_init();
+		#ifdef PIXELCONVERT_BUILD_AVX2
+			if (__builtin_cpu_supports("avx2"))
+				isa = PIXELCONVERT_AVX2;
+		#endif
+		#ifdef PIXELCONVERT_BUILD_AVX512
+			if (__builtin_cpu_supports("avx512f"))
+				isa = PIXELCONVERT_AVX512;
+		#endif
+	#elif defined(PIXELCONVERT_X86) && defined(_MSC_VER)
+		// CPU features
+		int info[4];
+		__cpuid(info, 0);
+		int maxLeaf = info[0];
+		__cpuid(info, 1);
+		bool osxsave = (info[2] & (1 << 27)) != 0;
+		bool avx = (info[2] & (1 << 28)) != 0;
+		bool avx2 = false;
+		bool avx512 = false;
+		if (maxLeaf >= 7)
+		{
+			__cpuidex(info, 7, 0);
+			avx2 = (info[1] & (1 << 5)) != 0;
+			avx512 = (info[1] & (1 << 16)) != 0;
+		}
+
+		// Registers saved by the OS (XMM/YMM, and opmask/ZMM for AVX-512)
+		unsigned long long xcr0 = osxsave ? _xgetbv(0) : 0;
+		#ifdef PIXELCONVERT_BUILD_AVX2
+			if (avx && avx2 && (xcr0 & 0x06) == 0x06)
+				isa = PIXELCONVERT_AVX2;
+		#endif
+		#ifdef PIXELCONVERT_BUILD_AVX512
+			if (avx && avx2 && avx512 && (xcr0 & 0xE6) == 0xE6)
+				isa = PIXELCONVERT_AVX512;
+		#endif
+	#endif
+
+	return isa;
+}
+
+// Chosen once, when the module is loaded
+static PixelConvertISA PixelConvertMaxISA = DetectPixelConvertISA();
+static PixelConvertISA PixelConvertCurrentISA = PixelConvertMaxISA;
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Public functions
+////////////////////////////////////////////////////////////////////////////////
+PixelFormat GetPixelFormat(uint32_t bpp)
+{
+	switch (bpp)
+	{
+	case 8:  return PIXEL_FORMAT_MONO8;
+	case 12: return PIXEL_FORMAT_MONO12_PACKED;
+	case 16: return PIXEL_FORMAT_MONO16;
+	default: return PIXEL_FORMAT_UNKNOWN;
+	}
+}
+
+size_t GetPixelFormatSize(PixelFormat format, size_t numel)
+{
+	switch (format)
+	{
+	case PIXEL_FORMAT_MONO8:         return numel;
+	case PIXEL_FORMAT_MONO12:        return numel * 2;
+	case PIXEL_FORMAT_MONO12_PACKED: return (numel * 3 + 1) / 2;
+	case PIXEL_FORMAT_MONO16:        return numel * 2;
+	default:                         return 0;
+	}
+}
+
+template<class D>
+bool ConvertPixelsDispatch(PixelFormat format, const uint8_t* source, size_t numel, D* target, const float* dark, const float* gain)
+{
+	if (format >= PIXEL_FORMAT_COUNT)
+		return false;
+
+	bool correct = (dark != NULL) && (gain != NULL);
+	GetPixelKernels<D>(PixelConvertCurrentISA).kernels[format][correct ? 1 : 0](source, target, numel, dark, gain);
+	return true;
+}
+
+bool ConvertPixels(PixelFormat format, const uint8_t* source, size_t numel, float* target, const float* dark, const float* gain)
+{
+	return ConvertPixelsDispatch(format, source, numel, target, dark, gain);
+}
+
+bool ConvertPixels(PixelFormat format, const uint8_t* source, size_t numel, double* target, const float* dark, const float* gain)
+{
+	return ConvertPixelsDispatch(format, source, numel, target, dark, gain);
+}
+
+PixelConvertISA GetPixelConvertMaxISA()
+{
+	return PixelConvertMaxISA;
+}
+
+PixelConvertISA GetPixelConvertISA()
+{
+	return PixelConvertCurrentISA;
+}
+
+bool SetPixelConvertISA(PixelConvertISA isa)
+{
+	if (isa > PixelConvertMaxISA)
+		return false;
+
+	#ifndef PIXELCONVERT_BUILD_SSE2
+		if (isa == PIXELCONVERT_SSE2)
+			return false;
+	#endif
+
+	PixelConvertCurrentISA = isa;
+	return true;
+}
+
+const char* GetPixelConvertISAName(PixelConvertISA isa)
+{
+	switch (isa)
+	{
+	case PIXELCONVERT_SCALAR: return "scalar";
+	case PIXELCONVERT_SSE2:   return "SSE2";
+	case PIXELCONVERT_AVX2:   return "AVX2";
+	case PIXELCONVERT_AVX512: return "AVX-512";
+	default:                  return "unknown";
+	}
+}
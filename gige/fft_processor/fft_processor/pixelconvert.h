@@ -0,0 +1,82 @@
+////////////////////////////////////////////////////////////////////////////////
+// Filename: pixelconvert.h
+// Conversion of camera pixels (Mono8, Mono12, Mono12Packed, Mono16) to the
+// floating point input of the FFT, with optional dark frame subtraction and
+// gain in the same pass:
+//     target[i] = (pixel[i] - dark[i]) * gain[i]
+// The kernels exist in scalar, SSE2, AVX2 and AVX-512 versions; the best one
+// that both the build and the CPU support is picked when the program starts.
+// Any other source type (e.g. from MATLAB arrays) goes through a plain
+// element-wise copy.
+////////////////////////////////////////////////////////////////////////////////
+#ifndef _PIXELCONVERT_H_
+#define _PIXELCONVERT_H_
+
+//////////////
+// INCLUDES //
+//////////////
+#include <stdint.h>
+#include <stddef.h>
+#include <algorithm>
+
+/////////////
+// GLOBALS //
+/////////////
+enum PixelFormat
+{
+	PIXEL_FORMAT_MONO8,
+	PIXEL_FORMAT_MONO12,			// 12 bits in 16-bit words
+	PIXEL_FORMAT_MONO12_PACKED,		// GigE Vision: 2 pixels in 3 bytes
+	PIXEL_FORMAT_MONO16,
+	PIXEL_FORMAT_COUNT,
+	PIXEL_FORMAT_UNKNOWN = PIXEL_FORMAT_COUNT
+};
+
+enum PixelConvertISA
+{
+	PIXELCONVERT_SCALAR,
+	PIXELCONVERT_SSE2,
+	PIXELCONVERT_AVX2,
+	PIXELCONVERT_AVX512,
+	PIXELCONVERT_ISA_COUNT
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// Conversion
+////////////////////////////////////////////////////////////////////////////////
+// Format of a frame, from its bits per pixel (8, 12 = packed, 16)
+PixelFormat		GetPixelFormat(uint32_t);
+// Bytes taken by a number of pixels
+size_t			GetPixelFormatSize(PixelFormat, size_t);
+
+// Convert a number of pixels; dark and gain are either both given (one value
+// per pixel) or both NULL. Returns false for an unknown format.
+bool			ConvertPixels(PixelFormat, const uint8_t*, size_t, float*, const float* = NULL, const float* = NULL);
+bool			ConvertPixels(PixelFormat, const uint8_t*, size_t, double*, const float* = NULL, const float* = NULL);
+
+////////////////////////////////////////////////////////////////////////////////
+// Dispatch
+////////////////////////////////////////////////////////////////////////////////
+// Best instruction set supported by the build and by this CPU
+PixelConvertISA	GetPixelConvertMaxISA();
+// Instruction set in use
+PixelConvertISA	GetPixelConvertISA();
+// Force an instruction set (for testing); fails if it is not supported
+bool			SetPixelConvertISA(PixelConvertISA);
+const char*		GetPixelConvertISAName(PixelConvertISA);
+
+////////////////////////////////////////////////////////////////////////////////
+// Typed conversion, for the SetDataIn templates
+////////////////////////////////////////////////////////////////////////////////
+template<class S, class D>
+inline void ConvertPixels(const S* source, D* target, size_t numel)
+{
+	std::copy(&source[0], &source[numel], target);
+}
+
+inline void ConvertPixels(const uint16_t* source, double* target, size_t numel) { ConvertPixels(PIXEL_FORMAT_MONO16, (const uint8_t*)source, numel, target); }
+inline void ConvertPixels(const uint16_t* source, float* target, size_t numel)  { ConvertPixels(PIXEL_FORMAT_MONO16, (const uint8_t*)source, numel, target); }
+inline void ConvertPixels(const uint8_t* source, double* target, size_t numel)  { ConvertPixels(PIXEL_FORMAT_MONO8, source, numel, target); }
+inline void ConvertPixels(const uint8_t* source, float* target, size_t numel)   { ConvertPixels(PIXEL_FORMAT_MONO8, source, numel, target); }
+
+#endif
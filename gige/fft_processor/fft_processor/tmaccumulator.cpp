@@ -0,0 +1,397 @@
+// The TMAccumulator class builds a transmission matrix from the output of an
+// FFTProcessor while it is being measured.
+
+#include "tmaccumulator.h"
+#include "blas.h"
+
+// Complex matrix product C += A*B' (BLAS from MATLAB, linked with -lmwblas)
+template<class R>
+struct TMBlas;
+
+template<>
+struct TMBlas<float>
+{
+	static void AddProductAdjoint(ptrdiff_t m, ptrdiff_t n, ptrdiff_t k, complex<float>* a, complex<float>* b, complex<float>* c)
+	{
+		char  transa = 'N';
+		char  transb = 'C';
+		float one[2] = { 1.0f, 0.0f };
+		cgemm(&transa, &transb, &m, &n, &k, one, (float*)a, &m, (float*)b, &n, one, (float*)c, &m);
+	}
+};
+
+template<>
+struct TMBlas<double>
+{
+	static void AddProductAdjoint(ptrdiff_t m, ptrdiff_t n, ptrdiff_t k, complex<double>* a, complex<double>* b, complex<double>* c)
+	{
+		char   transa = 'N';
+		char   transb = 'C';
+		double one[2] = { 1.0, 0.0 };
+		zgemm(&transa, &transb, &m, &n, &k, one, (double*)a, &m, (double*)b, &n, one, (double*)c, &m);
+	}
+};
+
+template<class R>
+TMAccumulator<R>::TMAccumulator() : NumberOfReceived(0), Errors(TMACC_ERROR_QUEUE_SIZE)
+{
+	pSource = NULL;
+	Thread = NULL;
+	Rows = 0;
+	Columns = 0;
+	BatchCount = 0;
+	Started = false;
+}
+
+template<class R>
+TMAccumulator<R>::~TMAccumulator()
+{
+	Shutdown();
+}
+
+template<class R>
+bool TMAccumulator<R>::Initialize(FFTProcessor<R>* source_ptr, const vector<int64_t>& columns, size_t number_of_columns, TMBasis basis)
+{
+	// Save inputs
+	pSource = source_ptr;
+	Basis = basis;
+	Rows = pSource->GetNumberOfCoefficients();
+	Columns = number_of_columns;
+	ColumnMap = columns;
+
+	// Check the basis
+	if (Columns == 0 || ColumnMap.empty())
+	{
+		PushError(std::string("Initialize failed: empty sequence."));
+		return false;
+	}
+	if (Basis == TM_BASIS_HADAMARD && (Columns & (Columns - 1)) != 0)
+	{
+		PushError(std::string("Initialize failed: the size of a Hadamard basis must be a power of 2."));
+		return false;
+	}
+
+	// Check the column map, and give the calibration frames their place
+	CalibrationIndex.assign(ColumnMap.size(), 0);
+	size_t calibration_frames = 0;
+	for (size_t i = 0; i < ColumnMap.size(); i++)
+	{
+		if (ColumnMap[i] == TMACC_CALIBRATION)
+			CalibrationIndex[i] = calibration_frames++;
+		else if (ColumnMap[i] < 0 || (size_t)ColumnMap[i] >= Columns)
+		{
+			PushError(std::string("Initialize failed: column ") + std::to_string(ColumnMap[i]) + std::string(" out of range."));
+			return false;
+		}
+	}
+
+	// Allocate everything now, so that nothing is allocated while measuring
+	try
+	{
+		Matrix.assign(Rows * Columns, Complex(0, 0));
+		Calibration.assign(Rows * calibration_frames, Complex(0, 0));
+		Timestamps.assign(ColumnMap.size(), 0);
+		if (Basis != TM_BASIS_UNIT)
+		{
+			BatchOutputs.assign(Rows * TMACC_BATCH_SIZE, Complex(0, 0));
+			BatchBasis.assign(Columns * TMACC_BATCH_SIZE, Complex(0, 0));
+		}
+	}
+	catch (std::bad_alloc&)
+	{
+		PushError(std::string("Initialize failed: not enough memory for a ") + std::to_string(Rows) + std::string("x") + std::to_string(Columns) + std::string(" matrix."));
+		return false;
+	}
+	BatchCount = 0;
+	NumberOfReceived = 0;
+	Started = false;
+
+	// Start thread
+	StopFlag = false;
+	Done = false;
+	Thread = CreateThread(NULL, 0, AccumulatorStaticStart, (void*)this, 0, NULL);
+	if (Thread == NULL)
+	{
+		PushError(std::string("CreateThread failed with code ") + std::to_string(GetLastError()));
+		return false;
+	}
+
+	// Return
+	return true;
+}
+
+template<class R>
+void TMAccumulator<R>::Shutdown()
+{
+	// Stop the thread; it applies the last batch on the way out
+	if (Thread != NULL)
+	{
+		StopFlag = true;
+		DWORD WaitResult = WaitForSingleObject(Thread, 10000);
+		if (WaitResult != WAIT_OBJECT_0)
+			MessageBox(NULL, "Accumulator thread does not respond.", "Error", MB_OK | MB_ICONERROR);
+		CloseHandle(Thread);
+		Thread = NULL;
+	}
+}
+
+template<class R>
+DWORD WINAPI TMAccumulator<R>::AccumulatorStaticStart(LPVOID lpParams)
+{
+	TMAccumulator* accumulator = (TMAccumulator*)lpParams;
+	return accumulator->AccumulateContinuously();
+}
+
+template<class R>
+DWORD TMAccumulator<R>::AccumulateContinuously()
+{
+	Extract extract;
+
+	// Take the extracts as they come, until the end of the sequence
+	while (!StopFlag && !Done)
+	{
+		if (!pSource->GetImage(extract))
+		{
+			pSource->WaitImages(1, 100);
+			continue;
+		}
+		if (!AddFrame(extract))
+			PushError("Accumulate operation failed.");
+	}
+
+	// Last columns
+	FlushBatch();
+	Done = true;
+
+	// The last extract goes back to the processor's pool
+	pSource->ReleaseImage(extract);
+
+	// Leave
+	return EXIT_SUCCESS;
+}
+
+template<class R>
+bool TMAccumulator<R>::NextPosition(uint64_t id)
+{
+	// The first frame starts the sequence
+	if (!Started)
+	{
+		Started = true;
+		LastBlockId = id;
+		Position = 0;
+		return true;
+	}
+
+	// Without block IDs, count the frames
+	uint64_t step;
+	if (id == 0 || LastBlockId == 0)
+		step = 1;
+	else if (LastBlockId <= TMACC_BLOCKID_16BIT_MAX && id <= TMACC_BLOCKID_16BIT_MAX)
+	{
+		// 16-bit IDs skip zero when they wrap around, and a long way
+		// forward is more likely a step back
+		step = (id + TMACC_BLOCKID_16BIT_MAX - LastBlockId) % TMACC_BLOCKID_16BIT_MAX;
+		if (step == 0 || step > TMACC_BLOCKID_16BIT_MAX / 2)
+			step = 0;
+	}
+	else
+		step = (id > LastBlockId) ? id - LastBlockId : 0;
+
+	if (step == 0)
+	{
+		PushError(std::string("NextPosition failed: block ID went back from ") + std::to_string(LastBlockId) + std::string(" to ") + std::to_string(id) + std::string("."));
+		return false;
+	}
+	LastBlockId = id;
+	Position += step;
+	return true;
+}
+
+template<class R>
+void TMAccumulator<R>::CopyColumn(Complex* out, const Extract& extract)
+{
+	if (extract.planar)
+	{
+		for (size_t i = 0; i < Rows; i++)
+			out[i] = Complex(extract.real[i], extract.imag[i]);
+	}
+	else
+		memcpy(out, extract.coefficients.data(), Rows * sizeof(Complex));
+}
+
+template<class R>
+bool TMAccumulator<R>::AddFrame(const Extract& extract)
+{
+	// Check size
+	size_t size = extract.planar ? extract.real.size() : extract.coefficients.size();
+	if (size != Rows)
+	{
+		PushError(std::string("AddFrame failed: the image has ") + std::to_string(size) + std::string(" coefficients instead of ") + std::to_string(Rows) + std::string("."));
+		return false;
+	}
+
+	// Position in the sequence
+	if (!NextPosition(extract.blockId))
+		return false;
+	if (Position >= ColumnMap.size())
+	{
+		PushError(std::string("AddFrame failed: frames are missing at the end of the sequence."));
+		Done = true;
+		return false;
+	}
+	size_t n = (size_t)Position;
+	Timestamps[n] = extract.timestamp;
+
+	// Calibration frames are kept as they are
+	int64_t column = ColumnMap[n];
+	if (column == TMACC_CALIBRATION)
+		CopyColumn(&Calibration[CalibrationIndex[n] * Rows], extract);
+
+	// Single pixels go straight into their column
+	else if (Basis == TM_BASIS_UNIT)
+		CopyColumn(&Matrix[(size_t)column * Rows], extract);
+
+	// Otherwise the output waits in the batch, next to its basis vector
+	else
+	{
+		CopyColumn(&BatchOutputs[BatchCount * Rows], extract);
+		BasisColumn(&BatchBasis[BatchCount * Columns], (size_t)column);
+		BatchCount++;
+		if (BatchCount == TMACC_BATCH_SIZE)
+			FlushBatch();
+	}
+
+	// Last frame of the sequence?
+	NumberOfReceived++;
+	if (n == ColumnMap.size() - 1)
+		Done = true;
+
+	// Return
+	return true;
+}
+
+template<class R>
+void TMAccumulator<R>::BasisColumn(Complex* out, size_t k)
+{
+	// Column k of the basis, normalized to make it unitary
+	double scale = 1.0 / sqrt((double)Columns);
+	if (Basis == TM_BASIS_HADAMARD)
+	{
+		// Sylvester order: the sign is the parity of the common bits
+		for (size_t j = 0; j < Columns; j++)
+		{
+			uint64_t bits = (uint64_t)(j & k);
+			bits ^= bits >> 32;
+			bits ^= bits >> 16;
+			bits ^= bits >> 8;
+			bits ^= bits >> 4;
+			bits ^= bits >> 2;
+			bits ^= bits >> 1;
+			out[j] = Complex((R)((bits & 1) ? -scale : scale), 0);
+		}
+	}
+	else
+	{
+		// exp(-2*pi*i*j*k/N), with j*k reduced first to keep the precision
+		const double pi = 3.14159265358979323846;
+		for (size_t j = 0; j < Columns; j++)
+		{
+			double angle = -2.0 * pi * (double)((j * k) % Columns) / (double)Columns;
+			out[j] = Complex((R)(scale * cos(angle)), (R)(scale * sin(angle)));
+		}
+	}
+}
+
+template<class R>
+void TMAccumulator<R>::FlushBatch()
+{
+	// T += Y*B' for the columns of the batch
+	if (BatchCount == 0)
+		return;
+	TMBlas<R>::AddProductAdjoint((ptrdiff_t)Rows, (ptrdiff_t)Columns, (ptrdiff_t)BatchCount, BatchOutputs.data(), BatchBasis.data(), Matrix.data());
+	BatchCount = 0;
+}
+
+template<class R>
+bool TMAccumulator<R>::WaitDone(DWORD timeoutMilliseconds)
+{
+	// The thread leaves at the end of the sequence
+	if (Thread == NULL)
+		return Done;
+	return WaitForSingleObject(Thread, timeoutMilliseconds) == WAIT_OBJECT_0;
+}
+
+template<class R>
+bool TMAccumulator<R>::IsDone()
+{
+	return Done;
+}
+
+template<class R>
+size_t TMAccumulator<R>::GetNumberOfRows()
+{
+	return Rows;
+}
+
+template<class R>
+size_t TMAccumulator<R>::GetNumberOfColumns()
+{
+	return Columns;
+}
+
+template<class R>
+size_t TMAccumulator<R>::GetNumberOfCalibrationFrames()
+{
+	return (Rows > 0) ? Calibration.size() / Rows : 0;
+}
+
+template<class R>
+size_t TMAccumulator<R>::GetNumberOfFrames()
+{
+	return ColumnMap.size();
+}
+
+template<class R>
+size_t TMAccumulator<R>::GetNumberOfReceivedFrames()
+{
+	return NumberOfReceived;
+}
+
+template<class R>
+const vector<complex<R>>& TMAccumulator<R>::GetMatrix()
+{
+	return Matrix;
+}
+
+template<class R>
+const vector<complex<R>>& TMAccumulator<R>::GetCalibration()
+{
+	return Calibration;
+}
+
+template<class R>
+const vector<uint64_t>& TMAccumulator<R>::GetTimestamps()
+{
+	return Timestamps;
+}
+
+template<class R>
+void TMAccumulator<R>::PushError(std::string str)
+{
+	Errors.TryPush(str);
+}
+
+template<class R>
+std::unique_ptr<std::string> TMAccumulator<R>::GetError()
+{
+	std::unique_ptr<std::string> err(new std::string());
+	if (!Errors.TryPop(*err))
+		err.reset();
+	return err;
+}
+
+template<class R>
+size_t TMAccumulator<R>::GetNumberOfErrors()
+{
+	return Errors.GetCount();
+}
@@ -0,0 +1,118 @@
+////////////////////////////////////////////////////////////////////////////////
+// Filename: tmaccumulator.h
+// The TMAccumulator class builds a transmission matrix while it is being
+// measured. It takes the place of MATLAB as the consumer of an FFTProcessor:
+// the extract of each frame is the output field for one input pattern, and
+// goes into its column of a preallocated matrix as soon as it comes out of
+// the processor.
+// The position of a frame in the sequence follows from its block ID (relative
+// to the first frame), so that a missing frame leaves its column empty rather
+// than shifting all the others. A map gives the column of each position, or
+// marks it as a calibration frame; those are kept apart, in order.
+// When the patterns are the columns of a Hadamard or Fourier basis B rather
+// than single pixels, the change of basis T = Y*B' is accumulated with BLAS,
+// a batch of columns at a time, so that T is ready when the sequence ends.
+////////////////////////////////////////////////////////////////////////////////
+#ifndef _TMACCUMULATOR_H_
+#define _TMACCUMULATOR_H_
+
+//////////////
+// INCLUDES //
+//////////////
+#include <windows.h>
+#include <string>
+#include <vector>
+#include <atomic>
+#include "spsc_queue.h"
+#include "fftprocessor.h"
+using namespace std;
+
+/////////////
+// GLOBALS //
+/////////////
+#define TMACC_ERROR_QUEUE_SIZE  1024
+#define TMACC_BATCH_SIZE        64			// Columns per BLAS update
+#define TMACC_CALIBRATION       (-1)		// In the column map
+#define TMACC_BLOCKID_16BIT_MAX 0xFFFF		// GigE Vision 1.x block IDs go from 65535 back to 1
+
+// Input patterns
+enum TMBasis
+{
+	TM_BASIS_UNIT,			// Pattern k lights up input k: T = Y
+	TM_BASIS_HADAMARD,		// Column k of hadamard(N)/sqrt(N)
+	TM_BASIS_FOURIER		// Column k of dftmtx(N)/sqrt(N)
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// Class name: TMAccumulator
+////////////////////////////////////////////////////////////////////////////////
+template<class R>
+class TMAccumulator
+{
+public:
+	typedef complex<R>			Complex;
+	typedef FFTExtract<R>		Extract;
+
+	TMAccumulator();
+	~TMAccumulator();
+
+	bool	Initialize(FFTProcessor<R>*, const vector<int64_t>&, size_t, TMBasis);
+	void	Shutdown();
+
+	bool						WaitDone(DWORD);
+	bool						IsDone();
+	size_t						GetNumberOfRows();
+	size_t						GetNumberOfColumns();
+	size_t						GetNumberOfCalibrationFrames();
+	size_t						GetNumberOfFrames();
+	size_t						GetNumberOfReceivedFrames();
+	const vector<Complex>&		GetMatrix();
+	const vector<Complex>&		GetCalibration();
+	const vector<uint64_t>&		GetTimestamps();
+	unique_ptr<string>			GetError();
+	size_t						GetNumberOfErrors();
+
+private:
+	FFTProcessor<R>				*pSource;
+	TMBasis						Basis;
+	size_t						Rows;
+	size_t						Columns;
+
+	// Per position in the sequence
+	vector<int64_t>				ColumnMap;
+	vector<size_t>				CalibrationIndex;
+	vector<uint64_t>			Timestamps;
+
+	// Results
+	vector<Complex>				Matrix;			// Rows x Columns, column-major
+	vector<Complex>				Calibration;	// Rows x calibration frames
+	std::atomic<size_t>			NumberOfReceived;
+
+	// Position of the frames
+	bool						Started;
+	uint64_t					LastBlockId;
+	uint64_t					Position;
+	bool						NextPosition(uint64_t);
+
+	// Change of basis
+	// (the outputs of a batch and the matching basis vectors)
+	vector<Complex>				BatchOutputs;	// Rows x TMACC_BATCH_SIZE
+	vector<Complex>				BatchBasis;		// Columns x TMACC_BATCH_SIZE
+	size_t						BatchCount;
+	void						BasisColumn(Complex*, size_t);
+	void						FlushBatch();
+
+	bool						AddFrame(const Extract&);
+	void						CopyColumn(Complex*, const Extract&);
+
+	HANDLE						Thread;
+	bool volatile				StopFlag = false;
+	bool volatile				Done = false;
+	DWORD						AccumulateContinuously();
+	static DWORD WINAPI			AccumulatorStaticStart(LPVOID);
+
+	SPSC_Ring<string>			Errors;
+	void						PushError(string);
+};
+
+#endif
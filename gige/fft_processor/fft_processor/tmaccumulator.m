@@ -0,0 +1,85 @@
+% TMACCUMULATOR
+% MATLAB class wrapper to an underlying C++ class that builds a transmission
+% matrix from the output of an fftprocessor, while it is being measured.
+%
+% Usage: tm = tmaccumulator(fftp, columns, n, basis)
+%        ... run the sequence ...
+%        tm.wait(timeout_seconds);
+%        [T, calibration, time] = tm.getmatrix();
+%
+%   columns: column of T measured by each frame of the sequence, from 1, or
+%            0 for a calibration frame (e.g. interleave_calibration(factor,
+%            n)). The first frame that comes out of the fftprocessor is the
+%            first frame of the sequence; the others are placed by their
+%            block ID, so a missing frame leaves its column at zero.
+%   n:       number of input patterns (columns of T).
+%   basis:   'unit' (default), where pattern k lights up input k and T is
+%            made of the measured fields as they are; 'hadamard' or
+%            'fourier', where pattern k is column k of hadamard(n)/sqrt(n)
+%            or dftmtx(n)/sqrt(n), and T = Y*B' is accumulated with BLAS
+%            as the frames arrive.
+%
+%   getmatrix returns T (coefficients x n), the calibration frames in order
+%   (coefficients x number of zeros in columns), and the timestamps of all
+%   the frames (0 for missing frames), for drift correction.
+%
+% Note: The accumulator takes the images of the fftprocessor; nothing else
+%       may get images from it until the accumulator is done or deleted.
+
+classdef tmaccumulator < handle
+
+    properties (SetAccess = private, Transient = true)
+         % Handle to the underlying C++ class instance
+        objectHandle;
+
+        % Source object
+        processor;
+    end
+
+    methods
+        % Constructor
+        function obj = tmaccumulator(fftp, columns, n, basis)
+            % Input processing
+            if nargin<4
+               basis = 'unit';
+            end
+            if ~isa(fftp,'fftprocessor')
+               error('tmaccumulator only works with an fftprocessor');
+            end
+            obj.processor = fftp;
+
+            % Create and start the C++ class
+            obj.objectHandle = fftprocessor_mex('NewTM', fftp.objectHandle, ...
+                                                double(columns(:)), ...
+                                                double(n), ...
+                                                lower(basis));
+        end
+
+        % Destructor
+        function delete(this)
+            fftprocessor_mex('delete', this.objectHandle);
+        end
+
+        % Wait for the end of the sequence; false on timeout
+        function res = wait(this, timeout_seconds)
+           res = fftprocessor_mex('WaitTM', this.objectHandle, timeout_seconds);
+        end
+
+        % Progress: [frames received, frames in the sequence]
+        function res = getprogress(this)
+           res = fftprocessor_mex('GetTMProgress', this.objectHandle);
+        end
+
+        % Get the matrix (stops the accumulation if the sequence is not
+        % complete yet)
+        function [T, calibration, time] = getmatrix(this)
+           [T, calibration, time] = fftprocessor_mex('GetTM', this.objectHandle);
+        end
+
+        % Get list of errors
+        function res = geterrors(this)
+           res = fftprocessor_mex('GetErrors', this.objectHandle);
+        end
+
+    end
+end
@@ -0,0 +1,344 @@
+////////////////////////////////////////////////////////////////////////////////
+// Filename: bufferpool.h
+// Pool of pre-allocated acquisition buffers. The pixel memory is allocated in
+// large page-aligned chunks (optionally backed by large pages) and attached
+// to PvBuffer objects once, so the acquisition thread does not go through the
+// heap for every frame. Each buffer comes with the Frame that describes it to
+// the consumers. Consumers hand the frames back through the ImageRelease
+// deleter, from any thread, and the buffer manager queues the buffers to the
+// stream again.
+//
+// The pool grows by whole chunks when all buffers are in use (e.g. when a
+// consumer falls behind), and it is destroyed once the last buffer is back
+// and nobody holds a reference to it anymore.
+//
+// Alternatively, the buffers can be the slots of a shared frame ring (see
+// sharedring.h), so that the camera writes straight into shared memory. Such
+// a pool has exactly one buffer per slot and cannot grow; a slot is marked
+// invalid for the readers when its buffer is handed out again.
+//
+// The pool also holds a fixed number of placeholder frames, which stand in
+// for frames the camera dropped. They all point at the same zeroed,
+// read-only page range, so a long gap costs neither pool buffers nor a
+// memset; they come back through Recycle like the other frames.
+////////////////////////////////////////////////////////////////////////////////
+#ifndef _BUFFERPOOL_H_
+#define _BUFFERPOOL_H_
+
+//////////////
+// INCLUDES //
+//////////////
+#include <windows.h>
+#include <vector>
+#include <mutex>
+#include <PvBuffer.h>
+#include "iimagequeue.h"
+#include "sharedring.h"
+
+/////////////
+// GLOBALS //
+/////////////
+#define BUFFER_POOL_GROWTH 64
+
+////////////////////////////////////////////////////////////////////////////////
+// Class name: BufferPool
+////////////////////////////////////////////////////////////////////////////////
+class BufferPool : public IImageRecycler
+{
+public:
+	BufferPool();
+	~BufferPool();
+
+	bool		Initialize(size_t, uint32_t, bool, std::shared_ptr<SharedFrameRing> = nullptr);
+	bool		ReservePlaceholders(size_t);
+
+	PvBuffer*	Get();
+	Frame*		GetFrame(PvBuffer*);
+	Frame*		GetPlaceholder();
+	void		Recycle(Frame*);
+
+	uint32_t	GetBufferSize();
+	size_t		GetNumberOfBuffers();
+	size_t		GetNumberOfFreeBuffers();
+	bool		IsUsingLargePages();
+	std::shared_ptr<SharedFrameRing> GetSharedRing();
+
+private:
+	uint32_t				BufferSize;
+	size_t					Stride;
+	size_t					PageSize;
+	size_t					ChunkAlignment;
+	bool					LargePages;
+	std::shared_ptr<SharedFrameRing> Ring;
+
+	std::vector<void*>		Chunks;
+	std::vector<PvBuffer*>	Buffers;
+	std::vector<Frame*>		Frames;
+
+	std::mutex				FreeMutex;
+	std::vector<PvBuffer*>	FreeBuffers;
+
+	void*					Zeros;
+	std::vector<Frame>		Placeholders;
+	std::vector<Frame*>		FreePlaceholders;
+
+	bool					Grow(size_t);
+	bool					Attach(void*, size_t);
+	static bool				EnableLockMemoryPrivilege();
+};
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Class implementation: BufferPool
+////////////////////////////////////////////////////////////////////////////////
+inline BufferPool::BufferPool()
+{
+	BufferSize = 0;
+	Stride = 0;
+	PageSize = 0;
+	ChunkAlignment = 0;
+	LargePages = false;
+	Zeros = NULL;
+}
+
+inline BufferPool::~BufferPool()
+{
+	// Delete the buffer and frame objects
+	for (size_t i = 0; i < Buffers.size(); i++)
+	{
+		Buffers[i]->Detach();
+		delete Buffers[i];
+		delete Frames[i];
+	}
+
+	// Release the memory
+	for (size_t i = 0; i < Chunks.size(); i++)
+		VirtualFree(Chunks[i], 0, MEM_RELEASE);
+	if (Zeros != NULL)
+		VirtualFree(Zeros, 0, MEM_RELEASE);
+}
+
+inline bool BufferPool::Initialize(size_t count, uint32_t bufferSize, bool largePages, std::shared_ptr<SharedFrameRing> ring)
+{
+	// Buffers in a shared frame ring: one per slot, laid out by the ring
+	if (ring)
+	{
+		Ring = ring;
+		BufferSize = bufferSize;
+		Stride = (size_t)ring->GetSlotBytes();
+		return Grow(ring->GetNumberOfSlots());
+	}
+
+	// Page size
+	SYSTEM_INFO info;
+	GetSystemInfo(&info);
+	PageSize = info.dwPageSize;
+
+	// Large pages need the "Lock pages in memory" privilege
+	LargePages = false;
+	ChunkAlignment = PageSize;
+	if (largePages)
+	{
+		size_t largePageSize = GetLargePageMinimum();
+		if (largePageSize > 0 && EnableLockMemoryPrivilege())
+		{
+			LargePages = true;
+			ChunkAlignment = largePageSize;
+		}
+	}
+
+	// Every buffer starts on a page boundary
+	BufferSize = bufferSize;
+	Stride = ((bufferSize + PageSize - 1) / PageSize) * PageSize;
+
+	// Allocate the first chunk
+	return Grow(count);
+}
+
+inline bool BufferPool::ReservePlaceholders(size_t count)
+{
+	// Committed pages read as zeros, and the readers never touch more than
+	// that until they are written (placeholders are never written)
+	if (Zeros == NULL)
+	{
+		Zeros = VirtualAlloc(NULL, BufferSize, MEM_COMMIT | MEM_RESERVE, PAGE_READONLY);
+		if (Zeros == NULL)
+			return false;
+	}
+
+	// Descriptors only (a placeholder has no camera buffer as its context)
+	std::lock_guard<std::mutex> lock(FreeMutex);
+	if (!Placeholders.empty())
+		return true;
+	Placeholders.resize(count);
+	FreePlaceholders.reserve(count);
+	for (size_t i = 0; i < count; i++)
+	{
+		Placeholders[i].data = (uint8_t*)Zeros;
+		FreePlaceholders.push_back(&Placeholders[i]);
+	}
+	return true;
+}
+
+inline bool BufferPool::Grow(size_t count)
+{
+	// The slots of a shared ring are all attached at once
+	if (Ring)
+	{
+		if (!Buffers.empty())
+			return false;
+		return Attach(Ring->GetSlotData(0), count);
+	}
+
+	// Allocate the chunk (falling back to normal pages if large pages fail)
+	size_t chunkSize = ((count*Stride + ChunkAlignment - 1) / ChunkAlignment) * ChunkAlignment;
+	void* chunk = NULL;
+	if (LargePages)
+	{
+		chunk = VirtualAlloc(NULL, chunkSize, MEM_COMMIT | MEM_RESERVE | MEM_LARGE_PAGES, PAGE_READWRITE);
+		if (chunk == NULL)
+		{
+			LargePages = false;
+			ChunkAlignment = PageSize;
+			chunkSize = count*Stride;
+		}
+	}
+	if (chunk == NULL)
+		chunk = VirtualAlloc(NULL, chunkSize, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+	if (chunk == NULL)
+		return false;
+	Chunks.push_back(chunk);
+
+	// Fit as many buffers as possible in the rounded-up chunk
+	return Attach(chunk, chunkSize / Stride);
+}
+
+inline bool BufferPool::Attach(void* chunk, size_t count)
+{
+	// Make room in the free list first, so that returning a buffer never
+	// allocates
+	std::lock_guard<std::mutex> lock(FreeMutex);
+	Buffers.reserve(Buffers.size() + count);
+	Frames.reserve(Buffers.size() + count);
+	FreeBuffers.reserve(Buffers.size() + count);
+
+	// Attach the memory to buffer objects
+	// (the buffer ID is the index, to find the frame back, and the slot
+	//  number in a shared ring)
+	for (size_t i = 0; i < count; i++)
+	{
+		PvBuffer* pBuffer = new PvBuffer();
+		pBuffer->Attach((uint8_t*)chunk + i*Stride, BufferSize);
+		pBuffer->SetID(Buffers.size());
+
+		Frame* pFrame = new Frame();
+		pFrame->context = pBuffer;
+
+		Buffers.push_back(pBuffer);
+		Frames.push_back(pFrame);
+		FreeBuffers.push_back(pBuffer);
+	}
+
+	return true;
+}
+
+inline PvBuffer* BufferPool::Get()
+{
+	// Take a free buffer
+	{
+		std::lock_guard<std::mutex> lock(FreeMutex);
+		if (!FreeBuffers.empty())
+		{
+			PvBuffer* pBuffer = FreeBuffers.back();
+			FreeBuffers.pop_back();
+
+			// The camera is about to overwrite the slot
+			if (Ring)
+				Ring->Invalidate((uint32_t)pBuffer->GetID());
+			return pBuffer;
+		}
+	}
+
+	// All buffers are in use, so add a chunk
+	// (only the buffer manager calls Get, so no one else can grow the pool)
+	if (!Grow(BUFFER_POOL_GROWTH))
+		return NULL;
+	return Get();
+}
+
+inline Frame* BufferPool::GetFrame(PvBuffer* pBuffer)
+{
+	// Only the buffer manager calls this, and only it grows the vector
+	return Frames[(size_t)pBuffer->GetID()];
+}
+
+inline Frame* BufferPool::GetPlaceholder()
+{
+	// None left means the rest of the gap goes without placeholders
+	std::lock_guard<std::mutex> lock(FreeMutex);
+	if (FreePlaceholders.empty())
+		return NULL;
+
+	Frame* pFrame = FreePlaceholders.back();
+	FreePlaceholders.pop_back();
+	return pFrame;
+}
+
+inline void BufferPool::Recycle(Frame* pFrame)
+{
+	std::lock_guard<std::mutex> lock(FreeMutex);
+	if (pFrame->context == NULL)
+		FreePlaceholders.push_back(pFrame);
+	else
+		FreeBuffers.push_back((PvBuffer*)pFrame->context);
+}
+
+inline uint32_t BufferPool::GetBufferSize()
+{
+	return BufferSize;
+}
+
+inline size_t BufferPool::GetNumberOfBuffers()
+{
+	std::lock_guard<std::mutex> lock(FreeMutex);
+	return Buffers.size();
+}
+
+inline size_t BufferPool::GetNumberOfFreeBuffers()
+{
+	std::lock_guard<std::mutex> lock(FreeMutex);
+	return FreeBuffers.size();
+}
+
+inline bool BufferPool::IsUsingLargePages()
+{
+	return LargePages;
+}
+
+inline std::shared_ptr<SharedFrameRing> BufferPool::GetSharedRing()
+{
+	return Ring;
+}
+
+inline bool BufferPool::EnableLockMemoryPrivilege()
+{
+	// Open the process token
+	HANDLE hToken;
+	if (!OpenProcessToken(GetCurrentProcess(), TOKEN_ADJUST_PRIVILEGES | TOKEN_QUERY, &hToken))
+		return false;
+
+	// Enable the privilege (this only works if the account holds it)
+	TOKEN_PRIVILEGES tp;
+	tp.PrivilegeCount = 1;
+	tp.Privileges[0].Attributes = SE_PRIVILEGE_ENABLED;
+	BOOL res = LookupPrivilegeValue(NULL, SE_LOCK_MEMORY_NAME, &tp.Privileges[0].Luid);
+	if (res)
+		res = AdjustTokenPrivileges(hToken, FALSE, &tp, 0, NULL, NULL);
+	DWORD err = GetLastError();
+	CloseHandle(hToken);
+
+	// AdjustTokenPrivileges succeeds even if the privilege was not assigned
+	return res && err == ERROR_SUCCESS;
+}
+
+#endif
@@ -44,6 +44,13 @@ template<class base> inline base *convertMat2Ptr(const mxArray *in)
     return convertMat2HandlePtr<base>(in)->ptr();
 }
 
+template<class base> inline bool isHandleOf(const mxArray *in)
+{
+    if (mxGetNumberOfElements(in) != 1 || mxGetClassID(in) != mxUINT64_CLASS || mxIsComplex(in))
+        return false;
+    return reinterpret_cast<class_handle<base> *>(*((uint64_t *)mxGetData(in)))->isValid();
+}
+
 template<class base> inline void destroyObject(const mxArray *in)
 {
     delete convertMat2HandlePtr<base>(in);
@@ -0,0 +1,143 @@
+////////////////////////////////////////////////////////////////////////////////
+// Filename: frame.h
+// Vendor-neutral description of one image, as it travels through the image
+// queues. A frame does not own its pixel memory; whoever produced it (a
+// camera buffer pool, a synthetic or replay source) gets the frame back
+// through its recycler once all consumers are done with it.
+////////////////////////////////////////////////////////////////////////////////
+#ifndef _FRAME_H_
+#define _FRAME_H_
+
+//////////////
+// INCLUDES //
+//////////////
+#include <memory>
+#include <atomic>
+#include <stdint.h>
+#include <stddef.h>
+
+struct Frame;
+
+////////////////////////////////////////////////////////////////////////////////
+// Class name: IImageRecycler
+// Interface for objects that take frames back once a consumer is done with
+// them (e.g. a buffer pool).
+////////////////////////////////////////////////////////////////////////////////
+class IImageRecycler
+{
+public:
+	virtual ~IImageRecycler() {}
+	virtual void Recycle(Frame*) = 0;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// Struct name: FrameReferences
+// Reference count of a frame that is broadcast to several consumers, and
+// where the frame goes once the last of them is done with it. It lives in the
+// frame (which is normally pooled), so sharing a frame allocates nothing; it
+// is not part of the description, and is not copied with it.
+////////////////////////////////////////////////////////////////////////////////
+struct FrameReferences
+{
+	std::atomic<uint32_t>			count;
+	std::shared_ptr<IImageRecycler>	owner;		// NULL to delete the frame
+
+	FrameReferences() : count(0) {}
+	FrameReferences(const FrameReferences&) : count(0) {}
+	FrameReferences& operator=(const FrameReferences&) { return *this; }
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// Struct name: Frame
+////////////////////////////////////////////////////////////////////////////////
+struct Frame
+{
+	uint32_t	width;
+	uint32_t	height;
+	uint32_t	bpp;		// Bits per pixel
+	uint64_t	timestamp;	// Source timestamp (camera ticks, or ns for software sources)
+	uint64_t	blockId;	// Sequence number assigned by the source
+	uint64_t	arrival;	// Host time at which the frame arrived (LatencyNow), 0 if unknown
+	uint8_t*	data;		// Pixel data
+	size_t		size;		// Size of the pixel data in bytes
+	void*		context;	// Reserved for the producer (e.g. the underlying camera buffer)
+	FrameReferences	shared;	// While the frame is broadcast (see ImageRelease)
+
+	Frame() : width(0), height(0), bpp(0), timestamp(0), blockId(0), arrival(0), data(NULL), size(0), context(NULL) {}
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// Struct name: ImageRelease
+// Deleter for the image pointers. A frame is either one reference to a frame
+// that is broadcast to several consumers (the reference is dropped, and the
+// frame is released once the last consumer is done with it), or it is owned
+// outright, in which case it goes back to its recycler if it has one, and is
+// deleted otherwise.
+////////////////////////////////////////////////////////////////////////////////
+struct ImageRelease
+{
+	std::shared_ptr<IImageRecycler>	Recycler;
+	bool							Shared;
+
+	ImageRelease() : Shared(false) {}
+	ImageRelease(const std::shared_ptr<IImageRecycler>& recycler) : Recycler(recycler), Shared(false) {}
+
+	static ImageRelease Reference()
+	{
+		ImageRelease release;
+		release.Shared = true;
+		return release;
+	}
+
+	void operator()(Frame* pFrame)
+	{
+		if (Shared)
+		{
+			// The last reference releases the frame as its owner would have
+			// (the owner is taken first, as the frame may be reused as soon
+			//  as it is recycled)
+			if (pFrame->shared.count.fetch_sub(1, std::memory_order_acq_rel) == 1)
+			{
+				std::shared_ptr<IImageRecycler> owner(std::move(pFrame->shared.owner));
+				if (owner)
+					owner->Recycle(pFrame);
+				else
+					delete pFrame;
+			}
+		}
+		else if (Recycler)
+		{
+			// Drop our hold on the recycler too, so that it can be
+			// destroyed once all its frames are back
+			Recycler->Recycle(pFrame);
+			Recycler.reset();
+		}
+		else
+		{
+			delete pFrame;
+		}
+	}
+};
+
+typedef std::unique_ptr<Frame, ImageRelease> ImagePtr;
+
+// Turn an image into the first reference to a shared frame (an image that is
+// a reference already stays as it is)
+inline void ShareImage(ImagePtr& upFrame)
+{
+	ImageRelease& release = upFrame.get_deleter();
+	if (release.Shared)
+		return;
+	upFrame->shared.owner = std::move(release.Recycler);
+	upFrame->shared.count.store(1, std::memory_order_relaxed);
+	release.Shared = true;
+}
+
+// One more reference to a shared frame
+inline ImagePtr AddImageReference(const ImagePtr& upFrame)
+{
+	upFrame->shared.count.fetch_add(1, std::memory_order_relaxed);
+	return ImagePtr(upFrame.get(), ImageRelease::Reference());
+}
+
+#endif
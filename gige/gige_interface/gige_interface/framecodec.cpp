@@ -0,0 +1,326 @@
+// Lossless frame compression by prediction and block bit packing.
+
+#include "framecodec.h"
+#include <string.h>
+#include <vector>
+
+///////////////////////
+// INSTRUCTION SETS  //
+///////////////////////
+#if defined(_M_X64) || defined(__SSE2__) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+	#define FRAMECODEC_BUILD_SSE2
+	#include <emmintrin.h>
+#endif
+
+
+// Median edge detector: a is the left neighbour, b the one above, c above left
+static inline int32_t Predict(int32_t a, int32_t b, int32_t c)
+{
+	int32_t lo = (a < b) ? a : b;
+	int32_t hi = (a < b) ? b : a;
+	return (c >= hi) ? lo : ((c <= lo) ? hi : a + b - c);
+}
+
+// Packs a block of zigzag-coded errors with the bits of the largest one
+static inline uint8_t* PackBlock(const uint32_t* z, uint8_t* p)
+{
+	uint32_t any = 0;
+	for (int k = 0; k < FRAMECODEC_BLOCK; k++)
+		any |= z[k];
+	uint32_t bits = 0;
+	while (bits < 32 && (any >> bits))
+		bits++;
+	*p++ = (uint8_t)bits;
+	if (bits == 0)
+		return p;
+
+	// FRAMECODEC_BLOCK*bits is a multiple of 32, so the words come out even
+	uint64_t acc = 0;
+	uint32_t n = 0;
+	for (int k = 0; k < FRAMECODEC_BLOCK; k++)
+	{
+		acc |= (uint64_t)z[k] << n;
+		n += bits;
+		if (n >= 32)
+		{
+			uint32_t word = (uint32_t)acc;
+			memcpy(p, &word, sizeof(word));
+			p += sizeof(word);
+			acc >>= 32;
+			n -= 32;
+		}
+	}
+	return p;
+}
+
+static inline const uint8_t* UnpackBlock(const uint8_t* p, const uint8_t* end, uint32_t* z)
+{
+	if (p >= end)
+		return NULL;
+	uint32_t bits = *p++;
+	if (bits == 0)
+	{
+		memset(z, 0, FRAMECODEC_BLOCK*sizeof(uint32_t));
+		return p;
+	}
+	if (bits > 32 || (size_t)(end - p) < bits*FRAMECODEC_BLOCK/8)
+		return NULL;
+
+	uint64_t mask = (1ULL << bits) - 1;
+	uint64_t acc = 0;
+	uint32_t n = 0;
+	for (int k = 0; k < FRAMECODEC_BLOCK; k++)
+	{
+		if (n < bits)
+		{
+			uint32_t word;
+			memcpy(&word, p, sizeof(word));
+			p += sizeof(word);
+			acc |= (uint64_t)word << n;
+			n += 32;
+		}
+		z[k] = (uint32_t)(acc & mask);
+		acc >>= bits;
+		n -= bits;
+	}
+	return p;
+}
+
+// Zigzag, so that small errors of either sign take few bits
+static inline uint32_t Zigzag(int32_t r)
+{
+	return ((uint32_t)r << 1) ^ (uint32_t)(r >> 31);
+}
+
+#ifdef FRAMECODEC_BUILD_SSE2
+////////////////////////////////////////////////////////////////////////////////
+// SSE2 prediction, 8 pixels at a time (as 2x4 32-bit lanes)
+////////////////////////////////////////////////////////////////////////////////
+static inline __m128i Load8(const uint16_t* p)
+{
+	return _mm_loadu_si128((const __m128i*)p);
+}
+
+static inline __m128i Load8(const uint8_t* p)
+{
+	return _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)p), _mm_setzero_si128());
+}
+
+static inline __m128i Select(__m128i mask, __m128i a, __m128i b)
+{
+	return _mm_or_si128(_mm_and_si128(mask, a), _mm_andnot_si128(mask, b));
+}
+
+static inline __m128i Residual4(__m128i x, __m128i a, __m128i b, __m128i c)
+{
+	// Same as Predict and Zigzag
+	__m128i a_lt_b = _mm_cmplt_epi32(a, b);
+	__m128i lo     = Select(a_lt_b, a, b);
+	__m128i hi     = Select(a_lt_b, b, a);
+	__m128i grad   = _mm_sub_epi32(_mm_add_epi32(a, b), c);
+	__m128i pred   = Select(_mm_cmpgt_epi32(hi, c), Select(_mm_cmpgt_epi32(c, lo), grad, hi), lo);
+	__m128i r      = _mm_sub_epi32(x, pred);
+	return _mm_xor_si128(_mm_slli_epi32(r, 1), _mm_srai_epi32(r, 31));
+}
+
+template <class T>
+static uint32_t PredictRow_Sse2(const T* row, const T* up, uint32_t width, uint32_t* z)
+{
+	const __m128i zero = _mm_setzero_si128();
+	uint32_t x = 1;
+	for (; x + 8 <= width; x += 8)
+	{
+		__m128i v = Load8(row + x);
+		__m128i a = Load8(row + x - 1);
+		__m128i b = Load8(up + x);
+		__m128i c = Load8(up + x - 1);
+		_mm_storeu_si128((__m128i*)(z + x), Residual4(_mm_unpacklo_epi16(v, zero), _mm_unpacklo_epi16(a, zero),
+		                                             _mm_unpacklo_epi16(b, zero), _mm_unpacklo_epi16(c, zero)));
+		_mm_storeu_si128((__m128i*)(z + x + 4), Residual4(_mm_unpackhi_epi16(v, zero), _mm_unpackhi_epi16(a, zero),
+		                                                 _mm_unpackhi_epi16(b, zero), _mm_unpackhi_epi16(c, zero)));
+	}
+	return x;
+}
+#endif
+
+template <class T>
+static size_t EncodePredict(const T* in, uint32_t width, uint32_t height, uint8_t* out)
+{
+	// Errors of one row, after those left over from the previous one
+	std::vector<uint32_t> z(width + FRAMECODEC_BLOCK);
+	size_t   fill = 0;
+	uint8_t* p = out;
+
+	for (uint32_t y = 0; y < height; y++)
+	{
+		// Prediction from the neighbours that the decoder already has
+		const T*  row = in + (size_t)y*width;
+		uint32_t* zr  = &z[fill];
+		if (y == 0)
+		{
+			zr[0] = Zigzag(row[0]);
+			for (uint32_t x = 1; x < width; x++)
+				zr[x] = Zigzag((int32_t)row[x] - row[x-1]);
+		}
+		else
+		{
+			const T* up = row - width;
+			uint32_t x = 1;
+			zr[0] = Zigzag((int32_t)row[0] - up[0]);
+			#ifdef FRAMECODEC_BUILD_SSE2
+				x = PredictRow_Sse2(row, up, width, zr);
+			#endif
+			for (; x < width; x++)
+				zr[x] = Zigzag((int32_t)row[x] - Predict(row[x-1], up[x], up[x-1]));
+		}
+
+		// Pack the whole blocks
+		size_t total = fill + width;
+		size_t k = 0;
+		for (; total - k >= FRAMECODEC_BLOCK; k += FRAMECODEC_BLOCK)
+			p = PackBlock(&z[k], p);
+		fill = total - k;
+		if (fill > 0)
+			memmove(&z[0], &z[k], fill*sizeof(uint32_t));
+	}
+
+	// Last block, padded with zeros
+	if (fill > 0)
+	{
+		memset(&z[fill], 0, (FRAMECODEC_BLOCK - fill)*sizeof(uint32_t));
+		p = PackBlock(&z[0], p);
+	}
+	return p - out;
+}
+
+template <class T>
+static bool DecodePredict(const uint8_t* p, const uint8_t* end, uint32_t width, uint32_t height, T* out)
+{
+	uint32_t z[FRAMECODEC_BLOCK];
+	int      used = FRAMECODEC_BLOCK;
+
+	for (uint32_t y = 0; y < height; y++)
+	{
+		T*       row = out + (size_t)y*width;
+		const T* up  = (y > 0) ? row - width : row;
+		for (uint32_t x = 0; x < width; x++)
+		{
+			if (used == FRAMECODEC_BLOCK)
+			{
+				p = UnpackBlock(p, end, z);
+				if (p == NULL)
+					return false;
+				used = 0;
+			}
+
+			int32_t pred;
+			if (y == 0)
+				pred = (x == 0) ? 0 : row[x-1];
+			else if (x == 0)
+				pred = up[0];
+			else
+				pred = Predict(row[x-1], up[x], up[x-1]);
+
+			uint32_t zz = z[used++];
+			int32_t  r  = (int32_t)(zz >> 1) ^ -(int32_t)(zz & 1);
+			row[x] = (T)(pred + r);
+		}
+	}
+	return true;
+}
+
+static inline size_t PixelBytes(const Frame& frame)
+{
+	// Only whole 8-bit or 16-bit pixels can be predicted
+	size_t pixels = (size_t)frame.width*frame.height;
+	if (frame.bpp == 8 && frame.size == pixels)
+		return 1;
+	if (frame.bpp > 8 && frame.bpp <= 16 && frame.size == 2*pixels)
+		return 2;
+	return 0;
+}
+
+size_t FrameCodecBound(const Frame& frame)
+{
+	// Worst case: every block at full width (9 or 17 bits), or stored
+	size_t blocks = ((size_t)frame.width*frame.height + FRAMECODEC_BLOCK - 1) / FRAMECODEC_BLOCK;
+	size_t coded = 0;
+	switch (PixelBytes(frame))
+	{
+	case 1: coded = blocks*(1 + 9*FRAMECODEC_BLOCK/8);  break;
+	case 2: coded = blocks*(1 + 17*FRAMECODEC_BLOCK/8); break;
+	}
+	return sizeof(FrameCodecHeader) + ((coded > frame.size) ? coded : frame.size);
+}
+
+size_t FrameEncode(const Frame& frame, uint8_t* out, size_t capacity)
+{
+	// Room for the worst case
+	if (capacity < FrameCodecBound(frame))
+		return 0;
+
+	FrameCodecHeader header;
+	header.codec = FRAMECODEC_PREDICT;
+	header.reserved = 0;
+	header.rawSize = frame.size;
+	uint8_t* data = out + sizeof(header);
+
+	// Compress
+	size_t coded;
+	switch (PixelBytes(frame))
+	{
+	case 1:  coded = EncodePredict((const uint8_t*)frame.data, frame.width, frame.height, data);  break;
+	case 2:  coded = EncodePredict((const uint16_t*)frame.data, frame.width, frame.height, data); break;
+	default: coded = frame.size; break;
+	}
+
+	// Store instead, if it did not help
+	if (coded >= frame.size)
+	{
+		header.codec = FRAMECODEC_NONE;
+		memcpy(data, frame.data, frame.size);
+		coded = frame.size;
+	}
+
+	memcpy(out, &header, sizeof(header));
+	return sizeof(header) + coded;
+}
+
+bool FrameDecode(const uint8_t* in, size_t size, uint32_t width, uint32_t height, uint32_t bpp, uint8_t* out, size_t outSize)
+{
+	FrameCodecHeader header;
+	if (size < sizeof(header))
+		return false;
+	memcpy(&header, in, sizeof(header));
+	if (header.rawSize != outSize)
+		return false;
+	const uint8_t* data = in + sizeof(header);
+	const uint8_t* end = in + size;
+
+	switch (header.codec)
+	{
+	case FRAMECODEC_NONE:
+		if ((size_t)(end - data) != outSize)
+			return false;
+		memcpy(out, data, outSize);
+		return true;
+
+	case FRAMECODEC_PREDICT:
+		{
+			Frame frame;
+			frame.width = width;
+			frame.height = height;
+			frame.bpp = bpp;
+			frame.size = outSize;
+			switch (PixelBytes(frame))
+			{
+			case 1:  return DecodePredict(data, end, width, height, out);
+			case 2:  return DecodePredict(data, end, width, height, (uint16_t*)out);
+			default: return false;
+			}
+		}
+
+	default:
+		return false;
+	}
+}
@@ -0,0 +1,55 @@
+////////////////////////////////////////////////////////////////////////////////
+// Filename: framecodec.h
+// Lossless compression of camera frames, fast enough to keep up with the
+// camera on a few cores. Each pixel is predicted from its already coded
+// neighbours (the median edge detector of LOCO-I / JPEG-LS), and the
+// prediction errors are stored in blocks of FRAMECODEC_BLOCK, each packed with
+// the number of bits of its largest error. The dark background outside the
+// fiber core and the smooth parts of the fringes then take a few bits per
+// pixel, or none at all. 8-bit frames and 16-bit frames (including 10 to 12
+// bits in 16) are compressed; other layouts, and frames that would not get
+// any smaller, are stored as they are.
+// A compressed frame is a FrameCodecHeader followed by the coded data.
+////////////////////////////////////////////////////////////////////////////////
+#ifndef _FRAMECODEC_H_
+#define _FRAMECODEC_H_
+
+//////////////
+// INCLUDES //
+//////////////
+#include <stdint.h>
+#include <stddef.h>
+#include "frame.h"
+
+/////////////
+// GLOBALS //
+/////////////
+#define FRAMECODEC_BLOCK 32				// Prediction errors per packed block
+
+// Codecs
+enum FrameCodec
+{
+	FRAMECODEC_NONE    = 0,				// Pixel data as it is
+	FRAMECODEC_PREDICT = 1				// Prediction and block bit packing
+};
+
+#pragma pack(push, 1)
+
+// Before the coded data of each frame
+struct FrameCodecHeader
+{
+	uint32_t	codec;					// FrameCodec actually used for this frame
+	uint32_t	reserved;
+	uint64_t	rawSize;				// Bytes of pixel data once decoded
+};
+
+#pragma pack(pop)
+
+////////////////////////////////////////////////////////////////////////////////
+// Functions
+////////////////////////////////////////////////////////////////////////////////
+size_t	FrameCodecBound(const Frame&);
+size_t	FrameEncode(const Frame&, uint8_t*, size_t);
+bool	FrameDecode(const uint8_t*, size_t, uint32_t, uint32_t, uint32_t, uint8_t*, size_t);
+
+#endif
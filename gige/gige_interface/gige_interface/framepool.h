@@ -0,0 +1,125 @@
+////////////////////////////////////////////////////////////////////////////////
+// Filename: framepool.h
+// Fixed pool of frames with page-aligned pixel memory, for the software frame
+// sources. This is the portable counterpart of BufferPool: consumers hand the
+// frames back through the ImageRelease deleter, from any thread. The pool
+// does not grow; like a camera with a fixed number of buffers, a source that
+// finds the pool empty has to wait or drop the frame.
+////////////////////////////////////////////////////////////////////////////////
+#ifndef _FRAMEPOOL_H_
+#define _FRAMEPOOL_H_
+
+//////////////
+// INCLUDES //
+//////////////
+#include <vector>
+#include <mutex>
+#include "spsc_queue.h"
+#include "frame.h"
+
+/////////////
+// GLOBALS //
+/////////////
+#define FRAME_POOL_ALIGNMENT 4096
+
+////////////////////////////////////////////////////////////////////////////////
+// Class name: FramePool
+////////////////////////////////////////////////////////////////////////////////
+class FramePool : public IImageRecycler
+{
+public:
+	FramePool();
+	~FramePool();
+
+	bool		Initialize(size_t, size_t);
+
+	Frame*		Get();
+	void		Recycle(Frame*);
+
+	size_t		GetFrameSize();
+	size_t		GetNumberOfFrames();
+	size_t		GetNumberOfFreeFrames();
+
+private:
+	size_t					FrameSize;
+	uint8_t*				Memory;
+	std::vector<Frame>		Frames;
+
+	std::mutex				FreeMutex;
+	std::vector<Frame*>		FreeFrames;
+};
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Class implementation: FramePool
+////////////////////////////////////////////////////////////////////////////////
+inline FramePool::FramePool()
+{
+	FrameSize = 0;
+	Memory = NULL;
+}
+
+inline FramePool::~FramePool()
+{
+	if (Memory != NULL)
+		spsc_aligned_free(Memory);
+}
+
+inline bool FramePool::Initialize(size_t count, size_t frameSize)
+{
+	// Every frame starts on a page boundary
+	FrameSize = frameSize;
+	size_t stride = ((frameSize + FRAME_POOL_ALIGNMENT - 1) / FRAME_POOL_ALIGNMENT) * FRAME_POOL_ALIGNMENT;
+
+	// Allocate the memory in one block
+	Memory = (uint8_t*)spsc_aligned_malloc(count*stride, FRAME_POOL_ALIGNMENT);
+	if (Memory == NULL)
+		return false;
+
+	// Create the frames
+	Frames.resize(count);
+	FreeFrames.reserve(count);
+	for (size_t i = 0; i < count; i++)
+	{
+		Frames[i].data = Memory + i*stride;
+		Frames[i].size = frameSize;
+		FreeFrames.push_back(&Frames[i]);
+	}
+
+	return true;
+}
+
+inline Frame* FramePool::Get()
+{
+	std::lock_guard<std::mutex> lock(FreeMutex);
+	if (FreeFrames.empty())
+		return NULL;
+
+	Frame* pFrame = FreeFrames.back();
+	FreeFrames.pop_back();
+	return pFrame;
+}
+
+inline void FramePool::Recycle(Frame* pFrame)
+{
+	std::lock_guard<std::mutex> lock(FreeMutex);
+	FreeFrames.push_back(pFrame);
+}
+
+inline size_t FramePool::GetFrameSize()
+{
+	return FrameSize;
+}
+
+inline size_t FramePool::GetNumberOfFrames()
+{
+	return Frames.size();
+}
+
+inline size_t FramePool::GetNumberOfFreeFrames()
+{
+	std::lock_guard<std::mutex> lock(FreeMutex);
+	return FreeFrames.size();
+}
+
+#endif
@@ -0,0 +1,281 @@
+////////////////////////////////////////////////////////////////////////////////
+// Filename: framesource.h
+// Common part of all frame producers (camera, synthetic, file replay): the
+// output queue, the broadcast to subscribers, and the consumer side of the
+// IImageQueue interface. A producer thread only has to fill frames and call
+// DeliverFrame().
+// Optionally, frames that the consumer does not fetch in time are spilled to
+// a scratch file once the queue holds a given number of bytes, and paged back
+// in order as the consumer catches up (see spillqueue.h).
+// The latency of each frame since its arrival is recorded when it is pushed
+// and when it is popped (see latencyhistogram.h); a producer that knows the
+// device clock also fills the "camera" stage.
+////////////////////////////////////////////////////////////////////////////////
+#ifndef _FRAMESOURCE_H_
+#define _FRAMESOURCE_H_
+
+//////////////
+// INCLUDES //
+//////////////
+#include <memory>
+#include <vector>
+#include <string>
+#include "spsc_queue.h"
+#include "iimagequeue.h"
+#include "imagebroadcast.h"
+#include "spillqueue.h"
+#include "latencyhistogram.h"
+
+////////////////////////////////////////////////////////////////////////////////
+// Class name: FrameSource
+////////////////////////////////////////////////////////////////////////////////
+class FrameSource : public IImageQueue
+{
+public:
+	virtual ~FrameSource() {}
+
+	ImagePtr							GetImage();
+	size_t								GetImages(ImagePtr*, size_t);
+	ImagePtr							GetLatestImage();
+	size_t								GetNumberOfAvailableImages();
+	DWORD								WaitImages(size_t, DWORD);
+	size_t								WaitImagesAny(size_t, size_t, DWORD);
+
+	std::shared_ptr<ImageSubscriber>	Subscribe(size_t);
+	std::vector<ImageSubscriberStats>	GetSubscriberStats();
+
+	bool								EnableSpill(const std::string&, uint64_t, uint64_t);
+	void								DisableSpill();
+	SpillStats							GetSpillStats();
+	std::string							GetSpillError();
+
+	LatencyProbes&						GetLatency();
+
+protected:
+	FrameSource(size_t);
+
+	SPSC_ImageQueue						queue;
+	ImageBroadcast						broadcast;
+
+	// Spill tier. The producer and the consumer read it for every frame, so
+	// it is a plain atomic pointer; a spill queue that is replaced is closed,
+	// and kept until the source is destroyed (declared after the queue,
+	// which their worker pushes into)
+	typedef std::unique_ptr<SpillQueue, spsc_aligned_delete<SpillQueue> > SpillQueuePtr;
+	std::atomic<SpillQueue*>			spill;
+	std::vector<SpillQueuePtr>			spillQueues;
+	std::string							spillError;
+
+	// Latency since arrival: camera transport, push and pop
+	LatencyProbes						latency;
+	LatencyHistogram*					pLatencyCamera;
+	LatencyHistogram*					pLatencyPush;
+	LatencyHistogram*					pLatencyPop;
+
+	bool								DeliverFrame(ImagePtr&);
+	void								ClearFrames();
+};
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Class implementation: FrameSource
+////////////////////////////////////////////////////////////////////////////////
+inline FrameSource::FrameSource(size_t capacity) : queue(capacity)
+{
+	spill.store(NULL);
+	pLatencyCamera = latency.Add("camera");
+	pLatencyPush = latency.Add("push");
+	pLatencyPop = latency.Add("pop");
+}
+
+inline ImagePtr FrameSource::GetImage()
+{
+	ImagePtr upFrame;
+	GetImages(&upFrame, 1);
+	return upFrame;
+}
+
+inline size_t FrameSource::GetImages(ImagePtr* frames, size_t n)
+{
+	size_t count = queue.TryPopBatch(frames, n);
+
+	// Spilled frames count as available, so wait for them to be paged back
+	// (a frame being paged back is briefly counted in both tiers; it is in
+	//  the queue by the time it leaves the spill count, hence this order)
+	SpillQueue* s = spill.load(std::memory_order_acquire);
+	if (s && count < n)
+	{
+		while (count < n && (s->GetCount() > 0 || queue.GetCount() > 0))
+		{
+			s->Demand(n - count);
+			if (queue.WaitAny(1, n - count, SPILL_CLEAR_TIMEOUT_MS) == 0)
+				break;
+			count += queue.TryPopBatch(frames + count, n - count);
+		}
+		s->Demand(0);
+	}
+
+	// Time since arrival, with one clock reading for the batch
+	if (count > 0)
+	{
+		uint64_t now = LatencyNow();
+		for (size_t i = 0; i < count; i++)
+			pLatencyPop->RecordSince(frames[i]->arrival, now);
+	}
+
+	return count;
+}
+
+inline ImagePtr FrameSource::GetLatestImage()
+{
+	// With subscribers, the newest frame is shared with them
+	if (broadcast.GetNumberOfSubscribers() > 0)
+		return broadcast.GetLatestImage();
+
+	// Otherwise, drain the queue and keep the last frame
+	// (the spilled frames are dropped: they are newer than those in memory,
+	//  but paging them all back to find the newest would take too long)
+	ImagePtr upFrame = queue.TryPop();
+	ImagePtr upFrameNew;
+	while (upFrameNew = queue.TryPop())
+		upFrame = std::move(upFrameNew);
+
+	SpillQueue* s = spill.load(std::memory_order_acquire);
+	if (s && s->GetCount() > 0)
+	{
+		s->Clear();
+		while (upFrameNew = queue.TryPop())
+			upFrame = std::move(upFrameNew);
+	}
+	return upFrame;
+}
+
+inline size_t FrameSource::GetNumberOfAvailableImages()
+{
+	// (a frame being paged back may briefly be counted twice, so GetImages can
+	//  return one frame less than this)
+	SpillQueue* s = spill.load(std::memory_order_acquire);
+	return queue.GetCount() + (s ? s->GetCount() : 0);
+}
+
+inline DWORD FrameSource::WaitImages(size_t n, DWORD timeoutMilliseconds)
+{
+	// While spilling, new frames do not go through the queue
+	SpillQueue* s = spill.load(std::memory_order_acquire);
+	if (s)
+		return s->Wait(n, timeoutMilliseconds);
+	return queue.Wait(n, timeoutMilliseconds);
+}
+
+inline size_t FrameSource::WaitImagesAny(size_t nMin, size_t nMax, DWORD timeoutMilliseconds)
+{
+	SpillQueue* s = spill.load(std::memory_order_acquire);
+	if (!s)
+		return queue.WaitAny(nMin, nMax, timeoutMilliseconds);
+
+	// Same as SPSC_Counters::WaitAny, over both tiers
+	if (nMin == 0)
+		nMin = 1;
+	if (s->Wait(nMin, timeoutMilliseconds) != WAIT_OBJECT_0)
+		return 0;
+	size_t available = GetNumberOfAvailableImages();
+	return (available < nMax) ? available : nMax;
+}
+
+inline std::shared_ptr<ImageSubscriber> FrameSource::Subscribe(size_t capacity)
+{
+	// From now on, frames go to the subscribers instead of the queue
+	return broadcast.Subscribe(capacity);
+}
+
+inline std::vector<ImageSubscriberStats> FrameSource::GetSubscriberStats()
+{
+	return broadcast.GetStats();
+}
+
+inline bool FrameSource::EnableSpill(const std::string& path, uint64_t memoryBytes, uint64_t fileBytes)
+{
+	// Replace the previous spill file, if any
+	DisableSpill();
+
+	SpillQueuePtr s(spsc_new_aligned<SpillQueue>(queue));
+	if (!s->Open(path, memoryBytes, fileBytes))
+	{
+		spillError = s->GetError();
+		return false;
+	}
+	spillError.clear();
+	spill.store(s.get(), std::memory_order_release);
+	spillQueues.push_back(std::move(s));
+	return true;
+}
+
+inline void FrameSource::DisableSpill()
+{
+	// Stop the worker first, so that it is not pushing into the queue once
+	// the producer goes back to it (frames still in the spill file are lost)
+	SpillQueue* s = spill.load(std::memory_order_acquire);
+	if (s)
+	{
+		s->Close();
+		spill.store(NULL, std::memory_order_release);
+	}
+
+	// Release the frames the producer may have pushed into the older ones
+	// while they were being closed
+	for (size_t i = 0; i < spillQueues.size(); i++)
+	{
+		if (spillQueues[i].get() != s)
+			spillQueues[i]->Close();
+	}
+}
+
+inline SpillStats FrameSource::GetSpillStats()
+{
+	SpillQueue* s = spill.load(std::memory_order_acquire);
+	if (s)
+		return s->GetStats();
+	SpillStats stats = {};
+	return stats;
+}
+
+inline std::string FrameSource::GetSpillError()
+{
+	return spillError;
+}
+
+inline LatencyProbes& FrameSource::GetLatency()
+{
+	return latency;
+}
+
+inline bool FrameSource::DeliverFrame(ImagePtr& upFrame)
+{
+	// Hand the frame to the subscribers if there are any (each of them
+	// keeps its own drop count), otherwise push it in the queue, or behind
+	// the spilled frames
+	pLatencyPush->RecordSince(upFrame->arrival, LatencyNow());
+	if (!broadcast.Publish(upFrame))
+	{
+		SpillQueue* s = spill.load(std::memory_order_acquire);
+		if (s)
+			s->Push(upFrame);
+		else
+			queue.TryPush(upFrame);
+	}
+
+	// If we still own the frame, the push failed
+	return !upFrame;
+}
+
+inline void FrameSource::ClearFrames()
+{
+	// Empty the spill file and the queue, and release the preview frame
+	SpillQueue* s = spill.load(std::memory_order_acquire);
+	if (s)
+		s->Clear();
+	queue.Clear();
+	broadcast.Clear();
+}
+
+#endif
@@ -0,0 +1,219 @@
+// Pipeline test for the software frame sources.
+// A SyntheticSource runs free and broadcasts its frames to two subscribers:
+// one checksums every frame, the other writes them to a recording, in the
+// same container format as the DiskWriter. The index and block IDs of the
+// recording are checked with a RecordingReader, then it is played back with a
+// ReplaySource, and the checksums of the replayed frames are compared with the
+// originals.
+// This file does not depend on the Pleora SDK and builds stand-alone, e.g. on
+// Linux:
+//   g++ -O2 -std=c++11 -pthread framesource_benchmark.cpp softwaresource.cpp
+//       syntheticsource.cpp replaysource.cpp recordingreader.cpp framecodec.cpp
+//       -o framesource_benchmark
+//
+// Usage: framesource_benchmark [frames] [width] [height] [bpp] [file]
+
+#include <iostream>
+#include <thread>
+#include <vector>
+#include <string>
+#include <cstdlib>
+#include <stdio.h>
+#include "syntheticsource.h"
+#include "replaysource.h"
+#include "recordingreader.h"
+
+/////////////
+// GLOBALS //
+/////////////
+#define BENCH_SUBSCRIBER_QUEUE_SIZE 1024  // Larger than the pool, so nothing is dropped
+
+typedef std::chrono::high_resolution_clock bench_clock;
+
+uint64_t Checksum(const Frame& frame)
+{
+	// FNV-1a, 8 bytes at a time
+	const uint64_t* p = (const uint64_t*)frame.data;
+	uint64_t h = 14695981039346656037ULL;
+	for (size_t i = 0; i < frame.size / 8; i++)
+		h = (h ^ p[i]) * 1099511628211ULL;
+	return h;
+}
+
+template <class Source> void PrintErrors(Source& source)
+{
+	std::unique_ptr<std::string> err;
+	while (err = source.GetError())
+		std::cout << "Error: " << *err << "\n";
+}
+
+int main(int argc, char* argv[])
+{
+	// Parameters
+	uint64_t    frames   = (argc > 1) ? strtoull(argv[1], NULL, 10) : 1000;
+	uint32_t    width    = (argc > 2) ? (uint32_t)atoi(argv[2]) : 512;
+	uint32_t    height   = (argc > 3) ? (uint32_t)atoi(argv[3]) : 512;
+	uint32_t    bpp      = (argc > 4) ? (uint32_t)atoi(argv[4]) : 16;
+	std::string filename = (argc > 5) ? argv[5] : "framesource_benchmark.bin";
+	double      megabytes = (double)frames*width*height*(bpp / 8) / 1e6;
+
+	std::cout << "Frame source benchmark: " << frames << " frames of " << width << "x"
+	          << height << "x" << bpp << " bits (" << megabytes << " MB), through " << filename << ".\n";
+
+	// Synthetic source with two subscribers
+	SyntheticSource synthetic;
+	if (!synthetic.Initialize(width, height, bpp, 0))
+	{
+		PrintErrors(synthetic);
+		return EXIT_FAILURE;
+	}
+	std::shared_ptr<ImageSubscriber> checker = synthetic.Subscribe(BENCH_SUBSCRIBER_QUEUE_SIZE);
+	std::shared_ptr<ImageSubscriber> writer = synthetic.Subscribe(BENCH_SUBSCRIBER_QUEUE_SIZE);
+
+	FILE* file = fopen(filename.c_str(), "wb");
+	if (file == NULL)
+	{
+		std::cout << "Error: could not create " << filename << ".\n";
+		return EXIT_FAILURE;
+	}
+
+	std::vector<uint64_t> checksums((size_t)frames);
+	std::vector<uint64_t> offsets;
+	uint64_t errors = 0;
+
+	bench_clock::time_point start = bench_clock::now();
+	synthetic.Start();
+
+	// Checksum consumer
+	std::thread checkerThread([&]()
+	{
+		ImagePtr batch[IMAGE_QUEUE_BATCH_SIZE];
+		uint64_t n = 0;
+		while (n < frames)
+		{
+			size_t count = checker->WaitImagesAny(1, IMAGE_QUEUE_BATCH_SIZE, 1000);
+			count = checker->GetImages(batch, count);
+			for (size_t i = 0; i < count && n < frames; i++, n++)
+			{
+				if (batch[i]->blockId != n + 1)
+					errors++;
+				checksums[(size_t)n] = Checksum(*batch[i]);
+			}
+			for (size_t i = 0; i < count; i++)
+				batch[i].reset();
+		}
+	});
+
+	// File writer
+	std::thread writerThread([&]()
+	{
+		ImagePtr batch[IMAGE_QUEUE_BATCH_SIZE];
+		uint64_t n = 0;
+		uint64_t offset = 0;
+
+		RecordingFileHeader fileHeader;
+		RecordingInitFileHeader(fileHeader);
+		offset += fwrite(&fileHeader, 1, sizeof(fileHeader), file);
+
+		while (n < frames)
+		{
+			size_t count = writer->WaitImagesAny(1, IMAGE_QUEUE_BATCH_SIZE, 1000);
+			count = writer->GetImages(batch, count);
+			for (size_t i = 0; i < count && n < frames; i++, n++)
+			{
+				RecordingFrameHeader frameHeader;
+				RecordingInitFrameHeader(frameHeader, *batch[i]);
+				offsets.push_back(offset);
+				offset += fwrite(&frameHeader, 1, sizeof(frameHeader), file);
+				offset += fwrite(batch[i]->data, 1, batch[i]->size, file);
+			}
+			for (size_t i = 0; i < count; i++)
+				batch[i].reset();
+		}
+
+		// Index, and the file header that points to it
+		RecordingIndexHeader index;
+		index.magic = RECORDING_INDEX_MAGIC;
+		index.reserved = 0;
+		index.numberOfFrames = offsets.size();
+		fwrite(&index, 1, sizeof(index), file);
+		fwrite(offsets.data(), sizeof(uint64_t), offsets.size(), file);
+		fileHeader.indexOffset = offset;
+		fileHeader.numberOfFrames = offsets.size();
+		fseek(file, 0, SEEK_SET);
+		fwrite(&fileHeader, 1, sizeof(fileHeader), file);
+	});
+
+	checkerThread.join();
+	writerThread.join();
+	synthetic.Shutdown();
+	fclose(file);
+
+	double interval = std::chrono::duration<double>(bench_clock::now() - start).count();
+	std::cout << "Synthetic: " << frames / interval << " fps, " << megabytes / interval << " MB/s.\n";
+	PrintErrors(synthetic);
+
+	// Check the recording
+	RecordingReader reader;
+	if (!reader.Open(filename))
+	{
+		std::cout << "Error: " << reader.GetError() << "\n";
+		return EXIT_FAILURE;
+	}
+	if (!reader.IsComplete() || reader.GetNumberOfFrames() != frames)
+	{
+		std::cout << "Error: the index of the recording holds " << reader.GetNumberOfFrames() << " frames.\n";
+		errors++;
+	}
+	for (uint64_t i = 0; i < reader.GetNumberOfFrames(); i++)
+	{
+		Frame frame;
+		if (!reader.GetFrame(i, frame) || frame.blockId != i + 1 || frame.width != width || Checksum(frame) != checksums[(size_t)i])
+			errors++;
+	}
+	reader.Close();
+
+	// Play the file back, as fast as possible, without looping
+	ReplaySource replay;
+	if (!replay.Initialize(filename, width, height, bpp, 0, false))
+	{
+		PrintErrors(replay);
+		return EXIT_FAILURE;
+	}
+	if (replay.GetNumberOfFramesInFile() != frames)
+	{
+		std::cout << "Error: the file holds " << replay.GetNumberOfFramesInFile() << " frames.\n";
+		errors++;
+	}
+
+	start = bench_clock::now();
+	replay.Start();
+
+	uint64_t n = 0;
+	ImagePtr batch[IMAGE_QUEUE_BATCH_SIZE];
+	while (n < frames && !(replay.IsFinished() && replay.GetNumberOfAvailableImages() == 0))
+	{
+		size_t count = replay.WaitImagesAny(1, IMAGE_QUEUE_BATCH_SIZE, 100);
+		count = replay.GetImages(batch, count);
+		for (size_t i = 0; i < count; i++, n++)
+		{
+			if (n >= frames || Checksum(*batch[i]) != checksums[(size_t)n])
+				errors++;
+			batch[i].reset();
+		}
+	}
+
+	interval = std::chrono::duration<double>(bench_clock::now() - start).count();
+	std::cout << "Replay: " << n / interval << " fps, " << (megabytes*n / frames) / interval << " MB/s.\n";
+	replay.Shutdown();
+	PrintErrors(replay);
+	remove(filename.c_str());
+
+	// Result
+	if (n != frames)
+		errors++;
+	if (errors != 0)
+		std::cout << "Error: " << errors << " frames were lost or corrupted.\n";
+
+	return (errors == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
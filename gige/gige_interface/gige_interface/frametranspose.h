@@ -0,0 +1,194 @@
+////////////////////////////////////////////////////////////////////////////////
+// Filename: frametranspose.h
+// Export of frames to column-major (MATLAB) arrays. The camera sends rows,
+// MATLAB stores columns, so each frame has to be transposed on the way out.
+// Done naively, every write of the transpose lands on a different cache line
+// and a 1.4 MP frame takes several milliseconds. Here the frame is walked in
+// square tiles of TRANSPOSE_TILE pixels, small enough for the rows read and
+// the columns written to stay in L1, and each tile is transposed in blocks
+// of 8x8 (16-bit) or 16x16 (8-bit) pixels in SSE2 registers.
+// A batch of frames is spread over several threads, one frame at a time.
+////////////////////////////////////////////////////////////////////////////////
+#ifndef _FRAMETRANSPOSE_H_
+#define _FRAMETRANSPOSE_H_
+
+//////////////
+// INCLUDES //
+//////////////
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <thread>
+#include <vector>
+
+///////////////////////
+// INSTRUCTION SETS  //
+///////////////////////
+#if defined(_M_X64) || defined(__SSE2__) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+	#define FRAMETRANSPOSE_BUILD_SSE2
+	#include <emmintrin.h>
+#endif
+
+/////////////
+// GLOBALS //
+/////////////
+#define TRANSPOSE_TILE         64		// Tile edge, in pixels
+#define TRANSPOSE_MAX_THREADS  8		// Threads per batch of frames
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Blocks
+// Transpose one block from in (rows of inStride) to out (rows of outStride).
+////////////////////////////////////////////////////////////////////////////////
+template<typename T>
+struct TransposeBlock
+{
+	static const size_t Size = 1;
+	static inline void Run(T* out, size_t outStride, const T* in, size_t)
+	{
+		*out = *in;
+	}
+};
+
+#ifdef FRAMETRANSPOSE_BUILD_SSE2
+template<>
+struct TransposeBlock<uint16_t>
+{
+	static const size_t Size = 8;
+	static inline void Run(uint16_t* out, size_t outStride, const uint16_t* in, size_t inStride)
+	{
+		__m128i r[8], t[8];
+		for (int k = 0; k < 8; k++)
+			r[k] = _mm_loadu_si128((const __m128i*)(in + k*inStride));
+
+		// Three perfect shuffles of the rows transpose 8x8
+		for (int k = 0; k < 4; k++)
+		{
+			t[2*k]   = _mm_unpacklo_epi16(r[k], r[k+4]);
+			t[2*k+1] = _mm_unpackhi_epi16(r[k], r[k+4]);
+		}
+		for (int k = 0; k < 4; k++)
+		{
+			r[2*k]   = _mm_unpacklo_epi16(t[k], t[k+4]);
+			r[2*k+1] = _mm_unpackhi_epi16(t[k], t[k+4]);
+		}
+		for (int k = 0; k < 4; k++)
+		{
+			t[2*k]   = _mm_unpacklo_epi16(r[k], r[k+4]);
+			t[2*k+1] = _mm_unpackhi_epi16(r[k], r[k+4]);
+		}
+
+		for (int k = 0; k < 8; k++)
+			_mm_storeu_si128((__m128i*)(out + k*outStride), t[k]);
+	}
+};
+
+template<>
+struct TransposeBlock<uint8_t>
+{
+	static const size_t Size = 16;
+	static inline void Run(uint8_t* out, size_t outStride, const uint8_t* in, size_t inStride)
+	{
+		__m128i r[16], t[16];
+		for (int k = 0; k < 16; k++)
+			r[k] = _mm_loadu_si128((const __m128i*)(in + k*inStride));
+
+		// Four perfect shuffles of the rows transpose 16x16
+		for (int pass = 0; pass < 2; pass++)
+		{
+			for (int k = 0; k < 8; k++)
+			{
+				t[2*k]   = _mm_unpacklo_epi8(r[k], r[k+8]);
+				t[2*k+1] = _mm_unpackhi_epi8(r[k], r[k+8]);
+			}
+			for (int k = 0; k < 8; k++)
+			{
+				r[2*k]   = _mm_unpacklo_epi8(t[k], t[k+8]);
+				r[2*k+1] = _mm_unpackhi_epi8(t[k], t[k+8]);
+			}
+		}
+
+		for (int k = 0; k < 16; k++)
+			_mm_storeu_si128((__m128i*)(out + k*outStride), r[k]);
+	}
+};
+#endif
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Frames
+// out[j*height + i] = in[i*width + j], i.e. a row-major width x height frame
+// into a column-major height x width array.
+////////////////////////////////////////////////////////////////////////////////
+template<typename T>
+void TransposeFrame(T* out, const T* in, size_t width, size_t height)
+{
+	const size_t B = TransposeBlock<T>::Size;
+
+	for (size_t i0 = 0; i0 < height; i0 += TRANSPOSE_TILE)
+	{
+		size_t i1 = (i0 + TRANSPOSE_TILE < height) ? i0 + TRANSPOSE_TILE : height;
+		for (size_t j0 = 0; j0 < width; j0 += TRANSPOSE_TILE)
+		{
+			size_t j1 = (j0 + TRANSPOSE_TILE < width) ? j0 + TRANSPOSE_TILE : width;
+
+			// Whole blocks
+			size_t i = i0;
+			for (; i + B <= i1; i += B)
+			{
+				size_t j = j0;
+				for (; j + B <= j1; j += B)
+					TransposeBlock<T>::Run(&out[j*height + i], height, &in[i*width + j], width);
+				for (; j < j1; j++)
+					for (size_t ii = i; ii < i + B; ii++)
+						out[j*height + ii] = in[ii*width + j];
+			}
+
+			// Rows left over at the bottom of the frame
+			for (; i < i1; i++)
+				for (size_t j = j0; j < j1; j++)
+					out[j*height + i] = in[i*width + j];
+		}
+	}
+}
+
+// Same layout as the frame; MATLAB sees it as width x height
+template<typename T>
+void CopyFrame(T* out, const T* in, size_t width, size_t height)
+{
+	memcpy(out, in, width*height*sizeof(T));
+}
+
+// Frame k of the batch goes to out + k*width*height. The threads take the
+// frames in turn; small batches stay on the calling thread.
+template<typename T>
+void ExportFrames(T* out, const T* const* in, size_t count, size_t width, size_t height, bool transposed)
+{
+	size_t threads = std::thread::hardware_concurrency();
+	if (threads > TRANSPOSE_MAX_THREADS)
+		threads = TRANSPOSE_MAX_THREADS;
+	if (threads > count)
+		threads = count;
+	if (threads < 1)
+		threads = 1;
+
+	auto work = [=](size_t first)
+	{
+		for (size_t k = first; k < count; k += threads)
+		{
+			if (transposed)
+				TransposeFrame(out + k*width*height, in[k], width, height);
+			else
+				CopyFrame(out + k*width*height, in[k], width, height);
+		}
+	};
+
+	std::vector<std::thread> workers;
+	for (size_t t = 1; t < threads; t++)
+		workers.push_back(std::thread(work, t));
+	work(0);
+	for (size_t t = 0; t < workers.size(); t++)
+		workers[t].join();
+}
+
+#endif
@@ -10,13 +10,32 @@
 
 
 #include <tchar.h>
+#include <string>
 #include "gigesource.h"
 
 
-GigE_Source::GigE_Source()
+GigE_Source::GigE_Source() : FrameSource(GIGE_IMAGE_QUEUE_SIZE), ManagerErrors(GIGE_ERROR_QUEUE_SIZE), Gaps(GIGE_GAP_QUEUE_SIZE), SharedFrames(GIGE_SHARED_QUEUE_SIZE)
 {
 	ManagerThread = NULL;
 	ManagerSignal = NULL;
+	largePages = GIGE_BUFFER_POOL_LARGE_PAGES;
+	SharedDepth = 0;
+	SharedHeldNext = 0;
+
+	placeholders = false;
+	Tracking = false;
+	TickNanoseconds = 0;
+	MinCameraOffset = 0;
+	LastBlockId = 0;
+	LastTimestamp = 0;
+	StatFrames = 0;
+	StatGaps = 0;
+	StatMissing = 0;
+	StatPlaceholders = 0;
+	StatLastBlockId = 0;
+	StatIntervalSum = 0;
+	StatIntervals = 0;
+	StatMaxInterval = 0;
 
 	/// ------------------------------ JWJS -------------------------
 	lPvSystem = new PvSystem;
@@ -160,22 +179,22 @@ void GigE_Source::Shutdown()
 
 
 	// Empty lStream buffer queue
-	PvBuffer* pBuffer;
-	PvResult resBuffer;
-
 	if (lStream != NULL)
 	{
-		while (lStream->RetrieveBuffer(&pBuffer, &resBuffer, 0).IsOK())
-		{
-			pBuffer->Free();
-			delete pBuffer;
-		}
+		RecycleStreamBuffers();
 	}
 
-	// Empty SPSC_queue
-	std::unique_ptr<PvBuffer> upBuffer;
-	while (upBuffer = queue.TryPop())
-		upBuffer.reset();
+	// Delete the spill file, empty SPSC_queue and release the preview frame
+	DisableSpill();
+	ClearFrames();
+
+	// Let go of the frames kept in the shared ring
+	SharedHeld.clear();
+	SharedFrames.Clear();
+
+	// Release the buffer pool
+	// (the memory goes away once consumers have returned all their frames)
+	std::atomic_store(&pool, std::shared_ptr<BufferPool>());
 
 	// Close stream
 	if (lStream != NULL)
@@ -227,6 +246,16 @@ PvResult GigE_Source::Start()
 	// Reset timestamps;
 	PvCheck(lDeviceParams->ExecuteCommand("GevTimestampControlReset"));
 
+	// The block IDs may start over too, so take the next frame as the new reference
+	ManagerResetFlag = true;
+
+	// Camera clock, for the transport latency (not measured if unknown)
+	int64_t lFrequency = 0;
+	if (lDeviceParams->GetIntegerValue("GevTimestampTickFrequency", lFrequency).IsOK() && lFrequency > 0)
+		TickNanoseconds = 1e9 / (double)lFrequency;
+	else
+		TickNanoseconds = 0;
+
 	// Lock parameters
 	PvCheck(lDeviceParams->SetIntegerValue("TLParamsLocked", 1));
 
@@ -261,10 +290,116 @@ DWORD WINAPI GigE_Source::ManagerStaticStart(LPVOID lpParams)
 #include <sstream>
 #include <iostream>
 #include <fstream>
+bool GigE_Source::QueueBuffers()
+{
+	// Top up the stream queue with buffers from the pool
+	for (uint32_t i = lStream->GetQueuedBufferCount(); i < lStream->GetQueuedBufferMaximum(); i++)
+	{
+		PvBuffer* pBuffer = pool->Get();
+		if (pBuffer == NULL)
+			return false;
+
+		if (!lStream->QueueBuffer(pBuffer).IsSuccess())
+		{
+			pool->Recycle(pool->GetFrame(pBuffer));
+			return false;
+		}
+	}
+
+	return true;
+}
+
+void GigE_Source::RecycleStreamBuffers()
+{
+	PvBuffer* pBuffer;
+	PvResult resBuffer;
+
+	// Take back all the buffers that are still in the stream
+	while (lStream->RetrieveBuffer(&pBuffer, &resBuffer, 0).IsOK())
+	{
+		if (pool)
+			pool->Recycle(pool->GetFrame(pBuffer));
+		else
+			delete pBuffer;
+	}
+}
+
+bool GigE_Source::MakePool()
+{
+	// Shared ring settings
+	std::string name;
+	size_t depth;
+	{
+		std::lock_guard<std::mutex> lock(SharedMutex);
+		name = SharedName;
+		depth = SharedDepth;
+		SharedChanged = false;
+	}
+
+	// Let go of the old pool first, as its ring may have the same name
+	// (it is unmapped once the consumers have returned its frames)
+	std::atomic_store(&pool, std::shared_ptr<BufferPool>());
+
+	// Ring for the newest frames, the frames in the stream, and a few more
+	std::shared_ptr<SharedFrameRing> ring;
+	if (!name.empty())
+	{
+		ring.reset(new SharedFrameRing());
+		uint32_t slots = (uint32_t)(depth + lStream->GetQueuedBufferMaximum() + GIGE_SHARED_RING_SPARE);
+		if (!ring->Create(name, slots, (uint64_t)bufferSize))
+		{
+			// Carry on with a private pool
+			std::string msg = ring->GetError();
+			{
+				std::lock_guard<std::mutex> lock(SharedMutex);
+				SharedError = msg;
+			}
+			PvResult res(PvResult::Code::GENERIC_ERROR, PvString(msg.c_str()));
+			ManagerErrors.TryPush(res);
+			ring.reset();
+		}
+	}
+	// (the frames kept out of the stream, oldest first from SharedHeldNext)
+	SharedHeld.clear();
+	SharedHeld.resize(depth);
+	SharedHeldNext = 0;
+
+	std::shared_ptr<BufferPool> newPool(new BufferPool());
+	if (!newPool->Initialize(lStream->GetQueuedBufferMaximum() + GIGE_BUFFER_POOL_SPARE, (uint32_t)bufferSize, largePages, ring))
+		return false;
+	if (!newPool->ReservePlaceholders(GIGE_GAP_PLACEHOLDERS))
+		return false;
+	std::atomic_store(&pool, newPool);
+	return true;
+}
+
+bool GigE_Source::OutputFrame(ImagePtr& upFrame)
+{
+	// Without a shared ring, to the queue or the subscribers
+	// (placeholders are not in a camera buffer, so they never go in the ring)
+	std::shared_ptr<SharedFrameRing> ring = pool->GetSharedRing();
+	if (!ring || upFrame->context == NULL)
+		return DeliverFrame(upFrame);
+
+	// Otherwise publish it where it is, and keep it until newer frames push
+	// it out (the descriptor is dropped if the consumer does not keep up,
+	// but the frame is in the ring regardless)
+	SharedFrameInfo info = ring->Publish((uint32_t)((PvBuffer*)upFrame->context)->GetID(), *upFrame);
+	SharedFrames.TryPush(info);
+	if (SharedHeld.empty())
+	{
+		upFrame.reset();
+		return true;
+	}
+	SharedHeld[SharedHeldNext] = std::move(upFrame);
+	SharedHeldNext = (SharedHeldNext + 1) % SharedHeld.size();
+	return true;
+}
+
 DWORD GigE_Source::ManageBuffers()
 {
 	PvBuffer* pBuffer;
-	PvResult resQueue, resRetrieve, resBuffer;
+	PvResult resRetrieve, resBuffer;
 
 	//// Debug log file
 	//QueryPerformanceCounter(&ManagerT2);
@@ -281,22 +416,26 @@ DWORD GigE_Source::ManageBuffers()
 		// Flush option
 		if (ManagerFlushFlag)
 		{
-			// Empty buffer queue
-			while (lStream->RetrieveBuffer(&pBuffer, &resBuffer, 0).IsOK())
+			// Empty buffer queue, and the shared ring
+			RecycleStreamBuffers();
+			for (size_t i = 0; i < SharedHeld.size(); i++)
+				SharedHeld[i].reset();
+
+			// Make a new pool if the payload size or the shared ring changed
+			// (frames from the old pool still go back there, and it is
+			//  released with its last frame)
+			if (!pool || pool->GetBufferSize() != (uint32_t)bufferSize || SharedChanged)
 			{
-				pBuffer->Free();
-				delete pBuffer;
+				if (!MakePool())
+					return EXIT_FAILURE;
 			}
 
 			// Fill buffer queue
-			for (uint32_t i = lStream->GetQueuedBufferCount(); i < lStream->GetQueuedBufferMaximum(); i++)
-			{
-				pBuffer = new PvBuffer();
-				pBuffer->Alloc((uint32_t)bufferSize);
-				resQueue = lStream->QueueBuffer(pBuffer);
-				if (!resQueue.IsSuccess())
-					return EXIT_FAILURE;
-			}
+			if (!QueueBuffers())
+				return EXIT_FAILURE;
+
+			// The frames in flight are gone, so do not count them as missing
+			Tracking = false;
 
 			// Signal the flush is done
 			SetEvent(ManagerSignal);
@@ -324,39 +463,55 @@ DWORD GigE_Source::ManageBuffers()
 		// Check if retrieve is successful
 		if (resRetrieve.IsOK())
 		{
-			// Create a new unique pointer for the acquired buffer
-			auto upBuffer = std::unique_ptr<PvBuffer>(pBuffer);
+			// Create a new unique pointer for the frame of the acquired buffer
+			// (it goes back to the pool once the consumers are done with it)
+			ImagePtr upBuffer(pool->GetFrame(pBuffer), ImageRelease(pool));
+			upBuffer->arrival = LatencyNow();
 
 			// Check if acquisition is succesful and if it's an image
 			if (resBuffer.IsOK() && pBuffer->GetPayloadType()==PvPayloadType::PvPayloadTypeImage)
 			{
-				// Push buffer in the queue
-				queue.TryPush(upBuffer);
-
-				// Turn "OK" into an error if this push operation failed
-				if (upBuffer)
+				// Describe the image
+				PvImage *lImage = pBuffer->GetImage();
+				upBuffer->width = lImage->GetWidth();
+				upBuffer->height = lImage->GetHeight();
+				upBuffer->bpp = lImage->GetBitsPerPixel();
+				upBuffer->data = lImage->GetDataPointer();
+				upBuffer->size = lImage->GetImageSize();
+				upBuffer->timestamp = pBuffer->GetTimestamp();
+				upBuffer->blockId = pBuffer->GetBlockID();
+
+				// Check that no frame went missing before this one
+				TrackFrame(*upBuffer);
+
+				// Push the frame in the queue, or hand it to the subscribers,
+				// or publish it in the shared ring
+				// (turn "OK" into an error if this push operation failed)
+				if (!OutputFrame(upBuffer))
 					resBuffer = PvResult(PvResult::Code::GENERIC_ERROR, PvString("Buffer queuing operation failed."));
 			}
 
 			// Register an error if needed, except for a manual abort
 			if (!resBuffer.IsOK() && resBuffer.GetCode()!=PvResult::Code::ABORTED)
-				ManagerErrors.TryPush(std::unique_ptr<PvResult>(new PvResult(resBuffer)));
+				ManagerErrors.TryPush(resBuffer);
 
 			// Drop the buffer if we still own it (i.e. if acquisition or push was unsuccessful, or if all was OK but it's not an image)
 			if (upBuffer)
 				upBuffer.reset();
 
 			// Queue a new buffer
-			pBuffer = new PvBuffer();
-			pBuffer->Alloc((uint32_t)bufferSize);
-			lStream->QueueBuffer(pBuffer);
+			if (!QueueBuffers())
+			{
+				resBuffer = PvResult(PvResult::Code::NOT_ENOUGH_MEMORY, PvString("Buffer pool could not grow."));
+				ManagerErrors.TryPush(resBuffer);
+			}
 		}
 		else if (resRetrieve.GetCode() == PvResult::Code::TIMEOUT || ManagerFlushFlag)
 		{
 		}
 		else
 		{
-			ManagerErrors.TryPush(std::unique_ptr<PvResult>(new PvResult(resRetrieve)));
+			ManagerErrors.TryPush(resRetrieve);
 			Sleep(1);
 		}
 	}
@@ -367,38 +522,254 @@ DWORD GigE_Source::ManageBuffers()
 	return EXIT_SUCCESS;
 }
 
-std::unique_ptr<PvBuffer> GigE_Source::GetImage()
+void GigE_Source::SetLargePages(bool enable)
 {
-	return queue.TryPop();
+	// Takes effect when the pool is (re)created, i.e. at initialization or
+	// when the payload size changes
+	largePages = enable;
 }
 
-size_t GigE_Source::GetNumberOfAvailableImages()
+size_t GigE_Source::GetNumberOfPoolBuffers()
 {
-	return queue.GetCount();
+	std::shared_ptr<BufferPool> currentPool = std::atomic_load(&pool);
+	return currentPool ? currentPool->GetNumberOfBuffers() : 0;
 }
 
-std::unique_ptr<PvResult> GigE_Source::GetError()
+void GigE_Source::TrackFrame(const Frame& frame)
+{
+	// Start over after Start()
+	if (ManagerResetFlag)
+	{
+		Tracking = false;
+		ManagerResetFlag = false;
+	}
+
+	// Delay from the camera to the host, relative to the fastest frame
+	double tick = TickNanoseconds;
+	if (tick > 0)
+	{
+		int64_t offset = (int64_t)frame.arrival - (int64_t)((double)frame.timestamp * tick);
+		if (!Tracking || offset < MinCameraOffset)
+			MinCameraOffset = offset;
+		pLatencyCamera->Record((uint64_t)(offset - MinCameraOffset));
+	}
+
+	// Spacing of the timestamps
+	if (Tracking && frame.timestamp > LastTimestamp)
+	{
+		uint64_t interval = frame.timestamp - LastTimestamp;
+		StatIntervalSum += interval;
+		StatIntervals++;
+		if (interval > StatMaxInterval)
+			StatMaxInterval = interval;
+	}
+
+	// Continuity of the block IDs (zero means the stream does not number them)
+	uint64_t id = frame.blockId;
+	if (Tracking && id != 0)
+	{
+		uint64_t expected = LastBlockId + 1;
+		uint64_t missing;
+		bool     backwards;
+		if (LastBlockId <= GIGE_BLOCKID_16BIT_MAX && id <= GIGE_BLOCKID_16BIT_MAX)
+		{
+			// 16-bit IDs skip zero when they wrap around, and a long way
+			// forward is more likely a step back
+			if (expected > GIGE_BLOCKID_16BIT_MAX)
+				expected = 1;
+			missing = (id + GIGE_BLOCKID_16BIT_MAX - expected) % GIGE_BLOCKID_16BIT_MAX;
+			backwards = missing > GIGE_BLOCKID_16BIT_MAX / 2;
+		}
+		else
+		{
+			missing = id - expected;
+			backwards = id < expected;
+		}
+
+		if (backwards)
+		{
+			std::string msg = "Block ID went back from " + std::to_string(LastBlockId) + " to " + std::to_string(id) + ".";
+			PvResult res(PvResult::Code::GENERIC_ERROR, PvString(msg.c_str()));
+			ManagerErrors.TryPush(res);
+		}
+		else if (missing > 0)
+		{
+			// Record the gap
+			GigE_Gap gap;
+			gap.firstMissing = expected;
+			gap.lastMissing = expected + missing - 1;
+			if (LastBlockId <= GIGE_BLOCKID_16BIT_MAX && gap.lastMissing > GIGE_BLOCKID_16BIT_MAX)
+				gap.lastMissing -= GIGE_BLOCKID_16BIT_MAX;
+			gap.timestamp = frame.timestamp;
+			Gaps.TryPush(gap);
+			StatGaps++;
+			StatMissing += missing;
+
+			std::string msg = "Missed " + std::to_string(missing) + " frame(s): block IDs " + std::to_string(gap.firstMissing) + " to " + std::to_string(gap.lastMissing) + ".";
+			PvResult res(PvResult::Code::GENERIC_ERROR, PvString(msg.c_str()));
+			ManagerErrors.TryPush(res);
+
+			// Keep the frame indices aligned
+			if (placeholders)
+				InsertPlaceholders(frame, expected, missing);
+		}
+	}
+
+	// This frame is the reference for the next one
+	if (id != 0)
+		LastBlockId = id;
+	LastTimestamp = frame.timestamp;
+	Tracking = true;
+	StatFrames++;
+	StatLastBlockId = LastBlockId;
+}
+
+void GigE_Source::InsertPlaceholders(const Frame& frame, uint64_t firstBlockId, uint64_t count)
 {
-	return ManagerErrors.TryPop();
+	// One placeholder per missing block ID, all on the pool's zeroed buffer
+	// (when the pool runs out of them, the rest of the gap is only counted
+	//  as missing)
+	for (uint64_t i = 0; i < count; i++)
+	{
+		Frame* pFrame = pool->GetPlaceholder();
+		if (pFrame == NULL)
+			return;
+		ImagePtr upBuffer(pFrame, ImageRelease(pool));
+
+		uint64_t id = firstBlockId + i;
+		if (firstBlockId <= GIGE_BLOCKID_16BIT_MAX && id > GIGE_BLOCKID_16BIT_MAX)
+			id -= GIGE_BLOCKID_16BIT_MAX;
+
+		upBuffer->width = frame.width;
+		upBuffer->height = frame.height;
+		upBuffer->bpp = frame.bpp;
+		upBuffer->size = frame.size;
+		upBuffer->timestamp = 0;
+		upBuffer->blockId = id;
+		upBuffer->arrival = 0;
+
+		if (!OutputFrame(upBuffer))
+			return;
+		StatPlaceholders++;
+	}
 }
 
-size_t GigE_Source::GetNumberOfErrors()
+GigE_SourceStats GigE_Source::GetStats()
 {
-	return ManagerErrors.GetCount();
+	GigE_SourceStats stats;
+	stats.frames = StatFrames;
+	stats.gaps = StatGaps;
+	stats.missing = StatMissing;
+	stats.placeholders = StatPlaceholders;
+	stats.lastBlockId = StatLastBlockId;
+	uint64_t intervals = StatIntervals;
+	stats.meanInterval = (intervals > 0) ? (double)StatIntervalSum / (double)intervals : 0;
+	stats.maxInterval = StatMaxInterval;
+	return stats;
 }
 
-DWORD GigE_Source::WaitImages(size_t n, DWORD timeoutMilliseconds)
+std::vector<GigE_Gap> GigE_Source::GetGaps()
 {
-	return queue.Wait(n, timeoutMilliseconds);
+	// Pop the gaps recorded since the last call
+	std::vector<GigE_Gap> gaps;
+	GigE_Gap gap;
+	while (Gaps.TryPop(gap))
+		gaps.push_back(gap);
+	return gaps;
+}
+
+void GigE_Source::SetPlaceholders(bool enable)
+{
+	placeholders = enable;
+}
+
+bool GigE_Source::EnableSharedRing(const std::string& name, size_t depth)
+{
+	{
+		std::lock_guard<std::mutex> lock(SharedMutex);
+
+		// The frames would bypass the subscribers, which would then wait
+		// for nothing
+		size_t subscribers = broadcast.GetNumberOfSubscribers();
+		if (!name.empty() && subscribers > 0)
+		{
+			SharedError = "The frames are broadcast to " + std::to_string(subscribers) + " subscriber(s); unsubscribe them before enabling the shared ring.";
+			return false;
+		}
+
+		SharedName = name;
+		SharedDepth = depth;
+		SharedError.clear();
+		SharedChanged = true;
+	}
+
+	// Have the manager make the pool again, if it runs already
+	if (lStream != NULL && ManagerThread != NULL)
+	{
+		PvResult res = FlushImages();
+		if (!res.IsOK())
+		{
+			std::lock_guard<std::mutex> lock(SharedMutex);
+			SharedError = std::string(res.GetDescription().GetAscii());
+		}
+	}
+
+	return GetSharedRingError().empty();
+}
+
+void GigE_Source::DisableSharedRing()
+{
+	// Back to a private pool
+	EnableSharedRing(std::string(), 0);
+}
+
+bool GigE_Source::IsSharedRingEnabled()
+{
+	std::lock_guard<std::mutex> lock(SharedMutex);
+	return !SharedName.empty();
+}
+
+std::string GigE_Source::GetSharedRingError()
+{
+	std::lock_guard<std::mutex> lock(SharedMutex);
+	return SharedError;
+}
+
+std::shared_ptr<SharedFrameRing> GigE_Source::GetSharedRing()
+{
+	std::shared_ptr<BufferPool> currentPool = std::atomic_load(&pool);
+	return currentPool ? currentPool->GetSharedRing() : std::shared_ptr<SharedFrameRing>();
+}
+
+std::vector<SharedFrameInfo> GigE_Source::GetSharedFrames()
+{
+	// Pop the descriptors of the frames published since the last call
+	std::vector<SharedFrameInfo> frames;
+	SharedFrameInfo info;
+	while (SharedFrames.TryPop(info))
+		frames.push_back(info);
+	return frames;
+}
+
+std::unique_ptr<PvResult> GigE_Source::GetError()
+{
+	std::unique_ptr<PvResult> err(new PvResult());
+	if (!ManagerErrors.TryPop(*err))
+		err.reset();
+	return err;
+}
+
+size_t GigE_Source::GetNumberOfErrors()
+{
+	return ManagerErrors.GetCount();
 }
 
 PvResult GigE_Source::GetQueuedError()
 {
-	std::unique_ptr<PvResult> err;
-	ManagerErrors.TryPop(err);
-	if (err)
+	PvResult err;
+	if (ManagerErrors.TryPop(err))
 	{
-		return PvResult(*err.get());
+		return err;
 	}
 	else
 	{
@@ -418,16 +789,10 @@ PvResult GigE_Source::FlushImages()
 	// Wait for completion
 	DWORD WaitResult = WaitForSingleObject(ManagerSignal, 10000);
 
-	// Pop all elements and free the associated buffers
-	// (object deletion is handled implicitly by the unique_ptr;
-	//  here we additionally added pBuffer->Free() but this is
-	//  redundant)
-	std::unique_ptr<PvBuffer> pBuffer;
-	while (pBuffer = queue.TryPop())
-	{
-		pBuffer->Free();
-		pBuffer.reset();
-	}
+	// Pop all elements and release the preview frame
+	// (the buffers go back to the pool through the unique_ptr deleter)
+	ClearFrames();
+	SharedFrames.Clear();
 
 	// Check if the wait was successful
 	if (WaitResult != WAIT_OBJECT_0)
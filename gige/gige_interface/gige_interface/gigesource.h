@@ -12,6 +12,10 @@
 // INCLUDES //
 //////////////
 #include <windows.h>
+#include <vector>
+#include <mutex>
+#include <string>
+#include <atomic>
 #include <PvString.h>
 #include <PvSystem.h>
 #include <PvDevice.h>
@@ -21,12 +25,23 @@
 #include <PvStreamGEV.h>
 #include "spsc_queue.h"
 #include "iimagequeue.h"
+#include "framesource.h"
+#include "bufferpool.h"
 
 /////////////
 // GLOBALS //
 /////////////
 #define PVSTREAM_NUM_BUFFERS 256
 #define PVPIPELINE_NUM_BUFFERS 512
+#define GIGE_IMAGE_QUEUE_SIZE  SPSC_QUEUE_SIZE
+#define GIGE_ERROR_QUEUE_SIZE  1024
+#define GIGE_BUFFER_POOL_SPARE 256
+#define GIGE_BUFFER_POOL_LARGE_PAGES false
+#define GIGE_GAP_QUEUE_SIZE    1024
+#define GIGE_GAP_PLACEHOLDERS  1024		// Placeholder frames held by consumers, at most
+#define GIGE_BLOCKID_16BIT_MAX 0xFFFF	// GigE Vision 1.x block IDs go from 65535 back to 1
+#define GIGE_SHARED_QUEUE_SIZE 4096		// Shared frame descriptors waiting for the consumer
+#define GIGE_SHARED_RING_SPARE 16		// Ring slots beyond the ring depth and the stream queue
 
 ///////////
 // MACRO //
@@ -39,10 +54,37 @@
 		}
 
 
+////////////////////////////////////////////////////////////////////////////////
+// Struct name: GigE_Gap
+// A run of block IDs that never arrived.
+////////////////////////////////////////////////////////////////////////////////
+struct GigE_Gap
+{
+	uint64_t	firstMissing;
+	uint64_t	lastMissing;
+	uint64_t	timestamp;		// Of the frame that arrived after the gap
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// Struct name: GigE_SourceStats
+// Continuity of the frames since the source was created. Timestamps are in
+// camera ticks.
+////////////////////////////////////////////////////////////////////////////////
+struct GigE_SourceStats
+{
+	uint64_t	frames;			// Images received
+	uint64_t	gaps;			// Runs of missing block IDs
+	uint64_t	missing;		// Missing block IDs, in total
+	uint64_t	placeholders;	// Placeholder frames inserted
+	uint64_t	lastBlockId;
+	double		meanInterval;	// Between consecutive images
+	uint64_t	maxInterval;
+};
+
 ////////////////////////////////////////////////////////////////////////////////
 // Class name: GigE_Source
 ////////////////////////////////////////////////////////////////////////////////
-class GigE_Source : IImageQueue
+class GigE_Source : public FrameSource
 {
 public:
 	GigE_Source();
@@ -55,11 +97,22 @@ public:
 	PvResult Stop();
 
 	PvResult FlushImages();
-	std::unique_ptr<PvBuffer> GetImage();
 	std::unique_ptr<PvResult> GetError();
-	size_t GetNumberOfAvailableImages();
 	size_t GetNumberOfErrors();
-	DWORD WaitImages(size_t, DWORD);
+
+	void SetLargePages(bool);
+	size_t GetNumberOfPoolBuffers();
+
+	GigE_SourceStats GetStats();
+	std::vector<GigE_Gap> GetGaps();
+	void SetPlaceholders(bool);
+
+	bool EnableSharedRing(const std::string&, size_t);
+	void DisableSharedRing();
+	bool IsSharedRingEnabled();
+	std::string GetSharedRingError();
+	std::shared_ptr<SharedFrameRing> GetSharedRing();
+	std::vector<SharedFrameInfo> GetSharedFrames();
 
 	PvGenParameterArray *lDeviceParams = NULL;
 
@@ -90,9 +143,31 @@ private:
 	const PvDeviceInfo *lDeviceInfo = NULL;
 	/// ---------------------------------
 
-	SPSC_Queue<PvBuffer> queue;
 	int64_t bufferSize;
 
+	std::shared_ptr<BufferPool> pool;
+	bool volatile largePages;
+	bool MakePool();
+	bool QueueBuffers();
+	void RecycleStreamBuffers();
+	bool OutputFrame(ImagePtr&);
+
+	// Shared frame ring
+	// (the pool is made of the ring slots, and instead of going to the queue
+	//  the newest SharedDepth frames are kept out of the stream, so that
+	//  other processes can read them in place; the consumer only gets their
+	//  descriptors. The settings take effect when the manager makes the pool.
+	//  Nothing goes to the queue or the subscribers meanwhile, so the ring
+	//  cannot be enabled while there are subscribers.)
+	std::mutex SharedMutex;
+	std::string SharedName;
+	size_t SharedDepth;
+	std::string SharedError;
+	bool volatile SharedChanged = false;
+	std::vector<ImagePtr> SharedHeld;
+	size_t SharedHeldNext;
+	SPSC_Ring<SharedFrameInfo> SharedFrames;
+
 	HANDLE ManagerThread;
 	HANDLE ManagerSignal;
 	bool volatile ManagerStopFlag = false;
@@ -100,9 +175,37 @@ private:
 	DWORD ManageBuffers();
 	static DWORD WINAPI GigE_Source::ManagerStaticStart(LPVOID);
 
-	SPSC_Queue<PvResult> ManagerErrors;
+	SPSC_Ring<PvResult>  ManagerErrors;
 	PvResult GetQueuedError();
 
+	// Frame continuity
+	// (the manager expects each block ID to follow the previous one; a gap
+	//  is recorded, and optionally filled with placeholder frames that have
+	//  zeroed pixels and a zero timestamp, so that frame n is still block n)
+	bool volatile placeholders;
+	bool volatile ManagerResetFlag = false;
+	bool Tracking;
+	uint64_t LastBlockId;
+	uint64_t LastTimestamp;
+
+	// Camera transport latency
+	// (the camera clock is converted with GevTimestampTickFrequency, and the
+	//  delay is counted from the fastest frame since Start, as the offset
+	//  between the two clocks is unknown)
+	double volatile TickNanoseconds;
+	int64_t MinCameraOffset;
+	std::atomic<uint64_t> StatFrames;
+	std::atomic<uint64_t> StatGaps;
+	std::atomic<uint64_t> StatMissing;
+	std::atomic<uint64_t> StatPlaceholders;
+	std::atomic<uint64_t> StatLastBlockId;
+	std::atomic<uint64_t> StatIntervalSum;
+	std::atomic<uint64_t> StatIntervals;
+	std::atomic<uint64_t> StatMaxInterval;
+	SPSC_Ring<GigE_Gap> Gaps;
+	void TrackFrame(const Frame&);
+	void InsertPlaceholders(const Frame&, uint64_t, uint64_t);
+
 	LARGE_INTEGER ManagerT1;
 	LARGE_INTEGER ManagerT2;
 
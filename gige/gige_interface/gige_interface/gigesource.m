@@ -102,19 +102,28 @@ classdef gigesource < hgsetget
            res = gigesource_mex('GetNumberOfImages', this.objectHandle);
         end
         
-        % Get last image (and flush all others)
-        function res = getlastimage(this)
-           res = gigesource_mex('GetLastImage', this.objectHandle);
+        % Get last image (and flush all others, unless the frames are
+        % broadcast to subscribers, in which case their queues are untouched)
+        function res = getlastimage(this, transposed)
+           if nargin<2
+               transposed = true;
+           end
+           res = gigesource_mex('GetLastImage', this.objectHandle, transposed);
         end
         
         % Get a number of images
-        function [data, time] = getimages(this, n)
+        % (transposed=false returns them as width x height, which saves the
+        %  transpose)
+        function [data, time] = getimages(this, n, transposed)
+            if nargin<3
+                transposed = true;
+            end
             if nargout<=1
                 % Only get the images
-                data = gigesource_mex('GetImages', this.objectHandle, n);
+                data = gigesource_mex('GetImages', this.objectHandle, n, transposed);
             elseif nargout==2
                 % Also get the timestamps
-                [data, time] = gigesource_mex('GetImages', this.objectHandle, n);
+                [data, time] = gigesource_mex('GetImages', this.objectHandle, n, transposed);
                 
                 % Attempt converting to seconds
                 try
@@ -147,6 +156,108 @@ classdef gigesource < hgsetget
            res = gigesource_mex('GetErrors', this.objectHandle);
         end
         
+        % Get the counters of the subscribers (one row per subscriber:
+        % [delivered dropped queued capacity])
+        function res = getsubscriberstats(this)
+           res = gigesource_mex('GetSubscriberStats', this.objectHandle);
+        end
+        
+        % Latency of the frames since they arrived on the host, per stage
+        % ('camera', 'push', 'pop'): one row per stage, [count mean min p50 p90 p99
+        % p999 max] in nanoseconds, and the names of the stages
+        function [res, stages] = getlatency(this)
+           [res, stages] = gigesource_mex('GetLatency', this.objectHandle);
+        end
+        
+        % Reset the latency histograms
+        function resetlatency(this)
+           gigesource_mex('ResetLatency', this.objectHandle);
+        end
+        
+        % Write the latency histograms to a CSV file
+        % (stage, lower_ns, upper_ns, count; one row per non-empty bucket)
+        function writelatencycsv(this, path)
+           gigesource_mex('WriteLatencyCsv', this.objectHandle, path);
+        end
+        
+        % Get the continuity counters of the frames (timestamps in camera
+        % ticks). Every missing block ID is also reported in geterrors.
+        function res = getstats(this)
+           s = gigesource_mex('GetStats', this.objectHandle);
+           res.frames        = s(1);
+           res.gaps          = s(2);
+           res.missing       = s(3);
+           res.placeholders  = s(4);
+           res.last_block_id = s(5);
+           res.mean_interval = s(6);
+           res.max_interval  = s(7);
+        end
+        
+        % Get the runs of missing block IDs since the last call (one row
+        % per gap: [first_missing last_missing timestamp_after])
+        function res = getgaps(this)
+           res = gigesource_mex('GetGaps', this.objectHandle);
+        end
+        
+        % Insert a placeholder frame for every missing block ID (zeroed
+        % pixels, zero timestamp), so that frame n is still block n. At
+        % most 1024 placeholders can be waiting at a time; beyond that, the
+        % block IDs are only counted as missing.
+        function setplaceholders(this, enable)
+           gigesource_mex('SetPlaceholders', this.objectHandle, logical(enable));
+        end
+        
+        % Spill the frames to a scratch file once those waiting in memory
+        % take more than memory_mb, and page them back in order as they are
+        % fetched, so that a slow consumer does not lose frames. The scratch
+        % file holds up to file_mb, and is deleted by disablespill or when
+        % the source is released.
+        function enablespill(this, path, memory_mb, file_mb)
+           gigesource_mex('EnableSpill', this.objectHandle, path, memory_mb, file_mb);
+        end
+        
+        % Stop spilling (frames still in the scratch file are lost)
+        function disablespill(this)
+           gigesource_mex('DisableSpill', this.objectHandle);
+        end
+        
+        % Get the counters of the scratch file:
+        % [spilled paged_back dropped pending used_mb file_mb]
+        function res = getspillstats(this)
+           res = gigesource_mex('GetSpillStats', this.objectHandle);
+        end
+        
+        % Acquire into the named shared memory ring 'name', which keeps the
+        % newest n frames readable in place by other processes. The frames
+        % no longer go to getimages (which then fails), nor to a
+        % diskwriter or an fftprocessor; getsharedframes returns their
+        % descriptors instead. This fails while a diskwriter or an
+        % fftprocessor is subscribed. Processes reading the ring must close
+        % it before it can be made again under the same name.
+        function enablesharedring(this, name, n)
+           gigesource_mex('EnableSharedRing', this.objectHandle, name, n);
+        end
+        
+        % Back to getimages
+        function disablesharedring(this)
+           gigesource_mex('DisableSharedRing', this.objectHandle);
+        end
+        
+        % Get the descriptors of the frames published in the ring since the
+        % last call (one row per frame: [slot sequence timestamp block_id])
+        function res = getsharedframes(this)
+           res = gigesource_mex('GetSharedFrames', this.objectHandle);
+        end
+        
+        % Copy one frame out of the ring, given its slot and sequence
+        % (fails if the frame was overwritten in the meantime)
+        function res = readsharedframe(this, slot, sequence, transposed)
+           if nargin<4
+               transposed = true;
+           end
+           res = gigesource_mex('ReadSharedFrame', this.objectHandle, double(slot), double(sequence), transposed);
+        end
+        
         %--------------------- JWJS -------------------------
         % Get the device info (MAC, IP, etc.)
         function res = getdeviceinfo(this)
@@ -169,39 +169,43 @@ void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
     // Get image data  
     if (!strcmp("GetLastImage", cmd)) {
         // Check parameters
-        if (nlhs!=1 || nrhs != 2)
+        if (nlhs!=1 || nrhs < 2 || nrhs > 3)
             mexErrMsgTxt("GetLastImage: Unexpected arguments.");
 
-		// Try to pop an image
-		std::unique_ptr<PvBuffer> pBuffer = GigE_instance->GetImage();
+		// Read input (transpose to height x width, the default)
+		bool Transposed = (nrhs < 3) || (mxGetScalar(prhs[2]) != 0);
 
-		// Check if pop was successful
-		if (!pBuffer)
-			mexErrMsgTxt("GetLastImage: no available image.");
+		// In the shared ring, the frames never reach the queue
+		if (GigE_instance->IsSharedRingEnabled())
+			mexErrMsgTxt("GetLastImage: The frames go to the shared ring; use GetSharedFrames.");
 
-		// Go until the last image
-		std::unique_ptr<PvBuffer> pBufferNew;
-		while (pBufferNew = GigE_instance->GetImage())
-			pBuffer.reset(pBufferNew.release());
+		// Get the newest image (this drains the queue, unless the frames
+		// are broadcast to subscribers, which are left untouched)
+		ImagePtr pBuffer = GigE_instance->GetLatestImage();
 
-		// Get image specific buffer interface
-		PvImage *lImage = pBuffer->GetImage();
+		// Check if this was successful
+		if (!pBuffer)
+			mexErrMsgTxt("GetLastImage: no available image.");
 
 		// Read image dimensions
-		uint32_t ImageWidth = lImage->GetWidth();
-		uint32_t ImageHeight = lImage->GetHeight();
-		uint32_t ImageBpp = lImage->GetBitsPerPixel();
+		uint32_t ImageWidth = pBuffer->width;
+		uint32_t ImageHeight = pBuffer->height;
+		uint32_t ImageBpp = pBuffer->bpp;
 		
+		// Dimensions of the MATLAB array
+		int Rows = Transposed ? (int)ImageHeight : (int)ImageWidth;
+		int Cols = Transposed ? (int)ImageWidth : (int)ImageHeight;
+
 		// Transfer to a MATLAB array (and transpose)
 		switch (ImageBpp)
 		{
 		case 8:
-			plhs[0] = mxCreateNumericMatrix((int)ImageHeight, (int)ImageWidth, mxUINT8_CLASS, mxREAL);
-			transpose((char*)mxGetData(plhs[0]), lImage->GetDataPointer(), ImageWidth, ImageHeight);
+			plhs[0] = mxCreateNumericMatrix(Rows, Cols, mxUINT8_CLASS, mxREAL);
+			transfer_single((uint8_t*)mxGetData(plhs[0]), pBuffer.get(), Transposed);
 			break;
 		case 16:
-			plhs[0] = mxCreateNumericMatrix((int)ImageHeight, (int)ImageWidth, mxUINT16_CLASS, mxREAL);
-			transpose((short*)mxGetData(plhs[0]), lImage->GetDataPointer(), ImageWidth, ImageHeight);
+			plhs[0] = mxCreateNumericMatrix(Rows, Cols, mxUINT16_CLASS, mxREAL);
+			transfer_single((uint16_t*)mxGetData(plhs[0]), pBuffer.get(), Transposed);
 			break;
 		default:
 			pBuffer.reset();
@@ -217,34 +221,37 @@ void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
 	// Get image data  
 	if (!strcmp("GetImages", cmd)) {
 		// Check parameters
-		if (nlhs > 2 || nrhs != 3 || mxGetNumberOfElements(prhs[2])!=1)
+		if (nlhs > 2 || nrhs < 3 || nrhs > 4 || mxGetNumberOfElements(prhs[2])!=1)
 			mexErrMsgTxt("GetImages: Unexpected arguments.");
 
-		// Read input (number of frames)
+		// Read input (number of frames, and whether to transpose them to
+		// height x width, the default)
 		size_t NumberOfFrames = (size_t)mxGetScalar(prhs[2]);
+		bool Transposed = (nrhs < 4) || (mxGetScalar(prhs[3]) != 0);
+
+		// In the shared ring, the frames never reach the queue
+		if (GigE_instance->IsSharedRingEnabled())
+			mexErrMsgTxt("GetImages: The frames go to the shared ring; use GetSharedFrames.");
 
 		// Check if there are that many frames available
 		if (NumberOfFrames > GigE_instance->GetNumberOfAvailableImages())
 			mexErrMsgTxt("GetImages: The number of images requested exceeds the number of available images.");
 
 		// Pop the first image
-		std::unique_ptr<PvBuffer> pBuffer = GigE_instance->GetImage();
+		ImagePtr pBuffer = GigE_instance->GetImage();
 
 		// Check if pop was successful
 		if (!pBuffer)
 			mexErrMsgTxt("GetImages: The first image could not be retrieved.");
 
-		// Get image specific buffer interface
-		PvImage *lImage = pBuffer->GetImage();
-
 		// Read image dimensions
-		uint32_t ImageWidth = lImage->GetWidth();
-		uint32_t ImageHeight = lImage->GetHeight();
-		uint32_t ImageBpp = lImage->GetBitsPerPixel();
+		uint32_t ImageWidth = pBuffer->width;
+		uint32_t ImageHeight = pBuffer->height;
+		uint32_t ImageBpp = pBuffer->bpp;
 
 		// Prepare dimensions of the MATLAB frames array
 		mwSize ndims = 4;
-		mwSize dims[4]{ImageHeight, ImageWidth, 1, (mwSize)NumberOfFrames};
+		mwSize dims[4]{Transposed ? ImageHeight : ImageWidth, Transposed ? ImageWidth : ImageHeight, 1, (mwSize)NumberOfFrames};
 
 		// Prepare MATLAB time array
 		mxArray*  mxTime = mxCreateNumericMatrix((int)NumberOfFrames, 1, mxUINT64_CLASS, mxREAL);
@@ -258,14 +265,8 @@ void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
 				// Create a MATLAB array
 				plhs[0] = mxCreateNumericArray(ndims, dims, mxUINT8_CLASS, mxREAL);
 
-				// Transfer first frame
-				char* pMat = (char*)mxGetData(plhs[0]);
-				transpose(pMat, lImage->GetDataPointer(), ImageWidth, ImageHeight);
-				pTime[0] = pBuffer->GetTimestamp();
-				pBuffer.reset();
-
-				// Transfer the other frames
-				transfer_many(&pMat[ImageWidth*ImageHeight], &pTime[1], GigE_instance, ImageWidth, ImageHeight, NumberOfFrames-1);
+				// Transfer the frames, starting with the first one
+				transfer_many((uint8_t*)mxGetData(plhs[0]), pTime, GigE_instance, pBuffer, NumberOfFrames, Transposed);
 			}
 			break;
 		case 16:
@@ -273,14 +274,8 @@ void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
 				// Create array
 				plhs[0] = mxCreateNumericArray(ndims, dims, mxUINT16_CLASS, mxREAL);
 
-				// Transfer first frame
-				short* pMat = (short*)mxGetData(plhs[0]);
-				transpose(pMat, lImage->GetDataPointer(), ImageWidth, ImageHeight);
-				pTime[0] = pBuffer->GetTimestamp();
-				pBuffer.reset();
-
-				// Transfer the other frames
-				transfer_many(&pMat[ImageWidth*ImageHeight], &pTime[1], GigE_instance, ImageWidth, ImageHeight, NumberOfFrames - 1);
+				// Transfer the frames, starting with the first one
+				transfer_many((uint16_t*)mxGetData(plhs[0]), pTime, GigE_instance, pBuffer, NumberOfFrames, Transposed);
 			}
 			break;
 		default:
@@ -358,6 +353,248 @@ void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
 	}
 
 
+	// Get the backpressure counters of the subscribers
+	if (!strcmp("GetSubscriberStats", cmd)) {
+		// Check parameters
+		if (nlhs > 1 || nrhs != 2)
+			mexErrMsgTxt("GetSubscriberStats: Unexpected arguments.");
+
+		// Get counters
+		std::vector<ImageSubscriberStats> stats = GigE_instance->GetSubscriberStats();
+
+		// One row per subscriber: [delivered dropped queued capacity]
+		plhs[0] = mxCreateNumericMatrix((int)stats.size(), 4, mxDOUBLE_CLASS, mxREAL);
+		double* pStats = (double*)mxGetData(plhs[0]);
+		for (size_t i = 0; i < stats.size(); i++)
+		{
+			pStats[i + 0 * stats.size()] = (double)stats[i].delivered;
+			pStats[i + 1 * stats.size()] = (double)stats[i].dropped;
+			pStats[i + 2 * stats.size()] = (double)stats[i].queued;
+			pStats[i + 3 * stats.size()] = (double)stats[i].capacity;
+		}
+
+		// Return
+		return;
+	}
+
+
+	// Get the continuity counters of the frames
+	if (!strcmp("GetStats", cmd)) {
+		// Check parameters
+		if (nlhs > 1 || nrhs != 2)
+			mexErrMsgTxt("GetStats: Unexpected arguments.");
+
+		// Get counters
+		GigE_SourceStats stats = GigE_instance->GetStats();
+
+		// [frames gaps missing placeholders lastBlockId meanInterval maxInterval]
+		plhs[0] = mxCreateNumericMatrix(1, 7, mxDOUBLE_CLASS, mxREAL);
+		double* pStats = (double*)mxGetData(plhs[0]);
+		pStats[0] = (double)stats.frames;
+		pStats[1] = (double)stats.gaps;
+		pStats[2] = (double)stats.missing;
+		pStats[3] = (double)stats.placeholders;
+		pStats[4] = (double)stats.lastBlockId;
+		pStats[5] = stats.meanInterval;
+		pStats[6] = (double)stats.maxInterval;
+
+		// Return
+		return;
+	}
+
+	// Get the runs of missing block IDs recorded since the last call
+	if (!strcmp("GetGaps", cmd)) {
+		// Check parameters
+		if (nlhs > 1 || nrhs != 2)
+			mexErrMsgTxt("GetGaps: Unexpected arguments.");
+
+		// Get gaps
+		std::vector<GigE_Gap> gaps = GigE_instance->GetGaps();
+
+		// One row per gap: [firstMissing lastMissing timestamp]
+		plhs[0] = mxCreateNumericMatrix((int)gaps.size(), 3, mxDOUBLE_CLASS, mxREAL);
+		double* pGaps = (double*)mxGetData(plhs[0]);
+		for (size_t i = 0; i < gaps.size(); i++)
+		{
+			pGaps[i + 0 * gaps.size()] = (double)gaps[i].firstMissing;
+			pGaps[i + 1 * gaps.size()] = (double)gaps[i].lastMissing;
+			pGaps[i + 2 * gaps.size()] = (double)gaps[i].timestamp;
+		}
+
+		// Return
+		return;
+	}
+
+	// Fill the gaps with placeholder frames
+	if (!strcmp("SetPlaceholders", cmd)) {
+		// Check parameters
+		if (nlhs > 0 || nrhs != 3 || mxGetNumberOfElements(prhs[2]) != 1)
+			mexErrMsgTxt("SetPlaceholders: Unexpected arguments.");
+
+		GigE_instance->SetPlaceholders(mxGetScalar(prhs[2]) != 0);
+		return;
+	}
+
+	// Spill the frames to a scratch file when the consumer falls behind
+	if (!strcmp("EnableSpill", cmd)) {
+		// Check parameters
+		if (nlhs > 0 || nrhs != 5 || !mxIsChar(prhs[2]) || mxGetNumberOfElements(prhs[3]) != 1 || mxGetNumberOfElements(prhs[4]) != 1)
+			mexErrMsgTxt("EnableSpill: Unexpected arguments.");
+
+		// Read inputs (sizes in megabytes)
+		char* cPath = mxArrayToString(prhs[2]);
+		std::string path(cPath);
+		mxFree(cPath);
+		uint64_t memoryBytes = (uint64_t)(mxGetScalar(prhs[3]) * 1024 * 1024);
+		uint64_t fileBytes   = (uint64_t)(mxGetScalar(prhs[4]) * 1024 * 1024);
+
+		// Create the file
+		if (!GigE_instance->EnableSpill(path, memoryBytes, fileBytes))
+			mexErrMsgTxt(("EnableSpill: " + GigE_instance->GetSpillError()).c_str());
+
+		// Return
+		return;
+	}
+
+	// Delete the scratch file (frames still in it are lost)
+	if (!strcmp("DisableSpill", cmd)) {
+		// Check parameters
+		if (nlhs > 0 || nrhs != 2)
+			mexErrMsgTxt("DisableSpill: Unexpected arguments.");
+
+		GigE_instance->DisableSpill();
+		return;
+	}
+
+	// Get the counters of the spill file
+	if (!strcmp("GetSpillStats", cmd)) {
+		// Check parameters
+		if (nlhs > 1 || nrhs != 2)
+			mexErrMsgTxt("GetSpillStats: Unexpected arguments.");
+
+		// Get counters
+		SpillStats stats = GigE_instance->GetSpillStats();
+
+		// [spilled pagedBack dropped pending usedMB fileMB]
+		plhs[0] = mxCreateNumericMatrix(1, 6, mxDOUBLE_CLASS, mxREAL);
+		double* pStats = (double*)mxGetData(plhs[0]);
+		pStats[0] = (double)stats.spilled;
+		pStats[1] = (double)stats.pagedBack;
+		pStats[2] = (double)stats.dropped;
+		pStats[3] = (double)stats.pending;
+		pStats[4] = (double)stats.usedBytes / (1024 * 1024);
+		pStats[5] = (double)stats.fileBytes / (1024 * 1024);
+
+		// Return
+		return;
+	}
+
+
+	// Acquire into a named shared frame ring, keeping the newest frames
+	if (!strcmp("EnableSharedRing", cmd)) {
+		// Check parameters
+		if (nlhs > 0 || nrhs != 4 || !mxIsChar(prhs[2]) || mxGetNumberOfElements(prhs[3]) != 1)
+			mexErrMsgTxt("EnableSharedRing: Unexpected arguments.");
+
+		// Read inputs (name of the mapping, number of frames kept)
+		char* cName = mxArrayToString(prhs[2]);
+		std::string name(cName);
+		mxFree(cName);
+		size_t depth = (size_t)mxGetScalar(prhs[3]);
+
+		// Make the pool again in the ring
+		if (!GigE_instance->EnableSharedRing(name, depth))
+			mexErrMsgTxt(("EnableSharedRing: " + GigE_instance->GetSharedRingError()).c_str());
+
+		// Return
+		return;
+	}
+
+	// Back to the queue
+	if (!strcmp("DisableSharedRing", cmd)) {
+		// Check parameters
+		if (nlhs > 0 || nrhs != 2)
+			mexErrMsgTxt("DisableSharedRing: Unexpected arguments.");
+
+		GigE_instance->DisableSharedRing();
+		return;
+	}
+
+	// Get the descriptors of the frames published in the ring since the last call
+	if (!strcmp("GetSharedFrames", cmd)) {
+		// Check parameters
+		if (nlhs > 1 || nrhs != 2)
+			mexErrMsgTxt("GetSharedFrames: Unexpected arguments.");
+
+		// Get descriptors
+		std::vector<SharedFrameInfo> frames = GigE_instance->GetSharedFrames();
+
+		// One row per frame: [slot sequence timestamp blockId]
+		plhs[0] = mxCreateNumericMatrix((int)frames.size(), 4, mxUINT64_CLASS, mxREAL);
+		uint64_t* pFrames = (uint64_t*)mxGetData(plhs[0]);
+		for (size_t i = 0; i < frames.size(); i++)
+		{
+			pFrames[i + 0 * frames.size()] = frames[i].slot;
+			pFrames[i + 1 * frames.size()] = frames[i].sequence;
+			pFrames[i + 2 * frames.size()] = frames[i].timestamp;
+			pFrames[i + 3 * frames.size()] = frames[i].blockId;
+		}
+
+		// Return
+		return;
+	}
+
+	// Copy one frame out of the ring, if it was not overwritten yet
+	if (!strcmp("ReadSharedFrame", cmd)) {
+		// Check parameters
+		if (nlhs > 1 || nrhs < 4 || nrhs > 5 || mxGetNumberOfElements(prhs[2]) != 1 || mxGetNumberOfElements(prhs[3]) != 1)
+			mexErrMsgTxt("ReadSharedFrame: Unexpected arguments.");
+
+		// Read inputs
+		uint32_t slot = (uint32_t)mxGetScalar(prhs[2]);
+		uint64_t sequence = (uint64_t)mxGetScalar(prhs[3]);
+		bool Transposed = (nrhs < 5) || (mxGetScalar(prhs[4]) != 0);
+
+		// Describe the frame
+		std::shared_ptr<SharedFrameRing> ring = GigE_instance->GetSharedRing();
+		if (!ring)
+			mexErrMsgTxt("ReadSharedFrame: There is no shared frame ring.");
+		Frame frame;
+		if (!ring->Peek(slot, sequence, frame))
+			mexErrMsgTxt("ReadSharedFrame: The frame is no longer in the ring.");
+		if (frame.bpp != 8 && frame.bpp != 16)
+			mexErrMsgTxt("ReadSharedFrame: Unsupported bit depth.");
+
+		// Copy it, and check that it was not overwritten meanwhile
+		std::vector<uint8_t> pixels(frame.size);
+		if (!ring->Read(slot, sequence, frame, pixels.data(), pixels.size()))
+			mexErrMsgTxt("ReadSharedFrame: The frame was overwritten while it was read.");
+		frame.data = pixels.data();
+
+		// Transfer to a MATLAB array
+		int Rows = Transposed ? (int)frame.height : (int)frame.width;
+		int Cols = Transposed ? (int)frame.width : (int)frame.height;
+		if (frame.bpp == 8)
+		{
+			plhs[0] = mxCreateNumericMatrix(Rows, Cols, mxUINT8_CLASS, mxREAL);
+			transfer_single((uint8_t*)mxGetData(plhs[0]), &frame, Transposed);
+		}
+		else
+		{
+			plhs[0] = mxCreateNumericMatrix(Rows, Cols, mxUINT16_CLASS, mxREAL);
+			transfer_single((uint16_t*)mxGetData(plhs[0]), &frame, Transposed);
+		}
+
+		// Return
+		return;
+	}
+
+
+	// Latency histograms
+	if (LatencyCommand(cmd, GigE_instance->GetLatency(), nlhs, plhs, nrhs, prhs))
+		return;
+
+
 	// Get image data  
 	if (!strcmp("GetErrors", cmd)) {
 		// Check parameters
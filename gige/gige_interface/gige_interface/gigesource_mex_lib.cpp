@@ -7,6 +7,7 @@
 
 #include "mex.h"
 #include "gigesource.cpp"
+#include "frametranspose.h"
 
 PvString GetPvString(PvResult res)
 {
@@ -201,50 +202,129 @@ mxArray* GetMxStruct(PvGenParameterArray *PvArr)
 }
 
 
+// Copies a frame into a MATLAB array, as height x width (transposed) or as
+// width x height (the same layout as the frame, without a transpose)
 template<typename T>
-void transpose(T* pDataOut, const void* pDataIn, size_t WidthIn, size_t HeightIn)
+void transfer_single(T* pMat, const Frame* pFrame, bool Transposed)
 {
-	T* pDataInT  = (T*)pDataIn;
-
-	for (size_t i = 0; i < HeightIn; i++)
-	{
-		for (size_t j = 0; j < WidthIn; j++)
-		{
-			pDataOut[j*(HeightIn)+i] = pDataInT[i*(WidthIn)+j];
-		}
-	}
+	if (Transposed)
+		TransposeFrame(pMat, (const T*)pFrame->data, pFrame->width, pFrame->height);
+	else
+		CopyFrame(pMat, (const T*)pFrame->data, pFrame->width, pFrame->height);
 }
 
+// Transfers the first frame and the Frames-1 next ones, popping them in
+// batches and copying each batch on several threads
 template<typename T, typename TSource>
-void transfer_many(T* pMat, uint64_t* pTime, TSource* GigE_instance, size_t Width, size_t Height, size_t Frames)
+void transfer_many(T* pMat, uint64_t* pTime, TSource* GigE_instance, ImagePtr& pFirst, size_t Frames, bool Transposed)
 {
-	// Transfer the other frames
-	for (size_t i = 0; i < Frames; i++)
+	ImagePtr pBuffers[IMAGE_QUEUE_BATCH_SIZE];
+	const T* pData[IMAGE_QUEUE_BATCH_SIZE];
+	size_t Width  = pFirst->width;
+	size_t Height = pFirst->height;
+
+	size_t i = 0;
+	while (i < Frames)
 	{
-		// Pop frame
-		std::unique_ptr<PvBuffer> pBuffer = GigE_instance->GetImage();
+		// Pop frames (the first batch starts with the frame already popped)
+		size_t nRequest = (Frames - i < IMAGE_QUEUE_BATCH_SIZE) ? (Frames - i) : IMAGE_QUEUE_BATCH_SIZE;
+		size_t nPopped  = 0;
+		if (pFirst)
+			pBuffers[nPopped++] = std::move(pFirst);
+		nPopped += GigE_instance->GetImages(&pBuffers[nPopped], nRequest - nPopped);
 
-		// Check validity of buffer
-		if (!pBuffer)
+		// Check that all of them were there
+		if (nPopped != nRequest)
 			mexErrMsgTxt("transfer_many: One of the images could not be retrieved. Part of the images were dropped.");
 
-		// Get image interface
-		PvImage *lImage = pBuffer->GetImage();
-
 		// Check specs
-		if (lImage->GetWidth() != Width || lImage->GetHeight() != Height || lImage->GetBitsPerPixel() != sizeof(T)*8)
+		for (size_t k = 0; k < nPopped; k++)
 		{
-			pBuffer.reset();
-			mexErrMsgTxt("transfer_many: One of the images has inconsistent dimensions. Part of the images were dropped.");
-			return;
+			Frame *pFrame = pBuffers[k].get();
+			if (pFrame->width != Width || pFrame->height != Height || pFrame->bpp != sizeof(T)*8)
+			{
+				for (size_t j = 0; j < nPopped; j++)
+					pBuffers[j].reset();
+				mexErrMsgTxt("transfer_many: One of the images has inconsistent dimensions. Part of the images were dropped.");
+				return;
+			}
+			pData[k] = (const T*)pFrame->data;
+			pTime[i + k] = pFrame->timestamp;
 		}
 
 		// Transpose/copy
-		transpose<T>(&pMat[i*Width*Height], lImage->GetDataPointer(), Width, Height);
+		ExportFrames(&pMat[i*Width*Height], pData, nPopped, Width, Height, Transposed);
+
+		// Release the frames
+		for (size_t k = 0; k < nPopped; k++)
+			pBuffers[k].reset();
+		i += nPopped;
+	}
+}
+
+// Latency commands, the same for all the MEX interfaces
+//   GetLatency      : one row per stage, [count mean min p50 p90 p99 p999 max]
+//                     in nanoseconds, and the names of the stages
+//   ResetLatency    : start counting again
+//   WriteLatencyCsv : write the histogram buckets of all stages to a file
+// Returns false if the command is not one of these.
+bool LatencyCommand(const char* cmd, LatencyProbes& probes, int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
+{
+	if (!strcmp("GetLatency", cmd)) {
+		// Check parameters
+		if (nlhs > 2 || nrhs != 2)
+			mexErrMsgTxt("GetLatency: Unexpected arguments.");
 
-		// Record timestamp
-		pTime[i] = pBuffer->GetTimestamp();
+		// Summaries
+		std::vector<LatencySummary> summaries = probes.GetSummaries();
+		size_t n = summaries.size();
+		plhs[0] = mxCreateNumericMatrix((int)n, 8, mxDOUBLE_CLASS, mxREAL);
+		double* pSummary = (double*)mxGetData(plhs[0]);
+		for (size_t i = 0; i < n; i++)
+		{
+			pSummary[i + 0 * n] = (double)summaries[i].count;
+			pSummary[i + 1 * n] = summaries[i].mean;
+			pSummary[i + 2 * n] = (double)summaries[i].min;
+			pSummary[i + 3 * n] = (double)summaries[i].p50;
+			pSummary[i + 4 * n] = (double)summaries[i].p90;
+			pSummary[i + 5 * n] = (double)summaries[i].p99;
+			pSummary[i + 6 * n] = (double)summaries[i].p999;
+			pSummary[i + 7 * n] = (double)summaries[i].max;
+		}
+
+		// Stage names
+		if (nlhs >= 2)
+		{
+			plhs[1] = mxCreateCellMatrix((mwSize)n, 1);
+			for (size_t i = 0; i < n; i++)
+				mxSetCell(plhs[1], (mwIndex)i, mxCreateString(probes.GetName(i).c_str()));
+		}
+		return true;
+	}
+
+	if (!strcmp("ResetLatency", cmd)) {
+		// Check parameters
+		if (nlhs > 0 || nrhs != 2)
+			mexErrMsgTxt("ResetLatency: Unexpected arguments.");
+
+		probes.Reset();
+		return true;
+	}
+
+	if (!strcmp("WriteLatencyCsv", cmd)) {
+		// Check parameters
+		if (nlhs > 0 || nrhs != 3 || !mxIsChar(prhs[2]))
+			mexErrMsgTxt("WriteLatencyCsv: Unexpected arguments.");
+
+		char* cPath = mxArrayToString(prhs[2]);
+		std::string path(cPath);
+		mxFree(cPath);
+		if (!probes.WriteCsv(path))
+			mexErrMsgTxt(("WriteLatencyCsv: Could not write " + path + ".").c_str());
+		return true;
 	}
+
+	return false;
 }
 
-#endif
\ No newline at end of file
+#endif
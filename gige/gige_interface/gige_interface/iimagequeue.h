@@ -10,7 +10,14 @@
 // INCLUDES //
 //////////////
 #include "spsc_queue.h"
-#include <PvBuffer.h>
+#include "frame.h"
+
+/////////////
+// GLOBALS //
+/////////////
+#define IMAGE_QUEUE_BATCH_SIZE 64
+
+typedef SPSC_Queue<Frame, ImageRelease> SPSC_ImageQueue;
 
 ////////////////////////////////////////////////////////////////////////////////
 // Class name: IImageQueue
@@ -18,9 +25,11 @@
 class IImageQueue
 {
 public:
-	virtual std::unique_ptr<PvBuffer> GetImage() = 0;
+	virtual ImagePtr GetImage() = 0;
+	virtual size_t GetImages(ImagePtr*, size_t) = 0;
 	virtual DWORD WaitImages(size_t, DWORD) = 0;
-	
+	virtual size_t WaitImagesAny(size_t, size_t, DWORD) = 0;
+
 };
 
 #endif
\ No newline at end of file
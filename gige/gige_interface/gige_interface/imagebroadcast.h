@@ -0,0 +1,328 @@
+////////////////////////////////////////////////////////////////////////////////
+// Filename: imagebroadcast.h
+// Fan-out stage that hands every frame of one producer to several consumers
+// (e.g. a disk writer, an FFT processor and a live preview), each of which
+// reads at its own pace.
+//
+// Every subscriber has its own lock-free SPSC queue of frame references; the
+// pop counter of that queue is the subscriber's read cursor. The frame itself
+// is shared and reference-counted (the count is in the frame, see frame.h),
+// so it is released when the last subscriber is done with it. A subscriber that falls behind only loses frames itself:
+// its queue overflows, the frame is counted as dropped for that subscriber,
+// and the other subscribers are unaffected.
+//
+// The producer additionally keeps a reference to the newest frame, which a
+// preview can fetch at any time without subscribing.
+//
+// The list of subscribers is immutable once published: subscribing makes a
+// new list, and the producer reads the current one for each frame through an
+// SPSC_Snapshot (no lock, no reference count). Subscribers that left are
+// skipped, and dropped from the list by the next change, or as soon as the
+// producer notices them. A replaced list is deleted once the producer is done
+// with it.
+////////////////////////////////////////////////////////////////////////////////
+#ifndef _IMAGEBROADCAST_H_
+#define _IMAGEBROADCAST_H_
+
+//////////////
+// INCLUDES //
+//////////////
+#include <memory>
+#include <vector>
+#include <atomic>
+#include <mutex>
+#include "spsc_queue.h"
+#include "iimagequeue.h"
+
+////////////////////////////////////////////////////////////////////////////////
+// Struct name: ImageSubscriberStats
+////////////////////////////////////////////////////////////////////////////////
+struct ImageSubscriberStats
+{
+	uint64_t	delivered;	// Frames pushed into the subscriber queue
+	uint64_t	dropped;	// Frames lost because the subscriber queue was full
+	size_t		queued;		// Frames currently waiting in the subscriber queue
+	size_t		capacity;	// Capacity of the subscriber queue
+};
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Class name: ImageSubscriber
+////////////////////////////////////////////////////////////////////////////////
+class ImageSubscriber : public IImageQueue
+{
+public:
+	ImageSubscriber(size_t);
+
+	ImagePtr				GetImage();
+	size_t					GetImages(ImagePtr*, size_t);
+	DWORD					WaitImages(size_t, DWORD);
+	size_t					WaitImagesAny(size_t, size_t, DWORD);
+	size_t					GetNumberOfAvailableImages();
+
+	ImageSubscriberStats	GetStats();
+	void					Unsubscribe();
+	bool					IsSubscribed();
+
+private:
+	friend class ImageBroadcast;
+
+	SPSC_ImageQueue			queue;
+	std::atomic<bool>		Subscribed;
+	std::atomic<uint64_t>	Delivered;
+	std::atomic<uint64_t>	Dropped;
+
+	bool					Deliver(ImagePtr&);
+};
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Class name: ImageBroadcast
+////////////////////////////////////////////////////////////////////////////////
+class ImageBroadcast
+{
+public:
+	ImageBroadcast();
+
+	std::shared_ptr<ImageSubscriber>	Subscribe(size_t);
+	size_t								GetNumberOfSubscribers();
+	std::vector<ImageSubscriberStats>	GetStats();
+
+	bool								Publish(ImagePtr&);
+	ImagePtr							GetLatestImage();
+	void								Clear();
+
+private:
+	typedef std::vector<std::shared_ptr<ImageSubscriber>> SubscriberList;
+
+	std::mutex										SubscribersMutex;	// Serializes the changes of the list
+	SPSC_Snapshot<const SubscriberList>				Subscribers;		// Read by the producer without the lock
+
+	std::mutex										LatestMutex;
+	ImagePtr										Latest;
+
+	void											Prune();
+};
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Class implementation: ImageSubscriber
+////////////////////////////////////////////////////////////////////////////////
+inline ImageSubscriber::ImageSubscriber(size_t capacity) : queue(capacity)
+{
+	Subscribed.store(true);
+	Delivered.store(0);
+	Dropped.store(0);
+}
+
+inline ImagePtr ImageSubscriber::GetImage()
+{
+	return queue.TryPop();
+}
+
+inline size_t ImageSubscriber::GetImages(ImagePtr* buffers, size_t n)
+{
+	return queue.TryPopBatch(buffers, n);
+}
+
+inline DWORD ImageSubscriber::WaitImages(size_t n, DWORD timeoutMilliseconds)
+{
+	return queue.Wait(n, timeoutMilliseconds);
+}
+
+inline size_t ImageSubscriber::WaitImagesAny(size_t nMin, size_t nMax, DWORD timeoutMilliseconds)
+{
+	return queue.WaitAny(nMin, nMax, timeoutMilliseconds);
+}
+
+inline size_t ImageSubscriber::GetNumberOfAvailableImages()
+{
+	return queue.GetCount();
+}
+
+inline ImageSubscriberStats ImageSubscriber::GetStats()
+{
+	ImageSubscriberStats stats;
+	stats.delivered = Delivered.load(std::memory_order_relaxed);
+	stats.dropped   = Dropped.load(std::memory_order_relaxed);
+	stats.queued    = queue.GetCount();
+	stats.capacity  = queue.GetCapacity();
+	return stats;
+}
+
+inline void ImageSubscriber::Unsubscribe()
+{
+	// The producer removes the subscriber at the next frame. Frames that are
+	// still queued are released when the subscriber object is destroyed.
+	Subscribed.store(false, std::memory_order_release);
+}
+
+inline bool ImageSubscriber::IsSubscribed()
+{
+	return Subscribed.load(std::memory_order_acquire);
+}
+
+inline bool ImageSubscriber::Deliver(ImagePtr& ref)
+{
+	// Push the reference (only the producer thread calls this)
+	queue.TryPush(ref);
+
+	// Update the counters
+	if (ref)
+	{
+		Dropped.fetch_add(1, std::memory_order_relaxed);
+		ref.reset();
+		return false;
+	}
+	else
+	{
+		Delivered.fetch_add(1, std::memory_order_relaxed);
+		return true;
+	}
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Class implementation: ImageBroadcast
+////////////////////////////////////////////////////////////////////////////////
+inline ImageBroadcast::ImageBroadcast() : Subscribers(new SubscriberList())
+{
+}
+
+inline std::shared_ptr<ImageSubscriber> ImageBroadcast::Subscribe(size_t capacity)
+{
+	std::shared_ptr<ImageSubscriber> subscriber = spsc_make_shared_aligned<ImageSubscriber>(capacity);
+
+	// Publish a new list with the subscriber (leaving out those that left)
+	std::lock_guard<std::mutex> lock(SubscribersMutex);
+	const SubscriberList* current = Subscribers.Get();
+	SubscriberList* list = new SubscriberList();
+	list->reserve(current->size() + 1);
+	for (size_t i = 0; i < current->size(); i++)
+	{
+		if ((*current)[i]->IsSubscribed())
+			list->push_back((*current)[i]);
+	}
+	list->push_back(subscriber);
+	Subscribers.Replace(list);
+	return subscriber;
+}
+
+inline void ImageBroadcast::Prune()
+{
+	// Publish a new list without the subscribers that left, if there are any
+	// (and delete the lists the producer is done with)
+	std::lock_guard<std::mutex> lock(SubscribersMutex);
+	const SubscriberList* current = Subscribers.Get();
+	size_t count = 0;
+	for (size_t i = 0; i < current->size(); i++)
+	{
+		if ((*current)[i]->IsSubscribed())
+			count++;
+	}
+	if (count == current->size())
+	{
+		Subscribers.Reclaim();
+		return;
+	}
+
+	SubscriberList* list = new SubscriberList();
+	list->reserve(count);
+	for (size_t i = 0; i < current->size(); i++)
+	{
+		if ((*current)[i]->IsSubscribed())
+			list->push_back((*current)[i]);
+	}
+	Subscribers.Replace(list);
+}
+
+inline size_t ImageBroadcast::GetNumberOfSubscribers()
+{
+	// (those that left but are still in the list are not counted)
+	std::lock_guard<std::mutex> lock(SubscribersMutex);
+	const SubscriberList* list = Subscribers.Get();
+	size_t count = 0;
+	for (size_t i = 0; i < list->size(); i++)
+	{
+		if ((*list)[i]->IsSubscribed())
+			count++;
+	}
+	return count;
+}
+
+inline std::vector<ImageSubscriberStats> ImageBroadcast::GetStats()
+{
+	Prune();
+
+	std::vector<ImageSubscriberStats> stats;
+	std::lock_guard<std::mutex> lock(SubscribersMutex);
+	const SubscriberList* list = Subscribers.Get();
+	for (size_t i = 0; i < list->size(); i++)
+		stats.push_back((*list)[i]->GetStats());
+	return stats;
+}
+
+inline bool ImageBroadcast::Publish(ImagePtr& upBuffer)
+{
+	// Current subscribers (without any, the caller keeps the frame)
+	size_t count = 0;
+	bool left;
+	{
+		SPSC_Snapshot<const SubscriberList>::Reader list(Subscribers);
+		for (size_t i = 0; i < list->size(); i++)
+		{
+			if ((*list)[i]->IsSubscribed())
+				count++;
+		}
+		left = (count != list->size());
+
+		// Hand out one reference per subscriber
+		// (the original deleter still runs once the last reference is gone)
+		if (count > 0)
+		{
+			ShareImage(upBuffer);
+			for (size_t i = 0; i < list->size(); i++)
+			{
+				if ((*list)[i]->IsSubscribed())
+				{
+					ImagePtr ref = AddImageReference(upBuffer);
+					(*list)[i]->Deliver(ref);
+				}
+			}
+		}
+	}
+
+	// Drop the subscribers that left
+	// (once done with the list, so that it can be deleted right away)
+	if (left)
+		Prune();
+	if (count == 0)
+		return false;
+
+	// Keep the newest frame for the preview
+	// (skipped if the preview is reading it right now; the next frame will do)
+	std::unique_lock<std::mutex> lockLatest(LatestMutex, std::try_to_lock);
+	if (lockLatest.owns_lock())
+		Latest = std::move(upBuffer);
+	else
+		upBuffer.reset();
+
+	return true;
+}
+
+inline ImagePtr ImageBroadcast::GetLatestImage()
+{
+	std::lock_guard<std::mutex> lock(LatestMutex);
+	if (Latest)
+		return AddImageReference(Latest);
+	else
+		return ImagePtr();
+}
+
+inline void ImageBroadcast::Clear()
+{
+	std::lock_guard<std::mutex> lock(LatestMutex);
+	Latest.reset();
+}
+
+#endif
@@ -0,0 +1,323 @@
+////////////////////////////////////////////////////////////////////////////////
+// Filename: latencyhistogram.h
+// Per-frame latency instrumentation. Each frame carries the host time at
+// which it arrived (Frame::arrival), and every stage of the pipeline that
+// wants to be measured records "now - arrival" into its own histogram when it
+// is done with the frame: the camera transport, the push into the output
+// queue, the consumer pop, the Fourier transform, the disk write.
+//
+// The histograms are log-linear, like HdrHistogram: values below
+// LATENCY_SUB_BUCKETS nanoseconds have a bucket each, and every power of two
+// above is split into LATENCY_SUB_BUCKETS buckets, which keeps the relative
+// error below 1/LATENCY_SUB_BUCKETS from nanoseconds to minutes with a
+// thousand counters. Recording is a handful of relaxed atomic increments and
+// takes no lock, so it can run on the acquisition thread, and the
+// histograms can be read while the pipeline runs.
+//
+// The host clock is QueryPerformanceCounter on Windows (steady_clock is not
+// monotonic on VS2013, and only ticks every few milliseconds), and
+// steady_clock elsewhere; it is shared by all modules of the process.
+////////////////////////////////////////////////////////////////////////////////
+#ifndef _LATENCYHISTOGRAM_H_
+#define _LATENCYHISTOGRAM_H_
+
+//////////////
+// INCLUDES //
+//////////////
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <chrono>
+#ifdef _WIN32
+	#include <windows.h>
+#endif
+#ifdef _MSC_VER
+	#include <intrin.h>
+#endif
+
+/////////////
+// GLOBALS //
+/////////////
+#define LATENCY_SUB_BITS     5
+#define LATENCY_SUB_BUCKETS  (1 << LATENCY_SUB_BITS)
+#define LATENCY_MAX_BITS     41				// Values up to ~36 minutes in ns
+#define LATENCY_BUCKETS      ((LATENCY_MAX_BITS - LATENCY_SUB_BITS + 1) * LATENCY_SUB_BUCKETS)
+
+// Host time in nanoseconds
+inline uint64_t LatencyNow()
+{
+#ifdef _WIN32
+	// Split in seconds and remainder, so that the product does not overflow
+	LARGE_INTEGER counter, frequency;
+	QueryPerformanceCounter(&counter);
+	QueryPerformanceFrequency(&frequency);
+	uint64_t ticks = (uint64_t)counter.QuadPart;
+	uint64_t rate = (uint64_t)frequency.QuadPart;
+	return (ticks / rate) * 1000000000ULL + ((ticks % rate) * 1000000000ULL) / rate;
+#else
+	return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+		std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Struct name: LatencySummary
+// All values in nanoseconds.
+////////////////////////////////////////////////////////////////////////////////
+struct LatencySummary
+{
+	uint64_t	count;
+	double		mean;
+	uint64_t	min;
+	uint64_t	p50;
+	uint64_t	p90;
+	uint64_t	p99;
+	uint64_t	p999;
+	uint64_t	max;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// Class name: LatencyHistogram
+////////////////////////////////////////////////////////////////////////////////
+class LatencyHistogram
+{
+public:
+	LatencyHistogram();
+
+	void				Record(uint64_t);
+	void				RecordSince(uint64_t, uint64_t);
+	void				Reset();
+
+	uint64_t			GetCount();
+	uint64_t			GetPercentile(double);
+	LatencySummary		GetSummary();
+
+	static size_t		GetBucket(uint64_t);
+	static uint64_t		GetBucketLower(size_t);
+	static uint64_t		GetBucketUpper(size_t);
+	uint64_t			GetBucketCount(size_t);
+
+private:
+	std::atomic<uint64_t>	Counts[LATENCY_BUCKETS];
+	std::atomic<uint64_t>	Count;
+	std::atomic<uint64_t>	Sum;
+	std::atomic<uint64_t>	Min;
+	std::atomic<uint64_t>	Max;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// Class name: LatencyProbes
+// The named histograms of one pipeline stage owner. Stages are added before
+// the threads start; after that the set does not change.
+////////////////////////////////////////////////////////////////////////////////
+class LatencyProbes
+{
+public:
+	LatencyHistogram*			Add(const std::string&);
+
+	size_t						GetNumberOfStages();
+	std::string					GetName(size_t);
+	LatencyHistogram&			GetStage(size_t);
+	std::vector<LatencySummary>	GetSummaries();
+	void						Reset();
+	bool						WriteCsv(const std::string&);
+
+private:
+	std::vector<std::string>						Names;
+	std::vector<std::unique_ptr<LatencyHistogram>>	Stages;
+};
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Class implementation: LatencyHistogram
+////////////////////////////////////////////////////////////////////////////////
+inline LatencyHistogram::LatencyHistogram()
+{
+	Reset();
+}
+
+inline size_t LatencyHistogram::GetBucket(uint64_t value)
+{
+	// One bucket per value at the bottom
+	if (value < LATENCY_SUB_BUCKETS)
+		return (size_t)value;
+
+	// Then LATENCY_SUB_BUCKETS per power of two
+	unsigned int msb;
+	#ifdef _MSC_VER
+		unsigned long index;
+		_BitScanReverse64(&index, value);
+		msb = (unsigned int)index;
+	#else
+		msb = 63 - (unsigned int)__builtin_clzll(value);
+	#endif
+	unsigned int shift = msb - LATENCY_SUB_BITS;
+	size_t bucket = (size_t)(shift + 1)*LATENCY_SUB_BUCKETS + (size_t)((value >> shift) - LATENCY_SUB_BUCKETS);
+	return (bucket < LATENCY_BUCKETS) ? bucket : LATENCY_BUCKETS - 1;
+}
+
+inline uint64_t LatencyHistogram::GetBucketLower(size_t bucket)
+{
+	if (bucket < LATENCY_SUB_BUCKETS)
+		return bucket;
+	size_t shift = bucket / LATENCY_SUB_BUCKETS - 1;
+	uint64_t top = LATENCY_SUB_BUCKETS + bucket % LATENCY_SUB_BUCKETS;
+	return top << shift;
+}
+
+inline uint64_t LatencyHistogram::GetBucketUpper(size_t bucket)
+{
+	return GetBucketLower(bucket + 1) - 1;
+}
+
+inline void LatencyHistogram::Record(uint64_t value)
+{
+	Counts[GetBucket(value)].fetch_add(1, std::memory_order_relaxed);
+	Count.fetch_add(1, std::memory_order_relaxed);
+	Sum.fetch_add(value, std::memory_order_relaxed);
+
+	// The extremes rarely change, so the loops hardly ever run twice
+	uint64_t current = Min.load(std::memory_order_relaxed);
+	while (value < current && !Min.compare_exchange_weak(current, value, std::memory_order_relaxed)) {}
+	current = Max.load(std::memory_order_relaxed);
+	while (value > current && !Max.compare_exchange_weak(current, value, std::memory_order_relaxed)) {}
+}
+
+inline void LatencyHistogram::RecordSince(uint64_t start, uint64_t now)
+{
+	// Frames without an arrival time (e.g. replayed ones) are not measured
+	if (start != 0 && now >= start)
+		Record(now - start);
+}
+
+inline void LatencyHistogram::Reset()
+{
+	// (values recorded during a reset may be partly lost)
+	for (size_t i = 0; i < LATENCY_BUCKETS; i++)
+		Counts[i].store(0, std::memory_order_relaxed);
+	Count = 0;
+	Sum = 0;
+	Min = UINT64_MAX;
+	Max = 0;
+}
+
+inline uint64_t LatencyHistogram::GetCount()
+{
+	return Count.load(std::memory_order_relaxed);
+}
+
+inline uint64_t LatencyHistogram::GetBucketCount(size_t bucket)
+{
+	return Counts[bucket].load(std::memory_order_relaxed);
+}
+
+inline uint64_t LatencyHistogram::GetPercentile(double percentile)
+{
+	// Total from the buckets themselves, which may be slightly ahead of Count
+	uint64_t total = 0;
+	for (size_t i = 0; i < LATENCY_BUCKETS; i++)
+		total += GetBucketCount(i);
+	if (total == 0)
+		return 0;
+
+	// Upper end of the bucket that holds the percentile, within the extremes
+	uint64_t rank = (uint64_t)(percentile / 100.0 * (double)total + 0.5);
+	if (rank < 1)
+		rank = 1;
+	uint64_t seen = 0;
+	uint64_t value = 0;
+	for (size_t i = 0; i < LATENCY_BUCKETS; i++)
+	{
+		seen += GetBucketCount(i);
+		if (seen >= rank)
+		{
+			value = GetBucketUpper(i);
+			break;
+		}
+	}
+	uint64_t max = Max.load(std::memory_order_relaxed);
+	return (value > max) ? max : value;
+}
+
+inline LatencySummary LatencyHistogram::GetSummary()
+{
+	LatencySummary summary;
+	summary.count = GetCount();
+	summary.mean = (summary.count > 0) ? (double)Sum.load(std::memory_order_relaxed) / (double)summary.count : 0;
+	summary.min = (summary.count > 0) ? Min.load(std::memory_order_relaxed) : 0;
+	summary.p50 = GetPercentile(50);
+	summary.p90 = GetPercentile(90);
+	summary.p99 = GetPercentile(99);
+	summary.p999 = GetPercentile(99.9);
+	summary.max = Max.load(std::memory_order_relaxed);
+	return summary;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Class implementation: LatencyProbes
+////////////////////////////////////////////////////////////////////////////////
+inline LatencyHistogram* LatencyProbes::Add(const std::string& name)
+{
+	Names.push_back(name);
+	Stages.push_back(std::unique_ptr<LatencyHistogram>(new LatencyHistogram()));
+	return Stages.back().get();
+}
+
+inline size_t LatencyProbes::GetNumberOfStages()
+{
+	return Stages.size();
+}
+
+inline std::string LatencyProbes::GetName(size_t i)
+{
+	return Names[i];
+}
+
+inline LatencyHistogram& LatencyProbes::GetStage(size_t i)
+{
+	return *Stages[i];
+}
+
+inline std::vector<LatencySummary> LatencyProbes::GetSummaries()
+{
+	std::vector<LatencySummary> summaries;
+	for (size_t i = 0; i < Stages.size(); i++)
+		summaries.push_back(Stages[i]->GetSummary());
+	return summaries;
+}
+
+inline void LatencyProbes::Reset()
+{
+	for (size_t i = 0; i < Stages.size(); i++)
+		Stages[i]->Reset();
+}
+
+inline bool LatencyProbes::WriteCsv(const std::string& filename)
+{
+	FILE* pFile = fopen(filename.c_str(), "w");
+	if (pFile == NULL)
+		return false;
+
+	// One row per non-empty bucket
+	fprintf(pFile, "stage,lower_ns,upper_ns,count\n");
+	for (size_t i = 0; i < Stages.size(); i++)
+	{
+		for (size_t b = 0; b < LATENCY_BUCKETS; b++)
+		{
+			uint64_t count = Stages[i]->GetBucketCount(b);
+			if (count > 0)
+				fprintf(pFile, "%s,%llu,%llu,%llu\n", Names[i].c_str(),
+					(unsigned long long)LatencyHistogram::GetBucketLower(b),
+					(unsigned long long)LatencyHistogram::GetBucketUpper(b),
+					(unsigned long long)count);
+		}
+	}
+
+	return fclose(pFile) == 0;
+}
+
+#endif
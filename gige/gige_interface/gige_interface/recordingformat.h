@@ -0,0 +1,111 @@
+////////////////////////////////////////////////////////////////////////////////
+// Filename: recordingformat.h
+// Layout of the recordings made by the DiskWriter. A recording is a file
+// header, then each frame as a fixed-size frame header followed by the pixel
+// data as it came from the camera, and at the end an index with the offset of
+// every frame header. The file is only ever appended to while recording; the
+// index offset and the number of frames in the file header are filled in when
+// the recording is closed. A recording that was never closed (e.g. after a
+// crash) has no index, but can still be read by walking the frame headers.
+// All fields are little-endian.
+// A recording striped over several files (e.g. on several disks) is described
+// by a text manifest: a "GIGEREC-MANIFEST 1" line, then "format container" or
+// "format raw", "stripes N", "frames M" once the recording is closed, and one
+// "stripe <path>" line per file. Frame n is frame n / N of stripe n % N.
+// A compressed recording has the codec in its file header, and the data of
+// every frame is then compressed as described in framecodec.h.
+////////////////////////////////////////////////////////////////////////////////
+#ifndef _RECORDINGFORMAT_H_
+#define _RECORDINGFORMAT_H_
+
+//////////////
+// INCLUDES //
+//////////////
+#include <string.h>
+#include <stdint.h>
+#include "frame.h"
+#include "framecodec.h"
+
+/////////////
+// GLOBALS //
+/////////////
+#define RECORDING_MAGIC          "GIGEREC1"
+#define RECORDING_VERSION        1
+#define RECORDING_FRAME_MAGIC    0x454D5246		// "FRME"
+#define RECORDING_INDEX_MAGIC    0x58444E49		// "INDX"
+#define RECORDING_MANIFEST_MAGIC   "GIGEREC-MANIFEST"
+#define RECORDING_MANIFEST_VERSION 1
+
+#pragma pack(push, 1)
+
+// At offset 0
+struct RecordingFileHeader
+{
+	char		magic[8];			// RECORDING_MAGIC, without terminating zero
+	uint32_t	version;
+	uint32_t	headerSize;			// sizeof(RecordingFileHeader)
+	uint32_t	frameHeaderSize;	// sizeof(RecordingFrameHeader)
+	uint32_t	codec;				// FrameCodec; unless FRAMECODEC_NONE, the data of each frame starts with a FrameCodecHeader
+	uint64_t	indexOffset;		// 0 until the recording is closed
+	uint64_t	numberOfFrames;		// 0 until the recording is closed
+	uint8_t		padding[24];
+};
+
+// Before the pixel data of each frame
+struct RecordingFrameHeader
+{
+	uint32_t	magic;				// RECORDING_FRAME_MAGIC
+	uint32_t	headerSize;			// sizeof(RecordingFrameHeader)
+	uint32_t	width;
+	uint32_t	height;
+	uint32_t	bpp;				// Bits per pixel
+	uint32_t	padding;			// Bytes between the pixel data and the next frame header
+	uint64_t	blockId;			// Sequence number assigned by the source
+	uint64_t	timestamp;			// Source timestamp
+	uint64_t	size;				// Bytes of pixel data (as stored, i.e. compressed)
+};
+
+// At indexOffset, followed by numberOfFrames offsets (uint64_t) of frame headers
+struct RecordingIndexHeader
+{
+	uint32_t	magic;				// RECORDING_INDEX_MAGIC
+	uint32_t	reserved;
+	uint64_t	numberOfFrames;
+};
+
+#pragma pack(pop)
+
+////////////////////////////////////////////////////////////////////////////////
+// Helpers
+////////////////////////////////////////////////////////////////////////////////
+inline void RecordingInitFileHeader(RecordingFileHeader& header)
+{
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, RECORDING_MAGIC, sizeof(header.magic));
+	header.version = RECORDING_VERSION;
+	header.headerSize = sizeof(RecordingFileHeader);
+	header.frameHeaderSize = sizeof(RecordingFrameHeader);
+}
+
+inline void RecordingInitFrameHeader(RecordingFrameHeader& header, const Frame& frame)
+{
+	header.magic = RECORDING_FRAME_MAGIC;
+	header.headerSize = sizeof(RecordingFrameHeader);
+	header.width = frame.width;
+	header.height = frame.height;
+	header.bpp = frame.bpp;
+	header.padding = 0;
+	header.blockId = frame.blockId;
+	header.timestamp = frame.timestamp;
+	header.size = frame.size;
+}
+
+inline bool RecordingIsFileHeader(const RecordingFileHeader& header)
+{
+	return memcmp(header.magic, RECORDING_MAGIC, sizeof(header.magic)) == 0
+		&& header.version == RECORDING_VERSION
+		&& header.headerSize == sizeof(RecordingFileHeader)
+		&& header.frameHeaderSize == sizeof(RecordingFrameHeader);
+}
+
+#endif
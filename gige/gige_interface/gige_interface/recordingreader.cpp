@@ -0,0 +1,450 @@
+// Random access reader for DiskWriter recordings.
+
+#include "recordingreader.h"
+#include <stdio.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+
+RecordingReader::RecordingReader()
+{
+	pFile = NULL;
+	FileSize = 0;
+	#ifdef _WIN32
+		FileHandle = INVALID_HANDLE_VALUE;
+		MappingHandle = NULL;
+	#else
+		FileDescriptor = -1;
+	#endif
+	Complete = false;
+	NumberOfStripedFrames = 0;
+	Codec = FRAMECODEC_NONE;
+}
+
+
+RecordingReader::~RecordingReader()
+{
+	Close();
+}
+
+bool RecordingReader::IsRecording(const std::string& filename)
+{
+	if (IsManifest(filename))
+		return true;
+
+	// Only the file header
+	RecordingFileHeader header;
+	FILE* file = fopen(filename.c_str(), "rb");
+	if (file == NULL)
+		return false;
+	bool res = (fread(&header, sizeof(header), 1, file) == 1) && RecordingIsFileHeader(header);
+	fclose(file);
+	return res;
+}
+
+bool RecordingReader::Open(const std::string& filename)
+{
+	// Start over
+	Close();
+
+	// Striped recording
+	if (IsManifest(filename))
+	{
+		if (!OpenManifest(filename))
+		{
+			Close();
+			return false;
+		}
+		return true;
+	}
+
+	// Map the file
+	if (!Map(filename))
+	{
+		Close();
+		return false;
+	}
+
+	// Check the header
+	if (FileSize < sizeof(RecordingFileHeader) || !RecordingIsFileHeader(*(const RecordingFileHeader*)pFile))
+	{
+		Error = filename + " is not a recording.";
+		Close();
+		return false;
+	}
+
+	// Compression
+	Codec = (FrameCodec)((const RecordingFileHeader*)pFile)->codec;
+
+	// Find the frames
+	// (through the index if the recording was closed, otherwise frame by frame)
+	Complete = ReadIndex();
+	if (!Complete)
+		ScanFrames();
+
+	return true;
+}
+
+bool RecordingReader::Map(const std::string& filename)
+{
+	#ifdef _WIN32
+		FileHandle = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+		if (FileHandle == INVALID_HANDLE_VALUE)
+		{
+			Error = "Could not open " + filename + " (code " + std::to_string(GetLastError()) + ").";
+			return false;
+		}
+
+		LARGE_INTEGER size;
+		if (!GetFileSizeEx(FileHandle, &size))
+		{
+			Error = "Could not get the size of " + filename + " (code " + std::to_string(GetLastError()) + ").";
+			return false;
+		}
+		FileSize = (uint64_t)size.QuadPart;
+		if (FileSize == 0)
+			return true;
+
+		MappingHandle = CreateFileMappingA(FileHandle, NULL, PAGE_READONLY, 0, 0, NULL);
+		if (MappingHandle == NULL)
+		{
+			Error = "CreateFileMapping failed with code " + std::to_string(GetLastError()) + ".";
+			return false;
+		}
+
+		pFile = (const uint8_t*)MapViewOfFile(MappingHandle, FILE_MAP_READ, 0, 0, 0);
+		if (pFile == NULL)
+		{
+			Error = "MapViewOfFile failed with code " + std::to_string(GetLastError()) + ".";
+			return false;
+		}
+	#else
+		FileDescriptor = open(filename.c_str(), O_RDONLY);
+		if (FileDescriptor < 0)
+		{
+			Error = "Could not open " + filename + ".";
+			return false;
+		}
+
+		struct stat st;
+		if (fstat(FileDescriptor, &st) != 0)
+		{
+			Error = "Could not get the size of " + filename + ".";
+			return false;
+		}
+		FileSize = (uint64_t)st.st_size;
+		if (FileSize == 0)
+			return true;
+
+		void* p = mmap(NULL, (size_t)FileSize, PROT_READ, MAP_SHARED, FileDescriptor, 0);
+		if (p == MAP_FAILED)
+		{
+			Error = "mmap failed for " + filename + ".";
+			return false;
+		}
+		pFile = (const uint8_t*)p;
+	#endif
+
+	return true;
+}
+
+void RecordingReader::Close()
+{
+	Offsets.clear();
+	Complete = false;
+	Stripes.clear();
+	NumberOfStripedFrames = 0;
+	Codec = FRAMECODEC_NONE;
+
+	#ifdef _WIN32
+		if (pFile != NULL)
+			UnmapViewOfFile(pFile);
+		if (MappingHandle != NULL)
+			CloseHandle(MappingHandle);
+		if (FileHandle != INVALID_HANDLE_VALUE)
+			CloseHandle(FileHandle);
+		MappingHandle = NULL;
+		FileHandle = INVALID_HANDLE_VALUE;
+	#else
+		if (pFile != NULL)
+			munmap((void*)pFile, (size_t)FileSize);
+		if (FileDescriptor >= 0)
+			close(FileDescriptor);
+		FileDescriptor = -1;
+	#endif
+
+	pFile = NULL;
+	FileSize = 0;
+}
+
+bool RecordingReader::IsManifest(const std::string& filename)
+{
+	// First line only
+	char line[64];
+	FILE* file = fopen(filename.c_str(), "r");
+	if (file == NULL)
+		return false;
+	bool res = (fgets(line, sizeof(line), file) != NULL) && strncmp(line, RECORDING_MANIFEST_MAGIC " ", strlen(RECORDING_MANIFEST_MAGIC " ")) == 0;
+	fclose(file);
+	return res;
+}
+
+bool RecordingReader::OpenManifest(const std::string& filename)
+{
+	FILE* file = fopen(filename.c_str(), "r");
+	if (file == NULL)
+	{
+		Error = "Could not open " + filename + ".";
+		return false;
+	}
+
+	// Read the manifest
+	char line[4096];
+	int version = 0;
+	unsigned long long frames = 0;
+	unsigned int stripes = 0;
+	bool closed = false;
+	bool container = true;
+	std::vector<std::string> paths;
+	if (fgets(line, sizeof(line), file) == NULL || sscanf(line, RECORDING_MANIFEST_MAGIC " %d", &version) != 1)
+		version = 0;
+	while (fgets(line, sizeof(line), file) != NULL)
+	{
+		// (paths may contain spaces, so only the end of line is cut)
+		size_t length = strlen(line);
+		while (length > 0 && (line[length-1] == '\n' || line[length-1] == '\r'))
+			line[--length] = 0;
+
+		if (strncmp(line, "stripe ", 7) == 0)
+			paths.push_back(line + 7);
+		else if (strncmp(line, "stripes ", 8) == 0)
+			sscanf(line + 8, "%u", &stripes);
+		else if (strncmp(line, "frames ", 7) == 0)
+			closed = (sscanf(line + 7, "%llu", &frames) == 1);
+		else if (strncmp(line, "format ", 7) == 0)
+			container = (strcmp(line + 7, "container") == 0);
+	}
+	fclose(file);
+
+	// Check it
+	if (version != RECORDING_MANIFEST_VERSION)
+	{
+		Error = filename + " is not a supported manifest.";
+		return false;
+	}
+	if (!container)
+	{
+		Error = filename + " describes raw files, which have no frame headers to read.";
+		return false;
+	}
+	if (paths.empty() || paths.size() != stripes)
+	{
+		Error = filename + " does not list its " + std::to_string(stripes) + " stripes.";
+		return false;
+	}
+
+	// Open the stripes
+	// (where they were written, or else next to the manifest, in case the
+	//  files were gathered in one place afterwards)
+	size_t slash = filename.find_last_of("/\\");
+	std::string directory = (slash == std::string::npos) ? std::string() : filename.substr(0, slash + 1);
+	Complete = closed;
+	NumberOfStripedFrames = UINT64_MAX;
+	for (size_t i = 0; i < paths.size(); i++)
+	{
+		Stripes.push_back(std::unique_ptr<RecordingReader>(new RecordingReader()));
+		RecordingReader& stripe = *Stripes.back();
+		if (!stripe.Open(paths[i]))
+		{
+			size_t name = paths[i].find_last_of("/\\");
+			std::string local = directory + ((name == std::string::npos) ? paths[i] : paths[i].substr(name + 1));
+			if (!stripe.Open(local))
+			{
+				Error = "Stripe " + paths[i] + " of " + filename + ": " + stripe.GetError();
+				return false;
+			}
+		}
+
+		// Frames up to the first one missing from a stripe
+		// (stripe i holds frames i, i+size, ...)
+		uint64_t available = stripe.GetNumberOfFrames() * paths.size() + i;
+		if (available < NumberOfStripedFrames)
+			NumberOfStripedFrames = available;
+		Complete &= stripe.IsComplete();
+
+		// All compressed the same way
+		if (i == 0)
+			Codec = stripe.GetCodec();
+		else if (stripe.GetCodec() != Codec)
+		{
+			Error = "The stripes of " + filename + " are not all compressed the same way.";
+			return false;
+		}
+	}
+	if (closed && frames < NumberOfStripedFrames)
+		NumberOfStripedFrames = frames;
+	Complete &= (NumberOfStripedFrames == frames);
+
+	return true;
+}
+
+bool RecordingReader::IsFrameAt(uint64_t offset)
+{
+	// Whole header and pixel data inside the file
+	if (offset > FileSize || FileSize - offset < sizeof(RecordingFrameHeader))
+		return false;
+	const RecordingFrameHeader* header = (const RecordingFrameHeader*)(pFile + offset);
+	return header->magic == RECORDING_FRAME_MAGIC
+		&& header->headerSize == sizeof(RecordingFrameHeader)
+		&& header->size <= FileSize - offset - sizeof(RecordingFrameHeader);
+}
+
+bool RecordingReader::ReadIndex()
+{
+	const RecordingFileHeader* file = (const RecordingFileHeader*)pFile;
+	uint64_t offset = file->indexOffset;
+	uint64_t count  = file->numberOfFrames;
+
+	// Not closed
+	if (offset == 0)
+		return false;
+
+	// Index header, then one offset per frame
+	if (offset > FileSize || FileSize - offset < sizeof(RecordingIndexHeader))
+		return false;
+	const RecordingIndexHeader* index = (const RecordingIndexHeader*)(pFile + offset);
+	if (index->magic != RECORDING_INDEX_MAGIC || index->numberOfFrames != count)
+		return false;
+	if ((FileSize - offset - sizeof(RecordingIndexHeader)) / sizeof(uint64_t) < count)
+		return false;
+
+	// Copy it, checking every entry
+	const uint64_t* entries = (const uint64_t*)(pFile + offset + sizeof(RecordingIndexHeader));
+	Offsets.resize((size_t)count);
+	for (uint64_t i = 0; i < count; i++)
+	{
+		uint64_t entry;
+		memcpy(&entry, &entries[i], sizeof(entry));
+		if (!IsFrameAt(entry))
+		{
+			Offsets.clear();
+			return false;
+		}
+		Offsets[(size_t)i] = entry;
+	}
+	return true;
+}
+
+void RecordingReader::ScanFrames()
+{
+	// Walk the frame headers up to the last complete frame
+	Offsets.clear();
+	uint64_t offset = sizeof(RecordingFileHeader);
+	while (IsFrameAt(offset))
+	{
+		const RecordingFrameHeader* header = (const RecordingFrameHeader*)(pFile + offset);
+		Offsets.push_back(offset);
+		offset += sizeof(RecordingFrameHeader) + header->size + header->padding;
+	}
+}
+
+uint64_t RecordingReader::GetNumberOfFrames()
+{
+	if (!Stripes.empty())
+		return NumberOfStripedFrames;
+	return Offsets.size();
+}
+
+bool RecordingReader::IsComplete()
+{
+	return Complete;
+}
+
+const RecordingFrameHeader* RecordingReader::GetFrameHeader(uint64_t frame)
+{
+	if (!Stripes.empty())
+		return (frame < NumberOfStripedFrames) ? Stripes[(size_t)(frame % Stripes.size())]->GetFrameHeader(frame / Stripes.size()) : NULL;
+	if (frame >= Offsets.size())
+		return NULL;
+	return (const RecordingFrameHeader*)(pFile + Offsets[(size_t)frame]);
+}
+
+const uint8_t* RecordingReader::GetFrameData(uint64_t frame)
+{
+	if (!Stripes.empty())
+		return (frame < NumberOfStripedFrames) ? Stripes[(size_t)(frame % Stripes.size())]->GetFrameData(frame / Stripes.size()) : NULL;
+	if (frame >= Offsets.size())
+		return NULL;
+	return pFile + Offsets[(size_t)frame] + sizeof(RecordingFrameHeader);
+}
+
+bool RecordingReader::GetFrame(uint64_t frame, Frame& target)
+{
+	// Describe the frame in place, without copying the pixel data
+	// (valid until the reader is closed)
+	const RecordingFrameHeader* header = GetFrameHeader(frame);
+	if (header == NULL)
+		return false;
+	if (Codec != FRAMECODEC_NONE)
+	{
+		Error = "The frames are compressed, and have to be read with ReadFrame.";
+		return false;
+	}
+
+	target.width = header->width;
+	target.height = header->height;
+	target.bpp = header->bpp;
+	target.timestamp = header->timestamp;
+	target.blockId = header->blockId;
+	target.arrival = 0;
+	target.data = (uint8_t*)GetFrameData(frame);
+	target.size = (size_t)header->size;
+	target.context = NULL;
+	return true;
+}
+
+bool RecordingReader::ReadFrame(uint64_t frame, uint8_t* target, size_t size)
+{
+	// Copy the pixel data, decoding it if the recording is compressed
+	const RecordingFrameHeader* header = GetFrameHeader(frame);
+	if (header == NULL)
+	{
+		Error = "Frame " + std::to_string(frame) + " is not in the recording.";
+		return false;
+	}
+	const uint8_t* data = GetFrameData(frame);
+	if (Codec == FRAMECODEC_NONE)
+	{
+		if (header->size != size)
+		{
+			Error = "Frame " + std::to_string(frame) + " is not of the expected size.";
+			return false;
+		}
+		memcpy(target, data, size);
+		return true;
+	}
+	if (!FrameDecode(data, (size_t)header->size, header->width, header->height, header->bpp, target, size))
+	{
+		Error = "Frame " + std::to_string(frame) + " could not be decoded, or is not of the expected size.";
+		return false;
+	}
+	return true;
+}
+
+FrameCodec RecordingReader::GetCodec()
+{
+	return Codec;
+}
+
+std::string RecordingReader::GetError()
+{
+	return Error;
+}
@@ -0,0 +1,74 @@
+////////////////////////////////////////////////////////////////////////////////
+// Filename: recordingreader.h
+// Random access to the frames of a DiskWriter recording. The file is mapped
+// into memory, so that a frame is read by pointing at it rather than copying
+// it, and only the pages that are actually touched are read from the disk.
+// The frames are found through the index at the end of the file, or, for a
+// recording that was not closed properly, by walking the frame headers up to
+// the last complete frame. A manifest of a striped recording is opened like a
+// single file: the frames of all the stripes are presented in their original
+// order. The frames of a compressed recording are decoded by ReadFrame.
+////////////////////////////////////////////////////////////////////////////////
+#ifndef _RECORDINGREADER_H_
+#define _RECORDINGREADER_H_
+
+//////////////
+// INCLUDES //
+//////////////
+#include <string>
+#include <vector>
+#include <memory>
+#include "recordingformat.h"
+
+////////////////////////////////////////////////////////////////////////////////
+// Class name: RecordingReader
+////////////////////////////////////////////////////////////////////////////////
+class RecordingReader
+{
+public:
+	RecordingReader();
+	~RecordingReader();
+
+	bool						Open(const std::string&);
+	void						Close();
+	static bool					IsRecording(const std::string&);
+
+	uint64_t					GetNumberOfFrames();
+	bool						IsComplete();
+	const RecordingFrameHeader*	GetFrameHeader(uint64_t);
+	const uint8_t*				GetFrameData(uint64_t);
+	bool						GetFrame(uint64_t, Frame&);
+	bool						ReadFrame(uint64_t, uint8_t*, size_t);
+	FrameCodec					GetCodec();
+	std::string					GetError();
+
+private:
+	// Mapping
+	const uint8_t*				pFile;
+	uint64_t					FileSize;
+	#ifdef _WIN32
+		void*					FileHandle;
+		void*					MappingHandle;
+	#else
+		int						FileDescriptor;
+	#endif
+
+	std::vector<uint64_t>		Offsets;
+	bool						Complete;
+	FrameCodec					Codec;
+	std::string					Error;
+
+	// Striped recording
+	// (frame n is frame n / size of stripe n % size)
+	std::vector<std::unique_ptr<RecordingReader>> Stripes;
+	uint64_t					NumberOfStripedFrames;
+	static bool					IsManifest(const std::string&);
+	bool						OpenManifest(const std::string&);
+
+	bool						Map(const std::string&);
+	bool						ReadIndex();
+	void						ScanFrames();
+	bool						IsFrameAt(uint64_t);
+};
+
+#endif
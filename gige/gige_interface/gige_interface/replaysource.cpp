@@ -0,0 +1,176 @@
+// Software camera that plays back a DiskWriter recording.
+
+#include "replaysource.h"
+#include <string.h>
+
+#ifdef _WIN32
+#define replay_fseek _fseeki64
+#define replay_ftell _ftelli64
+#else
+#define replay_fseek fseeko
+#define replay_ftell ftello
+#endif
+
+
+ReplaySource::ReplaySource()
+{
+	File = NULL;
+	IsContainer = false;
+	NumberOfFramesInFile = 0;
+	Position = 0;
+	Loop = false;
+	Finished = false;
+}
+
+
+ReplaySource::~ReplaySource()
+{
+	Shutdown();
+}
+
+bool ReplaySource::Initialize(const std::string& filename, uint32_t width, uint32_t height, uint32_t bpp, double framesPerSecond, bool loop)
+{
+	// Frames and timing
+	if (!InitializeSource(width, height, bpp, framesPerSecond))
+		return false;
+	Loop = loop;
+	Finished = false;
+	Position = 0;
+
+	// Container: every frame has to be of the size of the source
+	IsContainer = RecordingReader::IsRecording(filename);
+	if (IsContainer)
+	{
+		if (!Recording.Open(filename))
+		{
+			PushError("Initialize failed: " + Recording.GetError());
+			return false;
+		}
+		NumberOfFramesInFile = Recording.GetNumberOfFrames();
+		for (uint64_t i = 0; i < NumberOfFramesInFile; i++)
+		{
+			const RecordingFrameHeader* header = Recording.GetFrameHeader(i);
+			if (header->width != width || header->height != height || header->bpp != bpp)
+			{
+				PushError("Initialize failed: the frames in " + filename + " are not of the requested size.");
+				Recording.Close();
+				return false;
+			}
+		}
+		if (NumberOfFramesInFile == 0)
+		{
+			PushError("Initialize failed: " + filename + " holds no frames.");
+			Recording.Close();
+			return false;
+		}
+		return true;
+	}
+
+	// Open file
+	File = fopen(filename.c_str(), "rb");
+	if (File == NULL)
+	{
+		PushError("Initialize failed: could not open " + filename + ".");
+		return false;
+	}
+
+	// The file has to hold a whole number of frames
+	uint64_t frameSize = (uint64_t)width*height*(bpp / 8);
+	replay_fseek(File, 0, SEEK_END);
+	uint64_t fileSize = (uint64_t)replay_ftell(File);
+	replay_fseek(File, 0, SEEK_SET);
+	if (fileSize == 0 || fileSize % frameSize != 0)
+	{
+		PushError("Initialize failed: the size of " + filename + " is not a multiple of the frame size.");
+		fclose(File);
+		File = NULL;
+		return false;
+	}
+	NumberOfFramesInFile = fileSize / frameSize;
+	Position = 0;
+
+	return true;
+}
+
+void ReplaySource::Shutdown()
+{
+	// Stop the thread before closing the file it reads from
+	SoftwareSource::Shutdown();
+
+	// Close file
+	if (File != NULL)
+	{
+		fclose(File);
+		File = NULL;
+	}
+	Recording.Close();
+}
+
+bool ReplaySource::Render(Frame& frame, uint64_t)
+{
+	// Rewind at the end of the file, or stop
+	// (frames dropped for lack of buffers are not read, so the frame index of
+	//  the source is not the position in the file)
+	if (Position == NumberOfFramesInFile)
+	{
+		if (!Loop)
+		{
+			Finished = true;
+			return false;
+		}
+		if (!IsContainer)
+			replay_fseek(File, 0, SEEK_SET);
+		Position = 0;
+	}
+
+	// Copy the frame out of the mapped recording (decoding it if need be),
+	// with the block ID and timestamp it was recorded with, so that the gaps
+	// of the recording are still there
+	if (IsContainer)
+	{
+		if (!Recording.ReadFrame(Position, frame.data, frame.size))
+		{
+			PushError("Replay failed: " + Recording.GetError());
+			Finished = true;
+			return false;
+		}
+		const RecordingFrameHeader* header = Recording.GetFrameHeader(Position);
+		frame.blockId = header->blockId;
+		frame.timestamp = header->timestamp;
+		Position++;
+		return true;
+	}
+
+	// Read the frame
+	if (fread(frame.data, 1, frame.size, File) != frame.size)
+	{
+		PushError("Replay failed: could not read from the file.");
+		Finished = true;
+		return false;
+	}
+	Position++;
+
+	return true;
+}
+
+void ReplaySource::Restart()
+{
+	// Play the recording again from the start, once it has been played to
+	// the end (or up to an error)
+	if (!Finished)
+		return;
+	if (File != NULL)
+		replay_fseek(File, 0, SEEK_SET);
+	Position = 0;
+	Finished = false;
+}
+
+uint64_t ReplaySource::GetNumberOfFramesInFile()
+{
+	return NumberOfFramesInFile;
+}
+
+bool ReplaySource::IsFinished()
+{
+	return Finished;
+}
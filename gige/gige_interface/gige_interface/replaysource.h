@@ -0,0 +1,53 @@
+////////////////////////////////////////////////////////////////////////////////
+// Filename: replaysource.h
+// Software camera that plays back a recording made by the DiskWriter, at a
+// given frame rate or as fast as the consumers allow, optionally in a loop.
+// Both formats of the DiskWriter are understood: containers (read through a
+// RecordingReader) and raw files (frames of the same size, back to back,
+// without headers). A recording striped over several files is played back
+// through its manifest.
+// Frames from a container keep the block IDs and timestamps they were
+// recorded with (so they start over when the replay loops); frames from a raw
+// file are numbered and timed as they are played.
+////////////////////////////////////////////////////////////////////////////////
+#ifndef _REPLAYSOURCE_H_
+#define _REPLAYSOURCE_H_
+
+//////////////
+// INCLUDES //
+//////////////
+#include <stdio.h>
+#include <string>
+#include "softwaresource.h"
+#include "recordingreader.h"
+
+////////////////////////////////////////////////////////////////////////////////
+// Class name: ReplaySource
+////////////////////////////////////////////////////////////////////////////////
+class ReplaySource : public SoftwareSource
+{
+public:
+	ReplaySource();
+	~ReplaySource();
+
+	bool					Initialize(const std::string&, uint32_t, uint32_t, uint32_t, double, bool);
+	void					Shutdown();
+
+	uint64_t				GetNumberOfFramesInFile();
+	bool					IsFinished();
+
+protected:
+	bool					Render(Frame&, uint64_t);
+	void					Restart();
+
+private:
+	FILE*					File;
+	RecordingReader			Recording;
+	bool					IsContainer;
+	uint64_t				NumberOfFramesInFile;
+	uint64_t				Position;
+	bool					Loop;
+	bool volatile			Finished;
+};
+
+#endif
@@ -0,0 +1,331 @@
+////////////////////////////////////////////////////////////////////////////////
+// Filename: sharedring.h
+// Ring of camera frames in named shared memory, so that MATLAB or any other
+// process can look at the live stream without the frames being copied out.
+// The mapping is created on the paging file, as the one of the fullscreen
+// display (CommunicationClass), and holds, in this order:
+//   - a SharedRingHeader, which describes the layout,
+//   - one SharedRingSlot descriptor per slot,
+//   - the slots themselves, page-aligned, each holding one frame.
+// The acquisition buffers are the slots (see BufferPool), so the camera
+// writes the frames in place.
+//
+// A slot is reused without asking the readers, so each descriptor carries a
+// sequence number: the frame number (from 1) once the frame is complete, and
+// zero from the moment the slot goes back to the camera. A reader checks that
+// the sequence is still the same after reading the pixels; if it is not, the
+// frame was overwritten in the meantime and the copy must be thrown away.
+////////////////////////////////////////////////////////////////////////////////
+#ifndef _SHAREDRING_H_
+#define _SHAREDRING_H_
+
+//////////////
+// INCLUDES //
+//////////////
+#include <windows.h>
+#include <stdint.h>
+#include <string.h>
+#include <string>
+#include <atomic>
+#include "frame.h"
+
+/////////////
+// GLOBALS //
+/////////////
+#define SHARED_RING_MAGIC     0x474E5253	// "SRNG"
+#define SHARED_RING_VERSION   1
+#define SHARED_RING_ALIGNMENT 4096			// Slots start on page boundaries
+
+// Start of the mapping
+struct SharedRingHeader
+{
+	uint32_t			magic;
+	uint32_t			version;
+	uint32_t			slotCount;
+	uint32_t			headerBytes;	// sizeof(SharedRingHeader), the slot descriptors follow
+	uint64_t			slotBytes;		// Distance between two slots
+	uint64_t			dataOffset;		// From the start of the mapping to the first slot
+	volatile uint64_t	frameCount;		// Frames published so far
+	volatile uint64_t	latestSlot;		// Slot of the newest frame
+};
+
+// One per slot
+struct SharedRingSlot
+{
+	volatile uint64_t	sequence;		// Frame number once published, 0 while being written
+	uint64_t			timestamp;
+	uint64_t			blockId;
+	uint64_t			size;
+	uint32_t			width;
+	uint32_t			height;
+	uint32_t			bpp;
+	uint32_t			reserved;
+};
+
+// What the consumer gets instead of the pixels
+struct SharedFrameInfo
+{
+	uint32_t			slot;
+	uint64_t			sequence;
+	uint64_t			timestamp;
+	uint64_t			blockId;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// Class name: SharedFrameRing
+// The acquisition side creates the ring, and is the only one to publish;
+// readers open it by name.
+////////////////////////////////////////////////////////////////////////////////
+class SharedFrameRing
+{
+public:
+	SharedFrameRing();
+	~SharedFrameRing();
+
+	bool				Create(const std::string&, uint32_t, uint64_t);
+	bool				Open(const std::string&);
+	void				Close();
+	std::string			GetError();
+
+	std::string			GetName();
+	uint32_t			GetNumberOfSlots();
+	uint64_t			GetSlotBytes();
+	uint64_t			GetFrameCount();
+	uint8_t*			GetSlotData(uint32_t);
+
+	void				Invalidate(uint32_t);
+	SharedFrameInfo		Publish(uint32_t, const Frame&);
+
+	bool				Peek(uint32_t, uint64_t, Frame&);
+	bool				Read(uint32_t, uint64_t, Frame&, void*, size_t);
+
+private:
+	HANDLE				hMapping;
+	uint8_t*			pView;
+	SharedRingHeader*	pHeader;
+	SharedRingSlot*		pSlots;
+	std::string			Name;
+	std::string			Error;
+
+	bool				Map(DWORD, uint64_t);
+	bool				Fail(const std::string&);
+};
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Class implementation: SharedFrameRing
+////////////////////////////////////////////////////////////////////////////////
+inline SharedFrameRing::SharedFrameRing()
+{
+	hMapping = NULL;
+	pView = NULL;
+	pHeader = NULL;
+	pSlots = NULL;
+}
+
+inline SharedFrameRing::~SharedFrameRing()
+{
+	Close();
+}
+
+inline bool SharedFrameRing::Fail(const std::string& msg)
+{
+	Error = msg + " (error " + std::to_string(GetLastError()) + ").";
+	Close();
+	return false;
+}
+
+inline bool SharedFrameRing::Map(DWORD access, uint64_t viewBytes)
+{
+	pView = (uint8_t*)MapViewOfFile(hMapping, access, 0, 0, (size_t)viewBytes);
+	if (pView == NULL)
+		return false;
+	pHeader = (SharedRingHeader*)pView;
+	pSlots = (SharedRingSlot*)(pView + sizeof(SharedRingHeader));
+	return true;
+}
+
+inline bool SharedFrameRing::Create(const std::string& name, uint32_t slotCount, uint64_t frameBytes)
+{
+	Close();
+	Name = name;
+
+	// Layout
+	uint64_t slotBytes = ((frameBytes + SHARED_RING_ALIGNMENT - 1) / SHARED_RING_ALIGNMENT) * SHARED_RING_ALIGNMENT;
+	uint64_t tableBytes = sizeof(SharedRingHeader) + (uint64_t)slotCount*sizeof(SharedRingSlot);
+	uint64_t dataOffset = ((tableBytes + SHARED_RING_ALIGNMENT - 1) / SHARED_RING_ALIGNMENT) * SHARED_RING_ALIGNMENT;
+	uint64_t totalBytes = dataOffset + (uint64_t)slotCount*slotBytes;
+
+	// Mapping on the paging file
+	hMapping = CreateFileMappingA(
+					INVALID_HANDLE_VALUE,					// use paging file
+					NULL,									// default security
+					PAGE_READWRITE,							// read/write access
+					(DWORD)(totalBytes >> 32),				// maximum object size (high-order DWORD)
+					(DWORD)(totalBytes & 0xFFFFFFFF),		// maximum object size (low-order DWORD)
+					name.c_str());							// name of mapping object
+	if (hMapping == NULL)
+		return Fail("Could not create the shared frame ring \"" + name + "\"");
+
+	// A reader still holding an older ring of the same name would get frames
+	// it cannot interpret, so do not take it over
+	if (GetLastError() == ERROR_ALREADY_EXISTS)
+		return Fail("The shared frame ring \"" + name + "\" is still open elsewhere");
+
+	if (!Map(FILE_MAP_ALL_ACCESS, totalBytes))
+		return Fail("Could not map the shared frame ring \"" + name + "\"");
+
+	// Describe the layout, with no frames yet
+	ZeroMemory(pView, (size_t)dataOffset);
+	pHeader->magic = SHARED_RING_MAGIC;
+	pHeader->version = SHARED_RING_VERSION;
+	pHeader->slotCount = slotCount;
+	pHeader->headerBytes = sizeof(SharedRingHeader);
+	pHeader->slotBytes = slotBytes;
+	pHeader->dataOffset = dataOffset;
+	return true;
+}
+
+inline bool SharedFrameRing::Open(const std::string& name)
+{
+	Close();
+	Name = name;
+
+	hMapping = OpenFileMappingA(FILE_MAP_READ, FALSE, name.c_str());
+	if (hMapping == NULL)
+		return Fail("Could not open the shared frame ring \"" + name + "\"");
+
+	// Header first, to know the size of the whole ring
+	if (!Map(FILE_MAP_READ, sizeof(SharedRingHeader)))
+		return Fail("Could not map the shared frame ring \"" + name + "\"");
+	if (pHeader->magic != SHARED_RING_MAGIC || pHeader->version != SHARED_RING_VERSION)
+	{
+		Close();
+		Error = "\"" + name + "\" is not a shared frame ring of this version.";
+		return false;
+	}
+	uint64_t totalBytes = pHeader->dataOffset + (uint64_t)pHeader->slotCount*pHeader->slotBytes;
+	UnmapViewOfFile(pView);
+
+	if (!Map(FILE_MAP_READ, totalBytes))
+		return Fail("Could not map the shared frame ring \"" + name + "\"");
+	return true;
+}
+
+inline void SharedFrameRing::Close()
+{
+	if (pView)
+	{
+		UnmapViewOfFile(pView);
+		pView = NULL;
+	}
+	if (hMapping)
+	{
+		CloseHandle(hMapping);
+		hMapping = NULL;
+	}
+	pHeader = NULL;
+	pSlots = NULL;
+}
+
+inline std::string SharedFrameRing::GetError()
+{
+	return Error;
+}
+
+inline std::string SharedFrameRing::GetName()
+{
+	return Name;
+}
+
+inline uint32_t SharedFrameRing::GetNumberOfSlots()
+{
+	return pHeader ? pHeader->slotCount : 0;
+}
+
+inline uint64_t SharedFrameRing::GetSlotBytes()
+{
+	return pHeader ? pHeader->slotBytes : 0;
+}
+
+inline uint64_t SharedFrameRing::GetFrameCount()
+{
+	return pHeader ? pHeader->frameCount : 0;
+}
+
+inline uint8_t* SharedFrameRing::GetSlotData(uint32_t slot)
+{
+	return pView + pHeader->dataOffset + (uint64_t)slot*pHeader->slotBytes;
+}
+
+inline void SharedFrameRing::Invalidate(uint32_t slot)
+{
+	// Before the camera gets the slot: readers that see the old sequence
+	// after this must not trust what they read
+	pSlots[slot].sequence = 0;
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+}
+
+inline SharedFrameInfo SharedFrameRing::Publish(uint32_t slot, const Frame& frame)
+{
+	// Describe the frame, then make it valid
+	SharedRingSlot& s = pSlots[slot];
+	s.timestamp = frame.timestamp;
+	s.blockId = frame.blockId;
+	s.size = frame.size;
+	s.width = frame.width;
+	s.height = frame.height;
+	s.bpp = frame.bpp;
+
+	uint64_t sequence = pHeader->frameCount + 1;
+	std::atomic_thread_fence(std::memory_order_release);
+	s.sequence = sequence;
+	pHeader->latestSlot = slot;
+	pHeader->frameCount = sequence;
+
+	SharedFrameInfo info;
+	info.slot = slot;
+	info.sequence = sequence;
+	info.timestamp = frame.timestamp;
+	info.blockId = frame.blockId;
+	return info;
+}
+
+inline bool SharedFrameRing::Peek(uint32_t slot, uint64_t sequence, Frame& frame)
+{
+	// Describes the frame if it is still the one with that sequence number
+	// (any frame in the slot if the sequence is 0)
+	if (pHeader == NULL || slot >= pHeader->slotCount)
+		return false;
+	SharedRingSlot& s = pSlots[slot];
+	uint64_t before = s.sequence;
+	std::atomic_thread_fence(std::memory_order_acquire);
+	if (before == 0 || (sequence != 0 && before != sequence))
+		return false;
+
+	frame.timestamp = s.timestamp;
+	frame.blockId = s.blockId;
+	frame.size = (size_t)s.size;
+	frame.width = s.width;
+	frame.height = s.height;
+	frame.bpp = s.bpp;
+	frame.arrival = 0;
+
+	std::atomic_thread_fence(std::memory_order_acquire);
+	return s.sequence == before && frame.size <= pHeader->slotBytes;
+}
+
+inline bool SharedFrameRing::Read(uint32_t slot, uint64_t sequence, Frame& frame, void* pData, size_t capacity)
+{
+	// Same, and copies the pixels
+	if (!Peek(slot, sequence, frame) || frame.size > capacity)
+		return false;
+	uint64_t before = pSlots[slot].sequence;
+	memcpy(pData, GetSlotData(slot), frame.size);
+
+	// Still the same frame?
+	std::atomic_thread_fence(std::memory_order_acquire);
+	return pSlots[slot].sequence == before && (sequence == 0 || before == sequence);
+}
+
+#endif
@@ -0,0 +1,208 @@
+// Base class for frame sources that do not need a camera (synthetic patterns,
+// file replay).
+
+#include <chrono>
+#include "softwaresource.h"
+
+
+SoftwareSource::SoftwareSource() : FrameSource(SOFTWARESOURCE_QUEUE_SIZE), Errors(SOFTWARESOURCE_ERROR_QUEUE_SIZE)
+{
+	Width = 0;
+	Height = 0;
+	BitsPerPixel = 0;
+	FramesPerSecond = 0;
+	SourceStopFlag.store(false);
+	SourceRunning.store(false);
+	NumberOfGeneratedImages.store(0);
+	NumberOfDroppedImages.store(0);
+}
+
+
+SoftwareSource::~SoftwareSource()
+{
+	// The derived class must stop the thread before it goes away, since the
+	// thread calls its Render method; this is only a safety net
+	Stop();
+}
+
+bool SoftwareSource::InitializeSource(uint32_t width, uint32_t height, uint32_t bpp, double framesPerSecond)
+{
+	// Check the format
+	if (width == 0 || height == 0 || (bpp != 8 && bpp != 16))
+	{
+		PushError("Initialize failed: unsupported image format (only 8 and 16 bits per pixel).");
+		return false;
+	}
+
+	// Save inputs
+	Width = width;
+	Height = height;
+	BitsPerPixel = bpp;
+	FramesPerSecond = framesPerSecond;
+
+	// Allocate the frames
+	pool = std::shared_ptr<FramePool>(new FramePool());
+	if (!pool->Initialize(SOFTWARESOURCE_POOL_SIZE, (size_t)width*height*(bpp / 8)))
+	{
+		PushError("Initialize failed: could not allocate the frame pool.");
+		pool.reset();
+		return false;
+	}
+
+	return true;
+}
+
+bool SoftwareSource::Start()
+{
+	// Check state
+	if (!pool)
+	{
+		PushError("Start failed: the source is not initialized.");
+		return false;
+	}
+
+	// A thread that reached the end of the stream is done, but still has to
+	// be joined before it can be started again
+	if (SourceThread.joinable() && !SourceRunning.load())
+		SourceThread.join();
+	if (SourceThread.joinable())
+		return true;
+
+	// Start thread (a source at the end of its stream starts over)
+	Restart();
+	SourceStopFlag.store(false);
+	SourceRunning.store(true);
+	SourceThread = std::thread(&SoftwareSource::GenerateContinuously, this);
+	return true;
+}
+
+void SoftwareSource::Stop()
+{
+	// Stop the generator thread
+	if (SourceThread.joinable())
+	{
+		SourceStopFlag.store(true);
+		SourceThread.join();
+	}
+}
+
+void SoftwareSource::Shutdown()
+{
+	// Stop thread
+	Stop();
+
+	// Empty the queue and release the preview frame
+	// (the pool itself goes away once consumers have returned all frames)
+	ClearFrames();
+	pool.reset();
+}
+
+bool SoftwareSource::IsRunning()
+{
+	return SourceRunning.load();
+}
+
+void SoftwareSource::GenerateContinuously()
+{
+	typedef std::chrono::steady_clock clock;
+
+	// Timing
+	clock::time_point start = clock::now();
+	clock::duration   period = (FramesPerSecond > 0)
+		? std::chrono::duration_cast<clock::duration>(std::chrono::duration<double>(1.0 / FramesPerSecond))
+		: clock::duration::zero();
+	uint64_t index = 0;
+
+	// Continuous loop for frame generation
+	while (!SourceStopFlag.load())
+	{
+		// Keep the rate, if there is one
+		if (FramesPerSecond > 0)
+			std::this_thread::sleep_until(start + period*(int64_t)index);
+
+		// Get a free frame
+		// (at a fixed rate, an empty pool means a dropped frame, like with a
+		//  camera; free-running, we wait for the consumers instead)
+		Frame* pFrame = pool->Get();
+		if (pFrame == NULL)
+		{
+			if (FramesPerSecond > 0)
+			{
+				NumberOfDroppedImages++;
+				index++;
+			}
+			else
+			{
+				std::this_thread::sleep_for(std::chrono::microseconds(100));
+			}
+			continue;
+		}
+		ImagePtr upFrame(pFrame, ImageRelease(pool));
+
+		// Describe the frame
+		pFrame->width = Width;
+		pFrame->height = Height;
+		pFrame->bpp = BitsPerPixel;
+		pFrame->size = (size_t)Width*Height*(BitsPerPixel / 8);
+		pFrame->blockId = index + 1;
+		pFrame->timestamp = (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - start).count();
+
+		// Fill it (false means the end of the stream)
+		if (!Render(*pFrame, index))
+			break;
+		index++;
+		pFrame->arrival = LatencyNow();
+
+		// Deliver
+		if (DeliverFrame(upFrame))
+			NumberOfGeneratedImages++;
+		else
+			NumberOfDroppedImages++;
+	}
+
+	// Leave
+	SourceRunning.store(false);
+}
+
+uint32_t SoftwareSource::GetWidth()
+{
+	return Width;
+}
+
+uint32_t SoftwareSource::GetHeight()
+{
+	return Height;
+}
+
+uint32_t SoftwareSource::GetBitsPerPixel()
+{
+	return BitsPerPixel;
+}
+
+uint64_t SoftwareSource::GetNumberOfGeneratedImages()
+{
+	return NumberOfGeneratedImages.load();
+}
+
+uint64_t SoftwareSource::GetNumberOfDroppedImages()
+{
+	return NumberOfDroppedImages.load();
+}
+
+void SoftwareSource::PushError(std::string str)
+{
+	Errors.TryPush(str);
+}
+
+std::unique_ptr<std::string> SoftwareSource::GetError()
+{
+	std::unique_ptr<std::string> err(new std::string());
+	if (!Errors.TryPop(*err))
+		err.reset();
+	return err;
+}
+
+size_t SoftwareSource::GetNumberOfErrors()
+{
+	return Errors.GetCount();
+}
@@ -0,0 +1,78 @@
+////////////////////////////////////////////////////////////////////////////////
+// Filename: softwaresource.h
+// Base class for frame sources that do not need a camera (synthetic patterns,
+// file replay). A worker thread takes frames from a FramePool, lets the
+// derived class fill them, and delivers them at a fixed rate or as fast as the
+// consumers allow. Everything here is standard C++, so these sources run on
+// any platform, without the Pleora SDK.
+////////////////////////////////////////////////////////////////////////////////
+#ifndef _SOFTWARESOURCE_H_
+#define _SOFTWARESOURCE_H_
+
+//////////////
+// INCLUDES //
+//////////////
+#include <string>
+#include <thread>
+#include <atomic>
+#include <memory>
+#include "spsc_queue.h"
+#include "framesource.h"
+#include "framepool.h"
+
+/////////////
+// GLOBALS //
+/////////////
+#define SOFTWARESOURCE_QUEUE_SIZE       SPSC_QUEUE_SIZE
+#define SOFTWARESOURCE_POOL_SIZE        512
+#define SOFTWARESOURCE_ERROR_QUEUE_SIZE 1024
+
+////////////////////////////////////////////////////////////////////////////////
+// Class name: SoftwareSource
+////////////////////////////////////////////////////////////////////////////////
+class SoftwareSource : public FrameSource
+{
+public:
+	virtual ~SoftwareSource();
+
+	bool							Start();
+	void							Stop();
+	void							Shutdown();
+	bool							IsRunning();
+
+	uint32_t						GetWidth();
+	uint32_t						GetHeight();
+	uint32_t						GetBitsPerPixel();
+	uint64_t						GetNumberOfGeneratedImages();
+	uint64_t						GetNumberOfDroppedImages();
+
+	std::unique_ptr<std::string>	GetError();
+	size_t							GetNumberOfErrors();
+
+protected:
+	SoftwareSource();
+
+	uint32_t						Width;
+	uint32_t						Height;
+	uint32_t						BitsPerPixel;
+
+	bool							InitializeSource(uint32_t, uint32_t, uint32_t, double);
+	virtual bool					Render(Frame&, uint64_t) = 0;
+	virtual void					Restart() {}
+	void							PushError(std::string);
+
+private:
+	std::shared_ptr<FramePool>		pool;
+	double							FramesPerSecond;
+
+	std::thread						SourceThread;
+	std::atomic<bool>				SourceStopFlag;
+	std::atomic<bool>				SourceRunning;
+	std::atomic<uint64_t>			NumberOfGeneratedImages;
+	std::atomic<uint64_t>			NumberOfDroppedImages;
+	void							GenerateContinuously();
+
+	SPSC_Ring<std::string>			Errors;
+};
+
+#endif
@@ -0,0 +1,658 @@
+////////////////////////////////////////////////////////////////////////////////
+// Filename: spillqueue.h
+// Second tier of the output queue of a frame source, for when the consumer
+// falls behind. Once the frames waiting in memory take more than a given
+// number of bytes, new frames are copied to a scratch file that is mapped
+// into memory, and the acquisition buffers are released right away. A
+// worker thread pages the frames back into the memory queue, oldest first,
+// as the consumer makes room, so that the consumer sees a single queue in
+// the original frame order. The scratch file is a ring: frames are only lost
+// when it is full.
+//
+// Ordering: the producer only pushes into the memory queue directly when
+// nothing is waiting in the spill path (Pending == 0). Otherwise its frames
+// go behind the spilled ones, and the worker thread is the one pushing into
+// the memory queue. The two never push at the same time, since the worker
+// only pushes frames that are counted in Pending, and releases the count
+// after the push.
+//
+// Waiting: new frames may go to either tier, so the consumer waits on a count
+// of the frames the producer queued, in memory or in the spill path, rather
+// than on the memory queue. Paging a frame back does not change the total.
+//
+// The scratch file is deleted when the spill queue is closed. The pages of
+// the mapping are written back by the OS only under memory pressure, so a
+// short stall costs little more than a copy.
+////////////////////////////////////////////////////////////////////////////////
+#ifndef _SPILLQUEUE_H_
+#define _SPILLQUEUE_H_
+
+//////////////
+// INCLUDES //
+//////////////
+#include <string>
+#include <deque>
+#include <vector>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <string.h>
+#include "spsc_queue.h"
+#include "iimagequeue.h"
+#ifdef _WIN32
+	#include <windows.h>
+#else
+	#include <sys/mman.h>
+	#include <fcntl.h>
+	#include <unistd.h>
+#endif
+
+/////////////
+// GLOBALS //
+/////////////
+#define SPILL_INCOMING_SIZE     1024		// Frames between the producer and the worker
+#define SPILL_RECORD_ALIGNMENT  64			// Records start on a cache line
+#define SPILL_POLL_MS           1			// Worker polling interval
+#define SPILL_CLEAR_TIMEOUT_MS  1000
+
+////////////////////////////////////////////////////////////////////////////////
+// Struct name: SpillStats
+////////////////////////////////////////////////////////////////////////////////
+struct SpillStats
+{
+	uint64_t	spilled;	// Frames written to the scratch file
+	uint64_t	pagedBack;	// Frames read back from the scratch file
+	uint64_t	dropped;	// Frames lost because the spill path was full
+	size_t		pending;	// Frames currently waiting in the spill path
+	uint64_t	usedBytes;	// Bytes of the scratch file in use
+	uint64_t	fileBytes;	// Size of the scratch file
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// Struct name: SpillRecord
+// Header of one frame in the scratch file (followed by the pixel data).
+////////////////////////////////////////////////////////////////////////////////
+struct SpillRecord
+{
+	uint64_t	blockId;
+	uint64_t	timestamp;
+	uint64_t	arrival;
+	uint64_t	size;
+	uint32_t	width;
+	uint32_t	height;
+	uint32_t	bpp;
+	uint32_t	reserved;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// Class name: SpillFramePool
+// Heap frames for the frames paged back. The memory of a frame is kept for
+// the next ones once the consumer releases it.
+////////////////////////////////////////////////////////////////////////////////
+struct SpillFrame
+{
+	Frame					frame;			// context points back to the spill frame
+	size_t					capacity;
+};
+
+class SpillFramePool : public IImageRecycler
+{
+public:
+	~SpillFramePool();
+
+	Frame*					Get(size_t);
+	void					Recycle(Frame*);
+
+private:
+	std::mutex				FreeMutex;
+	std::vector<SpillFrame*> FreeFrames;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// Class name: SpillQueue
+////////////////////////////////////////////////////////////////////////////////
+class SpillQueue
+{
+public:
+	SpillQueue(SPSC_ImageQueue&);
+	~SpillQueue();
+
+	bool					Open(const std::string&, uint64_t, uint64_t);
+	void					Close();
+	std::string				GetError();
+
+	void					Push(ImagePtr&);
+	void					Clear();
+	void					Demand(size_t);
+	size_t					GetCount();
+	DWORD					Wait(size_t, DWORD);
+	SpillStats				GetStats();
+
+private:
+	SPSC_ImageQueue&		Target;
+	uint64_t				MemoryBytes;
+	std::string				Error;
+
+	// Scratch file
+	// (only the worker thread touches the mapping and the entries)
+	struct SpillEntry
+	{
+		uint64_t			offset;
+		uint64_t			length;
+	};
+	uint8_t*				pFile;
+	uint64_t				FileBytes;
+	uint64_t				WriteOffset;
+	std::deque<SpillEntry>	Entries;
+	#ifdef _WIN32
+		HANDLE				FileHandle;
+		HANDLE				MappingHandle;
+	#else
+		int					FileDescriptor;
+	#endif
+	bool					Map(const std::string&);
+	void					Unmap();
+	bool					Append(const Frame&);
+	bool					PageBack();
+
+	// Worker
+	SPSC_ImageQueue			Incoming;
+	std::shared_ptr<SpillFramePool> Pool;
+	std::thread				Thread;
+	std::atomic<bool>		StopFlag;
+	std::atomic<size_t>		Pending;
+	std::atomic<size_t>		Demanded;
+	std::atomic<uint64_t>	ClearRequested;
+	std::atomic<uint64_t>	ClearDone;
+	void					SpillContinuously();
+
+	// Frames queued by the producer, in either tier (see Wait)
+	std::atomic<size_t>		Arrived;
+	SPSC_Signal				ArrivedSignal;
+	void					Discard();
+
+	// Statistics
+	std::atomic<uint64_t>	NumberOfSpilled;
+	std::atomic<uint64_t>	NumberOfPagedBack;
+	std::atomic<uint64_t>	NumberOfDropped;
+	std::atomic<uint64_t>	UsedBytes;
+};
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Class implementation: SpillFramePool
+////////////////////////////////////////////////////////////////////////////////
+inline SpillFramePool::~SpillFramePool()
+{
+	for (size_t i = 0; i < FreeFrames.size(); i++)
+	{
+		spsc_aligned_free(FreeFrames[i]->frame.data);
+		delete FreeFrames[i];
+	}
+}
+
+inline Frame* SpillFramePool::Get(size_t size)
+{
+	// Reuse a frame that is large enough
+	SpillFrame* pSpill = NULL;
+	{
+		std::lock_guard<std::mutex> lock(FreeMutex);
+		if (!FreeFrames.empty())
+		{
+			pSpill = FreeFrames.back();
+			FreeFrames.pop_back();
+		}
+	}
+
+	if (pSpill == NULL)
+	{
+		pSpill = new SpillFrame();
+		pSpill->capacity = 0;
+		pSpill->frame.context = pSpill;
+	}
+
+	if (pSpill->capacity < size)
+	{
+		spsc_aligned_free(pSpill->frame.data);
+		pSpill->frame.data = (uint8_t*)spsc_aligned_malloc(size, SPILL_RECORD_ALIGNMENT);
+		pSpill->capacity = (pSpill->frame.data != NULL) ? size : 0;
+		if (pSpill->frame.data == NULL)
+		{
+			delete pSpill;
+			return NULL;
+		}
+	}
+
+	return &pSpill->frame;
+}
+
+inline void SpillFramePool::Recycle(Frame* pFrame)
+{
+	std::lock_guard<std::mutex> lock(FreeMutex);
+	FreeFrames.push_back((SpillFrame*)pFrame->context);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Class implementation: SpillQueue
+////////////////////////////////////////////////////////////////////////////////
+inline SpillQueue::SpillQueue(SPSC_ImageQueue& target) : Target(target), Incoming(SPILL_INCOMING_SIZE)
+{
+	MemoryBytes = 0;
+	pFile = NULL;
+	FileBytes = 0;
+	WriteOffset = 0;
+	#ifdef _WIN32
+		FileHandle = INVALID_HANDLE_VALUE;
+		MappingHandle = NULL;
+	#else
+		FileDescriptor = -1;
+	#endif
+
+	StopFlag = false;
+	Pending = 0;
+	Demanded = 0;
+	ClearRequested = 0;
+	ClearDone = 0;
+	Arrived = 0;
+	NumberOfSpilled = 0;
+	NumberOfPagedBack = 0;
+	NumberOfDropped = 0;
+	UsedBytes = 0;
+}
+
+inline SpillQueue::~SpillQueue()
+{
+	Close();
+}
+
+inline bool SpillQueue::Open(const std::string& path, uint64_t memoryBytes, uint64_t fileBytes)
+{
+	// Check the arguments
+	if (memoryBytes == 0 || fileBytes < SPILL_RECORD_ALIGNMENT)
+	{
+		Error = "The memory watermark and the size of the spill file should not be zero.";
+		return false;
+	}
+	MemoryBytes = memoryBytes;
+	FileBytes = (fileBytes / SPILL_RECORD_ALIGNMENT) * SPILL_RECORD_ALIGNMENT;
+
+	// Create the scratch file
+	if (!Map(path))
+	{
+		Unmap();
+		return false;
+	}
+
+	// Start the worker
+	Pool.reset(new SpillFramePool());
+	StopFlag = false;
+	try
+	{
+		Thread = std::thread(&SpillQueue::SpillContinuously, this);
+	}
+	catch (...)
+	{
+		Error = "Could not start the spill thread.";
+		Unmap();
+		return false;
+	}
+
+	return true;
+}
+
+inline void SpillQueue::Close()
+{
+	// Stop the worker
+	// (from here on, nothing pushes into the target queue anymore)
+	StopFlag = true;
+	if (Thread.joinable())
+		Thread.join();
+
+	// Drop what is left and delete the scratch file
+	// (the pool goes with the last frame that was paged back)
+	Discard();
+	Unmap();
+	Pool.reset();
+
+	// Have the consumer wait on the memory queue from now on
+	ArrivedSignal.Notify(Arrived.fetch_add(1, std::memory_order_acq_rel) + 1);
+}
+
+inline std::string SpillQueue::GetError()
+{
+	return Error;
+}
+
+inline bool SpillQueue::Map(const std::string& path)
+{
+	#ifdef _WIN32
+		// Temporary file, which the cache manager avoids writing out, and
+		// which is deleted when it is closed
+		FileHandle = CreateFileA(path.c_str(), GENERIC_READ | GENERIC_WRITE, 0, NULL, CREATE_ALWAYS,
+			FILE_ATTRIBUTE_TEMPORARY | FILE_FLAG_DELETE_ON_CLOSE, NULL);
+		if (FileHandle == INVALID_HANDLE_VALUE)
+		{
+			Error = "Could not create " + path + " (code " + std::to_string(GetLastError()) + ").";
+			return false;
+		}
+
+		LARGE_INTEGER size;
+		size.QuadPart = (LONGLONG)FileBytes;
+		if (!SetFilePointerEx(FileHandle, size, NULL, FILE_BEGIN) || !SetEndOfFile(FileHandle))
+		{
+			Error = "Could not resize " + path + " (code " + std::to_string(GetLastError()) + ").";
+			return false;
+		}
+
+		MappingHandle = CreateFileMappingA(FileHandle, NULL, PAGE_READWRITE, (DWORD)(FileBytes >> 32), (DWORD)FileBytes, NULL);
+		if (MappingHandle == NULL)
+		{
+			Error = "CreateFileMapping failed with code " + std::to_string(GetLastError()) + ".";
+			return false;
+		}
+
+		pFile = (uint8_t*)MapViewOfFile(MappingHandle, FILE_MAP_READ | FILE_MAP_WRITE, 0, 0, 0);
+		if (pFile == NULL)
+		{
+			Error = "MapViewOfFile failed with code " + std::to_string(GetLastError()) + ".";
+			return false;
+		}
+	#else
+		FileDescriptor = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0600);
+		if (FileDescriptor < 0)
+		{
+			Error = "Could not create " + path + ".";
+			return false;
+		}
+
+		// The name is not needed anymore; the file goes away with the descriptor
+		unlink(path.c_str());
+
+		if (ftruncate(FileDescriptor, (off_t)FileBytes) != 0)
+		{
+			Error = "Could not resize " + path + ".";
+			return false;
+		}
+
+		void* p = mmap(NULL, (size_t)FileBytes, PROT_READ | PROT_WRITE, MAP_SHARED, FileDescriptor, 0);
+		if (p == MAP_FAILED)
+		{
+			Error = "mmap failed for " + path + ".";
+			return false;
+		}
+		pFile = (uint8_t*)p;
+	#endif
+
+	return true;
+}
+
+inline void SpillQueue::Unmap()
+{
+	#ifdef _WIN32
+		if (pFile != NULL)
+			UnmapViewOfFile(pFile);
+		if (MappingHandle != NULL)
+			CloseHandle(MappingHandle);
+		if (FileHandle != INVALID_HANDLE_VALUE)
+			CloseHandle(FileHandle);
+		MappingHandle = NULL;
+		FileHandle = INVALID_HANDLE_VALUE;
+	#else
+		if (pFile != NULL)
+			munmap(pFile, (size_t)FileBytes);
+		if (FileDescriptor >= 0)
+			close(FileDescriptor);
+		FileDescriptor = -1;
+	#endif
+	pFile = NULL;
+}
+
+inline void SpillQueue::Push(ImagePtr& upFrame)
+{
+	// Frames go straight to memory as long as nothing is waiting in the
+	// spill path and the memory queue is below the watermark (or once the
+	// spill queue is closed, and the worker gone)
+	if (StopFlag.load(std::memory_order_acquire)
+		|| (Pending.load(std::memory_order_acquire) == 0
+			&& (uint64_t)Target.GetCount()*upFrame->size < MemoryBytes))
+	{
+		Target.TryPush(upFrame);
+	}
+	else
+	{
+		// Otherwise they queue up behind the spilled ones
+		// (counted first, so that the worker never sees a frame it cannot account for)
+		Pending.fetch_add(1, std::memory_order_acq_rel);
+		Incoming.TryPush(upFrame);
+		if (upFrame)
+		{
+			Pending.fetch_sub(1, std::memory_order_acq_rel);
+			NumberOfDropped++;
+		}
+	}
+
+	// Wake up the consumer (the frame is counted in its tier by now)
+	if (!upFrame)
+		ArrivedSignal.Notify(Arrived.fetch_add(1, std::memory_order_acq_rel) + 1);
+}
+
+inline void SpillQueue::Clear()
+{
+	// Ask the worker to drop everything, and wait until it has
+	uint64_t request = ++ClearRequested;
+	auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(SPILL_CLEAR_TIMEOUT_MS);
+	while (ClearDone.load() < request && std::chrono::steady_clock::now() < deadline)
+		std::this_thread::sleep_for(std::chrono::milliseconds(SPILL_POLL_MS));
+}
+
+inline void SpillQueue::Demand(size_t n)
+{
+	// Page back up to n frames, even beyond the watermark
+	Demanded = n;
+}
+
+inline size_t SpillQueue::GetCount()
+{
+	return Pending.load(std::memory_order_acquire);
+}
+
+inline DWORD SpillQueue::Wait(size_t n, DWORD timeoutMilliseconds)
+{
+	// Sleep until the producer queues another frame, in either tier, and
+	// check the total again
+	// (the arrival count is read first, so a frame queued after the check
+	//  wakes us up)
+	auto start = std::chrono::steady_clock::now();
+	while (true)
+	{
+		size_t arrived = Arrived.load(std::memory_order_acquire);
+		if (Target.GetCount() + GetCount() >= n)
+			return WAIT_OBJECT_0;
+		bool closed = StopFlag.load(std::memory_order_acquire);
+
+		DWORD remaining = INFINITE;
+		if (timeoutMilliseconds != INFINITE)
+		{
+			DWORD elapsed = (DWORD)std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+			if (elapsed >= timeoutMilliseconds)
+				return WAIT_TIMEOUT;
+			remaining = timeoutMilliseconds - elapsed;
+		}
+		if (closed)
+			return Target.Wait(n, remaining);
+		ArrivedSignal.Wait(Arrived, arrived + 1, remaining);
+	}
+}
+
+inline SpillStats SpillQueue::GetStats()
+{
+	SpillStats stats;
+	stats.spilled = NumberOfSpilled;
+	stats.pagedBack = NumberOfPagedBack;
+	stats.dropped = NumberOfDropped;
+	stats.pending = GetCount();
+	stats.usedBytes = UsedBytes;
+	stats.fileBytes = FileBytes;
+	return stats;
+}
+
+inline bool SpillQueue::Append(const Frame& frame)
+{
+	// Room for the record, in one piece
+	uint64_t length = sizeof(SpillRecord) + frame.size;
+	length = ((length + SPILL_RECORD_ALIGNMENT - 1) / SPILL_RECORD_ALIGNMENT) * SPILL_RECORD_ALIGNMENT;
+
+	uint64_t offset;
+	if (Entries.empty())
+	{
+		if (length > FileBytes)
+			return false;
+		offset = 0;
+	}
+	else
+	{
+		uint64_t head = Entries.front().offset;
+		if (WriteOffset == head)
+			return false;										// Full
+		else if (WriteOffset > head && WriteOffset + length <= FileBytes)
+			offset = WriteOffset;								// After the last record
+		else if (WriteOffset > head && length <= head)
+			offset = 0;											// Wrap around
+		else if (WriteOffset < head && WriteOffset + length <= head)
+			offset = WriteOffset;								// Wrapped, up to the first record
+		else
+			return false;
+	}
+
+	// Copy the frame
+	SpillRecord record;
+	record.blockId = frame.blockId;
+	record.timestamp = frame.timestamp;
+	record.arrival = frame.arrival;
+	record.size = frame.size;
+	record.width = frame.width;
+	record.height = frame.height;
+	record.bpp = frame.bpp;
+	record.reserved = 0;
+	memcpy(pFile + offset, &record, sizeof(record));
+	memcpy(pFile + offset + sizeof(record), frame.data, frame.size);
+
+	SpillEntry entry;
+	entry.offset = offset;
+	entry.length = length;
+	Entries.push_back(entry);
+	WriteOffset = offset + length;
+	UsedBytes += length;
+	NumberOfSpilled++;
+	return true;
+}
+
+inline bool SpillQueue::PageBack()
+{
+	// Oldest frame of the file
+	const SpillEntry& entry = Entries.front();
+	SpillRecord record;
+	memcpy(&record, pFile + entry.offset, sizeof(record));
+
+	// Copy it into a heap frame
+	Frame* pFrame = Pool->Get((size_t)record.size);
+	if (pFrame == NULL)
+		return false;
+	ImagePtr upFrame(pFrame, ImageRelease(Pool));
+	upFrame->width = record.width;
+	upFrame->height = record.height;
+	upFrame->bpp = record.bpp;
+	upFrame->timestamp = record.timestamp;
+	upFrame->blockId = record.blockId;
+	upFrame->arrival = record.arrival;
+	upFrame->size = (size_t)record.size;
+	memcpy(upFrame->data, pFile + entry.offset + sizeof(record), upFrame->size);
+
+	// Hand it to the consumer (if the queue is full, try again later)
+	Target.TryPush(upFrame);
+	if (upFrame)
+		return false;
+
+	UsedBytes -= entry.length;
+	Entries.pop_front();
+	Pending.fetch_sub(1, std::memory_order_acq_rel);
+	NumberOfPagedBack++;
+	return true;
+}
+
+inline void SpillQueue::Discard()
+{
+	// Frames that did not reach the file yet
+	ImagePtr upFrame;
+	while (upFrame = Incoming.TryPop())
+	{
+		upFrame.reset();
+		Pending.fetch_sub(1, std::memory_order_acq_rel);
+	}
+
+	// Frames in the file
+	Pending.fetch_sub(Entries.size(), std::memory_order_acq_rel);
+	Entries.clear();
+	WriteOffset = 0;
+	UsedBytes = 0;
+}
+
+inline void SpillQueue::SpillContinuously()
+{
+	ImagePtr upFrame;
+	size_t   watermark = 1;
+
+	while (!StopFlag)
+	{
+		// Flush request
+		uint64_t request = ClearRequested.load();
+		if (ClearDone.load() != request)
+		{
+			Discard();
+			ClearDone = request;
+		}
+
+		// Number of frames to keep in memory
+		size_t demanded = Demanded.load();
+		size_t target = (demanded > watermark) ? demanded : watermark;
+
+		// Page frames back, oldest first
+		while (!Entries.empty() && Target.GetCount() < target)
+			if (!PageBack())
+				break;
+
+		// New frames. While the file is empty and there is room in memory,
+		// they go straight on; otherwise they are copied to the file, and
+		// the acquisition buffer is released.
+		while (upFrame = Incoming.TryPop())
+		{
+			watermark = (size_t)(MemoryBytes / ((upFrame->size > 0) ? upFrame->size : 1));
+			if (watermark == 0)
+				watermark = 1;
+
+			if (Entries.empty() && Target.GetCount() < target)
+			{
+				Target.TryPush(upFrame);
+				if (!upFrame)
+				{
+					Pending.fetch_sub(1, std::memory_order_acq_rel);
+					continue;
+				}
+			}
+
+			if (!Append(*upFrame))
+			{
+				Pending.fetch_sub(1, std::memory_order_acq_rel);
+				NumberOfDropped++;
+			}
+			upFrame.reset();
+		}
+
+		// Sleep until new frames arrive, or the consumer made room
+		Incoming.Wait(1, SPILL_POLL_MS);
+	}
+}
+
+#endif
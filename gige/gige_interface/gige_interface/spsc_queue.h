@@ -4,6 +4,28 @@
 // generic objects. This class allows transferring ownership of a sequence of
 // objects (e.g. images) from one thread to another in a safe manner.
 //   - Damien Loterie (11/2014)
+//
+// The counters are C++11 atomics with acquire/release ordering, and the
+// blocking wait is built on a condition variable, so the queue builds and
+// behaves the same on Windows and Linux. The Wait() return codes keep the
+// Win32 WAIT_* semantics on both platforms.
+//
+// Two containers share the same counters and wait logic:
+//   - SPSC_Queue<T> transfers ownership of heap objects (std::unique_ptr<T>,
+//                   with an optional custom deleter D).
+//   - SPSC_Ring<T>  stores T inline in a cache-aligned ring. Push and pop
+//                   swap the caller's object with the slot, so objects that
+//                   own memory (strings, vectors) are recycled between the
+//                   producer and the consumer instead of being reallocated.
+// The capacity is chosen per instance and rounded up to a power of two.
+//
+// The batch functions move several elements with a single counter update,
+// and each side keeps a private copy of the other side's counter, so the
+// shared cache lines are only touched when the cached value runs out.
+//
+// SPSC_Snapshot<T> holds an object that a control thread replaces now and
+// then (e.g. a list of subscribers), and that the producer reads without a
+// lock or a reference count.
 ////////////////////////////////////////////////////////////////////////////////
 #ifndef _SPSC_QUEUE_H_
 #define _SPSC_QUEUE_H_
@@ -13,104 +35,443 @@
 //////////////
 #include <memory>
 #include <vector>
-#include <windows.h>
+#include <atomic>
+#include <mutex>
+#include <chrono>
+#include <condition_variable>
+#include <new>
+#include <utility>
+#include <stdint.h>
+#include <stdlib.h>
+#ifdef _WIN32
+	#include <windows.h>
+	#include <malloc.h>
+#endif
 
 /////////////
 // GLOBALS //
 /////////////
 #define SPSC_QUEUE_SIZE_POW   17
 #define SPSC_QUEUE_SIZE       (1<<SPSC_QUEUE_SIZE_POW)
-#define SPSC_QUEUE_SIZE_MASK  (SPSC_QUEUE_SIZE-1)
-#define T_ptr   std::unique_ptr<T>
+#define SPSC_CACHE_LINE       64
+#define T_ptr   std::unique_ptr<T,D>
+
+/////////////////
+// PORTABILITY //
+/////////////////
+#ifdef _MSC_VER
+	#define SPSC_ALIGN __declspec(align(64))
+#else
+	#define SPSC_ALIGN __attribute__((aligned(64)))
+#endif
+
+#ifndef _WIN32
+	typedef uint32_t DWORD;
+	#define WAIT_OBJECT_0  ((DWORD)0x00000000L)
+	#define WAIT_TIMEOUT   ((DWORD)0x00000102L)
+	#define WAIT_FAILED    ((DWORD)0xFFFFFFFF)
+	#define INFINITE       ((DWORD)0xFFFFFFFF)
+#endif
+
+inline void* spsc_aligned_malloc(size_t size, size_t alignment)
+{
+	#ifdef _WIN32
+		return _aligned_malloc(size, alignment);
+	#else
+		void* ptr = NULL;
+		if (posix_memalign(&ptr, alignment, size) != 0)
+			return NULL;
+		return ptr;
+	#endif
+}
+
+inline void spsc_aligned_free(void* ptr)
+{
+	#ifdef _WIN32
+		_aligned_free(ptr);
+	#else
+		free(ptr);
+	#endif
+}
+
+// Objects that hold queues or counters are aligned to cache lines, which the
+// plain operator new does not honour before C++17, so they are made in
+// aligned memory instead, and destroyed by this deleter
+template<class T>
+struct spsc_aligned_delete
+{
+	void operator()(T* ptr) const
+	{
+		if (ptr == NULL)
+			return;
+		ptr->~T();
+		spsc_aligned_free(ptr);
+	}
+};
+
+template<class T, class... Args>
+T* spsc_new_aligned(Args&&... args)
+{
+	void* memory = spsc_aligned_malloc(sizeof(T), SPSC_CACHE_LINE);
+	if (memory == NULL)
+		throw std::bad_alloc();
+
+	try
+	{
+		return new (memory) T(std::forward<Args>(args)...);
+	}
+	catch (...)
+	{
+		spsc_aligned_free(memory);
+		throw;
+	}
+}
+
+template<class T, class... Args>
+std::shared_ptr<T> spsc_make_shared_aligned(Args&&... args)
+{
+	return std::shared_ptr<T>(spsc_new_aligned<T>(std::forward<Args>(args)...), spsc_aligned_delete<T>());
+}
 
 
 ////////////////////////////////////////////////////////////////////////////////
-// Class definition: SPSC_Queue
+// Class definition: SPSC_Signal
+// Lets the consumer sleep until a counter reaches a target value. The producer
+// only touches the mutex when a waiter is actually registered.
 ////////////////////////////////////////////////////////////////////////////////
-template <class T>
-class SPSC_Queue
+class SPSC_Signal
 {
 private:
-	T_ptr*   Queue;
+	SPSC_ALIGN std::atomic<size_t> PushCondition;
+	std::mutex                     Mutex;
+	std::condition_variable        Variable;
 
-	__declspec (align(64)) volatile size_t PushCount;
-	__declspec (align(64)) volatile size_t PopCount;
+public:
+	SPSC_Signal();
 
-	__declspec (align(64)) volatile size_t PushCondition;
-	HANDLE  Signal;
+	void  Notify(size_t);
+	DWORD Wait(const std::atomic<size_t>&, size_t, DWORD);
+};
 
-public:
-	SPSC_Queue();
-	~SPSC_Queue();
 
-	void  TryPush(T_ptr&);
-	void  TryPop(T_ptr&);
-	T_ptr TryPop();
-	void  Clear();
+////////////////////////////////////////////////////////////////////////////////
+// Class definition: SPSC_Counters
+// Push/pop counters, capacity and wait logic shared by the containers below.
+////////////////////////////////////////////////////////////////////////////////
+class SPSC_Counters
+{
+protected:
+	size_t   Capacity;
+	size_t   Mask;
+
+	SPSC_ALIGN std::atomic<size_t> PushCount;
+	SPSC_ALIGN std::atomic<size_t> PopCount;
+
+	SPSC_ALIGN size_t PopCache;		// Producer's view of PopCount
+	SPSC_ALIGN size_t PushCache;	// Consumer's view of PushCount
+
+	SPSC_Signal Signal;
 
+	SPSC_Counters(size_t);
+
+	size_t ReservePush(size_t, size_t&);
+	size_t ReservePop(size_t, size_t&);
+	void   PublishPush(size_t);
+	void   PublishPop(size_t);
+
+public:
 	size_t GetCount();
+	size_t GetCapacity();
 
-	DWORD  SPSC_Queue<T>::Wait(size_t, DWORD);
+	DWORD  Wait(size_t, DWORD);
+	size_t WaitAny(size_t, size_t, DWORD);
 };
 
 
 ////////////////////////////////////////////////////////////////////////////////
-// Class implementation: SPSC_Queue
+// Class definition: SPSC_Queue
 ////////////////////////////////////////////////////////////////////////////////
-template <class T>
-SPSC_Queue<T>::SPSC_Queue()
+template <class T, class D = std::default_delete<T> >
+class SPSC_Queue : public SPSC_Counters
 {
-	Queue = new T_ptr[SPSC_QUEUE_SIZE];
+private:
+	T_ptr*   Queue;
+
+public:
+	SPSC_Queue(size_t capacity = SPSC_QUEUE_SIZE);
+	~SPSC_Queue();
 
-  	PushCount = 0;
-	PopCount = 0;
+	void   TryPush(T_ptr&);
+	void   TryPop(T_ptr&);
+	T_ptr  TryPop();
+	size_t TryPushBatch(T_ptr*, size_t);
+	size_t TryPopBatch(T_ptr*, size_t);
+	void   Clear();
+};
 
-	PushCondition = 0;
-	Signal = CreateEvent(NULL, true, false, NULL);
-}
 
+////////////////////////////////////////////////////////////////////////////////
+// Class definition: SPSC_Ring
+////////////////////////////////////////////////////////////////////////////////
 template <class T>
-SPSC_Queue<T>::~SPSC_Queue()
+class SPSC_Ring : public SPSC_Counters
 {
-	delete[] Queue;
+private:
+	T*       Ring;
+
+public:
+	SPSC_Ring(size_t capacity);
+	~SPSC_Ring();
+
+	bool   TryPush(T&);
+	bool   TryPop(T&);
+	size_t TryPushBatch(T*, size_t);
+	size_t TryPopBatch(T*, size_t);
+	void   Clear();
+};
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Class definition: SPSC_Snapshot
+// The reader announces the epoch in which it loads the pointer, and goes back
+// to idle when it is done with the object. A replaced object is retired with
+// the new epoch, and deleted once the reader is idle or in a later epoch.
+// Only one thread reads with Acquire/Release; Get, Replace and Reclaim are
+// serialized by the caller, who may read the object with Get meanwhile.
+////////////////////////////////////////////////////////////////////////////////
+template <class T, class D = std::default_delete<T> >
+class SPSC_Snapshot
+{
+private:
+	SPSC_ALIGN std::atomic<T*>       Current;
+	           std::atomic<uint64_t> Epoch;
+	SPSC_ALIGN std::atomic<uint64_t> ReaderEpoch;
+	std::vector<std::pair<uint64_t, T*> > Retired;
 
-	if (Signal != NULL)
-		CloseHandle(Signal);
+	SPSC_Snapshot(const SPSC_Snapshot&);
+	SPSC_Snapshot& operator=(const SPSC_Snapshot&);
+
+public:
+	SPSC_Snapshot(T* initial = NULL);
+	~SPSC_Snapshot();
+
+	T*     Acquire();
+	void   Release();
+
+	T*     Get();
+	void   Replace(T*);
+	void   Reclaim();
+
+	// Acquires the object for the lifetime of the guard
+	class Reader
+	{
+	private:
+		SPSC_Snapshot& Snapshot;
+		T*             Object;
+
+		Reader(const Reader&);
+		Reader& operator=(const Reader&);
+
+	public:
+		Reader(SPSC_Snapshot& snapshot) : Snapshot(snapshot) { Object = Snapshot.Acquire(); }
+		~Reader()               { Snapshot.Release(); }
+		T* get() const          { return Object; }
+		T* operator->() const   { return Object; }
+		T& operator*() const    { return *Object; }
+	};
+};
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Class implementation: SPSC_Signal
+////////////////////////////////////////////////////////////////////////////////
+inline SPSC_Signal::SPSC_Signal()
+{
+	PushCondition.store(0, std::memory_order_relaxed);
 }
 
-template <class T>
-void SPSC_Queue<T>::TryPush(T_ptr& obj)
+inline void SPSC_Signal::Notify(size_t count)
 {
-	if ((PushCount - PopCount) < SPSC_QUEUE_SIZE)
+	// Make the new count visible before looking for a waiter
+	// (pairs with the fence in Wait)
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+
+	// Wake up the consumer if it is waiting for this count
+	size_t condition = PushCondition.load(std::memory_order_relaxed);
+	if (condition>0 && count>=condition)
 	{
-		// Queue element
-		Queue[PushCount & SPSC_QUEUE_SIZE_MASK] = std::move(obj);
+		std::lock_guard<std::mutex> lock(Mutex);
+		Variable.notify_one();
+	}
+}
 
-		// Increment counter
-		MemoryBarrier();
-		PushCount++;
+inline DWORD SPSC_Signal::Wait(const std::atomic<size_t>& counter, size_t target, DWORD timeoutMilliseconds)
+{
+	// Check if the condition is already satisfied
+	// (if it is, no need to do all the synchronization work)
+	if (counter.load(std::memory_order_acquire) >= target)
+		return WAIT_OBJECT_0;
 
-		// Send signal if needed
-		MemoryBarrier();
-		if (PushCondition>0 && PushCount>=PushCondition)
-			SetEvent(Signal);
+	// Check if we actually intend to wait
+	if (timeoutMilliseconds == 0)
+		return WAIT_TIMEOUT;
+
+	// Set the count that we want to wait for
+	PushCondition.store(target, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+
+	// Wait for the signal. The predicate is evaluated under the mutex, so a
+	// notification sent between the fence and the wait cannot be missed.
+	bool satisfied;
+	{
+		std::unique_lock<std::mutex> lock(Mutex);
+		auto predicate = [&]{ return counter.load(std::memory_order_acquire) >= target; };
+		if (timeoutMilliseconds == INFINITE)
+		{
+			Variable.wait(lock, predicate);
+			satisfied = true;
+		}
+		else
+		{
+			satisfied = Variable.wait_for(lock, std::chrono::milliseconds(timeoutMilliseconds), predicate);
+		}
 	}
+
+	// Disable signalling again
+	PushCondition.store(0, std::memory_order_relaxed);
+
+	// Return
+	return satisfied ? WAIT_OBJECT_0 : WAIT_TIMEOUT;
 }
 
-template <class T>
-void SPSC_Queue<T>::TryPop(T_ptr& obj)
+
+////////////////////////////////////////////////////////////////////////////////
+// Class implementation: SPSC_Counters
+////////////////////////////////////////////////////////////////////////////////
+inline SPSC_Counters::SPSC_Counters(size_t capacity)
+{
+	// Round the capacity up to a power of two
+	Capacity = 1;
+	while (Capacity < capacity)
+		Capacity <<= 1;
+	Mask = Capacity - 1;
+
+	PushCount.store(0, std::memory_order_relaxed);
+	PopCount.store(0, std::memory_order_relaxed);
+	PopCache = 0;
+	PushCache = 0;
+}
+
+inline size_t SPSC_Counters::ReservePush(size_t n, size_t& push)
 {
-	if (PushCount > PopCount)
+	// Only the producer writes PushCount, so a relaxed read is enough
+	push = PushCount.load(std::memory_order_relaxed);
+
+	// Refresh the cached pop count only if it does not leave enough room
+	size_t free = Capacity - (push - PopCache);
+	if (free < n)
 	{
-		obj = std::move(Queue[PopCount & SPSC_QUEUE_SIZE_MASK]);
+		PopCache = PopCount.load(std::memory_order_acquire);
+		free = Capacity - (push - PopCache);
+	}
+
+	// Return the number of slots that can be written
+	return (free < n) ? free : n;
+}
 
-		MemoryBarrier();
-		PopCount++;
+inline size_t SPSC_Counters::ReservePop(size_t n, size_t& pop)
+{
+	// Only the consumer writes PopCount, so a relaxed read is enough
+	pop = PopCount.load(std::memory_order_relaxed);
+
+	// Refresh the cached push count only if it does not cover the request
+	size_t available = PushCache - pop;
+	if (available < n)
+	{
+		PushCache = PushCount.load(std::memory_order_acquire);
+		available = PushCache - pop;
 	}
+
+	// Return the number of slots that can be read
+	return (available < n) ? available : n;
 }
 
-template <class T>
-T_ptr SPSC_Queue<T>::TryPop()
+inline void SPSC_Counters::PublishPush(size_t push)
+{
+	// Publish the elements
+	PushCount.store(push, std::memory_order_release);
+
+	// Send signal if needed
+	Signal.Notify(push);
+}
+
+inline void SPSC_Counters::PublishPop(size_t pop)
+{
+	// Release the slots
+	PopCount.store(pop, std::memory_order_release);
+}
+
+inline size_t SPSC_Counters::GetCount()
+{
+	// Read PopCount first so the difference can never underflow
+	size_t pop = PopCount.load(std::memory_order_acquire);
+	return PushCount.load(std::memory_order_acquire) - pop;
+}
+
+inline size_t SPSC_Counters::GetCapacity()
+{
+	return Capacity;
+}
+
+inline DWORD SPSC_Counters::Wait(size_t n, DWORD timeoutMilliseconds)
+{
+	// Wait until n elements are available
+	return Signal.Wait(PushCount, PopCount.load(std::memory_order_relaxed) + n, timeoutMilliseconds);
+}
+
+inline size_t SPSC_Counters::WaitAny(size_t nMin, size_t nMax, DWORD timeoutMilliseconds)
+{
+	// Wait until at least nMin elements are available
+	if (nMin == 0)
+		nMin = 1;
+	if (Wait(nMin, timeoutMilliseconds) != WAIT_OBJECT_0)
+		return 0;
+
+	// Return how many can be popped, up to nMax
+	size_t available = GetCount();
+	return (available < nMax) ? available : nMax;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Class implementation: SPSC_Queue
+////////////////////////////////////////////////////////////////////////////////
+template <class T, class D>
+SPSC_Queue<T,D>::SPSC_Queue(size_t capacity) : SPSC_Counters(capacity)
+{
+	Queue = new T_ptr[Capacity];
+}
+
+template <class T, class D>
+SPSC_Queue<T,D>::~SPSC_Queue()
+{
+	delete[] Queue;
+}
+
+template <class T, class D>
+void SPSC_Queue<T,D>::TryPush(T_ptr& obj)
+{
+	TryPushBatch(&obj, 1);
+}
+
+template <class T, class D>
+void SPSC_Queue<T,D>::TryPop(T_ptr& obj)
+{
+	TryPopBatch(&obj, 1);
+}
+
+template <class T, class D>
+T_ptr SPSC_Queue<T,D>::TryPop()
 {
 	// Create an empty pointer
 	T_ptr obj;
@@ -122,72 +483,205 @@ T_ptr SPSC_Queue<T>::TryPop()
 	return obj;
 }
 
-template <class T>
-void SPSC_Queue<T>::Clear()
+template <class T, class D>
+size_t SPSC_Queue<T,D>::TryPushBatch(T_ptr* objs, size_t n)
+{
+	// Reserve room
+	size_t push;
+	n = ReservePush(n, push);
+
+	// Queue elements (the ones that did not fit stay with the caller)
+	for (size_t i = 0; i < n; i++)
+		Queue[(push + i) & Mask] = std::move(objs[i]);
+
+	// Publish them all at once
+	if (n > 0)
+		PublishPush(push + n);
+	return n;
+}
+
+template <class T, class D>
+size_t SPSC_Queue<T,D>::TryPopBatch(T_ptr* objs, size_t nMax)
+{
+	// Check what is available
+	size_t pop;
+	size_t n = ReservePop(nMax, pop);
+
+	// Pop elements
+	for (size_t i = 0; i < n; i++)
+		objs[i] = std::move(Queue[(pop + i) & Mask]);
+
+	// Release the slots all at once
+	if (n > 0)
+		PublishPop(pop + n);
+	return n;
+}
+
+template <class T, class D>
+void SPSC_Queue<T,D>::Clear()
 {
 	// Pop all elements
 	while (TryPop());
 }
 
 
+////////////////////////////////////////////////////////////////////////////////
+// Class implementation: SPSC_Ring
+////////////////////////////////////////////////////////////////////////////////
+template <class T>
+SPSC_Ring<T>::SPSC_Ring(size_t capacity) : SPSC_Counters(capacity)
+{
+	// Allocate cache-aligned storage and default-construct the slots
+	Ring = (T*)spsc_aligned_malloc(Capacity * sizeof(T), SPSC_CACHE_LINE);
+	if (Ring == NULL)
+		throw std::bad_alloc();
+	for (size_t i = 0; i < Capacity; i++)
+		new (&Ring[i]) T();
+}
 
+template <class T>
+SPSC_Ring<T>::~SPSC_Ring()
+{
+	for (size_t i = 0; i < Capacity; i++)
+		Ring[i].~T();
+	spsc_aligned_free(Ring);
+}
 
 template <class T>
-size_t SPSC_Queue<T>::GetCount()
+bool SPSC_Ring<T>::TryPush(T& obj)
 {
-	// Return
-	return PushCount-PopCount;
+	return TryPushBatch(&obj, 1) == 1;
 }
 
 template <class T>
-DWORD SPSC_Queue<T>::Wait(size_t n, DWORD timeoutMilliseconds)
+bool SPSC_Ring<T>::TryPop(T& obj)
 {
-	// Check if the condition is already satisfied
-	// (if it is, no need to do all the synchronization work)
-	if (PushCount >= (PopCount + n))
-		return WAIT_OBJECT_0;
+	return TryPopBatch(&obj, 1) == 1;
+}
 
-	// Check if we actually intend to wait
-	if (timeoutMilliseconds == 0)
-		return WAIT_TIMEOUT;
+template <class T>
+size_t SPSC_Ring<T>::TryPushBatch(T* objs, size_t n)
+{
+	// Reserve room
+	size_t push;
+	n = ReservePush(n, push);
+
+	// Exchange with the slots; the caller gets back the objects that the
+	// consumer left there, along with any memory they still own
+	using std::swap;
+	for (size_t i = 0; i < n; i++)
+		swap(Ring[(push + i) & Mask], objs[i]);
+
+	// Publish them all at once
+	if (n > 0)
+		PublishPush(push + n);
+	return n;
+}
 
-	// Set the push count that we want to wait for
-	PushCondition = PopCount + n;     
+template <class T>
+size_t SPSC_Ring<T>::TryPopBatch(T* objs, size_t nMax)
+{
+	// Check what is available
+	size_t pop;
+	size_t n = ReservePop(nMax, pop);
+
+	// Exchange with the slots; the caller's previous objects are left
+	// behind for the producer to reuse
+	using std::swap;
+	for (size_t i = 0; i < n; i++)
+		swap(Ring[(pop + i) & Mask], objs[i]);
+
+	// Release the slots all at once
+	if (n > 0)
+		PublishPop(pop + n);
+	return n;
+}
 
-	// Reset the synchronization object
-	MemoryBarrier();
-	if (!ResetEvent(Signal))
-	{
-		// In case of failure:
-		// Disable signalling again
-		PushCondition = 0;
+template <class T>
+void SPSC_Ring<T>::Clear()
+{
+	// Pop all elements
+	T obj;
+	while (TryPop(obj));
+}
 
-		// Return error
-		return WAIT_FAILED;
-	}
 
-	// Check again if the condition is satisfied
-	// (it could be that we missed a signal between the start
-	//  of this routine and the ResetEvent call)
-	MemoryBarrier();
-	if (PushCount >= PushCondition) 
-	{
-		// Disable signalling again
-		PushCondition = 0;
+////////////////////////////////////////////////////////////////////////////////
+// Class implementation: SPSC_Snapshot
+////////////////////////////////////////////////////////////////////////////////
+#define SPSC_IDLE   UINT64_MAX
 
-		// Return
-		return WAIT_OBJECT_0;
+template <class T, class D>
+SPSC_Snapshot<T,D>::SPSC_Snapshot(T* initial)
+{
+	Current.store(initial, std::memory_order_relaxed);
+	Epoch.store(0, std::memory_order_relaxed);
+	ReaderEpoch.store(SPSC_IDLE, std::memory_order_relaxed);
+}
+
+template <class T, class D>
+SPSC_Snapshot<T,D>::~SPSC_Snapshot()
+{
+	// (the reader must be done by now)
+	for (size_t i = 0; i < Retired.size(); i++)
+		D()(Retired[i].second);
+	D()(Current.load(std::memory_order_relaxed));
+}
+
+template <class T, class D>
+T* SPSC_Snapshot<T,D>::Acquire()
+{
+	// Announce the epoch, then check that it did not move meanwhile: if it
+	// did, the control thread may have missed the announcement
+	uint64_t epoch = Epoch.load(std::memory_order_seq_cst);
+	while (true)
+	{
+		ReaderEpoch.store(epoch, std::memory_order_seq_cst);
+		uint64_t check = Epoch.load(std::memory_order_seq_cst);
+		if (check == epoch)
+			break;
+		epoch = check;
 	}
+	return Current.load(std::memory_order_acquire);
+}
 
-	// Wait for signal
-	int result = WaitForSingleObject(Signal, timeoutMilliseconds);
+template <class T, class D>
+void SPSC_Snapshot<T,D>::Release()
+{
+	ReaderEpoch.store(SPSC_IDLE, std::memory_order_release);
+}
 
-	// Disable signalling again
-	PushCondition = 0;
+template <class T, class D>
+T* SPSC_Snapshot<T,D>::Get()
+{
+	return Current.load(std::memory_order_acquire);
+}
 
-	// Return
-	return result;
+template <class T, class D>
+void SPSC_Snapshot<T,D>::Replace(T* object)
+{
+	// A reader that announces the new epoch sees the new object
+	T* previous = Current.exchange(object, std::memory_order_seq_cst);
+	uint64_t epoch = Epoch.fetch_add(1, std::memory_order_seq_cst) + 1;
+	if (previous != NULL)
+		Retired.push_back(std::make_pair(epoch, previous));
+	Reclaim();
+}
 
+template <class T, class D>
+void SPSC_Snapshot<T,D>::Reclaim()
+{
+	// Delete the objects retired no later than the reader's epoch
+	uint64_t epoch = ReaderEpoch.load(std::memory_order_seq_cst);
+	size_t kept = 0;
+	for (size_t i = 0; i < Retired.size(); i++)
+	{
+		if (Retired[i].first <= epoch)
+			D()(Retired[i].second);
+		else
+			Retired[kept++] = Retired[i];
+	}
+	Retired.resize(kept);
 }
 
 
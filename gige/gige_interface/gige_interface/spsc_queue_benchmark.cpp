@@ -0,0 +1,150 @@
+// Throughput and latency benchmark for the SPSC_Queue class.
+// Two threads pinned to separate cores push objects through the queue. The
+// objects are recycled through a second queue in the opposite direction, so
+// no allocations happen during the measurement. This file does not depend on
+// the Pleora SDK and builds stand-alone, e.g. on Linux:
+//   g++ -O2 -std=c++11 -pthread spsc_queue_benchmark.cpp -o spsc_queue_benchmark
+//
+// Usage: spsc_queue_benchmark [items] [producer core] [consumer core]
+
+#include <iostream>
+#include <thread>
+#include <vector>
+#include <algorithm>
+#include <cstdlib>
+#include "spsc_queue.h"
+#ifndef _WIN32
+	#include <pthread.h>
+	#include <sched.h>
+#endif
+
+/////////////
+// GLOBALS //
+/////////////
+#define BENCH_POOL_SIZE      4096
+#define BENCH_LATENCY_STRIDE 64
+
+typedef std::chrono::high_resolution_clock bench_clock;
+
+struct BenchItem
+{
+	uint64_t  sequence;
+	bench_clock::time_point pushed;
+};
+
+bool PinCurrentThread(int core)
+{
+	#ifdef _WIN32
+		return SetThreadAffinityMask(GetCurrentThread(), ((DWORD_PTR)1) << core) != 0;
+	#else
+		cpu_set_t cpuset;
+		CPU_ZERO(&cpuset);
+		CPU_SET(core, &cpuset);
+		return pthread_setaffinity_np(pthread_self(), sizeof(cpuset), &cpuset) == 0;
+	#endif
+}
+
+int main(int argc, char* argv[])
+{
+	// Parameters
+	uint64_t items        = (argc > 1) ? strtoull(argv[1], NULL, 10) : 20000000ULL;
+	int      coreProducer = (argc > 2) ? atoi(argv[2]) : 0;
+	int      coreConsumer = (argc > 3) ? atoi(argv[3]) : 1;
+
+	// Queues (forward and recycling direction)
+	SPSC_Queue<BenchItem> forward;
+	SPSC_Queue<BenchItem> backward;
+	for (size_t i = 0; i < BENCH_POOL_SIZE; i++)
+	{
+		std::unique_ptr<BenchItem> item(new BenchItem());
+		backward.TryPush(item);
+	}
+
+	// Latency samples (one out of BENCH_LATENCY_STRIDE items)
+	std::vector<uint32_t> latency;
+	latency.reserve((size_t)(items / BENCH_LATENCY_STRIDE + 1));
+	uint64_t errors = 0;
+
+	std::cout << "SPSC_Queue benchmark: " << items << " items, producer on core "
+	          << coreProducer << ", consumer on core " << coreConsumer << ".\n";
+
+	bench_clock::time_point start = bench_clock::now();
+
+	// Consumer
+	std::thread consumer([&]()
+	{
+		if (!PinCurrentThread(coreConsumer))
+			std::cout << "Warning: could not pin the consumer thread.\n";
+
+		std::unique_ptr<BenchItem> item;
+		for (uint64_t n = 0; n < items; n++)
+		{
+			// Block until an item is there
+			while (!(item = forward.TryPop()))
+				forward.Wait(1, 1000);
+
+			// Check ordering and sample the latency
+			if (item->sequence != n)
+				errors++;
+			if ((n % BENCH_LATENCY_STRIDE) == 0)
+			{
+				auto delta = std::chrono::duration_cast<std::chrono::nanoseconds>(bench_clock::now() - item->pushed);
+				latency.push_back((uint32_t)std::min<int64_t>(delta.count(), UINT32_MAX));
+			}
+
+			// Recycle
+			backward.TryPush(item);
+		}
+	});
+
+	// Producer
+	std::thread producer([&]()
+	{
+		if (!PinCurrentThread(coreProducer))
+			std::cout << "Warning: could not pin the producer thread.\n";
+
+		std::unique_ptr<BenchItem> item;
+		for (uint64_t n = 0; n < items; n++)
+		{
+			// Get a free object
+			while (!(item = backward.TryPop()))
+				backward.Wait(1, 1000);
+
+			// Fill and push (the forward queue never overflows since
+			// only BENCH_POOL_SIZE objects are in circulation)
+			item->sequence = n;
+			item->pushed = bench_clock::now();
+			forward.TryPush(item);
+		}
+	});
+
+	producer.join();
+	consumer.join();
+
+	bench_clock::time_point end = bench_clock::now();
+
+	// Throughput
+	double interval = std::chrono::duration<double>(end - start).count();
+	std::cout << "Throughput: " << (items / interval) / 1e6 << " Mitems/s ("
+	          << interval << " s).\n";
+
+	// Latency percentiles
+	if (!latency.empty())
+	{
+		std::sort(latency.begin(), latency.end());
+		double percentiles[] = { 0.5, 0.9, 0.99, 0.999 };
+		std::cout << "Latency:";
+		for (size_t i = 0; i < sizeof(percentiles) / sizeof(percentiles[0]); i++)
+		{
+			size_t k = std::min(latency.size() - 1, (size_t)(percentiles[i] * latency.size()));
+			std::cout << " p" << percentiles[i] * 100 << "=" << latency[k] << "ns";
+		}
+		std::cout << " max=" << latency.back() << "ns.\n";
+	}
+
+	// Ordering
+	if (errors != 0)
+		std::cout << "Error: " << errors << " items were received out of order.\n";
+
+	return (errors == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,85 @@
+// Software camera that generates a moving fringe pattern.
+
+#include <math.h>
+#include "syntheticsource.h"
+
+
+SyntheticSource::SyntheticSource()
+{
+	PhaseStepX = 0;
+	PhaseStepY = 0;
+	PhaseStepFrame = 0;
+}
+
+
+SyntheticSource::~SyntheticSource()
+{
+	// Render is called from the thread, so stop it while we still exist
+	Stop();
+}
+
+bool SyntheticSource::Initialize(uint32_t width, uint32_t height, uint32_t bpp, double framesPerSecond)
+{
+	// Frames and timing
+	if (!InitializeSource(width, height, bpp, framesPerSecond))
+		return false;
+
+	// Cosine table, scaled to the full range of the pixel format
+	const double pi = 3.14159265358979323846;
+	const size_t n = (size_t)1 << SYNTHETIC_LUT_BITS;
+	const double maxValue = (double)((1u << bpp) - 1);
+	CosineTable.resize(n);
+	for (size_t i = 0; i < n; i++)
+		CosineTable[i] = (uint16_t)floor(0.5*maxValue*(1.0 + cos(2.0*pi*(double)i / (double)n)) + 0.5);
+
+	// Default pattern: 16 pixel fringes along x, drifting by 1/32 turn per frame
+	SetFringes(16.0, 0.0, 1.0 / 32.0);
+
+	return true;
+}
+
+uint32_t SyntheticSource::ToPhase(double turns)
+{
+	// Fraction of a turn, in 32-bit fixed point
+	double fraction = turns - floor(turns);
+	return (uint32_t)(uint64_t)(fraction*4294967296.0);
+}
+
+void SyntheticSource::SetFringes(double periodX, double periodY, double phaseStep)
+{
+	// A period of 0 means no fringes along that axis
+	PhaseStepX = (periodX != 0) ? ToPhase(1.0 / periodX) : 0;
+	PhaseStepY = (periodY != 0) ? ToPhase(1.0 / periodY) : 0;
+	PhaseStepFrame = ToPhase(phaseStep);
+}
+
+bool SyntheticSource::Render(Frame& frame, uint64_t index)
+{
+	const uint16_t* lut = CosineTable.data();
+	const uint32_t shift = 32 - SYNTHETIC_LUT_BITS;
+	const uint32_t dx = PhaseStepX;
+	const uint32_t dy = PhaseStepY;
+
+	// Phase of the first pixel of the frame
+	uint32_t phaseRow = (uint32_t)(index*PhaseStepFrame);
+
+	// Fill the rows by stepping the phase accumulator
+	for (uint32_t y = 0; y < Height; y++, phaseRow += dy)
+	{
+		uint32_t phase = phaseRow;
+		if (BitsPerPixel == 8)
+		{
+			uint8_t* row = frame.data + (size_t)y*Width;
+			for (uint32_t x = 0; x < Width; x++, phase += dx)
+				row[x] = (uint8_t)lut[phase >> shift];
+		}
+		else
+		{
+			uint16_t* row = (uint16_t*)frame.data + (size_t)y*Width;
+			for (uint32_t x = 0; x < Width; x++, phase += dx)
+				row[x] = lut[phase >> shift];
+		}
+	}
+
+	return true;
+}
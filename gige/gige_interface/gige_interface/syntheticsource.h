@@ -0,0 +1,47 @@
+////////////////////////////////////////////////////////////////////////////////
+// Filename: syntheticsource.h
+// Software camera that generates a moving fringe pattern (a 2D cosine
+// grating whose phase advances from frame to frame), so that the processing
+// and recording pipelines can be run and measured without a camera.
+////////////////////////////////////////////////////////////////////////////////
+#ifndef _SYNTHETICSOURCE_H_
+#define _SYNTHETICSOURCE_H_
+
+//////////////
+// INCLUDES //
+//////////////
+#include <vector>
+#include "softwaresource.h"
+
+/////////////
+// GLOBALS //
+/////////////
+#define SYNTHETIC_LUT_BITS 10
+
+////////////////////////////////////////////////////////////////////////////////
+// Class name: SyntheticSource
+////////////////////////////////////////////////////////////////////////////////
+class SyntheticSource : public SoftwareSource
+{
+public:
+	SyntheticSource();
+	~SyntheticSource();
+
+	bool					Initialize(uint32_t, uint32_t, uint32_t, double);
+	void					SetFringes(double, double, double);
+
+protected:
+	bool					Render(Frame&, uint64_t);
+
+private:
+	// The phase is a 32-bit fixed-point fraction of a turn, so that it wraps
+	// around for free; the top bits index the cosine table
+	std::vector<uint16_t>	CosineTable;
+	uint32_t volatile		PhaseStepX;
+	uint32_t volatile		PhaseStepY;
+	uint32_t volatile		PhaseStepFrame;
+
+	static uint32_t			ToPhase(double);
+};
+
+#endif